@@ -0,0 +1,383 @@
+#include "backend.h"
+
+#include "../hashmap/hashmap.h"
+#include "../hashmap/cuckoo.h"
+#include "../hashmap/hopscotch.h"
+#include "../hashmap/numa_map.h"
+#include "../hashmap/spill_map.h"
+#include "../hashmap/mmap_map.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef enum {
+    LOCK_NONE,     //thread-safe map
+    LOCK_SHARED,   //reads in shared mode, writes in exclusive mode
+    LOCK_EXCLUSIVE,//the reads modify the map too
+} lock_mode_t;
+
+typedef struct {
+    const char *name;
+    lock_mode_t lock;
+    void* (*create)(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget);
+    void (*destroy)(void *map);
+    bool (*read)(void *map, const void *key, void *value, size_t value_size);
+    bool (*insert)(void *map, const void *key, const void *value);
+    bool (*update)(void *map, const void *key, const void *value, size_t value_size);
+} backend_ops_t;
+
+struct _backend_t {
+    const backend_ops_t *ops;
+    void *map;
+    size_t value_size;
+    pthread_rwlock_t lock;
+};
+
+//copy of a new value (update functions)
+typedef struct {
+    const void *value;
+    size_t size;
+} overwrite_t;
+
+static bool is_default(const char *mode);
+static size_t key_hash(const void *key, const size_t size);
+static void overwrite(void *value, void *ctx);
+
+static void* hashmap_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget);
+static void hashmap_backend_destroy(void *map);
+static bool hashmap_backend_read(void *map, const void *key, void *value, size_t value_size);
+static bool hashmap_backend_insert(void *map, const void *key, const void *value);
+static bool hashmap_backend_update(void *map, const void *key, const void *value, size_t value_size);
+
+static void* cuckoo_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget);
+static void cuckoo_backend_destroy(void *map);
+static bool cuckoo_backend_read(void *map, const void *key, void *value, size_t value_size);
+static bool cuckoo_backend_insert(void *map, const void *key, const void *value);
+static bool cuckoo_backend_update(void *map, const void *key, const void *value, size_t value_size);
+
+static void* hopscotch_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget);
+static void hopscotch_backend_destroy(void *map);
+static bool hopscotch_backend_read(void *map, const void *key, void *value, size_t value_size);
+static bool hopscotch_backend_insert(void *map, const void *key, const void *value);
+static bool hopscotch_backend_update(void *map, const void *key, const void *value, size_t value_size);
+
+static void* numa_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget);
+static void numa_backend_destroy(void *map);
+static bool numa_backend_read(void *map, const void *key, void *value, size_t value_size);
+static bool numa_backend_insert(void *map, const void *key, const void *value);
+static bool numa_backend_update(void *map, const void *key, const void *value, size_t value_size);
+
+static void* spill_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget);
+static void spill_backend_destroy(void *map);
+static bool spill_backend_read(void *map, const void *key, void *value, size_t value_size);
+static bool spill_backend_insert(void *map, const void *key, const void *value);
+static bool spill_backend_update(void *map, const void *key, const void *value, size_t value_size);
+
+static void* mmap_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget);
+static void mmap_backend_destroy(void *map);
+static bool mmap_backend_read(void *map, const void *key, void *value, size_t value_size);
+static bool mmap_backend_insert(void *map, const void *key, const void *value);
+static bool mmap_backend_update(void *map, const void *key, const void *value, size_t value_size);
+
+static const backend_ops_t BACKENDS[] = {
+    { "hashmap", LOCK_SHARED, hashmap_backend_create, hashmap_backend_destroy,
+      hashmap_backend_read, hashmap_backend_insert, hashmap_backend_update },
+    { "cuckoo", LOCK_SHARED, cuckoo_backend_create, cuckoo_backend_destroy,
+      cuckoo_backend_read, cuckoo_backend_insert, cuckoo_backend_update },
+    { "hopscotch", LOCK_NONE, hopscotch_backend_create, hopscotch_backend_destroy,
+      hopscotch_backend_read, hopscotch_backend_insert, hopscotch_backend_update },
+    { "numa", LOCK_NONE, numa_backend_create, numa_backend_destroy,
+      numa_backend_read, numa_backend_insert, numa_backend_update },
+    { "spill", LOCK_EXCLUSIVE, spill_backend_create, spill_backend_destroy,
+      spill_backend_read, spill_backend_insert, spill_backend_update },
+    { "mmap", LOCK_SHARED, mmap_backend_create, mmap_backend_destroy,
+      mmap_backend_read, mmap_backend_insert, mmap_backend_update },
+};
+
+backend_t* backend_create(const char *name, const char *mode, size_t capacity,
+                          size_t key_size, size_t value_size, size_t memory_budget)
+{
+    const backend_ops_t *ops = NULL;
+    for(size_t i = 0; i < sizeof(BACKENDS) / sizeof(*BACKENDS); i++)
+        if(strcmp(name, BACKENDS[i].name) == 0) ops = &BACKENDS[i];
+
+    if(ops == NULL) return (fprintf(stderr, "unknown backend %s (%s)\n", name, BACKEND_NAMES), NULL);
+
+    backend_t *b = malloc(sizeof(*b));
+    if(!b) return (perror("malloc"), NULL);
+
+    b->ops = ops;
+    b->value_size = value_size;
+    b->map = ops->create(mode, capacity, key_size, value_size, memory_budget);
+    if(!b->map) return (free(b), NULL);
+
+    pthread_rwlock_init(&b->lock, NULL);
+    return b;
+}
+
+void backend_destroy(backend_t *b)
+{
+    b->ops->destroy(b->map);
+    pthread_rwlock_destroy(&b->lock);
+    free(b);
+}
+
+bool backend_read(backend_t *b, const void *key, void *value)
+{
+    if(b->ops->lock == LOCK_NONE) return b->ops->read(b->map, key, value, b->value_size);
+
+    if(b->ops->lock == LOCK_SHARED) pthread_rwlock_rdlock(&b->lock);
+    else pthread_rwlock_wrlock(&b->lock);
+
+    bool found = b->ops->read(b->map, key, value, b->value_size);
+    pthread_rwlock_unlock(&b->lock);
+    return found;
+}
+
+bool backend_insert(backend_t *b, const void *key, const void *value)
+{
+    if(b->ops->lock == LOCK_NONE) return b->ops->insert(b->map, key, value);
+
+    pthread_rwlock_wrlock(&b->lock);
+    bool ok = b->ops->insert(b->map, key, value);
+    pthread_rwlock_unlock(&b->lock);
+    return ok;
+}
+
+bool backend_update(backend_t *b, const void *key, const void *value)
+{
+    if(b->ops->lock == LOCK_NONE) return b->ops->update(b->map, key, value, b->value_size);
+
+    pthread_rwlock_wrlock(&b->lock);
+    bool ok = b->ops->update(b->map, key, value, b->value_size);
+    pthread_rwlock_unlock(&b->lock);
+    return ok;
+}
+
+static bool is_default(const char *mode)
+{ return mode == NULL || strcmp(mode, "default") == 0; }
+
+//FNV-1a over the key_size bytes (the default hash functions stop at the first '\0')
+static size_t key_hash(const void *key, const size_t size)
+{
+    const unsigned char *bytes = key;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+
+    return (size_t)hash;
+}
+
+static void overwrite(void *value, void *ctx)
+{
+    const overwrite_t *source = ctx;
+    memcpy(value, source->value, source->size);
+}
+
+
+//--------------- HASHMAP ---------------//
+
+static void* hashmap_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget)
+{
+    (void)memory_budget;//unused - to avoid warning
+    hashmap_alloc_mode_t alloc_mode = HASHMAP_ALLOC_DEFAULT;
+
+    if(is_default(mode)) alloc_mode = HASHMAP_ALLOC_DEFAULT;
+    else if(strcmp(mode, "hugepage") == 0) alloc_mode = HASHMAP_ALLOC_HUGEPAGE;
+    else if(strcmp(mode, "hugetlb") == 0) alloc_mode = HASHMAP_ALLOC_HUGETLB;
+    else return (fprintf(stderr, "hashmap: unknown mode %s (default, hugepage, hugetlb)\n", mode), NULL);
+
+    hashmap_t *hm = hashmap_create(0, key_hash, key_size, value_size);
+    if(!hm) return NULL;
+
+    hashmap_set_alloc_mode(hm, alloc_mode);
+    hashmap_reserve(hm, capacity);
+    return hm;
+}
+
+static void hashmap_backend_destroy(void *map)
+{ hashmap_destroy(map); }
+
+static bool hashmap_backend_read(void *map, const void *key, void *value, size_t value_size)
+{
+    const void *stored = hashmap_get(map, key);
+    if(stored != NULL) memcpy(value, stored, value_size);
+    return stored != NULL;
+}
+
+static bool hashmap_backend_insert(void *map, const void *key, const void *value)
+{ return hashmap_add(map, key, value) != NULL; }
+
+static bool hashmap_backend_update(void *map, const void *key, const void *value, size_t value_size)
+{
+    overwrite_t source = { .value = value, .size = value_size };
+    return hashmap_update(map, key, overwrite, &source) != NULL;
+}
+
+
+//--------------- CUCKOO ---------------//
+
+static void* cuckoo_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget)
+{
+    (void)memory_budget;//unused - to avoid warning
+    if(!is_default(mode)) return (fprintf(stderr, "cuckoo: unknown mode %s (default)\n", mode), NULL);
+
+    return cuckoo_create(capacity, key_hash, key_size, value_size);
+}
+
+static void cuckoo_backend_destroy(void *map)
+{ cuckoo_destroy(map); }
+
+static bool cuckoo_backend_read(void *map, const void *key, void *value, size_t value_size)
+{
+    const void *stored = cuckoo_get(map, key);
+    if(stored != NULL) memcpy(value, stored, value_size);
+    return stored != NULL;
+}
+
+static bool cuckoo_backend_insert(void *map, const void *key, const void *value)
+{ return cuckoo_add(map, key, value) != NULL; }
+
+static bool cuckoo_backend_update(void *map, const void *key, const void *value, size_t value_size)
+{
+    void *stored = cuckoo_add(map, key, value);
+    if(stored != NULL) memcpy(stored, value, value_size);//the key existed: its old value is replaced
+    return stored != NULL;
+}
+
+
+//--------------- HOPSCOTCH ---------------//
+
+static void* hopscotch_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget)
+{
+    (void)memory_budget;//unused - to avoid warning
+    bool combining = false;
+
+    if(is_default(mode)) combining = false;
+    else if(strcmp(mode, "combining") == 0) combining = true;
+    else return (fprintf(stderr, "hopscotch: unknown mode %s (default, combining)\n", mode), NULL);
+
+    hopscotch_t *hs = hopscotch_create(capacity, key_hash, key_size, value_size);
+    if(hs != NULL) hopscotch_set_flat_combining(hs, combining);
+    return hs;
+}
+
+static void hopscotch_backend_destroy(void *map)
+{ hopscotch_destroy(map); }
+
+static bool hopscotch_backend_read(void *map, const void *key, void *value, size_t value_size)
+{
+    (void)value_size;//unused - to avoid warning
+    return hopscotch_get_copy(map, key, value);
+}
+
+static bool hopscotch_backend_insert(void *map, const void *key, const void *value)
+{ return hopscotch_add(map, key, value) != NULL; }
+
+static bool hopscotch_backend_update(void *map, const void *key, const void *value, size_t value_size)
+{
+    overwrite_t source = { .value = value, .size = value_size };
+    return hopscotch_update(map, key, overwrite, &source) != NULL;
+}
+
+
+//--------------- NUMA ---------------//
+
+static void* numa_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget)
+{
+    (void)memory_budget;//unused - to avoid warning
+    if(!is_default(mode)) return (fprintf(stderr, "numa: unknown mode %s (default)\n", mode), NULL);
+
+    return numa_map_create(0, capacity, key_hash, key_size, value_size);
+}
+
+static void numa_backend_destroy(void *map)
+{ numa_map_destroy(map); }
+
+static bool numa_backend_read(void *map, const void *key, void *value, size_t value_size)
+{
+    (void)value_size;//unused - to avoid warning
+    return numa_map_get_copy(map, key, value);
+}
+
+static bool numa_backend_insert(void *map, const void *key, const void *value)
+{ return numa_map_add(map, key, value) != NULL; }
+
+static bool numa_backend_update(void *map, const void *key, const void *value, size_t value_size)
+{
+    overwrite_t source = { .value = value, .size = value_size };
+    return numa_map_update(map, key, overwrite, &source) != NULL;
+}
+
+
+//--------------- SPILL ---------------//
+
+static void* spill_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget)
+{
+    (void)capacity;//unused - to avoid warning
+    if(!is_default(mode)) return (fprintf(stderr, "spill: unknown mode %s (default)\n", mode), NULL);
+
+    return spill_map_create(NULL, memory_budget ? memory_budget : SIZE_MAX, 0, key_hash, key_size, value_size);
+}
+
+static void spill_backend_destroy(void *map)
+{ spill_map_destroy(map); }
+
+static bool spill_backend_read(void *map, const void *key, void *value, size_t value_size)
+{
+    (void)value_size;//unused - to avoid warning
+    return spill_map_get(map, key, value);
+}
+
+static bool spill_backend_insert(void *map, const void *key, const void *value)
+{ return spill_map_put(map, key, value); }
+
+static bool spill_backend_update(void *map, const void *key, const void *value, size_t value_size)
+{
+    (void)value_size;//unused - to avoid warning
+    return spill_map_put(map, key, value);
+}
+
+
+//--------------- MMAP ---------------//
+
+static void* mmap_backend_create(const char *mode, size_t capacity, size_t key_size, size_t value_size, size_t memory_budget)
+{
+    (void)memory_budget;//unused - to avoid warning
+    if(!is_default(mode)) return (fprintf(stderr, "mmap: unknown mode %s (default)\n", mode), NULL);
+
+    //fichier temporaire vide: la map y est creee, et il disparait a la fermeture
+    char path[] = "/tmp/hashmap-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) return (perror("mkstemp"), NULL);
+    close(fd);
+
+    mmap_map_t *mm = mmap_map_open(path, capacity, key_hash, key_size, value_size);
+    unlink(path);
+    return mm;
+}
+
+static void mmap_backend_destroy(void *map)
+{ mmap_map_close(map); }
+
+static bool mmap_backend_read(void *map, const void *key, void *value, size_t value_size)
+{
+    const void *stored = mmap_map_get(map, key);
+    if(stored != NULL) memcpy(value, stored, value_size);
+    return stored != NULL;
+}
+
+static bool mmap_backend_insert(void *map, const void *key, const void *value)
+{ return mmap_map_add(map, key, value) != NULL; }
+
+static bool mmap_backend_update(void *map, const void *key, const void *value, size_t value_size)
+{
+    void *stored = mmap_map_add(map, key, value);
+    if(stored != NULL) memcpy(stored, value, value_size);//the key existed: its old value is replaced
+    return stored != NULL;
+}
@@ -0,0 +1,62 @@
+/*
+ *  The maps driven by the benchmark, behind one interface.
+ *
+ *  Backends (and their modes):
+ *  - hashmap    hashmap_t (default, hugepage, hugetlb: allocation mode of the table)
+ *  - cuckoo     cuckoo_t
+ *  - hopscotch  hopscotch_t (default, combining: flat-combining writes)
+ *  - numa       numa_map_t (one shard per NUMA node)
+ *  - spill      spill_map_t (the memory budget is given to backend_create)
+ *  - mmap       mmap_map_t (in a temporary file)
+ *
+ *  The keys and values are flat (key_size / value_size bytes), and the keys are hashed with
+ *  FNV-1a over their bytes (the default hash functions stop at the first '\0').
+ *
+ *  The thread-safe maps (hopscotch, numa) are called directly; the others are protected by a
+ *  reader-writer lock (the reads share it, except for spill whose reads can bring a partition
+ *  back in memory), like an application sharing one of them between threads would do.
+ *
+ *  An update overwrites the value in place (hashmap_update / hopscotch_update / numa_map_update,
+ *  or through the pointer of the value), or with spill_map_put. The thread-safe maps copy the
+ *  value out inside their own synchronization (hopscotch_get_copy: validated by the seqlock of
+ *  the lookup, numa_map_get_copy: under the lock of the shard), so a read never sees a
+ *  half-written value.
+*/
+
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct _backend_t backend_t;
+
+#define BACKEND_NAMES "hashmap, cuckoo, hopscotch, numa, spill, mmap"
+
+/// @brief Create an empty map
+/// @param name The backend (see BACKEND_NAMES)
+/// @param mode The mode of the backend (NULL or "default" for the default one)
+/// @param capacity The expected number of keys
+/// @param key_size The size of the keys in bytes
+/// @param value_size The size of the values in bytes
+/// @param memory_budget spill: the memory budget in bytes (0 for no limit)
+/// @return A pointer to the backend or NULL if an error occured (unknown backend or mode...)
+backend_t* backend_create(const char *name, const char *mode, size_t capacity,
+                          size_t key_size, size_t value_size, size_t memory_budget);
+
+/// @brief Destroy the map
+void backend_destroy(backend_t *b);
+
+/// @brief Copy the value of a key
+/// @return true if the key was found
+bool backend_read(backend_t *b, const void *key, void *value);
+
+/// @brief Add a new key
+/// @return true on success
+bool backend_insert(backend_t *b, const void *key, const void *value);
+
+/// @brief Overwrite the value of a key (added if it does not exist)
+/// @return true on success
+bool backend_update(backend_t *b, const void *key, const void *value);
+
+#endif
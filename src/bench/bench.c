@@ -0,0 +1,486 @@
+/*
+ *  YCSB-style benchmark of the maps: the core workloads (workload.h) run against any backend
+ *  and mode (backend.h), with the throughput and the latency percentiles of each kind of
+ *  operation written as CSV.
+ *
+ *  Usage: bin/bench [-b backend] [-m mode] [-w workload] [-d distribution] [-r records]
+ *                   [-o operations] [-t threads] [-k key_size] [-v value_size]
+ *                   [-M memory_budget_mb] [-s seed] [-c file.csv]
+ *  Defaults: hashmap, default mode, workload a with its own distribution, 100000 records,
+ *  1000000 operations, 1 thread, 16 bytes keys, 100 bytes values.
+ *
+ *  ---------- Phases ---------
+ *  - load: the records (key numbers 0 to records - 1) are inserted by one thread.
+ *  - run: the threads share the operations. Each thread draws its operations and its keys with
+ *    its own generator, and records the latency of each operation in its own histogram
+ *    (histogram.h, one per kind of operation), merged at the end.
+ *  The inserts of the run phase take the next key numbers, and the keys become visible to the
+ *  other operations once inserted (a key still being inserted by another thread can be read,
+ *  and not found: counted in not_found).
+ *
+ *  ---------- Keys and values ---------
+ *  A key is its number (8 bytes) followed by a constant padding up to key_size bytes (at least
+ *  8). A value is value_size bytes, starting with the number of the key and a version that the
+ *  updates increment. The maps are not ordered: a scan reads up to WORKLOAD_MAX_SCAN records of
+ *  consecutive key numbers, one by one.
+ *
+ *  ---------- Output ---------
+ *  One line per kind of operation of the run phase, plus LOAD and TOTAL (every operation of the
+ *  run phase), on the standard output or appended to the CSV file (the header is written when
+ *  the file is empty):
+ *  backend,mode,workload,distribution,threads,records,key_size,value_size,
+ *  operation,count,not_found,throughput,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,
+ *  cycles_per_op,instructions_per_op,l1d_misses_per_op,llc_misses_per_op,dtlb_misses_per_op,
+ *  branch_misses_per_op,page_faults_per_op
+ *  The throughput (operations per second) is the count divided by the duration of the phase.
+ *
+ *  ---------- Hardware counters ---------
+ *  Each thread counts its own events during a phase (counters.h), the counts of the threads are
+ *  added and divided by the number of operations of the phase: the *_per_op columns of the LOAD
+ *  and TOTAL lines (for a workload with a single kind of operation, the TOTAL line is that
+ *  operation). They are empty for the other lines, and for the counters the kernel does not
+ *  provide (no PMU in a virtual machine, perf_event_paranoid...). The timing of each operation
+ *  is counted too: compare layouts with the same benchmark, not with absolute numbers.
+*/
+
+#include "backend.h"
+#include "counters.h"
+#include "workload.h"
+#include "../hashmap/histogram.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#define BENCH_KEY_PADDING 'k'
+
+typedef struct {
+    const char *backend;
+    const char *mode;
+    workload_mix_t mix;
+    size_t records;
+    size_t operations;
+    size_t threads;
+    size_t key_size;
+    size_t value_size;
+    size_t memory_budget;
+    uint64_t seed;
+    const char *csv;
+} options_t;
+
+//state shared by the threads of the run phase
+typedef struct {
+    const options_t *options;
+    backend_t *backend;
+    workload_keys_t keys;//chooser prepared once, copied by each thread
+    atomic_size_t next_key;//number given to the next insert
+    atomic_size_t key_count;//keys inserted (the choosers draw from [0, key_count))
+
+    //depart simultane des threads (abort: un thread n'a pas pu etre lance)
+    pthread_mutex_t gate_lock;
+    pthread_cond_t gate;
+    bool go;
+    bool abort;
+} shared_t;
+
+typedef struct {
+    shared_t *shared;
+    pthread_t thread;
+    size_t operations;
+    uint64_t seed;
+    histogram_t *histograms[WORKLOAD_OPERATIONS];
+    uint64_t not_found[WORKLOAD_OPERATIONS];
+    counters_values_t counters;//of the run phase
+    bool failed;
+} worker_t;
+
+static bool parse_options(int argc, char **argv, options_t *options);
+static bool load(shared_t *shared, histogram_t *histogram, counters_values_t *counters, double *seconds);
+static bool run(shared_t *shared, worker_t *workers, FILE *out);
+static void open_gate(shared_t *shared, bool abort);
+static void* worker_main(void *arg);
+static bool run_operation(worker_t *w, workload_keys_t *keys, workload_operation_t operation, char *key, char *value);
+static void make_key(char *key, size_t key_size, size_t number);
+static void make_value(char *value, size_t value_size, size_t number, uint64_t version);
+static uint64_t now_ns(void);
+static void report_header(FILE *out);
+static void report(FILE *out, const options_t *options, const char *operation, const histogram_t *h,
+                   uint64_t not_found, double seconds, const counters_values_t *counters);
+
+int main(int argc, char **argv)
+{
+    options_t options;
+    if(!parse_options(argc, argv, &options)) return 1;
+
+    FILE *out = stdout;
+    if(options.csv != NULL && (out = fopen(options.csv, "a")) == NULL) return (perror(options.csv), 1);
+
+    shared_t shared = { .options = &options };
+    shared.backend = backend_create(options.backend, options.mode, options.records, options.key_size,
+                                    options.value_size, options.memory_budget);
+    if(!shared.backend) return (out != stdout ? fclose(out) : 0, 1);
+
+    //en-tete si le fichier est vide (toujours sur la sortie standard)
+    if(out == stdout || ftell(out) == 0) report_header(out);
+
+    worker_t *workers = calloc(options.threads, sizeof(*workers));
+    histogram_t *loading = histogram_create();
+    bool ok = workers != NULL && loading != NULL;
+    if(workers == NULL) perror("calloc");
+
+    for(size_t i = 0; ok && i < options.threads; i++)
+        for(int op = 0; op < WORKLOAD_OPERATIONS && ok; op++)
+            ok = (workers[i].histograms[op] = histogram_create()) != NULL;
+
+    //phase de chargement, puis d'execution
+    double seconds = 0;
+    counters_values_t counters;
+    ok = ok && load(&shared, loading, &counters, &seconds);
+    if(ok) report(out, &options, "LOAD", loading, 0, seconds, &counters);
+
+    ok = ok && run(&shared, workers, out);
+
+    for(size_t i = 0; workers != NULL && i < options.threads; i++)
+        for(int op = 0; op < WORKLOAD_OPERATIONS; op++)
+            if(workers[i].histograms[op] != NULL) histogram_destroy(workers[i].histograms[op]);
+
+    if(loading != NULL) histogram_destroy(loading);
+    free(workers);
+    backend_destroy(shared.backend);
+    if(out != stdout) fclose(out);
+
+    if(!ok) fprintf(stderr, "bench: an operation failed\n");
+    return ok ? 0 : 1;
+}
+
+static bool parse_options(int argc, char **argv, options_t *options)
+{
+    *options = (options_t){
+        .backend = "hashmap",
+        .mode = NULL,
+        .records = 100000,
+        .operations = 1000000,
+        .threads = 1,
+        .key_size = 16,
+        .value_size = 100,
+        .memory_budget = 0,
+        .seed = 1,
+        .csv = NULL,
+    };
+    workload_mix_parse("a", &options->mix);
+
+    const char *distribution = NULL;
+    int option;
+
+    while((option = getopt(argc, argv, "b:m:w:d:r:o:t:k:v:M:s:c:h")) != -1)
+    {
+        switch(option)
+        {
+            case 'b': options->backend = optarg; break;
+            case 'm': options->mode = optarg; break;
+            case 'w':
+                if(workload_mix_parse(optarg, &options->mix)) break;
+                return (fprintf(stderr, "unknown workload %s (a to f)\n", optarg), false);
+            case 'd': distribution = optarg; break;
+            case 'r': options->records = strtoul(optarg, NULL, 10); break;
+            case 'o': options->operations = strtoul(optarg, NULL, 10); break;
+            case 't': options->threads = strtoul(optarg, NULL, 10); break;
+            case 'k': options->key_size = strtoul(optarg, NULL, 10); break;
+            case 'v': options->value_size = strtoul(optarg, NULL, 10); break;
+            case 'M': options->memory_budget = strtoul(optarg, NULL, 10) << 20; break;
+            case 's': options->seed = strtoull(optarg, NULL, 10); break;
+            case 'c': options->csv = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-b backend] [-m mode] [-w workload] [-d distribution] [-r records]\n"
+                                "       [-o operations] [-t threads] [-k key_size] [-v value_size]\n"
+                                "       [-M memory_budget_mb] [-s seed] [-c file.csv]\n"
+                                "backends: %s\n"
+                                "distributions: uniform, zipfian, latest, hotspot\n", argv[0], BACKEND_NAMES);
+                return false;
+        }
+    }
+
+    //la distribution choisie remplace celle du workload (a la fin: -d avant -w marche aussi)
+    if(distribution != NULL && !workload_distribution_parse(distribution, &options->mix.distribution))
+        return (fprintf(stderr, "unknown distribution %s\n", distribution), false);
+
+    if(options->threads < 1) options->threads = 1;
+    if(options->records < 1) options->records = 1;
+    if(options->key_size < sizeof(uint64_t)) options->key_size = sizeof(uint64_t);
+    if(options->value_size < 2 * sizeof(uint64_t)) options->value_size = 2 * sizeof(uint64_t);
+
+    return true;
+}
+
+static bool load(shared_t *shared, histogram_t *histogram, counters_values_t *counters, double *seconds)
+{
+    const options_t *options = shared->options;
+    char *key = malloc(options->key_size);
+    char *value = malloc(options->value_size);
+    bool ok = key != NULL && value != NULL;
+    if(!ok) perror("malloc");
+
+    counters_t c;
+    counters_open(&c);
+
+    uint64_t begin = now_ns();
+    counters_start(&c);
+
+    for(size_t i = 0; i < options->records && ok; i++)
+    {
+        make_key(key, options->key_size, i);
+        make_value(value, options->value_size, i, 0);
+
+        uint64_t start = now_ns();
+        ok = backend_insert(shared->backend, key, value);
+        histogram_record(histogram, now_ns() - start);
+    }
+
+    counters_stop(&c, counters);
+    *seconds = (double)(now_ns() - begin) / 1e9;
+    counters_close(&c);
+
+    //une seule fois: les threads du run ont les memes compteurs
+    if(!counters->available[COUNTER_CYCLES])
+        fprintf(stderr, "bench: hardware counters unavailable (perf_event_open), their columns are empty\n");
+
+    free(key);
+    free(value);
+    return ok;
+}
+
+//the run phase: false if the threads could not be started or an operation failed
+static bool run(shared_t *shared, worker_t *workers, FILE *out)
+{
+    const options_t *options = shared->options;
+
+    //la loi de zipf est preparee une fois (O(records)), puis copiee par chaque thread
+    workload_keys_init(&shared->keys, options->mix.distribution, options->records, options->seed);
+    atomic_store(&shared->next_key, options->records);
+    atomic_store(&shared->key_count, options->records);
+    pthread_mutex_init(&shared->gate_lock, NULL);
+    pthread_cond_init(&shared->gate, NULL);
+    shared->go = false;
+    shared->abort = false;
+
+    size_t started = 0;
+    for(; started < options->threads; started++)
+    {
+        worker_t *w = &workers[started];
+        w->shared = shared;
+        w->operations = options->operations / options->threads + (started < options->operations % options->threads);
+        w->seed = options->seed * 0x9E3779B97F4A7C15ULL + started + 1;
+
+        if(pthread_create(&w->thread, NULL, worker_main, w) != 0){ perror("pthread_create"); break; }
+    }
+
+    uint64_t begin = now_ns();
+    open_gate(shared, started < options->threads);
+
+    for(size_t i = 0; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    double seconds = (double)(now_ns() - begin) / 1e9;
+
+    pthread_cond_destroy(&shared->gate);
+    pthread_mutex_destroy(&shared->gate_lock);
+    if(started < options->threads) return false;
+
+    //fusion des histogrammes des threads (dans ceux du premier), par operation
+    histogram_t *total = histogram_create();
+    if(!total) return false;
+
+    bool ok = true;
+    uint64_t total_not_found = 0;
+
+    for(int op = 0; op < WORKLOAD_OPERATIONS; op++)
+    {
+        uint64_t not_found = 0;
+        for(size_t i = 0; i < options->threads; i++)
+        {
+            if(i > 0) histogram_merge(workers[0].histograms[op], workers[i].histograms[op]);
+            not_found += workers[i].not_found[op];
+        }
+
+        if(histogram_count(workers[0].histograms[op]) > 0)
+            report(out, options, workload_operation_name((workload_operation_t)op), workers[0].histograms[op], not_found, seconds, NULL);
+
+        histogram_merge(total, workers[0].histograms[op]);
+        total_not_found += not_found;
+    }
+
+    counters_values_t counters;
+    counters_values_init(&counters);
+    for(size_t i = 0; i < options->threads; i++)
+        counters_add(&counters, &workers[i].counters);
+
+    report(out, options, "TOTAL", total, total_not_found, seconds, &counters);
+    histogram_destroy(total);
+
+    for(size_t i = 0; i < options->threads; i++)
+        if(workers[i].failed) ok = false;
+
+    return ok;
+}
+
+static void open_gate(shared_t *shared, bool abort)
+{
+    pthread_mutex_lock(&shared->gate_lock);
+    shared->go = true;
+    shared->abort = abort;
+    pthread_cond_broadcast(&shared->gate);
+    pthread_mutex_unlock(&shared->gate_lock);
+}
+
+static void* worker_main(void *arg)
+{
+    worker_t *w = arg;
+    const options_t *options = w->shared->options;
+
+    workload_keys_t keys = w->shared->keys;
+    workload_keys_seed(&keys, w->seed);
+
+    char *key = malloc(options->key_size);
+    char *value = malloc(options->value_size);
+    if(!key || !value){ perror("malloc"); w->failed = true; }
+
+    counters_t c;
+    counters_open(&c);
+
+    pthread_mutex_lock(&w->shared->gate_lock);
+    while(!w->shared->go) pthread_cond_wait(&w->shared->gate, &w->shared->gate_lock);
+    if(w->shared->abort) w->operations = 0;
+    pthread_mutex_unlock(&w->shared->gate_lock);
+
+    counters_start(&c);
+
+    for(size_t i = 0; i < w->operations && !w->failed; i++)
+    {
+        workload_operation_t operation = workload_next_operation(&keys, &options->mix);
+
+        uint64_t start = now_ns();
+        if(!run_operation(w, &keys, operation, key, value)) w->failed = true;
+        histogram_record(w->histograms[operation], now_ns() - start);
+    }
+
+    counters_stop(&c, &w->counters);
+    counters_close(&c);
+
+    free(key);
+    free(value);
+    return NULL;
+}
+
+//false if the map could not be modified
+static bool run_operation(worker_t *w, workload_keys_t *keys, workload_operation_t operation, char *key, char *value)
+{
+    shared_t *shared = w->shared;
+    const options_t *options = shared->options;
+
+    if(operation == WORKLOAD_INSERT)
+    {
+        size_t number = atomic_fetch_add(&shared->next_key, 1);
+        make_key(key, options->key_size, number);
+        make_value(value, options->value_size, number, 0);
+        if(!backend_insert(shared->backend, key, value)) return false;
+
+        atomic_fetch_add(&shared->key_count, 1);
+        return true;
+    }
+
+    size_t count = atomic_load_explicit(&shared->key_count, memory_order_relaxed);
+    size_t number = workload_keys_next(keys, count);
+
+    if(operation == WORKLOAD_SCAN)
+    {
+        size_t length = 1 + workload_random(keys, WORKLOAD_MAX_SCAN);
+        for(size_t i = 0; i < length; i++)
+        {
+            make_key(key, options->key_size, (number + i) % count);
+            if(!backend_read(shared->backend, key, value)) w->not_found[operation]++;
+        }
+        return true;
+    }
+
+    make_key(key, options->key_size, number);
+    bool found = true;
+
+    if(operation == WORKLOAD_READ || operation == WORKLOAD_READ_MODIFY_WRITE)
+        found = backend_read(shared->backend, key, value);
+    if(!found) w->not_found[operation]++;
+    if(operation == WORKLOAD_READ) return true;
+
+    //nouvelle version de la valeur (lue pour read-modify-write)
+    uint64_t version = 1;
+    if(operation == WORKLOAD_READ_MODIFY_WRITE && found)
+    {
+        memcpy(&version, value + sizeof(uint64_t), sizeof(version));
+        version++;
+    }
+
+    make_value(value, options->value_size, number, version);
+    return backend_update(shared->backend, key, value);
+}
+
+static void make_key(char *key, size_t key_size, size_t number)
+{
+    uint64_t n = number;
+    memcpy(key, &n, sizeof(n));
+    memset(key + sizeof(n), BENCH_KEY_PADDING, key_size - sizeof(n));
+}
+
+static void make_value(char *value, size_t value_size, size_t number, uint64_t version)
+{
+    uint64_t n = number;
+    memcpy(value, &n, sizeof(n));
+    memcpy(value + sizeof(n), &version, sizeof(version));
+    memset(value + 2 * sizeof(n), (int)(version & 0xFF), value_size - 2 * sizeof(n));
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void report_header(FILE *out)
+{
+    fprintf(out, "backend,mode,workload,distribution,threads,records,key_size,value_size,"
+                 "operation,count,not_found,throughput,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns");
+
+    for(int i = 0; i < COUNTERS; i++)
+        fprintf(out, ",%s_per_op", counters_name((counter_t)i));
+
+    fprintf(out, "\n");
+}
+
+static void report(FILE *out, const options_t *options, const char *operation, const histogram_t *h,
+                   uint64_t not_found, double seconds, const counters_values_t *counters)
+{
+    uint64_t count = histogram_count(h);
+
+    fprintf(out, "%s,%s,%c,%s,%zu,%zu,%zu,%zu,%s,%llu,%llu,%.0f,%.1f,%llu,%llu,%llu,%llu,%llu",
+            options->backend, options->mode ? options->mode : "default", options->mix.name,
+            workload_distribution_name(options->mix.distribution), options->threads, options->records,
+            options->key_size, options->value_size, operation,
+            (unsigned long long)count, (unsigned long long)not_found,
+            seconds > 0 ? (double)count / seconds : 0.0, histogram_mean(h),
+            (unsigned long long)histogram_percentile(h, 50), (unsigned long long)histogram_percentile(h, 90),
+            (unsigned long long)histogram_percentile(h, 99), (unsigned long long)histogram_percentile(h, 99.9),
+            (unsigned long long)histogram_max(h));
+
+    //compteurs par operation (colonne vide: pas mesure pour cette ligne, ou indisponible)
+    for(int i = 0; i < COUNTERS; i++)
+    {
+        if(counters != NULL && counters->available[i] && count > 0) fprintf(out, ",%.3f", counters->values[i] / (double)count);
+        else fprintf(out, ",");
+    }
+
+    fprintf(out, "\n");
+}
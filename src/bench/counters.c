@@ -0,0 +1,106 @@
+#include "counters.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} EVENTS[COUNTERS] = {
+    [COUNTER_CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [COUNTER_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [COUNTER_L1D_MISSES] = { "l1d_misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    [COUNTER_LLC_MISSES] = { "llc_misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+    [COUNTER_DTLB_MISSES] = { "dtlb_misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    [COUNTER_BRANCH_MISSES] = { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [COUNTER_PAGE_FAULTS] = { "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+bool counters_open(counters_t *c)
+{
+    bool any = false;
+
+    for(int i = 0; i < COUNTERS; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = EVENTS[i].type;
+        attr.config = EVENTS[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        //ce thread (pid 0), sur n'importe quel cpu
+        c->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        any = any || c->fds[i] >= 0;
+    }
+
+    return any;
+}
+
+void counters_close(counters_t *c)
+{
+    for(int i = 0; i < COUNTERS; i++)
+        if(c->fds[i] >= 0) close(c->fds[i]);
+}
+
+void counters_start(counters_t *c)
+{
+    for(int i = 0; i < COUNTERS; i++)
+    {
+        if(c->fds[i] < 0) continue;
+
+        ioctl(c->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(c->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void counters_stop(counters_t *c, counters_values_t *values)
+{
+    //tous arretes d'abord: la lecture des uns n'est pas comptee par les autres
+    for(int i = 0; i < COUNTERS; i++)
+        if(c->fds[i] >= 0) ioctl(c->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for(int i = 0; i < COUNTERS; i++)
+    {
+        uint64_t data[3];//value, time enabled, time running
+        values->values[i] = 0;
+        values->available[i] = c->fds[i] >= 0 && read(c->fds[i], data, sizeof(data)) == sizeof(data);
+        if(!values->available[i]) continue;
+
+        //multiplexe: extrapole au temps total
+        if(data[2] == 0) values->available[i] = false;
+        else values->values[i] = (double)data[0] * ((double)data[1] / (double)data[2]);
+    }
+}
+
+void counters_values_init(counters_values_t *values)
+{
+    for(int i = 0; i < COUNTERS; i++)
+    {
+        values->values[i] = 0;
+        values->available[i] = true;
+    }
+}
+
+void counters_add(counters_values_t *dst, const counters_values_t *src)
+{
+    for(int i = 0; i < COUNTERS; i++)
+    {
+        dst->values[i] += src->values[i];
+        dst->available[i] = dst->available[i] && src->available[i];
+    }
+}
+
+const char* counters_name(counter_t counter)
+{ return EVENTS[counter].name; }
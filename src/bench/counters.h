@@ -0,0 +1,65 @@
+/*
+ *  Hardware performance counters of a thread (perf_event_open), read around a phase of the
+ *  benchmark: cycles, instructions, L1 data cache, last level cache and data TLB misses, branch
+ *  mispredictions, and page faults (software counter).
+ *
+ *  Each counter is opened separately (no group): when the PMU has fewer registers than
+ *  counters, the kernel multiplexes them, and the values are scaled by the time each counter
+ *  was really counting. Only the user space of the calling thread is counted.
+ *
+ *  A counter that cannot be opened (no PMU in a virtual machine or a container,
+ *  perf_event_paranoid, seccomp...) is marked unavailable, the others still work.
+*/
+
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include <stdbool.h>
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,   //L1 data cache read misses
+    COUNTER_LLC_MISSES,   //last level cache read misses
+    COUNTER_DTLB_MISSES,  //data TLB read misses
+    COUNTER_BRANCH_MISSES,
+    COUNTER_PAGE_FAULTS,
+    COUNTERS,//number of counters
+} counter_t;
+
+//the counters of one thread
+typedef struct {
+    int fds[COUNTERS];//-1: unavailable
+} counters_t;
+
+//values of a phase (summed over the threads with counters_add)
+typedef struct {
+    double values[COUNTERS];
+    bool available[COUNTERS];
+} counters_values_t;
+
+/// @brief Open the counters of the calling thread (stopped)
+/// @return true if at least one counter is available
+bool counters_open(counters_t *c);
+
+/// @brief Close the counters
+void counters_close(counters_t *c);
+
+/// @brief Reset and start the counters
+void counters_start(counters_t *c);
+
+/// @brief Stop the counters and read them
+/// @param c The counters
+/// @param values Receives the values (scaled if the counters were multiplexed)
+void counters_stop(counters_t *c, counters_values_t *values);
+
+/// @brief Prepare a sum of values (every counter at 0 and available)
+void counters_values_init(counters_values_t *values);
+
+/// @brief Add the values of src to dst (a counter stays available if it is available in src)
+void counters_add(counters_values_t *dst, const counters_values_t *src);
+
+/// @brief Get the name of a counter, as a CSV column (cycles, instructions...)
+const char* counters_name(counter_t counter);
+
+#endif
@@ -0,0 +1,196 @@
+#include "workload.h"
+
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+
+static const workload_mix_t MIXES[] = {
+    { 'a', { [WORKLOAD_READ] = 0.5, [WORKLOAD_UPDATE] = 0.5 }, WORKLOAD_ZIPFIAN },
+    { 'b', { [WORKLOAD_READ] = 0.95, [WORKLOAD_UPDATE] = 0.05 }, WORKLOAD_ZIPFIAN },
+    { 'c', { [WORKLOAD_READ] = 1.0 }, WORKLOAD_ZIPFIAN },
+    { 'd', { [WORKLOAD_READ] = 0.95, [WORKLOAD_INSERT] = 0.05 }, WORKLOAD_LATEST },
+    { 'e', { [WORKLOAD_SCAN] = 0.95, [WORKLOAD_INSERT] = 0.05 }, WORKLOAD_ZIPFIAN },
+    { 'f', { [WORKLOAD_READ] = 0.5, [WORKLOAD_READ_MODIFY_WRITE] = 0.5 }, WORKLOAD_ZIPFIAN },
+};
+
+static const char *DISTRIBUTIONS[] = {
+    [WORKLOAD_UNIFORM] = "uniform",
+    [WORKLOAD_ZIPFIAN] = "zipfian",
+    [WORKLOAD_LATEST] = "latest",
+    [WORKLOAD_HOTSPOT] = "hotspot",
+};
+
+static const char *OPERATIONS[] = {
+    [WORKLOAD_READ] = "READ",
+    [WORKLOAD_UPDATE] = "UPDATE",
+    [WORKLOAD_INSERT] = "INSERT",
+    [WORKLOAD_SCAN] = "SCAN",
+    [WORKLOAD_READ_MODIFY_WRITE] = "READ_MODIFY_WRITE",
+};
+
+static uint64_t next_random(workload_keys_t *keys);
+static double next_double(workload_keys_t *keys);
+static size_t zipf_next(workload_keys_t *keys, size_t count);
+static void zipf_grow(workload_keys_t *keys, size_t count);
+static uint64_t scramble(uint64_t value);
+
+bool workload_mix_parse(const char *name, workload_mix_t *mix)
+{
+    if(strlen(name) != 1) return false;
+
+    for(size_t i = 0; i < sizeof(MIXES) / sizeof(*MIXES); i++)
+    {
+        if((name[0] | 0x20) != MIXES[i].name) continue;
+
+        *mix = MIXES[i];
+        return true;
+    }
+
+    return false;
+}
+
+bool workload_distribution_parse(const char *name, workload_distribution_t *distribution)
+{
+    for(size_t i = 0; i < sizeof(DISTRIBUTIONS) / sizeof(*DISTRIBUTIONS); i++)
+    {
+        if(strcasecmp(name, DISTRIBUTIONS[i]) != 0) continue;
+
+        *distribution = (workload_distribution_t)i;
+        return true;
+    }
+
+    return false;
+}
+
+const char* workload_distribution_name(workload_distribution_t distribution)
+{ return DISTRIBUTIONS[distribution]; }
+
+const char* workload_operation_name(workload_operation_t operation)
+{ return OPERATIONS[operation]; }
+
+void workload_keys_init(workload_keys_t *keys, workload_distribution_t distribution, size_t count, uint64_t seed)
+{
+    keys->distribution = distribution;
+    workload_keys_seed(keys, seed);
+
+    keys->zipf_count = 0;
+    keys->zeta_n = 0;
+    keys->zeta_2 = 1.0 + pow(0.5, WORKLOAD_ZIPF_THETA);
+    keys->alpha = 1.0 / (1.0 - WORKLOAD_ZIPF_THETA);
+    keys->eta = 0;
+
+    if((distribution == WORKLOAD_ZIPFIAN || distribution == WORKLOAD_LATEST) && count > 1) zipf_grow(keys, count);
+}
+
+void workload_keys_seed(workload_keys_t *keys, uint64_t seed)
+{ keys->rng = seed ? seed : 0x9E3779B97F4A7C15ULL; }
+
+size_t workload_keys_next(workload_keys_t *keys, size_t count)
+{
+    if(count <= 1) return 0;
+
+    switch(keys->distribution)
+    {
+        case WORKLOAD_ZIPFIAN:
+            //les clefs populaires sont dispersees (sinon ce seraient les premieres inserees)
+            return scramble(zipf_next(keys, count)) % count;
+
+        case WORKLOAD_LATEST:
+            return count - 1 - zipf_next(keys, count);
+
+        case WORKLOAD_HOTSPOT:
+        {
+            size_t hot = (size_t)((double)count * WORKLOAD_HOT_KEYS);
+            if(hot == 0) hot = 1;
+
+            if(next_double(keys) < WORKLOAD_HOT_OPERATIONS) return workload_random(keys, hot);
+            return hot + workload_random(keys, count - hot);
+        }
+
+        case WORKLOAD_UNIFORM:
+        default:
+            return workload_random(keys, count);
+    }
+}
+
+workload_operation_t workload_next_operation(workload_keys_t *keys, const workload_mix_t *mix)
+{
+    double choice = next_double(keys);
+
+    for(int i = 0; i < WORKLOAD_OPERATIONS; i++)
+    {
+        if(choice < mix->proportions[i]) return (workload_operation_t)i;
+        choice -= mix->proportions[i];
+    }
+
+    //arrondis: la derniere operation du melange
+    workload_operation_t last = WORKLOAD_READ;
+    for(int i = 0; i < WORKLOAD_OPERATIONS; i++)
+        if(mix->proportions[i] > 0) last = (workload_operation_t)i;
+
+    return last;
+}
+
+uint64_t workload_random(workload_keys_t *keys, uint64_t bound)
+{
+    //biais du modulo negligeable: bound est tres petit devant 2^64
+    return next_random(keys) % bound;
+}
+
+
+//--------------- RANDOM NUMBERS ---------------//
+
+//xorshift64*
+static uint64_t next_random(workload_keys_t *keys)
+{
+    keys->rng ^= keys->rng >> 12;
+    keys->rng ^= keys->rng << 25;
+    keys->rng ^= keys->rng >> 27;
+    return keys->rng * 0x2545F4914F6CDD1DULL;
+}
+
+//uniform over [0, 1)
+static double next_double(workload_keys_t *keys)
+{ return (double)(next_random(keys) >> 11) * 0x1.0p-53; }
+
+//FNV-1a over the 8 bytes of the value
+static uint64_t scramble(uint64_t value)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for(int i = 0; i < 8; i++)
+    {
+        hash = (hash ^ (value & 0xFF)) * 0x100000001B3ULL;
+        value >>= 8;
+    }
+
+    return hash;
+}
+
+
+//--------------- ZIPF ---------------//
+
+//rank in [0, count), 0 being the most popular (Gray et al., "Quickly generating billion-record synthetic databases")
+static size_t zipf_next(workload_keys_t *keys, size_t count)
+{
+    if(count > keys->zipf_count) zipf_grow(keys, count);
+
+    double u = next_double(keys);
+    double uz = u * keys->zeta_n;
+
+    if(uz < 1.0) return 0;
+    if(uz < keys->zeta_2) return 1;
+
+    size_t rank = (size_t)((double)keys->zipf_count * pow(keys->eta * u - keys->eta + 1.0, keys->alpha));
+    return rank < count ? rank : count - 1;
+}
+
+//zeta(n) = sum of 1 / i^theta for i in [1, n]: only the new terms are added when the keys grow
+static void zipf_grow(workload_keys_t *keys, size_t count)
+{
+    for(size_t i = keys->zipf_count + 1; i <= count; i++)
+        keys->zeta_n += 1.0 / pow((double)i, WORKLOAD_ZIPF_THETA);
+
+    keys->zipf_count = count;
+    keys->eta = (1.0 - pow(2.0 / (double)count, 1.0 - WORKLOAD_ZIPF_THETA)) / (1.0 - keys->zeta_2 / keys->zeta_n);
+}
@@ -0,0 +1,111 @@
+/*
+ *  YCSB-style workload generation: the operation mixes of the core workloads A to F, and the
+ *  distributions of the keys they access.
+ *
+ *  ---------- Workloads ---------
+ *  A: 50% read, 50% update            (zipfian)   session store, heavy updates
+ *  B: 95% read,  5% update            (zipfian)   read mostly
+ *  C: 100% read                       (zipfian)   read only
+ *  D: 95% read,  5% insert            (latest)    the new keys are the popular ones
+ *  E: 95% scan,  5% insert            (zipfian)   short ranges (1 to WORKLOAD_MAX_SCAN keys)
+ *  F: 50% read, 50% read-modify-write (zipfian)
+ *
+ *  ---------- Distributions ---------
+ *  - uniform: every key has the same probability.
+ *  - zipfian: the popularity of the keys follows a zipf law (WORKLOAD_ZIPF_THETA), and the
+ *    popular keys are scattered over the key space (scrambled zipfian, like YCSB).
+ *  - latest: zipfian over the age of the keys, the last inserted keys are the most popular.
+ *  - hotspot: WORKLOAD_HOT_OPERATIONS of the operations go to WORKLOAD_HOT_KEYS of the keys.
+ *
+ *  The keys are numbered from 0 (in insertion order): the generator returns key numbers,
+ *  the caller builds the actual keys from them.
+*/
+
+#ifndef __WORKLOAD_H__
+#define __WORKLOAD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WORKLOAD_ZIPF_THETA 0.99  //skew of the zipfian distributions (YCSB default)
+#define WORKLOAD_HOT_KEYS 0.2     //hotspot: fraction of the keys that are hot
+#define WORKLOAD_HOT_OPERATIONS 0.8 //hotspot: fraction of the operations on the hot keys
+#define WORKLOAD_MAX_SCAN 100     //longest scan (the length is uniform between 1 and this)
+
+typedef enum {
+    WORKLOAD_READ,
+    WORKLOAD_UPDATE,
+    WORKLOAD_INSERT,
+    WORKLOAD_SCAN,
+    WORKLOAD_READ_MODIFY_WRITE,
+    WORKLOAD_OPERATIONS,//number of operations
+} workload_operation_t;
+
+typedef enum {
+    WORKLOAD_UNIFORM,
+    WORKLOAD_ZIPFIAN,
+    WORKLOAD_LATEST,
+    WORKLOAD_HOTSPOT,
+} workload_distribution_t;
+
+typedef struct {
+    char name;//'a' to 'f'
+    double proportions[WORKLOAD_OPERATIONS];//sum: 1
+    workload_distribution_t distribution;
+} workload_mix_t;
+
+//key chooser of one thread
+typedef struct {
+    workload_distribution_t distribution;
+    uint64_t rng;
+
+    //zipf law over [0, zipf_count), updated when the number of keys grows
+    size_t zipf_count;
+    double zeta_n;
+    double zeta_2;
+    double alpha;
+    double eta;
+} workload_keys_t;
+
+/// @brief Get the mix of a core workload
+/// @param name "a" to "f" (case insensitive)
+/// @param mix Receives the mix
+/// @return false if the name is not a workload
+bool workload_mix_parse(const char *name, workload_mix_t *mix);
+
+/// @brief Get a distribution from its name ("uniform", "zipfian", "latest" or "hotspot")
+/// @return false if the name is not a distribution
+bool workload_distribution_parse(const char *name, workload_distribution_t *distribution);
+
+/// @brief Get the name of a distribution
+const char* workload_distribution_name(workload_distribution_t distribution);
+
+/// @brief Get the name of an operation (READ, UPDATE...)
+const char* workload_operation_name(workload_operation_t operation);
+
+/// @brief Prepare a key chooser
+/// @param keys The chooser
+/// @param distribution The distribution of the keys
+/// @param count The initial number of keys
+/// @param seed The seed of its random numbers
+/// @note O(count) for the zipfian distributions: prepare one chooser, copy it for each thread, and
+///       give each copy its own seed with workload_keys_seed
+void workload_keys_init(workload_keys_t *keys, workload_distribution_t distribution, size_t count, uint64_t seed);
+
+/// @brief Change the seed of a key chooser
+void workload_keys_seed(workload_keys_t *keys, uint64_t seed);
+
+/// @brief Choose a key
+/// @param keys The chooser
+/// @param count The current number of keys (it can grow between two calls)
+/// @return A key number in [0, count)
+size_t workload_keys_next(workload_keys_t *keys, size_t count);
+
+/// @brief Choose an operation of the mix
+workload_operation_t workload_next_operation(workload_keys_t *keys, const workload_mix_t *mix);
+
+/// @brief Get a random number (uniform over [0, bound))
+uint64_t workload_random(workload_keys_t *keys, uint64_t bound);
+
+#endif
@@ -0,0 +1,559 @@
+#define _GNU_SOURCE //O_DIRECT
+#include "aio.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef HASHMAP_NO_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+//a buffer of a file, and the request that uses it
+typedef struct _aio_slot_t {
+    struct _aio_file_t *file;
+    char *buffer;
+    off_t offset;
+    size_t length;//requested
+    size_t needed;//read: bytes that must be read (the rest of an aligned block may be past the end of the file)
+    size_t done;//transferred
+    bool write;
+    bool aligned;//O_DIRECT request: after a partial transfer, the rest must start at an aligned offset
+    bool busy;//in flight
+    struct _aio_slot_t *next;//queue of the pool
+} aio_slot_t;
+
+#ifndef HASHMAP_NO_IO_URING
+typedef struct {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;//== sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring_t;
+#endif
+
+struct _aio_file_t {
+    int fd;
+    bool direct;//O_DIRECT is set on fd
+    size_t buffer_size;
+    size_t depth;
+    char *buffers;
+    aio_slot_t *slots;
+    size_t next;//slot of the next aio_write_buffer / aio_read_next
+    bool failed;//protected by lock (set by the pool threads)
+
+    //reading
+    off_t read_offset;//next block to submit
+    off_t read_end;
+    size_t skip;//bytes before begin in the first block
+    size_t submitted;//blocks
+    size_t consumed;
+    aio_slot_t *returned;//given by the last aio_read_next, reused by the next call
+
+#ifndef HASHMAP_NO_IO_URING
+    bool use_uring;
+    uring_t ring;
+#endif
+
+    //completions of the pool
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+//the pool is shared by every file, and started on first use
+static struct {
+    pthread_once_t once;
+    size_t started;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    aio_slot_t *head;
+    aio_slot_t *tail;
+} pool = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER,
+};
+
+static void slot_submit(aio_file_t *file, aio_slot_t *slot);
+static void slot_wait(aio_file_t *file, aio_slot_t *slot);
+static void read_submit(aio_file_t *file, aio_slot_t *slot);
+static bool slot_advance(aio_slot_t *slot, size_t transferred);
+static bool file_failed(aio_file_t *file);
+static void file_fail(aio_file_t *file);
+
+//thread pool
+static void pool_start(void);
+static void* pool_main(void *arg);
+static void pool_run(aio_slot_t *slot);
+
+#ifndef HASHMAP_NO_IO_URING
+//io_uring
+static bool uring_setup(uring_t *ring, unsigned entries);
+static void uring_teardown(uring_t *ring);
+static bool uring_submit(aio_file_t *file, aio_slot_t *slot);
+static void uring_reap(aio_file_t *file);
+#endif
+
+int aio_open(const char *path, int flags, mode_t mode)
+{
+    int fd = open(path, flags | O_DIRECT, mode);
+    if(fd >= 0 || errno != EINVAL) return fd;
+
+    //systeme de fichiers sans O_DIRECT (tmpfs...)
+    return open(path, flags, mode);
+}
+
+aio_file_t* aio_file_create(int fd, size_t buffer_size, size_t depth)
+{
+    assert(buffer_size > 0 && buffer_size % AIO_ALIGNMENT == 0);
+    if(depth == 0) depth = AIO_QUEUE_DEPTH;
+
+    aio_file_t *file = calloc(1, sizeof(*file));
+    if(!file) return (perror("calloc"), NULL);
+
+    file->fd = fd;
+    file->buffer_size = buffer_size;
+    file->depth = depth;
+
+    int flags = fcntl(fd, F_GETFL);
+    file->direct = flags >= 0 && (flags & O_DIRECT);
+
+    file->buffers = aligned_alloc(AIO_ALIGNMENT, depth * buffer_size);
+    file->slots = calloc(depth, sizeof(*file->slots));
+    if(!file->buffers || !file->slots) return (perror("malloc"), free(file->buffers), free(file->slots), free(file), NULL);
+
+    for(size_t i = 0; i < depth; i++)
+    {
+        file->slots[i].file = file;
+        file->slots[i].buffer = file->buffers + i * buffer_size;
+    }
+
+    pthread_mutex_init(&file->lock, NULL);
+    pthread_cond_init(&file->done, NULL);
+
+#ifndef HASHMAP_NO_IO_URING
+    file->use_uring = uring_setup(&file->ring, (unsigned)depth);
+#endif
+
+    return file;
+}
+
+bool aio_file_destroy(aio_file_t *file)
+{
+    for(size_t i = 0; i < file->depth; i++)
+        slot_wait(file, &file->slots[i]);
+
+    bool ok = !file_failed(file);
+
+#ifndef HASHMAP_NO_IO_URING
+    if(file->use_uring) uring_teardown(&file->ring);
+#endif
+
+    pthread_mutex_destroy(&file->lock);
+    pthread_cond_destroy(&file->done);
+    free(file->buffers);
+    free(file->slots);
+    free(file);
+    return ok;
+}
+
+bool aio_file_uses_io_uring(aio_file_t *file)
+{
+#ifndef HASHMAP_NO_IO_URING
+    return file->use_uring;
+#else
+    (void)file;//unused - to avoid warning
+    return false;
+#endif
+}
+
+char* aio_write_buffer(aio_file_t *file)
+{
+    aio_slot_t *slot = &file->slots[file->next];
+    slot_wait(file, slot);
+
+    return file_failed(file) ? NULL : slot->buffer;
+}
+
+bool aio_write_submit(aio_file_t *file, size_t length, off_t offset)
+{
+    aio_slot_t *slot = &file->slots[file->next];
+    assert(!slot->busy && length <= file->buffer_size);
+
+    //O_DIRECT n'accepte que des blocs alignes: la fin du fichier s'ecrit sans
+    if(file->direct && (length % AIO_ALIGNMENT != 0 || offset % AIO_ALIGNMENT != 0))
+    {
+        int flags = fcntl(file->fd, F_GETFL);
+        if(flags >= 0) fcntl(file->fd, F_SETFL, flags & ~O_DIRECT);
+        file->direct = false;
+    }
+
+    slot->offset = offset;
+    slot->length = length;
+    slot->needed = length;
+    slot->done = 0;
+    slot->write = true;
+    slot->aligned = file->direct;
+    slot_submit(file, slot);
+
+    file->next = (file->next + 1) % file->depth;
+    return !file_failed(file);
+}
+
+bool aio_read_start(aio_file_t *file, off_t begin, off_t end)
+{
+    off_t aligned = begin & ~(off_t)(AIO_ALIGNMENT - 1);
+
+    file->read_offset = aligned;
+    file->read_end = end;
+    file->skip = (size_t)(begin - aligned);
+    file->submitted = 0;
+    file->consumed = 0;
+    file->returned = NULL;
+    file->next = 0;
+
+    //lecture en avance: tous les buffers sont en vol des le debut
+    for(size_t i = 0; i < file->depth && file->read_offset < file->read_end; i++)
+        read_submit(file, &file->slots[i]);
+
+    return !file_failed(file);
+}
+
+ssize_t aio_read_next(aio_file_t *file, const char **data)
+{
+    //le buffer rendu au dernier appel est libre: il lit le prochain bloc
+    if(file->returned != NULL && file->read_offset < file->read_end) read_submit(file, file->returned);
+    file->returned = NULL;
+
+    if(file->consumed == file->submitted) return 0;
+
+    aio_slot_t *slot = &file->slots[file->next];
+    slot_wait(file, slot);
+    if(file_failed(file)) return -1;
+
+    size_t skip = file->consumed == 0 ? file->skip : 0;
+    *data = slot->buffer + skip;
+
+    file->consumed++;
+    file->next = (file->next + 1) % file->depth;
+    file->returned = slot;
+    return (ssize_t)(slot->needed - skip);
+}
+
+static void read_submit(aio_file_t *file, aio_slot_t *slot)
+{
+    size_t needed = (size_t)(file->read_end - file->read_offset);
+    if(needed > file->buffer_size) needed = file->buffer_size;
+
+    slot->offset = file->read_offset;
+    slot->needed = needed;
+    slot->length = file->direct ? (needed + AIO_ALIGNMENT - 1) & ~(size_t)(AIO_ALIGNMENT - 1) : needed;
+    slot->done = 0;
+    slot->write = false;
+    slot->aligned = file->direct;
+    slot_submit(file, slot);
+
+    file->read_offset += (off_t)needed;
+    file->submitted++;
+}
+
+static void slot_submit(aio_file_t *file, aio_slot_t *slot)
+{
+    slot->busy = true;
+
+#ifndef HASHMAP_NO_IO_URING
+    if(file->use_uring)
+    {
+        if(!uring_submit(file, slot))
+        {
+            file_fail(file);
+            slot->busy = false;
+        }
+        return;
+    }
+#else
+    (void)file;
+#endif
+
+    //plusieurs threads du pool: les champs du slot sont publies par le verrou du pool
+    pthread_once(&pool.once, pool_start);
+    if(pool.started == 0)
+    {
+        pool_run(slot);
+        return;
+    }
+
+    slot->next = NULL;
+    pthread_mutex_lock(&pool.lock);
+    if(pool.tail) pool.tail->next = slot;
+    else pool.head = slot;
+    pool.tail = slot;
+    pthread_cond_signal(&pool.wakeup);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void slot_wait(aio_file_t *file, aio_slot_t *slot)
+{
+#ifndef HASHMAP_NO_IO_URING
+    if(file->use_uring)
+    {
+        while(slot->busy) uring_reap(file);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&file->lock);
+    while(slot->busy) pthread_cond_wait(&file->done, &file->lock);
+    pthread_mutex_unlock(&file->lock);
+}
+
+//count the bytes of a partial transfer. an O_DIRECT request is resumed at the last aligned
+//offset (the partial block is transferred again). return false if no progress was made: with
+//O_DIRECT, less than a block is only returned at the end of the file
+static bool slot_advance(aio_slot_t *slot, size_t transferred)
+{
+    size_t done = slot->done + transferred;
+    if(slot->aligned && done < slot->needed)
+    {
+        done &= ~(size_t)(AIO_ALIGNMENT - 1);
+        if(done == slot->done) return false;
+    }
+
+    slot->done = done;
+    return transferred > 0;
+}
+
+static bool file_failed(aio_file_t *file)
+{
+    pthread_mutex_lock(&file->lock);
+    bool failed = file->failed;
+    pthread_mutex_unlock(&file->lock);
+
+    return failed;
+}
+
+static void file_fail(aio_file_t *file)
+{
+    pthread_mutex_lock(&file->lock);
+    file->failed = true;
+    pthread_mutex_unlock(&file->lock);
+}
+
+
+//--------------- THREAD POOL ---------------//
+
+static void pool_start(void)
+{
+    for(size_t i = 0; i < AIO_POOL_THREADS; i++)
+    {
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, pool_main, NULL) != 0){ perror("pthread_create"); break; }
+
+        pthread_detach(thread);
+        pool.started++;
+    }
+}
+
+static void* pool_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&pool.lock);
+    for(;;)
+    {
+        while(pool.head == NULL) pthread_cond_wait(&pool.wakeup, &pool.lock);
+
+        aio_slot_t *slot = pool.head;
+        pool.head = slot->next;
+        if(pool.head == NULL) pool.tail = NULL;
+
+        pthread_mutex_unlock(&pool.lock);
+        pool_run(slot);
+        pthread_mutex_lock(&pool.lock);
+    }
+
+    return NULL;
+}
+
+//blocking pread / pwrite of the whole request
+static void pool_run(aio_slot_t *slot)
+{
+    aio_file_t *file = slot->file;
+    bool ok = true;
+
+    while(slot->done < slot->needed)
+    {
+        ssize_t n = slot->write ? pwrite(file->fd, slot->buffer + slot->done, slot->length - slot->done, slot->offset + (off_t)slot->done)
+                                : pread(file->fd, slot->buffer + slot->done, slot->length - slot->done, slot->offset + (off_t)slot->done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0){ perror(slot->write ? "pwrite" : "pread"); ok = false; break; }
+        if(!slot_advance(slot, (size_t)n)){ fprintf(stderr, "aio: unexpected end of file\n"); ok = false; break; }
+    }
+
+    pthread_mutex_lock(&file->lock);
+    file->failed = file->failed || !ok;
+    slot->busy = false;
+    pthread_cond_broadcast(&file->done);
+    pthread_mutex_unlock(&file->lock);
+}
+
+
+//--------------- IO_URING ---------------//
+
+#ifndef HASHMAP_NO_IO_URING
+
+static bool uring_setup(uring_t *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(fd < 0) return false;//pas d'io_uring: le pool de threads prend le relais
+
+    //IORING_OP_READ / IORING_OP_WRITE n'existent que depuis linux 5.6
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    bool supported = probe != NULL && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0
+                  && probe->last_op >= IORING_OP_WRITE
+                  && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+                  && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if(!supported) return (close(fd), false);
+
+    ring->fd = fd;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single && ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED) return (perror("mmap"), close(fd), false);
+
+    ring->cq_ring = single ? ring->sq_ring
+                  : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if(ring->cq_ring == MAP_FAILED) return (perror("mmap"), munmap(ring->sq_ring, ring->sq_ring_size), close(fd), false);
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+    {
+        perror("mmap");
+        if(!single) munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(fd);
+        return false;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+static void uring_teardown(uring_t *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+//queue the rest of the request of the slot (at most depth requests in flight: the ring never overflows)
+static bool uring_submit(aio_file_t *file, aio_slot_t *slot)
+{
+    uring_t *ring = &file->ring;
+
+    unsigned tail = *ring->sq_tail;//un seul producteur: ce thread
+    unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = slot->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = file->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->buffer + slot->done);
+    sqe->len = (uint32_t)(slot->length - slot->done);
+    sqe->off = (uint64_t)(slot->offset + (off_t)slot->done);
+    sqe->user_data = (uint64_t)(uintptr_t)slot;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while(syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0)
+        if(errno != EINTR && errno != EAGAIN) return (perror("io_uring_enter"), false);
+
+    return true;
+}
+
+//wait for at least one completion, and handle every completion available
+static void uring_reap(aio_file_t *file)
+{
+    uring_t *ring = &file->ring;
+    unsigned head = *ring->cq_head;
+
+    while(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        if(syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+        {
+            //plus aucun moyen d'attendre: les requetes en vol sont abandonnees
+            perror("io_uring_enter");
+            file_fail(file);
+            for(size_t i = 0; i < file->depth; i++) file->slots[i].busy = false;
+            return;
+        }
+    }
+
+    while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        aio_slot_t *slot = (aio_slot_t*)(uintptr_t)cqe->user_data;
+        int result = cqe->res;
+
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        if(result < 0)
+        {
+            fprintf(stderr, "aio: io_uring %s: %s\n", slot->write ? "write" : "read", strerror(-result));
+            file_fail(file);
+            slot->busy = false;
+            continue;
+        }
+
+        //transfert partiel: le reste est soumis a nouveau
+        if(slot_advance(slot, (size_t)result) && slot->done < slot->needed)
+        {
+            if(!uring_submit(file, slot)){ file_fail(file); slot->busy = false; }
+            continue;
+        }
+
+        if(slot->done < slot->needed){ fprintf(stderr, "aio: unexpected end of file\n"); file_fail(file); }
+        slot->busy = false;
+    }
+}
+
+#endif
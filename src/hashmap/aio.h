@@ -0,0 +1,82 @@
+/*
+ *  Asynchronous file I/O of the snapshots (hashmap_dump_fd, hashmap_dump_files, hashmap_load).
+ *
+ *  A file has a few buffers (the queue depth): while one buffer is filled (serialized pairs)
+ *  or consumed (parsed records), the others are written or read by the kernel. The disk works
+ *  while the CPU formats or parses, instead of one blocking write / read per buffer.
+ *
+ *  ---------- Backends ---------
+ *  - io_uring, through the raw system calls (no liburing): one ring per file, the requests are
+ *    submitted without blocking and the completions reaped when a buffer is needed again.
+ *  - a pool of AIO_POOL_THREADS threads doing pread / pwrite, shared by every file, when
+ *    io_uring is not available (old kernel, seccomp filter...) or when HASHMAP_NO_IO_URING is
+ *    defined at compile time.
+ *
+ *  ---------- O_DIRECT ---------
+ *  The buffers are aligned on AIO_ALIGNMENT, and their size must be a multiple of it, so the
+ *  files can be opened with O_DIRECT (aio_open): the snapshot does not go through the page
+ *  cache (no copy, no eviction of the hot data by a 100 GB dump). A write that is not aligned
+ *  (the end of the file) clears O_DIRECT on the file before being submitted. A partial
+ *  transfer is resumed at the last aligned offset (its partial block is transferred again).
+ *
+ *  A file is used by one thread at a time.
+*/
+
+#ifndef __AIO_H__
+#define __AIO_H__
+
+#include "hashmap.h"
+
+#include <sys/types.h>
+
+typedef struct _aio_file_t aio_file_t;
+
+#define AIO_ALIGNMENT 4096   //alignment of the buffers, offsets and sizes for O_DIRECT
+#define AIO_QUEUE_DEPTH 4    //buffers of a file, in flight or being filled / consumed
+#define AIO_POOL_THREADS 4   //threads of the fallback pool
+
+/// @brief Open a file with O_DIRECT if the file system supports it, without otherwise
+/// @param path The file
+/// @param flags The flags of open (O_DIRECT is added)
+/// @param mode The mode of a created file
+/// @return The file descriptor, or -1 if the file cannot be opened
+int aio_open(const char *path, int flags, mode_t mode);
+
+/// @brief Prepare asynchronous I/O on a file descriptor
+/// @param fd The file (it is not closed by aio_file_destroy)
+/// @param buffer_size The size of each buffer (a multiple of AIO_ALIGNMENT)
+/// @param depth The number of buffers (0 for AIO_QUEUE_DEPTH)
+/// @return A pointer to the file or NULL if an error occured
+aio_file_t* aio_file_create(int fd, size_t buffer_size, size_t depth);
+
+/// @brief Wait for the pending requests, and free the file (and its buffers)
+/// @return true if every request succeeded
+bool aio_file_destroy(aio_file_t *file);
+
+/// @brief Tell if the file uses io_uring (false: the thread pool)
+bool aio_file_uses_io_uring(aio_file_t *file);
+
+/// @brief Get the next buffer to fill (waits for the oldest write if every buffer is in flight)
+/// @return The buffer (buffer_size bytes), or NULL if a previous write failed
+char* aio_write_buffer(aio_file_t *file);
+
+/// @brief Write the buffer returned by the last aio_write_buffer, in the background
+/// @param file The file
+/// @param length The number of bytes to write
+/// @param offset Where to write them in the file
+/// @return false if a previous write failed
+bool aio_write_submit(aio_file_t *file, size_t length, off_t offset);
+
+/// @brief Read [begin, end) of the file, by blocks of buffer_size read in advance
+/// @return false if the reads cannot be submitted
+/// @note The blocks are read from begin rounded down to AIO_ALIGNMENT (O_DIRECT), the bytes
+///       outside of [begin, end) are skipped by aio_read_next
+bool aio_read_start(aio_file_t *file, off_t begin, off_t end);
+
+/// @brief Get the next block of [begin, end), in order
+/// @param file The file
+/// @param data Receives a pointer to the bytes (valid until the next call)
+/// @return The number of bytes, 0 at the end, or -1 if a read failed
+ssize_t aio_read_next(aio_file_t *file, const char **data);
+
+#endif
@@ -0,0 +1,501 @@
+#include "changefeed.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#define VARINT_MAX 10 //bytes of a 64 bits LEB128
+#define MAGIC_SIZE sizeof(CHANGEFEED_MAGIC)
+
+typedef struct {
+    int fd;
+    bool is_socket;//written with send(MSG_NOSIGNAL): no SIGPIPE if the follower is gone
+} follower_t;
+
+struct _changefeed_t {
+    hashmap_t *hm;
+    format_fn_t format_key_fn;
+    format_fn_t format_value_fn;
+
+    follower_t followers[CHANGEFEED_MAX_FOLLOWERS];
+    size_t follower_count;
+
+    char *buffer;
+    size_t used;
+    size_t capacity;//CHANGEFEED_BUFFER_SIZE, more after a record bigger than that
+};
+
+struct _changefeed_reader_t {
+    hashmap_t *hm;
+    int fd;
+    parse_fn_t parse_key_fn;
+    parse_fn_t parse_value_fn;
+
+    char *buffer;//bytes [begin, end) not applied yet
+    size_t begin;
+    size_t end;
+    size_t capacity;
+
+    void *key;//max(key_size, length + 1) bytes for the parse functions
+    size_t key_capacity;
+    void *value;
+    size_t value_capacity;
+
+    bool header;//the magic was checked
+    bool closed;
+    bool failed;
+};
+
+//snapshot of the map sent to a new follower
+typedef struct {
+    changefeed_t *cf;
+    follower_t *follower;
+    bool failed;
+} snapshot_ctx_t;
+
+//leader
+static void feed_mutation(hashmap_mutation_t mutation, const void *key, const void *value, void *ctx);
+static void feed_snapshot_pair(const void *key, void *value, void *ctx);
+static bool feed_encode(changefeed_t *cf, hashmap_mutation_t mutation, const void *key, const void *value);
+static bool feed_encode_element(changefeed_t *cf, size_t *position, format_fn_t fn, const void *element, size_t element_size);
+static bool feed_reserve(changefeed_t *cf, size_t size);
+static bool feed_send(changefeed_t *cf);
+static void feed_drop_all(changefeed_t *cf);
+static bool follower_write(const follower_t *follower, const char *data, size_t size);
+
+//follower
+static ssize_t reader_apply(changefeed_reader_t *reader);
+static bool reader_element(void **element, size_t *capacity, size_t element_size, parse_fn_t fn, const char *data, size_t length);
+static bool reader_reserve(changefeed_reader_t *reader);
+
+static size_t varint_encode(char *buffer, size_t value);
+static int varint_decode(const char **data, const char *end, size_t *value);
+
+//default functions
+static size_t format_raw(const void *element, const size_t element_size, char *buffer, const size_t size);
+static bool parse_raw(const char *text, const size_t length, void *element, const size_t element_size);
+
+changefeed_t* changefeed_create(hashmap_t *hm, format_fn_t format_key_fn, format_fn_t format_value_fn)
+{
+    changefeed_t *cf = malloc(sizeof(*cf));
+    if(!cf) return (perror("malloc"), NULL);
+
+    cf->buffer = malloc(CHANGEFEED_BUFFER_SIZE);
+    if(!cf->buffer) return (perror("malloc"), free(cf), NULL);
+
+    cf->hm = hm;
+    cf->format_key_fn = format_key_fn != NULL ? format_key_fn : format_raw;
+    cf->format_value_fn = format_value_fn != NULL ? format_value_fn : format_raw;
+    cf->follower_count = 0;
+    cf->used = 0;
+    cf->capacity = CHANGEFEED_BUFFER_SIZE;
+
+    hashmap_set_fn_mutation(hm, feed_mutation, cf);
+    return cf;
+}
+
+void changefeed_destroy(changefeed_t *cf)
+{
+    feed_send(cf);
+    hashmap_set_fn_mutation(cf->hm, NULL, NULL);
+
+    free(cf->buffer);
+    free(cf);
+}
+
+bool changefeed_add_follower(changefeed_t *cf, int fd)
+{
+    if(cf->follower_count == CHANGEFEED_MAX_FOLLOWERS)
+        return (fprintf(stderr, "changefeed: too many followers\n"), false);
+
+    //les mutations deja faites sont dans le snapshot: elles partent d'abord vers les autres
+    feed_send(cf);
+
+    struct stat st;
+    follower_t *follower = &cf->followers[cf->follower_count];
+    follower->fd = fd;
+    follower->is_socket = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+
+    memcpy(cf->buffer, CHANGEFEED_MAGIC, MAGIC_SIZE);
+    cf->used = MAGIC_SIZE;
+
+    //snapshot: toutes les paires, ecrites par blocs a ce seul follower
+    snapshot_ctx_t snapshot = { .cf = cf, .follower = follower, .failed = false };
+    hashmap_scan(cf->hm, 0, 0, feed_snapshot_pair, &snapshot);
+
+    if(!snapshot.failed && !follower_write(follower, cf->buffer, cf->used)) snapshot.failed = true;
+    cf->used = 0;
+
+    if(snapshot.failed) return false;
+
+    cf->follower_count++;
+    return true;
+}
+
+size_t changefeed_follower_count(changefeed_t *cf)
+{ return cf->follower_count; }
+
+bool changefeed_flush(changefeed_t *cf)
+{ return feed_send(cf); }
+
+changefeed_reader_t* changefeed_reader_create(hashmap_t *hm, int fd, parse_fn_t parse_key_fn, parse_fn_t parse_value_fn)
+{
+    changefeed_reader_t *reader = calloc(1, sizeof(*reader));
+    if(!reader) return (perror("calloc"), NULL);
+
+    reader->buffer = malloc(CHANGEFEED_BUFFER_SIZE);
+    if(!reader->buffer) return (perror("malloc"), free(reader), NULL);
+
+    reader->hm = hm;
+    reader->fd = fd;
+    reader->parse_key_fn = parse_key_fn != NULL ? parse_key_fn : parse_raw;
+    reader->parse_value_fn = parse_value_fn != NULL ? parse_value_fn : parse_raw;
+    reader->capacity = CHANGEFEED_BUFFER_SIZE;
+
+    return reader;
+}
+
+void changefeed_reader_destroy(changefeed_reader_t *reader)
+{
+    free(reader->buffer);
+    free(reader->key);
+    free(reader->value);
+    free(reader);
+}
+
+ssize_t changefeed_reader_poll(changefeed_reader_t *reader)
+{
+    if(reader->failed) return -1;
+    if(reader->closed) return 0;
+    if(!reader_reserve(reader)) return (reader->failed = true, -1);
+
+    ssize_t n = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end);
+    if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if(n < 0) return (perror("read"), reader->failed = true, -1);
+
+    if(n == 0)
+    {
+        reader->closed = true;
+        if(reader->begin == reader->end) return 0;
+
+        fprintf(stderr, "changefeed: truncated record\n");
+        return (reader->failed = true, -1);
+    }
+
+    reader->end += (size_t)n;
+    return reader_apply(reader);
+}
+
+bool changefeed_reader_run(changefeed_reader_t *reader)
+{
+    struct pollfd pfd = { .fd = reader->fd, .events = POLLIN };
+
+    while(!reader->closed)
+    {
+        ssize_t applied = changefeed_reader_poll(reader);
+        if(applied < 0) return false;
+
+        //descripteur non bloquant: on attend les donnees suivantes
+        if(applied == 0 && !reader->closed && poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return (perror("poll"), false);
+    }
+
+    return !reader->failed;
+}
+
+bool changefeed_reader_closed(changefeed_reader_t *reader)
+{ return reader->closed; }
+
+
+//--------------- LEADER ---------------//
+
+static void feed_mutation(hashmap_mutation_t mutation, const void *key, const void *value, void *ctx)
+{
+    changefeed_t *cf = ctx;
+    if(cf->follower_count == 0) return;
+
+    //un record perdu desynchronise tous les followers: ils sont abandonnes
+    if(!feed_encode(cf, mutation, key, value)){ feed_drop_all(cf); return; }
+    if(cf->used >= CHANGEFEED_BUFFER_SIZE) feed_send(cf);
+}
+
+static void feed_snapshot_pair(const void *key, void *value, void *ctx)
+{
+    snapshot_ctx_t *snapshot = ctx;
+    changefeed_t *cf = snapshot->cf;
+    if(snapshot->failed) return;
+
+    if(!feed_encode(cf, HASHMAP_MUTATION_ADD, key, value)){ snapshot->failed = true; return; }
+    if(cf->used < CHANGEFEED_BUFFER_SIZE) return;
+
+    if(!follower_write(snapshot->follower, cf->buffer, cf->used)) snapshot->failed = true;
+    cf->used = 0;
+}
+
+//a record at the end of the buffer (cf->used is unchanged if it cannot be encoded)
+static bool feed_encode(changefeed_t *cf, hashmap_mutation_t mutation, const void *key, const void *value)
+{
+    if(!feed_reserve(cf, cf->used + 1)) return false;
+
+    size_t position = cf->used;
+    cf->buffer[position++] = (char)mutation;
+
+    if(!feed_encode_element(cf, &position, cf->format_key_fn, key, hashmap_key_size(cf->hm))) return false;
+    if(mutation != HASHMAP_MUTATION_REMOVE && !feed_encode_element(cf, &position, cf->format_value_fn, value, hashmap_value_size(cf->hm)))
+        return false;
+
+    cf->used = position;
+    return true;
+}
+
+//length (varint) + element, at position
+static bool feed_encode_element(changefeed_t *cf, size_t *position, format_fn_t fn, const void *element, size_t element_size)
+{
+    size_t length;
+
+    //formate apres la place maximale d'un varint, puis colle l'element a sa longueur
+    for(;;)
+    {
+        if(!feed_reserve(cf, *position + VARINT_MAX + 1)) return false;
+
+        size_t space = cf->capacity - *position - VARINT_MAX;
+        length = fn(element, element_size, cf->buffer + *position + VARINT_MAX, space);
+        if(length < space) break;
+
+        if(length > CHANGEFEED_MAX_ELEMENT) return (fprintf(stderr, "changefeed: element of %zu bytes\n", length), false);
+        if(!feed_reserve(cf, *position + VARINT_MAX + length + 1)) return false;
+    }
+
+    size_t prefix = varint_encode(cf->buffer + *position, length);
+    memmove(cf->buffer + *position + prefix, cf->buffer + *position + VARINT_MAX, length);
+    *position += prefix + length;
+    return true;
+}
+
+static bool feed_reserve(changefeed_t *cf, size_t size)
+{
+    if(size <= cf->capacity) return true;
+
+    size_t capacity = cf->capacity;
+    while(capacity < size) capacity *= 2;
+
+    char *buffer = realloc(cf->buffer, capacity);
+    if(!buffer) return (perror("realloc"), false);
+
+    cf->buffer = buffer;
+    cf->capacity = capacity;
+    return true;
+}
+
+static bool feed_send(changefeed_t *cf)
+{
+    bool ok = true;
+
+    for(size_t i = 0; i < cf->follower_count && cf->used > 0; )
+    {
+        if(follower_write(&cf->followers[i], cf->buffer, cf->used)){ i++; continue; }
+
+        //follower perdu: remplace par le dernier
+        cf->followers[i] = cf->followers[--cf->follower_count];
+        ok = false;
+    }
+
+    cf->used = 0;
+
+    //le buffer a grandi pour un gros record: il reprend sa taille
+    if(cf->capacity > CHANGEFEED_BUFFER_SIZE)
+    {
+        char *buffer = realloc(cf->buffer, CHANGEFEED_BUFFER_SIZE);
+        if(buffer != NULL){ cf->buffer = buffer; cf->capacity = CHANGEFEED_BUFFER_SIZE; }
+    }
+
+    return ok;
+}
+
+static void feed_drop_all(changefeed_t *cf)
+{
+    fprintf(stderr, "changefeed: a mutation could not be encoded, %zu follower(s) dropped\n", cf->follower_count);
+    cf->follower_count = 0;
+    cf->used = 0;
+}
+
+static bool follower_write(const follower_t *follower, const char *data, size_t size)
+{
+    struct pollfd pfd = { .fd = follower->fd, .events = POLLOUT };
+
+    while(size > 0)
+    {
+        ssize_t n = follower->is_socket ? send(follower->fd, data, size, MSG_NOSIGNAL) : write(follower->fd, data, size);
+
+        if(n >= 0){ data += n; size -= (size_t)n; }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK) poll(&pfd, 1, -1);//descripteur non bloquant
+        else if(errno != EINTR) return (perror("changefeed write"), false);
+    }
+
+    return true;
+}
+
+
+//--------------- FOLLOWER ---------------//
+
+//apply the complete records of [begin, end)
+static ssize_t reader_apply(changefeed_reader_t *reader)
+{
+    ssize_t applied = 0;
+
+    if(!reader->header)
+    {
+        if(reader->end - reader->begin < MAGIC_SIZE) return 0;
+        if(memcmp(reader->buffer + reader->begin, CHANGEFEED_MAGIC, MAGIC_SIZE) != 0)
+            return (fprintf(stderr, "changefeed: not a change feed\n"), reader->failed = true, -1);
+
+        reader->begin += MAGIC_SIZE;
+        reader->header = true;
+    }
+
+    const char *end = reader->buffer + reader->end;
+
+    for(;;)
+    {
+        const char *data = reader->buffer + reader->begin;
+        if(data == end) break;
+
+        hashmap_mutation_t mutation = (hashmap_mutation_t)(unsigned char)*data++;
+        if(mutation > HASHMAP_MUTATION_REMOVE) return (fprintf(stderr, "changefeed: invalid record\n"), reader->failed = true, -1);
+
+        //le record doit etre complet avant d'etre parse
+        size_t key_length = 0, value_length = 0;
+        int status = varint_decode(&data, end, &key_length);
+        if(status < 0) return (fprintf(stderr, "changefeed: invalid record\n"), reader->failed = true, -1);
+        if(status == 0 || (size_t)(end - data) < key_length) break;
+
+        const char *key = data;
+        data += key_length;
+
+        if(mutation != HASHMAP_MUTATION_REMOVE)
+        {
+            status = varint_decode(&data, end, &value_length);
+            if(status < 0) return (fprintf(stderr, "changefeed: invalid record\n"), reader->failed = true, -1);
+            if(status == 0 || (size_t)(end - data) < value_length) break;
+        }
+
+        const char *value = data;
+        data += value_length;
+
+        bool ok = reader_element(&reader->key, &reader->key_capacity, hashmap_key_size(reader->hm), reader->parse_key_fn, key, key_length);
+        if(ok && mutation == HASHMAP_MUTATION_REMOVE) hashmap_remove(reader->hm, reader->key);
+        else if(ok)
+        {
+            ok = reader_element(&reader->value, &reader->value_capacity, hashmap_value_size(reader->hm), reader->parse_value_fn, value, value_length)
+              && hashmap_put(reader->hm, reader->key, reader->value) != NULL;
+        }
+
+        if(!ok) return (fprintf(stderr, "changefeed: record not applied\n"), reader->failed = true, -1);
+
+        reader->begin = (size_t)(data - reader->buffer);
+        applied++;
+    }
+
+    return applied;
+}
+
+//parse an element into a buffer of max(element_size, length + 1) bytes
+static bool reader_element(void **element, size_t *capacity, size_t element_size, parse_fn_t fn, const char *data, size_t length)
+{
+    size_t size = element_size > length ? element_size : length + 1;
+
+    if(size > *capacity)
+    {
+        void *tmp = realloc(*element, size);
+        if(!tmp) return (perror("realloc"), false);
+
+        *element = tmp;
+        *capacity = size;
+    }
+
+    memset(*element, 0, size);
+    return fn(data, length, *element, element_size);
+}
+
+//room after end for the next read: the pending bytes are moved to the start, the buffer grows for a big record
+static bool reader_reserve(changefeed_reader_t *reader)
+{
+    if(reader->begin > 0)
+    {
+        memmove(reader->buffer, reader->buffer + reader->begin, reader->end - reader->begin);
+        reader->end -= reader->begin;
+        reader->begin = 0;
+    }
+
+    if(reader->end < reader->capacity) return true;
+    if(reader->capacity >= 2 * (CHANGEFEED_MAX_ELEMENT + VARINT_MAX) + 1)
+        return (fprintf(stderr, "changefeed: record too big\n"), false);
+
+    char *buffer = realloc(reader->buffer, reader->capacity * 2);
+    if(!buffer) return (perror("realloc"), false);
+
+    reader->buffer = buffer;
+    reader->capacity *= 2;
+    return true;
+}
+
+
+//--------------- VARINTS ---------------//
+
+static size_t varint_encode(char *buffer, size_t value)
+{
+    size_t n = 0;
+
+    while(value >= 0x80)
+    {
+        buffer[n++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+
+    buffer[n++] = (char)value;
+    return n;
+}
+
+//1: decoded, 0: incomplete, -1: invalid (too long)
+static int varint_decode(const char **data, const char *end, size_t *value)
+{
+    size_t result = 0;
+
+    for(size_t shift = 0; shift < 7 * VARINT_MAX; shift += 7)
+    {
+        if(*data == end) return 0;
+
+        unsigned char byte = (unsigned char)*(*data)++;
+        result |= (size_t)(byte & 0x7F) << shift;
+        if(byte & 0x80) continue;
+
+        if(result > CHANGEFEED_MAX_ELEMENT) return -1;
+
+        *value = result;
+        return 1;
+    }
+
+    return -1;
+}
+
+
+//--------------- DEFAULT FUNCTIONS ---------------//
+
+static size_t format_raw(const void *element, const size_t element_size, char *buffer, const size_t size)
+{
+    if(element_size < size) memcpy(buffer, element, element_size);
+    return element_size;
+}
+
+static bool parse_raw(const char *text, const size_t length, void *element, const size_t element_size)
+{
+    if(length != element_size) return false;
+
+    memcpy(element, text, length);
+    return true;
+}
@@ -0,0 +1,106 @@
+/*
+ *  Change feed: replication of the mutations of a hashmap_t to follower processes.
+ *
+ *  The leader installs a mutation function on its map (hashmap_set_fn_mutation): every add,
+ *  update and remove is encoded into a compact binary log, kept in a buffer, and written to the
+ *  followers (pipes or Unix sockets) by blocks of CHANGEFEED_BUFFER_SIZE, or when the leader
+ *  calls changefeed_flush. A follower reads the log by big blocks too, and applies the records
+ *  to its own map (hashmap_put / hashmap_remove): warm read replicas on the same host, kept up
+ *  to date without periodic full snapshots.
+ *
+ *  ---------- Log format ---------
+ *  - header: CHANGEFEED_MAGIC (8 bytes with the '\0')
+ *  - records: [mutation: 1 byte][key length: varint][key][value length: varint][value]
+ *    (no value length nor value for a remove). The varints are LEB128: 7 bits per byte, low
+ *    bits first, the high bit set on every byte but the last.
+ *  The keys and values are written by format functions (like hashmap_dump: NULL for their
+ *  key_size / value_size raw bytes) and read back by parse functions (like hashmap_load: NULL
+ *  for raw bytes, whose length must be key_size / value_size).
+ *
+ *  ---------- Followers ---------
+ *  A follower added to the feed first receives every pair of the map (as adds), then the
+ *  mutations: it can start from an empty map. A follower that cannot be written to anymore
+ *  (closed pipe...) is dropped, the others go on. The writes block when a follower does not
+ *  read fast enough (back pressure on the leader).
+ *
+ *  NOT THREAD-SAFE: the feed is used by the thread that modifies the map (the mutations are
+ *  encoded by the mutation functions of hashmap_t), a reader by the thread that owns its map.
+ *
+ *  -------- Limitations --------
+ *  - the values modified in place (through hashmap_get...) are not replicated (see
+ *    hashmap_set_fn_mutation): use hashmap_put or hashmap_update on the leader.
+ *  - the feed replaces any other mutation function of the map.
+ *  - writing to a pipe whose follower is gone raises SIGPIPE: the leader must ignore it (sockets
+ *    are written with MSG_NOSIGNAL).
+*/
+
+#ifndef __CHANGEFEED_H__
+#define __CHANGEFEED_H__
+
+#include "hashmap.h"
+
+#include <sys/types.h>
+
+typedef struct _changefeed_t changefeed_t;
+typedef struct _changefeed_reader_t changefeed_reader_t;
+
+#define CHANGEFEED_MAGIC "HMFEED1" //first 8 bytes (with the '\0') of the log
+#define CHANGEFEED_BUFFER_SIZE (64UL << 10) //the log is written and read by blocks of this size
+#define CHANGEFEED_MAX_FOLLOWERS 16
+#define CHANGEFEED_MAX_ELEMENT (64UL << 20) //longest encoded key or value
+
+/// @brief Start recording the mutations of a map
+/// @param hm The map (its mutation function is replaced)
+/// @param format_key_fn The function that writes a key (NULL: its key_size raw bytes)
+/// @param format_value_fn The function that writes a value (NULL: its value_size raw bytes)
+/// @return A pointer to the feed or NULL if an error occured
+/// @note The mutations are only encoded while the feed has followers
+changefeed_t* changefeed_create(hashmap_t *hm, format_fn_t format_key_fn, format_fn_t format_value_fn);
+
+/// @brief Write the buffered mutations, remove the mutation function of the map, and free the feed
+/// @note The file descriptors of the followers are not closed
+void changefeed_destroy(changefeed_t *cf);
+
+/// @brief Add a follower: the log header and every pair of the map are written to it right away
+/// @param cf The feed
+/// @param fd Where the log is written (pipe, Unix socket...)
+/// @return true if the follower was added, false if it could not be written to (or too many followers)
+/// @note The buffered mutations are written to the other followers first
+bool changefeed_add_follower(changefeed_t *cf, int fd);
+
+/// @brief Get the number of followers (the dropped ones are not counted)
+size_t changefeed_follower_count(changefeed_t *cf);
+
+/// @brief Write the buffered mutations to the followers
+/// @return false if a follower was dropped (it could not be written to)
+/// @note Call it after each batch of mutations (an iteration of an event loop, a transaction...):
+///       the followers only see the mutations once they are written
+bool changefeed_flush(changefeed_t *cf);
+
+/// @brief Prepare the application of a log to a map
+/// @param hm The map of the follower
+/// @param fd Where the log is read (blocking or not)
+/// @param parse_key_fn The function that reads a key (NULL: key_size raw bytes)
+/// @param parse_value_fn The function that reads a value (NULL: value_size raw bytes)
+/// @return A pointer to the reader or NULL if an error occured
+/// @note A parse function reads length bytes (not null-terminated) into element, which has
+///       max(element_size, length + 1) bytes, and returns false if they are invalid
+changefeed_reader_t* changefeed_reader_create(hashmap_t *hm, int fd, parse_fn_t parse_key_fn, parse_fn_t parse_value_fn);
+
+/// @brief Free the reader (the file descriptor is not closed)
+void changefeed_reader_destroy(changefeed_reader_t *reader);
+
+/// @brief Read what the log has available (one read) and apply the complete records
+/// @return The number of records applied (0 if nothing was available), or -1 if an error occured
+///         (invalid log, truncated record, the map could not be modified...)
+/// @note Waits for data if fd is blocking, returns 0 right away otherwise (EAGAIN)
+ssize_t changefeed_reader_poll(changefeed_reader_t *reader);
+
+/// @brief Apply the log until its end (the leader closed it)
+/// @return true if the log ended cleanly, false if an error occured
+bool changefeed_reader_run(changefeed_reader_t *reader);
+
+/// @brief Tell if the end of the log was reached
+bool changefeed_reader_closed(changefeed_reader_t *reader);
+
+#endif
@@ -0,0 +1,564 @@
+#include "cuckoo.h"
+#include "probes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#define CACHE_LINE_SIZE 64
+#define CUCKOO_MINIMAL_BUCKETS 2
+
+typedef struct {
+    void *key;
+    void *value;
+    size_t hash;//keeping the hash avoids rehashing the key when it is displaced
+} entry_t;
+
+//a bucket fits in a single cache line: the tags are checked first,
+//the entry (and the key) is only dereferenced when the tag matches
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) unsigned char tags[CUCKOO_BUCKET_SIZE];//0 = empty slot
+    entry_t *entries[CUCKOO_BUCKET_SIZE];
+} bucket_t;
+
+struct _cuckoo_t {
+    size_t bucket_count;//always a power of two
+    size_t key_size;
+    size_t value_size;
+    size_t count;
+
+    //settings
+    float load_balance_threshold_min;
+    float load_balance_threshold_max;
+
+    //functions
+    hash_fn_t fn_hash;
+    compare_fn_t fn_compare;
+    destroy_fn_t fn_destroy_key;
+    destroy_fn_t fn_destroy_value;
+    alloc_copy_fn_t fn_alloc_copy_key;
+    alloc_copy_fn_t fn_alloc_copy_value;
+
+    bucket_t *buckets;
+    entry_t *stash[CUCKOO_STASH_SIZE];
+    size_t stash_count;
+};
+
+//one step of a displacement path (BFS node)
+typedef struct {
+    size_t bucket;
+    int parent;//index of the parent step in the queue, -1 for the two candidate buckets
+    int slot;  //slot in the parent bucket that holds the entry moving to this bucket
+} path_step_t;
+
+static inline size_t slot_count(const cuckoo_t *cm)
+{ return cm->bucket_count * CUCKOO_BUCKET_SIZE; }
+
+//resize
+static void auto_grow(cuckoo_t *cm);
+static void auto_shrink(cuckoo_t *cm);
+static bool resize(cuckoo_t *cm, size_t bucket_count);
+
+//placement
+static bool place_entry(cuckoo_t *cm, entry_t *entry);
+static bool find_path(cuckoo_t *cm, size_t b1, size_t b2, path_step_t *queue, int *leaf, int *free_slot);
+static bool move_along_path(cuckoo_t *cm, const path_step_t *queue, int leaf, int free_slot, size_t *bucket, int *slot);
+
+//entry management
+static entry_t* entry_create(const cuckoo_t *cm, const void *key, const void *value, size_t hash);
+static void entry_destroy(const cuckoo_t *cm, entry_t *entry);
+
+//default functions
+static void* default_fn_alloc_copy(const void *element, const size_t size);
+static const compare_fn_t default_fn_compare = memcmp;
+static const destroy_fn_t default_fn_destroy = free;
+
+//the second hash function is derived from the first one (murmur3 finalizer)
+static inline size_t mix_hash(size_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53UL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline unsigned char hash_tag(size_t hash)
+{
+    unsigned char tag = (unsigned char)(mix_hash(hash) >> 56);
+    return tag ? tag : 1;//0 is reserved for empty slots
+}
+
+static inline size_t primary_bucket(size_t hash, size_t bucket_count)
+{ return hash & (bucket_count - 1); }
+
+static inline size_t secondary_bucket(size_t hash, size_t bucket_count)
+{
+    size_t b1 = primary_bucket(hash, bucket_count);
+    size_t b2 = mix_hash(hash) & (bucket_count - 1);
+    return b2 != b1 ? b2 : b1 ^ 1;//the two candidates must always be different
+}
+
+static inline size_t alternate_bucket(size_t hash, size_t bucket, size_t bucket_count)
+{
+    size_t b1 = primary_bucket(hash, bucket_count);
+    return bucket == b1 ? secondary_bucket(hash, bucket_count) : b1;
+}
+
+static inline size_t round_up_pow2(size_t n)
+{
+    size_t p = CUCKOO_MINIMAL_BUCKETS;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+static bucket_t* buckets_alloc(size_t bucket_count)
+{
+    bucket_t *buckets = aligned_alloc(CACHE_LINE_SIZE, bucket_count * sizeof(*buckets));
+    if(!buckets) return (perror("aligned_alloc"), NULL);
+
+    memset(buckets, 0, bucket_count * sizeof(*buckets));
+    return buckets;
+}
+
+cuckoo_t* cuckoo_create(size_t initial_capacity, hash_fn_t hash_fn,
+                        const size_t key_size, const size_t value_size)
+{
+    assert(key_size > 0 && value_size > 0);
+
+    //setting default values
+    if(initial_capacity == 0) initial_capacity = HASHMAP_DEFAULT_CAPACITY;
+    if(hash_fn == NULL) hash_fn = HASH_FUNC_DEFAULT;
+
+    cuckoo_t *cm = malloc(sizeof(*cm));
+    if(!cm) return (perror("malloc"), NULL);
+
+    cm->bucket_count = round_up_pow2((initial_capacity + CUCKOO_BUCKET_SIZE - 1) / CUCKOO_BUCKET_SIZE);
+    cm->key_size = key_size;
+    cm->value_size = value_size;
+    cm->count = 0;
+    cm->stash_count = 0;
+
+    cm->load_balance_threshold_min = CUCKOO_DEFAULT_LOAD_BALANCE_THRESHOLD_MIN;
+    cm->load_balance_threshold_max = CUCKOO_DEFAULT_LOAD_BALANCE_THRESHOLD_MAX;
+
+    cm->fn_hash = hash_fn;
+    cm->fn_compare = default_fn_compare;
+    cm->fn_destroy_key = default_fn_destroy;
+    cm->fn_destroy_value = default_fn_destroy;
+    cm->fn_alloc_copy_key = default_fn_alloc_copy;
+    cm->fn_alloc_copy_value = default_fn_alloc_copy;
+
+    cm->buckets = buckets_alloc(cm->bucket_count);
+    if(!cm->buckets) return (free(cm), NULL);
+
+    return cm;
+}
+
+void cuckoo_destroy(cuckoo_t *cm)
+{
+    for(size_t b = 0; b < cm->bucket_count; b++)
+    {
+        for(int s = 0; s < CUCKOO_BUCKET_SIZE; s++)
+        {
+            if(cm->buckets[b].tags[s]) entry_destroy(cm, cm->buckets[b].entries[s]);
+        }
+    }
+
+    for(size_t i = 0; i < cm->stash_count; i++)
+        entry_destroy(cm, cm->stash[i]);
+
+    free(cm->buckets);
+    free(cm);
+}
+
+//search the key in a bucket, return the slot or -1
+static inline int bucket_find(const cuckoo_t *cm, const bucket_t *bucket, unsigned char tag,
+                              size_t hash, const void *key)
+{
+    for(int s = 0; s < CUCKOO_BUCKET_SIZE; s++)
+    {
+        if(bucket->tags[s] != tag) continue;
+
+        const entry_t *entry = bucket->entries[s];
+        if(entry->hash == hash && cm->fn_compare(key, entry->key, cm->key_size) == 0)
+            return s;
+    }
+
+    return -1;
+}
+
+static inline int stash_find(const cuckoo_t *cm, size_t hash, const void *key)
+{
+    for(size_t i = 0; i < cm->stash_count; i++)
+    {
+        if(cm->stash[i]->hash == hash && cm->fn_compare(key, cm->stash[i]->key, cm->key_size) == 0)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+void* cuckoo_get(cuckoo_t *cm, const void *key)
+{
+    size_t hash = cm->fn_hash(key, cm->key_size);
+    unsigned char tag = hash_tag(hash);
+
+    bucket_t *bucket = &cm->buckets[primary_bucket(hash, cm->bucket_count)];
+    int slot = bucket_find(cm, bucket, tag, hash, key);
+    if(slot >= 0) return bucket->entries[slot]->value;
+
+    bucket = &cm->buckets[secondary_bucket(hash, cm->bucket_count)];
+    slot = bucket_find(cm, bucket, tag, hash, key);
+    if(slot >= 0) return bucket->entries[slot]->value;
+
+    if(cm->stash_count == 0) return NULL;
+
+    slot = stash_find(cm, hash, key);
+    return slot >= 0 ? cm->stash[slot]->value : NULL;
+}
+
+void* cuckoo_add(cuckoo_t *cm, const void *key, const void *value)
+{
+    //on verifie si la clef existe deja
+    void *existing_value = cuckoo_get(cm, key);
+    if(existing_value != NULL) return existing_value;
+
+    //comme pour hashmap_add, on resize avant d'ajouter l'element
+    cm->count++;
+    auto_grow(cm);
+
+    entry_t *entry = entry_create(cm, key, value, cm->fn_hash(key, cm->key_size));
+    if(entry == NULL)
+    {
+        PROBE1(cuckoo, alloc__fail, cm);
+        return (cm->count--, NULL);
+    }
+
+    //si aucun chemin n'est trouve et que le stash est plein, on double la table
+    while(!place_entry(cm, entry))
+    {
+        if(!resize(cm, cm->bucket_count << 1))
+            return (entry_destroy(cm, entry), cm->count--, NULL);
+    }
+
+    return entry->value;
+}
+
+bool cuckoo_remove(cuckoo_t *cm, const void *key)
+{
+    size_t hash = cm->fn_hash(key, cm->key_size);
+    unsigned char tag = hash_tag(hash);
+    size_t candidates[2] = { primary_bucket(hash, cm->bucket_count), secondary_bucket(hash, cm->bucket_count) };
+
+    for(int c = 0; c < 2; c++)
+    {
+        bucket_t *bucket = &cm->buckets[candidates[c]];
+        int slot = bucket_find(cm, bucket, tag, hash, key);
+        if(slot < 0) continue;
+
+        entry_destroy(cm, bucket->entries[slot]);
+        bucket->tags[slot] = 0;
+        bucket->entries[slot] = NULL;
+        cm->count--;
+        auto_shrink(cm);
+        return true;
+    }
+
+    int index = stash_find(cm, hash, key);
+    if(index < 0) return false;
+
+    entry_destroy(cm, cm->stash[index]);
+    cm->stash[index] = cm->stash[--cm->stash_count];//l'ordre du stash n'a pas d'importance
+    cm->count--;
+    auto_shrink(cm);
+    return true;
+}
+
+void cuckoo_print(cuckoo_t *cm, print_fn_t print_key_fn, print_fn_t print_value_fn)
+{
+    printf("(cuckoo):\n");
+    printf("{\n");
+    printf("    key_size: %zu bytes\n", cm->key_size);
+    printf("    value_size: %zu bytes\n", cm->value_size);
+    printf("    buckets: %zu\n", cm->bucket_count);
+    printf("    capacity: %zu\n", slot_count(cm));
+    printf("    count: %zu\n", cm->count);
+    printf("    stash: %zu\n", cm->stash_count);
+    printf("    load_balance: %.2f\n", (float)cm->count / slot_count(cm));
+    printf("    table:\n");
+    printf("    [\n");
+
+    bool first = true;
+    for(size_t b = 0; b < cm->bucket_count; b++)
+    {
+        for(int s = 0; s < CUCKOO_BUCKET_SIZE; s++)
+        {
+            if(!cm->buckets[b].tags[s]) continue;
+
+            printf(first ? "\t" : ",\n\t");
+            printf("(%zu.%d) : ", b, s);
+            print_key_fn(cm->buckets[b].entries[s]->key);
+            printf("  =>  ");
+            print_value_fn(cm->buckets[b].entries[s]->value);
+            first = false;
+        }
+    }
+
+    for(size_t i = 0; i < cm->stash_count; i++)
+    {
+        printf(first ? "\t" : ",\n\t");
+        printf("(stash) : ");
+        print_key_fn(cm->stash[i]->key);
+        printf("  =>  ");
+        print_value_fn(cm->stash[i]->value);
+        first = false;
+    }
+
+    printf("\n    ]\n");
+    printf("}\n");
+}
+
+size_t cuckoo_count(cuckoo_t *cm)
+{ return cm->count; }
+
+size_t cuckoo_capacity(cuckoo_t *cm)
+{ return slot_count(cm); }
+
+void cuckoo_set_load_balance_threshold(cuckoo_t *cm, float min, float max)
+{
+    cm->load_balance_threshold_min = min;
+    cm->load_balance_threshold_max = max;
+}
+
+void cuckoo_set_fn_compare(cuckoo_t *cm, compare_fn_t compare_fn)
+{ cm->fn_compare = compare_fn; }
+
+void cuckoo_set_fn_alloc_copy_key(cuckoo_t *cm, alloc_copy_fn_t key_alloc_fn)
+{ cm->fn_alloc_copy_key = key_alloc_fn; }
+
+void cuckoo_set_fn_alloc_copy_value(cuckoo_t *cm, alloc_copy_fn_t value_alloc_fn)
+{ cm->fn_alloc_copy_value = value_alloc_fn; }
+
+void cuckoo_set_fn_destroy_key(cuckoo_t *cm, destroy_fn_t key_destroy_fn)
+{ cm->fn_destroy_key = key_destroy_fn; }
+
+void cuckoo_set_fn_destroy_value(cuckoo_t *cm, destroy_fn_t value_destroy_fn)
+{ cm->fn_destroy_value = value_destroy_fn; }
+
+
+static void auto_grow(cuckoo_t *cm)
+{
+    if(((float)cm->count / slot_count(cm)) > cm->load_balance_threshold_max)
+        resize(cm, cm->bucket_count << 1);
+}
+
+static void auto_shrink(cuckoo_t *cm)
+{
+    if(cm->bucket_count > CUCKOO_MINIMAL_BUCKETS &&
+       ((float)cm->count / slot_count(cm)) < cm->load_balance_threshold_min)
+        resize(cm, cm->bucket_count >> 1);
+}
+
+static bool resize(cuckoo_t *cm, size_t bucket_count)
+{
+    if(bucket_count < CUCKOO_MINIMAL_BUCKETS) bucket_count = CUCKOO_MINIMAL_BUCKETS;
+    PROBE4(cuckoo, resize__start, cm, cm->bucket_count, bucket_count, cm->count);
+
+    //on garde l'ancienne table pour pouvoir revenir en arriere si le placement echoue
+    bucket_t *old_buckets = cm->buckets;
+    size_t old_bucket_count = cm->bucket_count;
+    entry_t *old_stash[CUCKOO_STASH_SIZE];
+    size_t old_stash_count = cm->stash_count;
+    memcpy(old_stash, cm->stash, sizeof(old_stash));
+
+    for(;;)
+    {
+        bucket_t *new_buckets = buckets_alloc(bucket_count);
+        if(!new_buckets)
+        {
+            cm->buckets = old_buckets;
+            cm->bucket_count = old_bucket_count;
+            cm->stash_count = old_stash_count;
+            memcpy(cm->stash, old_stash, sizeof(old_stash));
+            PROBE3(cuckoo, resize__end, cm, cm->bucket_count, 0);
+            return false;
+        }
+
+        cm->buckets = new_buckets;
+        cm->bucket_count = bucket_count;
+        cm->stash_count = 0;
+
+        //les entrees gardent leur hash, on n'a donc pas besoin de rehasher les clefs
+        bool placed = true;
+        for(size_t b = 0; b < old_bucket_count && placed; b++)
+        {
+            for(int s = 0; s < CUCKOO_BUCKET_SIZE && placed; s++)
+            {
+                if(old_buckets[b].tags[s]) placed = place_entry(cm, old_buckets[b].entries[s]);
+            }
+        }
+
+        for(size_t i = 0; i < old_stash_count && placed; i++)
+            placed = place_entry(cm, old_stash[i]);
+
+        if(placed) break;
+
+        //tres improbable: on recommence avec une table plus grande
+        free(new_buckets);
+        bucket_count <<= 1;
+    }
+
+    free(old_buckets);
+    PROBE3(cuckoo, resize__end, cm, cm->bucket_count, 1);
+    return true;
+}
+
+static inline int bucket_free_slot(const bucket_t *bucket)
+{
+    for(int s = 0; s < CUCKOO_BUCKET_SIZE; s++)
+    {
+        if(!bucket->tags[s]) return s;
+    }
+
+    return -1;
+}
+
+static inline void bucket_set(bucket_t *bucket, int slot, entry_t *entry)
+{
+    bucket->tags[slot] = hash_tag(entry->hash);
+    bucket->entries[slot] = entry;
+}
+
+static bool place_entry(cuckoo_t *cm, entry_t *entry)
+{
+    size_t b1 = primary_bucket(entry->hash, cm->bucket_count);
+    size_t b2 = secondary_bucket(entry->hash, cm->bucket_count);
+
+    //cas le plus frequent: une place libre dans un des deux buckets
+    int slot = bucket_free_slot(&cm->buckets[b1]);
+    if(slot >= 0) return (bucket_set(&cm->buckets[b1], slot, entry), true);
+
+    slot = bucket_free_slot(&cm->buckets[b2]);
+    if(slot >= 0) return (bucket_set(&cm->buckets[b2], slot, entry), true);
+
+    //sinon on cherche le chemin de deplacement le plus court
+    path_step_t queue[CUCKOO_BFS_MAX_NODES];
+    int leaf, free_slot;
+    size_t root;
+
+    if(find_path(cm, b1, b2, queue, &leaf, &free_slot) &&
+       move_along_path(cm, queue, leaf, free_slot, &root, &slot))
+    {
+        bucket_set(&cm->buckets[root], slot, entry);
+        return true;
+    }
+
+    //en dernier recours, le stash
+    if(cm->stash_count < CUCKOO_STASH_SIZE)
+    {
+        cm->stash[cm->stash_count++] = entry;
+        return true;
+    }
+
+    return false;
+}
+
+//breadth-first search of the shortest path ending on a bucket with a free slot
+static bool find_path(cuckoo_t *cm, size_t b1, size_t b2, path_step_t *queue, int *leaf, int *free_slot)
+{
+    int head = 0, tail = 0;
+    queue[tail++] = (path_step_t){ .bucket = b1, .parent = -1, .slot = -1 };
+    queue[tail++] = (path_step_t){ .bucket = b2, .parent = -1, .slot = -1 };
+
+    while(head < tail)
+    {
+        int current = head++;
+        const bucket_t *bucket = &cm->buckets[queue[current].bucket];
+
+        for(int s = 0; s < CUCKOO_BUCKET_SIZE && tail < CUCKOO_BFS_MAX_NODES; s++)
+        {
+            size_t alt = alternate_bucket(bucket->entries[s]->hash, queue[current].bucket, cm->bucket_count);
+            queue[tail] = (path_step_t){ .bucket = alt, .parent = current, .slot = s };
+
+            int slot = bucket_free_slot(&cm->buckets[alt]);
+            if(slot >= 0)
+            {
+                *leaf = tail;
+                *free_slot = slot;
+                return true;
+            }
+
+            tail++;
+        }
+    }
+
+    return false;
+}
+
+//move the entries from the end of the path to the start, freeing a slot in one of the two root buckets
+static bool move_along_path(cuckoo_t *cm, const path_step_t *queue, int leaf, int free_slot, size_t *bucket, int *slot)
+{
+    int step = leaf;
+    int target_slot = free_slot;
+    int moves = 0;
+
+    while(queue[step].parent >= 0)
+    {
+        const path_step_t *from = &queue[queue[step].parent];
+        bucket_t *src = &cm->buckets[from->bucket];
+        bucket_t *dst = &cm->buckets[queue[step].bucket];
+        entry_t *entry = src->entries[queue[step].slot];
+
+        //un bucket peut apparaitre plusieurs fois dans le chemin, on verifie que le deplacement est toujours valide
+        if(dst->tags[target_slot] ||
+           alternate_bucket(entry->hash, from->bucket, cm->bucket_count) != queue[step].bucket)
+            return false;
+
+        bucket_set(dst, target_slot, entry);
+        src->tags[queue[step].slot] = 0;
+        src->entries[queue[step].slot] = NULL;
+
+        target_slot = queue[step].slot;
+        step = queue[step].parent;
+        moves++;
+    }
+
+    PROBE2(cuckoo, displace, cm, moves);
+    *bucket = queue[step].bucket;
+    *slot = target_slot;
+    return true;
+}
+
+static void* default_fn_alloc_copy(const void *element, const size_t size)
+{
+    void *copy = malloc(size);
+    if(!copy) return NULL;
+
+    memcpy(copy, element, size);
+    return copy;
+}
+
+static entry_t* entry_create(const cuckoo_t *cm, const void *key, const void *value, size_t hash)
+{
+    entry_t *entry = malloc(sizeof(*entry));
+    if(!entry) return (perror("malloc"), NULL);
+
+    entry->key = cm->fn_alloc_copy_key(key, cm->key_size);
+    if(!entry->key) return (perror("cuckoo_key_alloc_cpy"), free(entry), NULL);
+
+    entry->value = cm->fn_alloc_copy_value(value, cm->value_size);
+    if(!entry->value) return (perror("cuckoo_value_alloc_cpy"), cm->fn_destroy_key(entry->key), free(entry), NULL);
+
+    entry->hash = hash;
+    return entry;
+}
+
+static inline void entry_destroy(const cuckoo_t *cm, entry_t *entry)
+{
+    cm->fn_destroy_key(entry->key);
+    cm->fn_destroy_value(entry->value);
+    free(entry);
+}
@@ -0,0 +1,115 @@
+/*
+ *  Bucketized cuckoo hashing backend.
+ *
+ *  Same usage as hashmap_t (see hashmap.h), but with a different table layout:
+ *  every key lives in one of two candidate buckets (2 hash functions), and every
+ *  bucket holds up to 4 entries in a single cache line. A small stash catches the
+ *  rare keys that cannot be placed.
+ *
+ *  ---------- Guarantees ---------
+ *  - cuckoo_get looks at most at 2 buckets (2 cache lines) + the stash, whatever
+ *    the load or the key distribution. A key is only compared (dereferenced) when
+ *    its 8-bit tag matches.
+ *  - insertion searches the shortest displacement path (BFS), so the kick-out
+ *    chains stay short even at 95% load.
+ *
+ *  -------- Limitations --------
+ *  - the table grows by doubling (power-of-two number of buckets).
+ *  - insertion is more expensive than in hashmap_t when the table is nearly full.
+ *  - NOT thread-safe (like hashmap_t).
+*/
+
+#ifndef __CUCKOO_H__
+#define __CUCKOO_H__
+
+#include "hashmap.h"
+
+typedef struct _cuckoo_t cuckoo_t;
+
+//table settings
+#define CUCKOO_BUCKET_SIZE 4 //slots per bucket
+#define CUCKOO_STASH_SIZE 4  //keys that can be stored outside the buckets
+#define CUCKOO_BFS_MAX_NODES 256 //max buckets visited when searching a displacement path
+
+//default load balance thresholds (count / (buckets * CUCKOO_BUCKET_SIZE))
+#define CUCKOO_DEFAULT_LOAD_BALANCE_THRESHOLD_MAX 0.95f
+#define CUCKOO_DEFAULT_LOAD_BALANCE_THRESHOLD_MIN 0.20f
+
+/// @brief Create a new cuckoo hashmap
+/// @param initial_capacity The initial capacity (number of key-value pairs), 0 for the default capacity
+/// @param hash_fn The hash function to use (NULL for the default hash function)
+/// @param key_size The size of the key in bytes
+/// @param value_size The size of the value in bytes
+/// @return A pointer to the cuckoo hashmap or NULL if an error occured
+///
+/// @note The key_size and value_size must be greater than 0 (asserted)
+/// @note The second hash function is derived from hash_fn, so only one hash function is needed
+/// @note The same custom functions as hashmap_t can be provided (cuckoo_set_fn_...)
+/// @see hashmap_create
+cuckoo_t* cuckoo_create(size_t initial_capacity, hash_fn_t hash_fn,
+                        const size_t key_size, const size_t value_size);
+
+/// @brief Destroy the cuckoo hashmap and all the key-value pairs (using the destroy functions)
+/// @param cm The cuckoo hashmap to destroy
+void cuckoo_destroy(cuckoo_t *cm);
+
+/// @brief Get the value associated with the key
+/// @param cm The cuckoo hashmap
+/// @param key The key to search for
+/// @return A pointer to the value or NULL if the key was not found
+/// @complexity O(1) worst case (2 buckets + the stash)
+void* cuckoo_get(cuckoo_t *cm, const void *key);
+
+/// @brief Add a new key-value pair to the cuckoo hashmap
+/// @param cm The cuckoo hashmap
+/// @param key The key to add
+/// @param value The value to add
+/// @return A pointer to the added value, a pointer to the existing value or NULL if an error occured
+/// @note If the key already exists, it will NOT REPLACE the old value ! (but return the old value)
+/// @note If no displacement path is found and the stash is full, the table is doubled
+/// @complexity amortized O(1)
+void* cuckoo_add(cuckoo_t *cm, const void *key, const void *value);
+
+/// @brief Remove a key-value pair from the cuckoo hashmap
+/// @param cm The cuckoo hashmap
+/// @param key The key to remove
+/// @return true if the key was removed, false otherwise (not found)
+/// @note AFTER removing the key, the table will automatically shrink if the load balance is too low
+/// @complexity O(1) worst case
+bool cuckoo_remove(cuckoo_t *cm, const void *key);
+
+/// @brief Print the cuckoo hashmap : some informations about the table and all the key-value pairs
+/// @param cm The cuckoo hashmap
+/// @param print_key_fn The function to print the key
+/// @param print_value_fn The function to print the value
+void cuckoo_print(cuckoo_t *cm, print_fn_t print_key_fn, print_fn_t print_value_fn);
+
+/// @brief Get the number of key-value pairs
+/// @complexity O(1)
+size_t cuckoo_count(cuckoo_t *cm);
+
+/// @brief Get the capacity (number of slots = buckets * CUCKOO_BUCKET_SIZE)
+/// @complexity O(1)
+size_t cuckoo_capacity(cuckoo_t *cm);
+
+/// @brief Set the load balance thresholds
+/// @note by default, the load balance thresholds are set to 0.20 and 0.95
+/// @see hashmap_set_load_balance_threshold
+void cuckoo_set_load_balance_threshold(cuckoo_t *cm, float min, float max);
+
+/// @see hashmap_set_fn_alloc_copy_key
+void cuckoo_set_fn_alloc_copy_key(cuckoo_t *cm, alloc_copy_fn_t key_alloc_fn);
+
+/// @see hashmap_set_fn_alloc_copy_value
+void cuckoo_set_fn_alloc_copy_value(cuckoo_t *cm, alloc_copy_fn_t value_alloc_fn);
+
+/// @see hashmap_set_fn_destroy_key
+void cuckoo_set_fn_destroy_key(cuckoo_t *cm, destroy_fn_t key_destroy_fn);
+
+/// @see hashmap_set_fn_destroy_value
+void cuckoo_set_fn_destroy_value(cuckoo_t *cm, destroy_fn_t value_destroy_fn);
+
+/// @see hashmap_set_fn_compare
+void cuckoo_set_fn_compare(cuckoo_t *cm, compare_fn_t compare_fn);
+
+#endif
@@ -0,0 +1,634 @@
+#include "hamt.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#define HAMT_BRANCHING (1u << HAMT_BITS)
+#define HASH_BITS (sizeof(size_t) * 8)
+
+_Static_assert(HAMT_BRANCHING <= 32, "the node bitmaps are 32-bit");
+
+//a key-value pair, shared by every version (and every node) that contains it
+typedef struct {
+    atomic_size_t refs;
+    size_t hash;
+    void *key;
+    void *value;
+} entry_t;
+
+//a node stores its entries (in slot order), then its children (in slot order)
+typedef struct _node_t {
+    atomic_size_t refs;
+    uint32_t datamap;//bit i: slot i holds an entry
+    uint32_t nodemap;//bit i: slot i holds a child node
+    uint32_t collisions;//collision node (every bit of the hash consumed): number of entries, the maps are unused
+    void *slots[];
+} node_t;
+
+//sizes and functions, shared by every version derived from the same hamt_create
+typedef struct {
+    atomic_size_t refs;
+    size_t key_size;
+    size_t value_size;
+
+    hash_fn_t fn_hash;
+    compare_fn_t fn_compare;
+    destroy_fn_t fn_destroy_key;
+    destroy_fn_t fn_destroy_value;
+    alloc_copy_fn_t fn_alloc_copy_key;
+    alloc_copy_fn_t fn_alloc_copy_value;
+} config_t;
+
+struct _hamt_t {
+    atomic_size_t refs;
+    config_t *config;
+    node_t *root;//NULL = empty map
+    size_t count;
+};
+
+//a bitmap node unpacked by slot, to build a modified copy
+typedef struct {
+    uint32_t datamap;
+    uint32_t nodemap;
+    entry_t *entries[HAMT_BRANCHING];//valid if the bit is in datamap
+    node_t *children[HAMT_BRANCHING];//valid if the bit is in nodemap
+} layout_t;
+
+typedef enum { DISSOC_NOT_FOUND, DISSOC_REMOVED, DISSOC_ERROR } dissoc_result_t;
+
+static inline unsigned int slot_of(size_t hash, unsigned int shift)
+{ return (hash >> shift) & (HAMT_BRANCHING - 1); }
+
+//index of the slot in the packed array: number of bits set below it
+static inline unsigned int rank(uint32_t map, uint32_t bit)
+{ return __builtin_popcount(map & (bit - 1)); }
+
+static inline unsigned int entry_count(const node_t *node)
+{ return node->collisions ? node->collisions : (unsigned int)__builtin_popcount(node->datamap); }
+
+static inline unsigned int child_count(const node_t *node)
+{ return __builtin_popcount(node->nodemap); }
+
+static inline bool entry_matches(const config_t *config, const entry_t *entry, size_t hash, const void *key)
+{ return entry->hash == hash && config->fn_compare(key, entry->key, config->key_size) == 0; }
+
+//trie operations
+static node_t* node_assoc(const config_t *config, const node_t *node, unsigned int shift, entry_t *entry, bool *replaced);
+static node_t* node_dissoc(const config_t *config, node_t *node, unsigned int shift, size_t hash, const void *key, dissoc_result_t *result);
+static node_t* node_merge(const config_t *config, entry_t *a, entry_t *b, unsigned int shift);
+static node_t* collision_assoc(const config_t *config, const node_t *node, entry_t *entry, bool *replaced);
+static node_t* collision_dissoc(const config_t *config, node_t *node, size_t hash, const void *key, dissoc_result_t *result);
+
+//node management
+static node_t* node_alloc(unsigned int slot_count);
+static void node_unpack(const node_t *node, layout_t *layout);
+static node_t* node_pack(const layout_t *layout);
+static void node_retain(node_t *node);
+static void node_release(const config_t *config, node_t *node);
+static void node_visit(const node_t *node, void (*fn)(const entry_t *entry, void *ctx), void *ctx);
+
+//entry management
+static entry_t* entry_create(const config_t *config, const void *key, const void *value, size_t hash);
+static void entry_retain(entry_t *entry);
+static void entry_release(const config_t *config, entry_t *entry);
+
+//versions
+static hamt_t* version_create(config_t *config, node_t *root, size_t count);
+static void config_release(config_t *config);
+
+//default functions
+static void* default_fn_alloc_copy(const void *element, const size_t size);
+static const compare_fn_t default_fn_compare = memcmp;
+static const destroy_fn_t default_fn_destroy = free;
+
+hamt_t* hamt_create(hash_fn_t hash_fn, const size_t key_size, const size_t value_size)
+{
+    assert(key_size > 0 && value_size > 0);
+
+    if(hash_fn == NULL) hash_fn = HASH_FUNC_DEFAULT;
+
+    config_t *config = malloc(sizeof(*config));
+    if(!config) return (perror("malloc"), NULL);
+
+    atomic_init(&config->refs, 0);//reference prise par la version
+    config->key_size = key_size;
+    config->value_size = value_size;
+    config->fn_hash = hash_fn;
+    config->fn_compare = default_fn_compare;
+    config->fn_destroy_key = default_fn_destroy;
+    config->fn_destroy_value = default_fn_destroy;
+    config->fn_alloc_copy_key = default_fn_alloc_copy;
+    config->fn_alloc_copy_value = default_fn_alloc_copy;
+
+    hamt_t *hm = version_create(config, NULL, 0);
+    if(!hm) return (free(config), NULL);
+
+    return hm;
+}
+
+void hamt_destroy(hamt_t *hm)
+{
+    if(atomic_fetch_sub_explicit(&hm->refs, 1, memory_order_acq_rel) != 1) return;
+
+    if(hm->root != NULL) node_release(hm->config, hm->root);
+    config_release(hm->config);
+    free(hm);
+}
+
+hamt_t* hamt_retain(hamt_t *hm)
+{
+    atomic_fetch_add_explicit(&hm->refs, 1, memory_order_relaxed);
+    return hm;
+}
+
+const void* hamt_get(const hamt_t *hm, const void *key)
+{
+    const config_t *config = hm->config;
+    size_t hash = config->fn_hash(key, config->key_size);
+
+    const node_t *node = hm->root;
+    unsigned int shift = 0;
+    while(node != NULL)
+    {
+        if(node->collisions)
+        {
+            for(unsigned int i = 0; i < node->collisions; i++)
+            {
+                const entry_t *entry = node->slots[i];
+                if(entry_matches(config, entry, hash, key)) return entry->value;
+            }
+            return NULL;
+        }
+
+        uint32_t bit = 1u << slot_of(hash, shift);
+        if(node->datamap & bit)
+        {
+            const entry_t *entry = node->slots[rank(node->datamap, bit)];
+            return entry_matches(config, entry, hash, key) ? entry->value : NULL;
+        }
+        if(!(node->nodemap & bit)) return NULL;
+
+        node = node->slots[entry_count(node) + rank(node->nodemap, bit)];
+        shift += HAMT_BITS;
+    }
+
+    return NULL;
+}
+
+hamt_t* hamt_assoc(const hamt_t *hm, const void *key, const void *value)
+{
+    config_t *config = hm->config;
+    size_t hash = config->fn_hash(key, config->key_size);
+
+    entry_t *entry = entry_create(config, key, value, hash);
+    if(!entry) return NULL;
+
+    bool replaced = false;
+    node_t *root;
+    if(hm->root != NULL) root = node_assoc(config, hm->root, 0, entry, &replaced);
+    else
+    {
+        layout_t layout = { .datamap = 1u << slot_of(hash, 0), .nodemap = 0 };
+        layout.entries[slot_of(hash, 0)] = entry;
+        root = node_pack(&layout);
+    }
+
+    //les noeuds crees ont pris leur propre reference sur l'entree
+    entry_release(config, entry);
+    if(!root) return NULL;
+
+    hamt_t *version = version_create(config, root, hm->count + (replaced ? 0 : 1));
+    if(!version) return (node_release(config, root), NULL);
+
+    return version;
+}
+
+hamt_t* hamt_dissoc(const hamt_t *hm, const void *key)
+{
+    config_t *config = hm->config;
+    size_t hash = config->fn_hash(key, config->key_size);
+
+    dissoc_result_t result = DISSOC_NOT_FOUND;
+    node_t *root = NULL;
+    if(hm->root != NULL)
+    {
+        root = node_dissoc(config, hm->root, 0, hash, key, &result);
+        if(result == DISSOC_ERROR) return NULL;
+    }
+
+    hamt_t *version = version_create(config, root, hm->count - (result == DISSOC_REMOVED ? 1 : 0));
+    if(!version && root != NULL) node_release(config, root);
+
+    return version;
+}
+
+typedef struct {
+    bool first;
+    print_fn_t print_key_fn;
+    print_fn_t print_value_fn;
+} print_ctx_t;
+
+static void print_entry(const entry_t *entry, void *ctx)
+{
+    print_ctx_t *print = ctx;
+
+    printf(print->first ? "\t" : ",\n\t");
+    print->print_key_fn(entry->key);
+    printf("  =>  ");
+    print->print_value_fn(entry->value);
+
+    print->first = false;
+}
+
+void hamt_print(const hamt_t *hm, print_fn_t print_key_fn, print_fn_t print_value_fn)
+{
+    printf("(hamt):\n");
+    printf("{\n");
+    printf("    key_size: %zu bytes\n", hm->config->key_size);
+    printf("    value_size: %zu bytes\n", hm->config->value_size);
+    printf("    count: %zu\n", hm->count);
+    printf("    references: %zu\n", atomic_load(&hm->refs));
+    printf("    table:\n");
+    printf("    [\n");
+
+    print_ctx_t ctx = { .first = true, .print_key_fn = print_key_fn, .print_value_fn = print_value_fn };
+    if(hm->root != NULL) node_visit(hm->root, print_entry, &ctx);
+
+    printf("\n    ]\n");
+    printf("}\n");
+}
+
+size_t hamt_count(const hamt_t *hm)
+{ return hm->count; }
+
+void hamt_set_fn_compare(hamt_t *hm, compare_fn_t compare_fn)
+{ hm->config->fn_compare = compare_fn; }
+
+void hamt_set_fn_alloc_copy_key(hamt_t *hm, alloc_copy_fn_t key_alloc_fn)
+{ hm->config->fn_alloc_copy_key = key_alloc_fn; }
+
+void hamt_set_fn_alloc_copy_value(hamt_t *hm, alloc_copy_fn_t value_alloc_fn)
+{ hm->config->fn_alloc_copy_value = value_alloc_fn; }
+
+void hamt_set_fn_destroy_key(hamt_t *hm, destroy_fn_t key_destroy_fn)
+{ hm->config->fn_destroy_key = key_destroy_fn; }
+
+void hamt_set_fn_destroy_value(hamt_t *hm, destroy_fn_t value_destroy_fn)
+{ hm->config->fn_destroy_value = value_destroy_fn; }
+
+
+//--------------- TRIE OPERATIONS ---------------//
+
+//copy of node (new reference) where entry is associated with its key, NULL if an allocation failed
+//(path copying: only the nodes from node to the entry are copied, the other subtrees are shared)
+static node_t* node_assoc(const config_t *config, const node_t *node, unsigned int shift, entry_t *entry, bool *replaced)
+{
+    if(node->collisions) return collision_assoc(config, node, entry, replaced);
+
+    layout_t layout;
+    node_unpack(node, &layout);
+
+    unsigned int slot = slot_of(entry->hash, shift);
+    uint32_t bit = 1u << slot;
+    node_t *child = NULL;
+
+    if(layout.datamap & bit)
+    {
+        entry_t *existing = layout.entries[slot];
+        if(entry_matches(config, existing, entry->hash, entry->key))
+        {
+            layout.entries[slot] = entry;
+            *replaced = true;
+        }
+        else
+        {
+            //deux clefs sur le meme slot: on les descend dans un nouveau noeud
+            child = node_merge(config, existing, entry, shift + HAMT_BITS);
+            if(!child) return NULL;
+
+            layout.datamap &= ~bit;
+            layout.nodemap |= bit;
+            layout.children[slot] = child;
+        }
+    }
+    else if(layout.nodemap & bit)
+    {
+        child = node_assoc(config, layout.children[slot], shift + HAMT_BITS, entry, replaced);
+        if(!child) return NULL;
+
+        layout.children[slot] = child;
+    }
+    else
+    {
+        layout.datamap |= bit;
+        layout.entries[slot] = entry;
+    }
+
+    node_t *copy = node_pack(&layout);
+    if(child != NULL) node_release(config, child);//la copie a pris sa propre reference
+    return copy;
+}
+
+//copy of node (new reference) without the key, NULL if it becomes empty (or on error).
+//if the key is not found, node itself is returned (new reference)
+static node_t* node_dissoc(const config_t *config, node_t *node, unsigned int shift, size_t hash, const void *key, dissoc_result_t *result)
+{
+    if(node->collisions) return collision_dissoc(config, node, hash, key, result);
+
+    unsigned int slot = slot_of(hash, shift);
+    uint32_t bit = 1u << slot;
+
+    layout_t layout;
+    node_unpack(node, &layout);
+
+    node_t *child = NULL;
+    if((layout.datamap & bit) && entry_matches(config, layout.entries[slot], hash, key))
+    {
+        layout.datamap &= ~bit;
+    }
+    else if(layout.nodemap & bit)
+    {
+        child = node_dissoc(config, layout.children[slot], shift + HAMT_BITS, hash, key, result);
+        if(*result == DISSOC_ERROR) return NULL;
+        if(*result == DISSOC_NOT_FOUND)
+        {
+            node_release(config, child);
+            node_retain(node);
+            return node;
+        }
+
+        if(child == NULL) layout.nodemap &= ~bit;
+        else if(entry_count(child) == 1 && child_count(child) == 0)
+        {
+            //un enfant avec une seule clef est remonte dans ce noeud (forme canonique)
+            layout.nodemap &= ~bit;
+            layout.datamap |= bit;
+            layout.entries[slot] = child->slots[0];
+        }
+        else layout.children[slot] = child;
+    }
+    else
+    {
+        *result = DISSOC_NOT_FOUND;
+        node_retain(node);
+        return node;
+    }
+
+    *result = DISSOC_REMOVED;
+
+    node_t *copy = NULL;
+    if(layout.datamap != 0 || layout.nodemap != 0)
+    {
+        copy = node_pack(&layout);
+        if(!copy) *result = DISSOC_ERROR;
+    }
+
+    if(child != NULL) node_release(config, child);
+    return copy;
+}
+
+//new node (new reference) holding two entries whose slots are equal up to shift
+static node_t* node_merge(const config_t *config, entry_t *a, entry_t *b, unsigned int shift)
+{
+    if(shift >= HASH_BITS)
+    {
+        //tous les bits du hash sont utilises: noeud de collision
+        node_t *node = node_alloc(2);
+        if(!node) return NULL;
+
+        node->collisions = 2;
+        node->slots[0] = a;
+        node->slots[1] = b;
+        entry_retain(a);
+        entry_retain(b);
+        return node;
+    }
+
+    unsigned int slot_a = slot_of(a->hash, shift);
+    unsigned int slot_b = slot_of(b->hash, shift);
+    layout_t layout = { .datamap = 0, .nodemap = 0 };
+
+    if(slot_a != slot_b)
+    {
+        layout.datamap = (1u << slot_a) | (1u << slot_b);
+        layout.entries[slot_a] = a;
+        layout.entries[slot_b] = b;
+        return node_pack(&layout);
+    }
+
+    node_t *child = node_merge(config, a, b, shift + HAMT_BITS);
+    if(!child) return NULL;
+
+    layout.nodemap = 1u << slot_a;
+    layout.children[slot_a] = child;
+
+    node_t *node = node_pack(&layout);
+    node_release(config, child);//le noeud a pris sa propre reference
+    return node;
+}
+
+static node_t* collision_assoc(const config_t *config, const node_t *node, entry_t *entry, bool *replaced)
+{
+    unsigned int count = node->collisions;
+    unsigned int index = count;
+    for(unsigned int i = 0; i < count && index == count; i++)
+    {
+        if(entry_matches(config, node->slots[i], entry->hash, entry->key)) index = i;
+    }
+
+    *replaced = index < count;
+
+    node_t *copy = node_alloc(*replaced ? count : count + 1);
+    if(!copy) return NULL;
+
+    copy->collisions = *replaced ? count : count + 1;
+    for(unsigned int i = 0; i < copy->collisions; i++)
+    {
+        copy->slots[i] = (i == index) ? entry : node->slots[i];
+        entry_retain(copy->slots[i]);
+    }
+
+    return copy;
+}
+
+static node_t* collision_dissoc(const config_t *config, node_t *node, size_t hash, const void *key, dissoc_result_t *result)
+{
+    unsigned int count = node->collisions;
+    unsigned int index = count;
+    for(unsigned int i = 0; i < count && index == count; i++)
+    {
+        if(entry_matches(config, node->slots[i], hash, key)) index = i;
+    }
+
+    if(index == count)
+    {
+        *result = DISSOC_NOT_FOUND;
+        node_retain(node);
+        return node;
+    }
+
+    *result = DISSOC_REMOVED;
+    if(count == 1) return NULL;
+
+    //un noeud de collision avec une seule clef est remonte par le parent
+    node_t *copy = node_alloc(count - 1);
+    if(!copy) return (*result = DISSOC_ERROR, NULL);
+
+    copy->collisions = count - 1;
+    for(unsigned int i = 0, j = 0; i < count; i++)
+    {
+        if(i == index) continue;
+
+        copy->slots[j++] = node->slots[i];
+        entry_retain(node->slots[i]);
+    }
+
+    return copy;
+}
+
+
+//--------------- NODE MANAGEMENT ---------------//
+
+static node_t* node_alloc(unsigned int slot_count)
+{
+    node_t *node = malloc(sizeof(*node) + slot_count * sizeof(node->slots[0]));
+    if(!node) return (perror("malloc"), NULL);
+
+    atomic_init(&node->refs, 1);
+    node->datamap = 0;
+    node->nodemap = 0;
+    node->collisions = 0;
+    return node;
+}
+
+static void node_unpack(const node_t *node, layout_t *layout)
+{
+    layout->datamap = node->datamap;
+    layout->nodemap = node->nodemap;
+
+    unsigned int k = 0;
+    for(uint32_t map = node->datamap; map; map &= map - 1)
+        layout->entries[__builtin_ctz(map)] = node->slots[k++];
+    for(uint32_t map = node->nodemap; map; map &= map - 1)
+        layout->children[__builtin_ctz(map)] = node->slots[k++];
+}
+
+//allocate the node described by layout (new reference), taking a reference on every entry and child
+static node_t* node_pack(const layout_t *layout)
+{
+    node_t *node = node_alloc(__builtin_popcount(layout->datamap) + __builtin_popcount(layout->nodemap));
+    if(!node) return NULL;
+
+    node->datamap = layout->datamap;
+    node->nodemap = layout->nodemap;
+
+    unsigned int k = 0;
+    for(uint32_t map = layout->datamap; map; map &= map - 1)
+    {
+        entry_t *entry = layout->entries[__builtin_ctz(map)];
+        entry_retain(entry);
+        node->slots[k++] = entry;
+    }
+    for(uint32_t map = layout->nodemap; map; map &= map - 1)
+    {
+        node_t *child = layout->children[__builtin_ctz(map)];
+        node_retain(child);
+        node->slots[k++] = child;
+    }
+
+    return node;
+}
+
+static void node_retain(node_t *node)
+{ atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed); }
+
+static void node_release(const config_t *config, node_t *node)
+{
+    if(atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) != 1) return;
+
+    unsigned int entries = entry_count(node);
+    for(unsigned int i = 0; i < entries; i++)
+        entry_release(config, node->slots[i]);
+
+    unsigned int children = child_count(node);
+    for(unsigned int i = 0; i < children; i++)
+        node_release(config, node->slots[entries + i]);
+
+    free(node);
+}
+
+static void node_visit(const node_t *node, void (*fn)(const entry_t *entry, void *ctx), void *ctx)
+{
+    unsigned int entries = entry_count(node);
+    for(unsigned int i = 0; i < entries; i++)
+        fn(node->slots[i], ctx);
+
+    unsigned int children = child_count(node);
+    for(unsigned int i = 0; i < children; i++)
+        node_visit(node->slots[entries + i], fn, ctx);
+}
+
+
+//--------------- ENTRY MANAGEMENT ---------------//
+
+static entry_t* entry_create(const config_t *config, const void *key, const void *value, size_t hash)
+{
+    entry_t *entry = malloc(sizeof(*entry));
+    if(!entry) return (perror("malloc"), NULL);
+
+    entry->key = config->fn_alloc_copy_key(key, config->key_size);
+    if(!entry->key) return (perror("hamt_key_alloc_cpy"), free(entry), NULL);
+
+    entry->value = config->fn_alloc_copy_value(value, config->value_size);
+    if(!entry->value) return (perror("hamt_value_alloc_cpy"), config->fn_destroy_key(entry->key), free(entry), NULL);
+
+    atomic_init(&entry->refs, 1);
+    entry->hash = hash;
+    return entry;
+}
+
+static void entry_retain(entry_t *entry)
+{ atomic_fetch_add_explicit(&entry->refs, 1, memory_order_relaxed); }
+
+static void entry_release(const config_t *config, entry_t *entry)
+{
+    if(atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_acq_rel) != 1) return;
+
+    config->fn_destroy_key(entry->key);
+    config->fn_destroy_value(entry->value);
+    free(entry);
+}
+
+
+//--------------- VERSIONS ---------------//
+
+//the version takes the reference of the caller on root, and a new reference on config
+static hamt_t* version_create(config_t *config, node_t *root, size_t count)
+{
+    hamt_t *hm = malloc(sizeof(*hm));
+    if(!hm) return (perror("malloc"), NULL);
+
+    atomic_init(&hm->refs, 1);
+    atomic_fetch_add_explicit(&config->refs, 1, memory_order_relaxed);
+    hm->config = config;
+    hm->root = root;
+    hm->count = count;
+    return hm;
+}
+
+static void config_release(config_t *config)
+{
+    if(atomic_fetch_sub_explicit(&config->refs, 1, memory_order_acq_rel) == 1) free(config);
+}
+
+static void* default_fn_alloc_copy(const void *element, const size_t size)
+{
+    void *copy = malloc(size);
+    if(!copy) return NULL;
+
+    memcpy(copy, element, size);
+    return copy;
+}
@@ -0,0 +1,104 @@
+/*
+ *  Persistent (immutable) hash array mapped trie.
+ *
+ *  A hamt_t is a VERSION of a map: it is never modified. hamt_assoc and hamt_dissoc
+ *  return a new version, which shares every unchanged subtree with the old one (only the
+ *  path from the root to the modified key is copied: O(log32 n) nodes).
+ *
+ *  Every node of the trie consumes 5 bits of the hash: a 32-bit bitmap tells which of the
+ *  32 slots are used, and the used slots are stored contiguously (index = popcount of the
+ *  bits below), so a node only takes the memory of its children. Keys whose full hashes
+ *  are equal end up in a collision node (compared with the compare function).
+ *
+ *  Nodes, key-value pairs and versions are reference counted (atomically): a version can be
+ *  read, derived and released from any thread, without lock. Holding a version (hamt_retain)
+ *  gives a consistent snapshot for free, whatever the writers do.
+ *
+ *  Same custom functions as hashmap_t (see hashmap.h), shared by every version derived from
+ *  the same hamt_create.
+ *
+ *  -------- Limitations --------
+ *  - the values are shared between versions: the pointer returned by hamt_get must not be
+ *    used to modify the value.
+ *  - an update allocates O(log32 n) nodes (path copying): a mutable hashmap_t is faster
+ *    for write-heavy workloads.
+ *  - publishing a version to other threads (pointer swap) must make sure the readers
+ *    retain it before the old one is released (lock, epoch... see txmap.c).
+*/
+
+#ifndef __HAMT_H__
+#define __HAMT_H__
+
+#include "hashmap.h"
+
+typedef struct _hamt_t hamt_t;
+
+#define HAMT_BITS 5 //bits of the hash consumed by each level (32 slots per node)
+
+/// @brief Create a new empty map
+/// @param hash_fn The hash function to use (NULL for the default hash function)
+/// @param key_size The size of the key in bytes
+/// @param value_size The size of the value in bytes
+/// @return A pointer to the empty version or NULL if an error occured
+/// @note The key_size and value_size must be greater than 0 (asserted)
+/// @note The custom functions (hamt_set_fn_...) must be set on this version, before deriving others
+/// @see hashmap_create
+hamt_t* hamt_create(hash_fn_t hash_fn, const size_t key_size, const size_t value_size);
+
+/// @brief Release a version (the nodes it shares with other versions stay alive)
+/// @param hm The version to release
+/// @note The key-value pairs are destroyed (using the destroy functions) when the last version using them is released
+void hamt_destroy(hamt_t *hm);
+
+/// @brief Take a new reference on a version (released with hamt_destroy)
+/// @return hm
+hamt_t* hamt_retain(hamt_t *hm);
+
+/// @brief Get the value associated with the key
+/// @param hm The version
+/// @param key The key to search for
+/// @return A pointer to the value (read-only) or NULL if the key was not found
+/// @complexity O(log32 n)
+const void* hamt_get(const hamt_t *hm, const void *key);
+
+/// @brief Get a new version where the key is associated with the value
+/// @param hm The version to derive (not modified)
+/// @param key The key
+/// @param value The value (replaces the old value in the new version if the key exists)
+/// @return The new version or NULL if an error occured
+/// @complexity O(log32 n) (path copying)
+hamt_t* hamt_assoc(const hamt_t *hm, const void *key, const void *value);
+
+/// @brief Get a new version without the key
+/// @param hm The version to derive (not modified)
+/// @param key The key to remove
+/// @return The new version (same content if the key was not found) or NULL if an error occured
+/// @complexity O(log32 n) (path copying)
+hamt_t* hamt_dissoc(const hamt_t *hm, const void *key);
+
+/// @brief Print the version : some informations and all the key-value pairs
+/// @param hm The version
+/// @param print_key_fn The function to print the key
+/// @param print_value_fn The function to print the value
+void hamt_print(const hamt_t *hm, print_fn_t print_key_fn, print_fn_t print_value_fn);
+
+/// @brief Get the number of key-value pairs of the version
+/// @complexity O(1)
+size_t hamt_count(const hamt_t *hm);
+
+/// @see hashmap_set_fn_alloc_copy_key
+void hamt_set_fn_alloc_copy_key(hamt_t *hm, alloc_copy_fn_t key_alloc_fn);
+
+/// @see hashmap_set_fn_alloc_copy_value
+void hamt_set_fn_alloc_copy_value(hamt_t *hm, alloc_copy_fn_t value_alloc_fn);
+
+/// @see hashmap_set_fn_destroy_key
+void hamt_set_fn_destroy_key(hamt_t *hm, destroy_fn_t key_destroy_fn);
+
+/// @see hashmap_set_fn_destroy_value
+void hamt_set_fn_destroy_value(hamt_t *hm, destroy_fn_t value_destroy_fn);
+
+/// @see hashmap_set_fn_compare
+void hamt_set_fn_compare(hamt_t *hm, compare_fn_t compare_fn);
+
+#endif
@@ -1,16 +1,61 @@
 #include "hashmap.h"
+#include "aio.h"
+#include "probes.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define HUGEPAGE_SIZE (2UL << 20)
+#define LOAD_OWNER_SHIFT 4 //hashmap_load: groups of 16 consecutive buckets (4 cache lines) are filled by the same thread
+#define MPOL_PREFERRED_MODE 1 //MPOL_PREFERRED (linux/mempolicy.h), without depending on libnuma
+#define LATENCY_BUCKETS ((HASHMAP_LATENCY_MAX_BITS - HASHMAP_LATENCY_SUB_BUCKET_BITS + 1) << HASHMAP_LATENCY_SUB_BUCKET_BITS)
 
 typedef struct _node_t {
     void* key;
     void* value;
-    struct _node_t* next;
+    size_t hash;//keeping the hash avoids rehashing the key when resizing or ordering a tree
+    union {
+        struct _node_t* next;//chain bucket
+        struct _node_t* left;//tree bucket
+    };
+    struct _node_t* right;//tree bucket only
+    int height;//tree bucket only (AVL)
 } node_t;
 
+//a bucket is a linked list, or a balanced tree ordered by (hash, fn_compare)
+//once the chain is longer than HASHMAP_TREEIFY_THRESHOLD
+typedef struct {
+    node_t* head;//first node of the chain or root of the tree
+    unsigned int length;
+    bool is_tree;
+} bucket_t;
+
+typedef void (*node_visit_fn_t)(const node_t *node, void *ctx);
+
+//latency histograms of a thread (log-linear like histogram.h, but only HASHMAP_LATENCY_SUB_BUCKET_BITS = 5 sub-bucket
+//bits instead of 7: about 3% of error instead of less than 1%, for a smaller footprint per thread)
+typedef struct {
+    _Atomic uint64_t buckets[HASHMAP_LATENCY_OPERATIONS][LATENCY_BUCKETS];
+} latency_slot_t;
+
+//sampled latencies of a map (see hashmap_set_latency_sampling)
+typedef struct {
+    bool enabled;
+    uint64_t mask;//a call is timed when (random & mask) == 0
+    _Atomic(latency_slot_t*) slots[HASHMAP_LATENCY_SLOTS];//allocated by the first thread using them
+} latency_t;
+
 struct _hashmap_t {
     size_t capacity;
     size_t key_size;
@@ -20,6 +65,8 @@ struct _hashmap_t {
     //settings
     float load_balance_threshold_min;
     float load_balance_threshold_max;
+    hashmap_alloc_mode_t alloc_mode;
+    int numa_node;//-1 = no binding
 
     //functions
     hash_fn_t fn_hash;
@@ -28,24 +75,190 @@ struct _hashmap_t {
     destroy_fn_t fn_destroy_value;
     alloc_copy_fn_t fn_alloc_copy_key;
     alloc_copy_fn_t fn_alloc_copy_value;
+    mutation_fn_t fn_mutation;//NULL = no hook
+    void *mutation_ctx;
+
+    latency_t *latency;//NULL = never sampled
+
+    bucket_t* table;
+    size_t table_mapped_size;//size of the mapping if the table comes from mmap, 0 if it comes from calloc
+
+    //deferred frees of the removed nodes (see hashmap_set_free_batch)
+    size_t free_batch;//0 = freed immediately
+    node_t* removed;//chained with next
+    size_t removed_count;
+};
 
-    node_t** table;
+//buffered output of the dump functions (to a stream or to a file descriptor)
+typedef struct {
+    FILE *stream;//NULL: written to fd
+    int fd;
+    aio_file_t *aio;//asynchronous writes to fd (NULL: stream, or fd that cannot seek)
+    off_t offset;//in fd, of the buffer being filled
+    char *buffer;//HASHMAP_DUMP_BUFFER_SIZE bytes
+    size_t used;
+    bool failed;//a write failed: the rest of the dump is dropped
+} dump_writer_t;
+
+//part of the file parsed by a thread of hashmap_load
+typedef struct {
+    hashmap_t *hm;
+    int fd;//the chunk is [file_begin, file_end) of the file
+    off_t file_begin;
+    off_t file_end;
+    const char *begin;//whole lines / records being parsed (in a read buffer)
+    const char *end;
+    hashmap_dump_format_t format;
+    parse_fn_t parse_key_fn;
+    parse_fn_t parse_value_fn;
+
+    //parsed nodes (chained with next, in the order of the file), by owner (see load_append)
+    size_t owners;
+    node_t **heads;
+    node_t **tails;
+    size_t parsed;
+    bool ok;
+} load_chunk_t;
+
+//owners inserted by a thread of hashmap_load
+typedef struct {
+    hashmap_t *hm;
+    load_chunk_t *chunks;
+    size_t chunk_count;
+    size_t owner_begin;
+    size_t owner_end;
+    size_t added;
+} load_insert_t;
+
+//work handed to the background reclaimer thread
+typedef struct _reclaim_job_t {
+    hashmap_t *map;//map to destroy (NULL for a batch of nodes)
+    node_t *nodes;//removed nodes to destroy, chained with next
+    destroy_fn_t fn_destroy_key;
+    destroy_fn_t fn_destroy_value;
+    struct _reclaim_job_t *next;
+} reclaim_job_t;
+
+//latency sampling: slot and random generator of the calling thread
+static atomic_int latency_next_slot;
+static _Thread_local int latency_slot = -1;
+static _Thread_local uint64_t latency_state;
+
+//the reclaimer thread is shared by every map, and started on first use
+static struct {
+    pthread_once_t once;
+    bool started;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;//a job was queued
+    pthread_cond_t idle;//every job was done
+    reclaim_job_t *head;
+    reclaim_job_t *tail;
+    size_t pending;//jobs queued or running
+} reclaimer = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
 };
 
 static inline size_t get_auto_growth_new_capacity(const hashmap_t *hm)
-{ return hm->capacity + (hm->capacity >> 1); } //+50%
+{ return hm->capacity << 1; } //x2 (the capacity stays a power of two)
 
 static inline size_t get_auto_shrink_new_capacity(const hashmap_t *hm)
 { return hm->capacity >> 1; } //-50%
 
+//the capacity is a power of two: the index is the low bits of the hash
+static inline size_t bucket_index(size_t hash, size_t capacity)
+{ return hash & (capacity - 1); }
+
+static inline size_t round_up_pow2(size_t n)
+{
+    size_t p = HASHMAP_MINIMAL_CAPACITY;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+//reverse the bits of a cursor (hashmap_scan increments the cursor from its high bits)
+static inline size_t reverse_bits(size_t v)
+{
+    size_t r = 0;
+    for(unsigned int i = 0; i < sizeof(v) * 8; i++, v >>= 1)
+        r = (r << 1) | (v & 1);
+    return r;
+}
+
 //resize
 static void auto_grow(hashmap_t *hm);
 static void auto_shrink(hashmap_t *hm);
 static void resize(hashmap_t *hm, size_t capacity);
 
+//table allocation
+static bucket_t* table_alloc(const hashmap_t *hm, size_t capacity, size_t *mapped_size);
+static void table_free(bucket_t *table, size_t mapped_size);
+
+//bucket management
+static node_t* bucket_find(const hashmap_t *hm, const bucket_t *bucket, size_t hash, const void *key);
+static void bucket_insert(const hashmap_t *hm, bucket_t *bucket, node_t *node);
+static node_t* bucket_unlink(const hashmap_t *hm, bucket_t *bucket, size_t hash, const void *key);
+static node_t* bucket_detach(bucket_t *bucket);
+static void bucket_visit(const bucket_t *bucket, node_visit_fn_t fn, void *ctx);
+
+//tree buckets (AVL)
+static node_t* tree_insert(const hashmap_t *hm, node_t *root, node_t *node);
+static node_t* tree_remove(const hashmap_t *hm, node_t *root, size_t hash, const void *key, node_t **removed);
+static node_t* tree_to_list(node_t *root, node_t *list);
+static void tree_visit(const node_t *root, node_visit_fn_t fn, void *ctx);
+static void treeify(const hashmap_t *hm, bucket_t *bucket);
+static void untreeify(bucket_t *bucket);
+
 //node management
-static node_t* node_create(const hashmap_t *hm, const void *key, const void *value);
+static node_t* node_create(const hashmap_t *hm, const void *key, const void *value, size_t hash);
 static void node_destroy(const hashmap_t *hm, node_t *node);
+static void node_list_destroy(node_t *list, destroy_fn_t fn_destroy_key, destroy_fn_t fn_destroy_value);
+static node_t* node_insert_new(hashmap_t *hm, const void *key, const void *value, size_t hash);
+static void mutation_notify(const hashmap_t *hm, hashmap_mutation_t mutation, const node_t *node);
+
+//latency sampling
+static inline uint64_t latency_begin(const hashmap_t *hm);
+static inline uint64_t latency_begin_every(const hashmap_t *hm);
+static inline void latency_end(const hashmap_t *hm, hashmap_latency_op_t op, uint64_t begin);
+static void latency_record(latency_t *latency, hashmap_latency_op_t op, uint64_t duration);
+static uint64_t latency_now(void);
+static uint64_t latency_random(void);
+static size_t latency_bucket_of(uint64_t value);
+static uint64_t latency_bucket_highest(size_t index);
+static void latency_destroy(latency_t *latency);
+
+//background reclaimer
+static void reclaimer_start(void);
+static void* reclaimer_main(void *arg);
+static void reclaimer_submit(reclaim_job_t *job);
+static void reclaim_job_run(reclaim_job_t *job);
+static void removed_flush(hashmap_t *hm);
+
+//dump
+static bool dump_range(hashmap_t *hm, hashmap_range_t range, dump_writer_t *writer, hashmap_dump_format_t format,
+                       format_fn_t format_key_fn, format_fn_t format_value_fn);
+static void dump_pair(const void *key, void *value, void *ctx);
+static void* dump_file_worker(void *arg);
+static void writer_write(dump_writer_t *writer, const void *data, size_t size);
+static void writer_format(dump_writer_t *writer, format_fn_t fn, const void *element, size_t element_size, bool length_prefix);
+static void writer_flush(dump_writer_t *writer);
+static size_t format_hex(const void *element, const size_t element_size, char *buffer, const size_t size);
+static size_t format_json_hex(const void *element, const size_t element_size, char *buffer, const size_t size);
+static size_t format_raw(const void *element, const size_t element_size, char *buffer, const size_t size);
+
+//bulk load
+static void* load_parse_worker(void *arg);
+static void* load_insert_worker(void *arg);
+static bool load_stream(load_chunk_t *chunk);
+static bool load_parse_range(load_chunk_t *chunk, const char *begin, const char *end);
+static off_t load_next_line(int fd, off_t offset, off_t end);
+static bool load_parse_tsv(load_chunk_t *chunk);
+static bool load_parse_binary(load_chunk_t *chunk);
+static bool load_buffer_reserve(char **buffer, size_t *capacity, size_t size);
+static bool load_append(load_chunk_t *chunk, const void *key, const void *value);
+static bool parse_hex(const char *text, const size_t length, void *element, const size_t element_size);
 
 //default functions
 static void* default_fn_alloc_copy(const void *element, const size_t size);
@@ -59,7 +272,7 @@ hashmap_t* hashmap_create(size_t initial_capacity, hash_fn_t hash_fn,
 
     //setting default values
     if(initial_capacity == 0) initial_capacity = HASHMAP_DEFAULT_CAPACITY;
-    if(initial_capacity < HASHMAP_MINIMAL_CAPACITY) initial_capacity = HASHMAP_MINIMAL_CAPACITY;
+    initial_capacity = round_up_pow2(initial_capacity);
     if(hash_fn == NULL) hash_fn = HASH_FUNC_DEFAULT;
 
     //allocation pour la hashmap
@@ -74,6 +287,8 @@ hashmap_t* hashmap_create(size_t initial_capacity, hash_fn_t hash_fn,
 
     hashmap->load_balance_threshold_min = HASHMAP_DEFAULT_LOAD_BALANCE_THRESHOLD_MIN;
     hashmap->load_balance_threshold_max = HASHMAP_DEFAULT_LOAD_BALANCE_THRESHOLD_MAX;
+    hashmap->alloc_mode = HASHMAP_ALLOC_DEFAULT;
+    hashmap->numa_node = -1;
 
     //initialisation des fonctions
     hashmap->fn_hash = hash_fn;
@@ -82,10 +297,17 @@ hashmap_t* hashmap_create(size_t initial_capacity, hash_fn_t hash_fn,
     hashmap->fn_destroy_value = default_fn_destroy;
     hashmap->fn_alloc_copy_key = default_fn_alloc_copy;
     hashmap->fn_alloc_copy_value = default_fn_alloc_copy;
+    hashmap->fn_mutation = NULL;
+    hashmap->mutation_ctx = NULL;
+    hashmap->latency = NULL;
+
+    hashmap->free_batch = 0;
+    hashmap->removed = NULL;
+    hashmap->removed_count = 0;
 
     //allocation pour le tableau qui va contenir les donnees
-    hashmap->table = calloc(hashmap->capacity, sizeof(*hashmap->table));
-    if(!hashmap->table) return (perror("calloc"), free(hashmap), NULL);
+    hashmap->table = table_alloc(hashmap, hashmap->capacity, &hashmap->table_mapped_size);
+    if(!hashmap->table) return (free(hashmap), NULL);
 
     return hashmap;
 }
@@ -95,7 +317,7 @@ void hashmap_destroy(hashmap_t *hm)
     //on iterere sur chaque noeud et les detruire
     for(size_t i = 0; i < hm->capacity; i++)
     {
-        node_t *current = hm->table[i];
+        node_t *current = bucket_detach(&hm->table[i]);
         while(current != NULL)
         {
             node_t *tmp = current;
@@ -104,81 +326,336 @@ void hashmap_destroy(hashmap_t *hm)
         }
     }
 
-    free(hm->table);
+    node_list_destroy(hm->removed, hm->fn_destroy_key, hm->fn_destroy_value);
+    table_free(hm->table, hm->table_mapped_size);
+    latency_destroy(hm->latency);
     free(hm);
 }
 
+void hashmap_destroy_async(hashmap_t *hm)
+{
+    reclaim_job_t *job = malloc(sizeof(*job));
+    if(!job)
+    {
+        perror("malloc");
+        hashmap_destroy(hm);
+        return;
+    }
+
+    *job = (reclaim_job_t){ .map = hm };
+    reclaimer_submit(job);
+}
+
+void hashmap_reclaimer_wait(void)
+{
+    pthread_mutex_lock(&reclaimer.lock);
+    while(reclaimer.pending > 0) pthread_cond_wait(&reclaimer.idle, &reclaimer.lock);
+    pthread_mutex_unlock(&reclaimer.lock);
+}
+
 
 void* hashmap_get(hashmap_t *hm, const void* key)
 {
-    size_t index = hm->fn_hash(key, hm->key_size) % hm->capacity;
-    node_t *current = hm->table[index];
+    uint64_t begin = latency_begin(hm);
+    size_t hash = hm->fn_hash(key, hm->key_size);
+    node_t *node = bucket_find(hm, &hm->table[bucket_index(hash, hm->capacity)], hash, key);
 
-    while(current != NULL)
+    latency_end(hm, HASHMAP_LATENCY_GET, begin);
+    return node != NULL ? node->value : NULL;
+}
+
+size_t hashmap_get_batch(hashmap_t *hm, const void *const *keys, void **values, size_t count)
+{
+    size_t hashes[HASHMAP_BATCH_SIZE];
+    size_t found = 0;
+
+    for(size_t begin = 0; begin < count; begin += HASHMAP_BATCH_SIZE)
     {
-        if(hm->fn_compare(key, current->key, hm->key_size) == 0)
-            return current->value;
+        size_t n = count - begin < HASHMAP_BATCH_SIZE ? count - begin : HASHMAP_BATCH_SIZE;
 
-        current = current->next;
+        //les buckets du groupe sont charges en parallele...
+        for(size_t i = 0; i < n; i++)
+        {
+            hashes[i] = hm->fn_hash(keys[begin + i], hm->key_size);
+            __builtin_prefetch(&hm->table[bucket_index(hashes[i], hm->capacity)]);
+        }
+
+        //...puis leurs premiers noeuds
+        for(size_t i = 0; i < n; i++)
+        {
+            const node_t *head = hm->table[bucket_index(hashes[i], hm->capacity)].head;
+            if(head != NULL) __builtin_prefetch(head);
+        }
+
+        for(size_t i = 0; i < n; i++)
+        {
+            node_t *node = bucket_find(hm, &hm->table[bucket_index(hashes[i], hm->capacity)], hashes[i], keys[begin + i]);
+            values[begin + i] = node != NULL ? node->value : NULL;
+            found += node != NULL;
+        }
     }
 
-    return NULL;
+    return found;
 }
 
 void* hashmap_add(hashmap_t *hm, const void* key, const void* value)
 {
+    uint64_t begin = latency_begin(hm);
+
     //on verifie si la clef existe deja
-    void* existing_value = hashmap_get(hm, key);
-    if(existing_value != NULL) return existing_value;
-    
-    //on resize avant d'ajouter l'element
-    //cela nous permet de ne pas avoir a rehasher l'element
-    hm->count++;
-    auto_grow(hm);
+    size_t hash = hm->fn_hash(key, hm->key_size);
+    node_t *node = bucket_find(hm, &hm->table[bucket_index(hash, hm->capacity)], hash, key);
 
-    //on ajoute l'element
-    size_t index = hm->fn_hash(key, hm->key_size) % hm->capacity;
-    node_t *node = node_create(hm, key, value);
-    if(node == NULL) return (hm->count--, NULL);//decrement count (mais pas besoin de shrink)
+    if(node == NULL)
+    {
+        node = node_insert_new(hm, key, value, hash);
+        if(node != NULL) mutation_notify(hm, HASHMAP_MUTATION_ADD, node);
+    }
 
-    //on ajoute le noeud en tete de la liste chainée
-    //(on rest a O(1) pour l'ajout)
-    node->next = hm->table[index];
-    hm->table[index] = node;
+    latency_end(hm, HASHMAP_LATENCY_ADD, begin);
+    return node != NULL ? node->value : NULL;
+}
+
+bool hashmap_add_bulk(hashmap_t *hm, const void *const *keys, const void *const *values, size_t count)
+{
+    //une seule reallocation de la table au lieu d'un resize a chaque doublement
+    hashmap_reserve(hm, hm->count + count);
+
+    for(size_t i = 0; i < count; i++)
+        if(hashmap_add(hm, keys[i], values[i]) == NULL) return false;
+
+    return true;
+}
+
+void hashmap_reserve(hashmap_t *hm, size_t count)
+{
+    size_t capacity = (size_t)((double)count / hm->load_balance_threshold_max) + 1;
+    if(capacity > hm->capacity) resize(hm, capacity);
+}
+
+void* hashmap_put(hashmap_t *hm, const void *key, const void *value)
+{
+    size_t hash = hm->fn_hash(key, hm->key_size);
+    node_t *node = bucket_find(hm, &hm->table[bucket_index(hash, hm->capacity)], hash, key);
+
+    if(node == NULL)
+    {
+        node = node_insert_new(hm, key, value, hash);
+        if(node == NULL) return NULL;
+
+        mutation_notify(hm, HASHMAP_MUTATION_ADD, node);
+        return node->value;
+    }
+
+    //la copie est faite avant de detruire l'ancienne valeur (gardee si la copie echoue)
+    void *copy = hm->fn_alloc_copy_value(value, hm->value_size);
+    if(!copy) return (perror("hashmap_value_alloc_cpy"), NULL);
+
+    hm->fn_destroy_value(node->value);
+    node->value = copy;
+
+    mutation_notify(hm, HASHMAP_MUTATION_UPDATE, node);
+    return node->value;
+}
+
+void* hashmap_update(hashmap_t *hm, const void *key, update_fn_t update_fn, void *ctx)
+{
+    size_t hash = hm->fn_hash(key, hm->key_size);
+    node_t *node = bucket_find(hm, &hm->table[bucket_index(hash, hm->capacity)], hash, key);
+    hashmap_mutation_t mutation = HASHMAP_MUTATION_UPDATE;
+
+    if(node == NULL)
+    {
+        //la clef n'existe pas: on insere une valeur par defaut (que des zeros)
+        void *default_value = calloc(1, hm->value_size);
+        if(!default_value) return (perror("calloc"), NULL);
+
+        node = node_insert_new(hm, key, default_value, hash);
+        free(default_value);
+        if(node == NULL) return NULL;
 
+        mutation = HASHMAP_MUTATION_ADD;//signale avec la valeur deja modifiee
+    }
+
+    update_fn(node->value, ctx);
+    mutation_notify(hm, mutation, node);
     return node->value;
 }
 
+typedef struct {
+    int64_t delta;
+    int64_t previous;
+} fetch_add_ctx_t;
+
+static void fetch_add_i64(void *value, void *ctx)
+{
+    fetch_add_ctx_t *fetch_add = ctx;
+    fetch_add->previous = *(int64_t*)value;
+    *(int64_t*)value += fetch_add->delta;
+}
+
+int64_t hashmap_fetch_add_i64(hashmap_t *hm, const void *key, int64_t delta)
+{
+    assert(hm->value_size == sizeof(int64_t));
+
+    fetch_add_ctx_t ctx = { .delta = delta, .previous = 0 };
+    hashmap_update(hm, key, fetch_add_i64, &ctx);
+    return ctx.previous;
+}
+
 bool hashmap_remove(hashmap_t *hm, const void *key)
 {
-    size_t index = hm->fn_hash(key, hm->key_size) % hm->capacity;
-    node_t *current = hm->table[index];
-    node_t *prev = NULL;
+    uint64_t begin = latency_begin(hm);
+    size_t hash = hm->fn_hash(key, hm->key_size);
+    node_t *node = bucket_unlink(hm, &hm->table[bucket_index(hash, hm->capacity)], hash, key);
+    if(node == NULL) return (latency_end(hm, HASHMAP_LATENCY_REMOVE, begin), false);
 
-    while(current != NULL)
+    mutation_notify(hm, HASHMAP_MUTATION_REMOVE, node);
+
+    if(hm->free_batch == 0) node_destroy(hm, node);
+    else
     {
-        if(hm->fn_compare(key, current->key, hm->key_size) == 0)
-        {
-            if(prev != NULL) //si le noeud n'est pas le premier de la liste
-            {
-                prev->next = current->next;
-            }    
-            else //si le noeud est le premier de la liste
-            {
-                hm->table[index] = current->next;
-            }
+        //libere plus tard, par lot, par le thread de recuperation
+        node->next = hm->removed;
+        hm->removed = node;
+        if(++hm->removed_count >= hm->free_batch) removed_flush(hm);
+    }
 
-            node_destroy(hm, current);
-            hm->count--;
-            auto_shrink(hm);
-            return true;
-        }
+    hm->count--;
+    auto_shrink(hm);
+    latency_end(hm, HASHMAP_LATENCY_REMOVE, begin);
+    return true;
+}
 
-        prev = current;
-        current = current->next;
+typedef struct {
+    foreach_fn_t fn;
+    void *ctx;
+} foreach_ctx_t;
+
+static void foreach_node(const node_t *node, void *ctx)
+{
+    foreach_ctx_t *foreach = ctx;
+    foreach->fn(node->key, node->value, foreach->ctx);
+}
+
+size_t hashmap_scan(hashmap_t *hm, size_t cursor, size_t count, foreach_fn_t fn, void *ctx)
+{
+    foreach_ctx_t foreach = { .fn = fn, .ctx = ctx };
+    size_t mask = hm->capacity - 1;
+
+    //curseur incremente a partir des bits de poids fort (comme SCAN de redis): quand la table
+    //double ou est divisee par deux, les buckets deja visites correspondent toujours a des
+    //curseurs plus petits, donc aucun element present pendant tout le parcours n'est oublie
+    for(size_t visited = 0; visited < count || count == 0; visited++)
+    {
+        bucket_visit(&hm->table[cursor & mask], foreach_node, &foreach);
+
+        cursor |= ~mask;
+        cursor = reverse_bits(reverse_bits(cursor) + 1);
+        if(cursor == 0) break;
+    }
+
+    return cursor;
+}
+
+hashmap_range_t hashmap_range(hashmap_t *hm)
+{ return (hashmap_range_t){ .begin = 0, .end = hm->capacity }; }
+
+bool hashmap_range_split(hashmap_range_t *range, hashmap_range_t *other)
+{
+    if(range->end - range->begin < 2) return false;
+
+    size_t middle = range->begin + (range->end - range->begin) / 2;
+    other->begin = middle;
+    other->end = range->end;
+    range->end = middle;
+    return true;
+}
+
+void hashmap_range_foreach(hashmap_t *hm, hashmap_range_t range, foreach_fn_t fn, void *ctx)
+{
+    foreach_ctx_t foreach = { .fn = fn, .ctx = ctx };
+    for(size_t i = range.begin; i < range.end && i < hm->capacity; i++)
+        bucket_visit(&hm->table[i], foreach_node, &foreach);
+}
+
+typedef struct {
+    hashmap_t *hm;
+    foreach_fn_t fn;
+    void *ctx;
+    atomic_size_t next;//first bucket of the next chunk to claim
+} parallel_ctx_t;
+
+static void* parallel_worker(void *arg)
+{
+    parallel_ctx_t *parallel = arg;
+    size_t capacity = parallel->hm->capacity;
+
+    //chaque thread prend le prochain chunk libre: pas de partage fixe, donc pas de thread qui
+    //attend les autres parce que ses buckets etaient plus remplis
+    for(;;)
+    {
+        size_t begin = atomic_fetch_add_explicit(&parallel->next, HASHMAP_PARALLEL_CHUNK, memory_order_relaxed);
+        if(begin >= capacity) break;
+
+        hashmap_range_t range = { .begin = begin, .end = begin + HASHMAP_PARALLEL_CHUNK };
+        hashmap_range_foreach(parallel->hm, range, parallel->fn, parallel->ctx);
+    }
+
+    return NULL;
+}
+
+void hashmap_parallel_foreach(hashmap_t *hm, size_t nthreads, foreach_fn_t fn, void *ctx)
+{
+    if(nthreads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    //inutile de lancer plus de threads qu'il n'y a de chunks
+    size_t chunks = (hm->capacity + HASHMAP_PARALLEL_CHUNK - 1) / HASHMAP_PARALLEL_CHUNK;
+    if(nthreads > chunks) nthreads = chunks;
+
+    parallel_ctx_t parallel = { .hm = hm, .fn = fn, .ctx = ctx };
+    atomic_init(&parallel.next, 0);
+
+    pthread_t *threads = nthreads > 1 ? malloc((nthreads - 1) * sizeof(*threads)) : NULL;
+    if(nthreads > 1 && !threads) perror("malloc");
+
+    size_t started = 0;
+    while(threads && started < nthreads - 1)
+    {
+        if(pthread_create(&threads[started], NULL, parallel_worker, &parallel) != 0){ perror("pthread_create"); break; }
+        started++;
     }
 
-    return false;
+    parallel_worker(&parallel);//le thread appelant travaille aussi
+
+    for(size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+}
+
+typedef struct {
+    size_t index;
+    bool first;
+    print_fn_t print_key_fn;
+    print_fn_t print_value_fn;
+} print_ctx_t;
+
+static void print_node(const node_t *node, void *ctx)
+{
+    print_ctx_t *print = ctx;
+
+    printf(print->first ? "\t" : ",\n\t");
+    printf("(%zu) : ", print->index);
+    print->print_key_fn(node->key);
+    printf("  =>  ");
+    print->print_value_fn(node->value);
+
+    print->first = false;
 }
 
 void hashmap_print(hashmap_t *hm, print_fn_t print_key_fn, print_fn_t print_value_fn)
@@ -193,28 +670,251 @@ void hashmap_print(hashmap_t *hm, print_fn_t print_key_fn, print_fn_t print_valu
     printf("    table:\n");
     printf("    [\n");
 
-    for(size_t i = 0; i < hm->capacity; i++)
+    print_ctx_t ctx = { .first = true, .print_key_fn = print_key_fn, .print_value_fn = print_value_fn };
+    for(ctx.index = 0; ctx.index < hm->capacity; ctx.index++)
+        bucket_visit(&hm->table[ctx.index], print_node, &ctx);
+
+    printf("\n    ]\n");
+    printf("}\n");
+}
+
+bool hashmap_dump(hashmap_t *hm, FILE *stream, hashmap_dump_format_t format,
+                  format_fn_t format_key_fn, format_fn_t format_value_fn)
+{
+    //ce qui est deja dans le buffer du stream doit sortir avant le dump
+    if(fflush(stream) != 0) return (perror("fflush"), false);
+
+    dump_writer_t writer = { .stream = stream, .fd = -1 };
+    bool ok = dump_range(hm, hashmap_range(hm), &writer, format, format_key_fn, format_value_fn);
+
+    if(fflush(stream) != 0) return (perror("fflush"), false);
+    return ok;
+}
+
+bool hashmap_dump_fd(hashmap_t *hm, int fd, hashmap_dump_format_t format,
+                     format_fn_t format_key_fn, format_fn_t format_value_fn)
+{ return hashmap_dump_range(hm, hashmap_range(hm), fd, format, format_key_fn, format_value_fn); }
+
+bool hashmap_dump_range(hashmap_t *hm, hashmap_range_t range, int fd, hashmap_dump_format_t format,
+                        format_fn_t format_key_fn, format_fn_t format_value_fn)
+{
+    dump_writer_t writer = { .stream = NULL, .fd = fd };
+    return dump_range(hm, range, &writer, format, format_key_fn, format_value_fn);
+}
+
+typedef struct {
+    hashmap_t *hm;
+    hashmap_range_t range;
+    char *path;
+    hashmap_dump_format_t format;
+    format_fn_t format_key_fn;
+    format_fn_t format_value_fn;
+    bool ok;
+} dump_file_job_t;
+
+bool hashmap_dump_files(hashmap_t *hm, const char *path, size_t chunks, hashmap_dump_format_t format,
+                        format_fn_t format_key_fn, format_fn_t format_value_fn)
+{
+    if(chunks == 0)
     {
-        node_t *current = hm->table[i];
-        while(current != NULL)
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        chunks = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    size_t path_size = strlen(path) + 24;//".<index>"
+    dump_file_job_t *jobs = malloc(chunks * sizeof(*jobs));
+    pthread_t *threads = malloc(chunks * sizeof(*threads));
+    bool *started = calloc(chunks, sizeof(*started));
+    char *paths = malloc(chunks * path_size);
+    if(!jobs || !threads || !started || !paths)
+    {
+        perror("malloc");
+        free(jobs); free(threads); free(started); free(paths);
+        return false;
+    }
+
+    //chaque fichier recoit une plage contigue de buckets
+    for(size_t i = 0; i < chunks; i++)
+    {
+        jobs[i] = (dump_file_job_t){
+            .hm = hm,
+            .range = { .begin = hm->capacity * i / chunks, .end = hm->capacity * (i + 1) / chunks },
+            .path = paths + i * path_size,
+            .format = format,
+            .format_key_fn = format_key_fn,
+            .format_value_fn = format_value_fn,
+        };
+        snprintf(jobs[i].path, path_size, "%s.%zu", path, i);
+    }
+
+    //le thread appelant ecrit le premier fichier, et ceux dont le thread n'a pas pu demarrer
+    for(size_t i = 1; i < chunks; i++)
+        started[i] = pthread_create(&threads[i], NULL, dump_file_worker, &jobs[i]) == 0;
+
+    bool ok = true;
+    for(size_t i = 0; i < chunks; i++)
+    {
+        if(started[i]) pthread_join(threads[i], NULL);
+        else dump_file_worker(&jobs[i]);
+
+        ok = ok && jobs[i].ok;
+    }
+
+    free(jobs);
+    free(threads);
+    free(started);
+    free(paths);
+    return ok;
+}
+
+bool hashmap_load(hashmap_t *hm, const char *path, hashmap_dump_format_t format, size_t nthreads,
+                  parse_fn_t parse_key_fn, parse_fn_t parse_value_fn)
+{
+    assert(format == HASHMAP_DUMP_TSV || format == HASHMAP_DUMP_BINARY);
+
+    if(nthreads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    //fd: entete et bornes des morceaux, data_fd: lectures des morceaux (O_DIRECT si possible)
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return (perror("open"), false);
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    if(size < 0) return (perror("lseek"), close(fd), false);
+    if(size == 0) return (close(fd), format == HASHMAP_DUMP_TSV);//binaire: il manque l'entete
+
+    int data_fd = aio_open(path, O_RDONLY, 0);
+    if(data_fd < 0) return (perror("open"), close(fd), false);
+
+    off_t begin = 0;
+    off_t end = size;
+    size_t record_size = 2 * sizeof(uint32_t) + hm->key_size + hm->value_size;
+    if(format == HASHMAP_DUMP_BINARY)
+    {
+        char magic[sizeof(HASHMAP_DUMP_MAGIC)];
+        begin = sizeof(HASHMAP_DUMP_MAGIC);
+        if(size < begin || pread(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic)
+           || memcmp(magic, HASHMAP_DUMP_MAGIC, sizeof(magic)) != 0 || (size_t)(end - begin) % record_size != 0)
         {
-            printf("\t");
-            printf("(%zu) : ", i);
-            print_key_fn(current->key);
-            printf("  =>  ");
-            print_value_fn(current->value);
+            fprintf(stderr, "hashmap_load: %s is not a binary dump with %zu+%zu bytes records\n", path, hm->key_size, hm->value_size);
+            close(fd);
+            close(data_fd);
+            return false;
+        }
+    }
 
-            if(i < hm->capacity - 1 || current->next != NULL)
-            {
-                printf(",\n");
-            }
+    //les paires d'une meme clef ont toujours le meme proprietaire (bits du hash): le proprietaire
+    //insere ses paires dans l'ordre du fichier, comme des hashmap_add successifs
+    size_t owners = 1;
+    while(owners * 2 <= nthreads) owners *= 2;
+
+    load_chunk_t *chunks = calloc(nthreads, sizeof(*chunks));
+    node_t **lists = calloc(2 * nthreads * owners, sizeof(*lists));
+    load_insert_t *inserts = calloc(owners, sizeof(*inserts));
+    pthread_t *threads = malloc(nthreads * sizeof(*threads));
+    bool *started = calloc(nthreads, sizeof(*started));
+    if(!chunks || !lists || !inserts || !threads || !started)
+    {
+        perror("malloc");
+        free(chunks); free(lists); free(inserts); free(threads); free(started);
+        close(fd);
+        close(data_fd);
+        return false;
+    }
 
-            current = current->next;
+    //decoupage: les bornes sont avancees jusqu'a un debut de ligne (ou d'enregistrement)
+    off_t chunk_begin = begin;
+    for(size_t i = 0; i < nthreads; i++)
+    {
+        off_t chunk_end = end;
+        if(i + 1 < nthreads && format == HASHMAP_DUMP_TSV)
+        {
+            chunk_end = begin + (off_t)((size_t)(end - begin) * (i + 1) / nthreads);
+            if(chunk_end < chunk_begin) chunk_end = chunk_begin;
+            chunk_end = load_next_line(fd, chunk_end, end);
+        }
+        else if(i + 1 < nthreads)
+        {
+            size_t records = (size_t)(end - begin) / record_size;
+            chunk_end = begin + (off_t)(records * (i + 1) / nthreads * record_size);
         }
+
+        chunks[i] = (load_chunk_t){
+            .hm = hm,
+            .fd = data_fd,
+            .file_begin = chunk_begin,
+            .file_end = chunk_end,
+            .format = format,
+            .parse_key_fn = parse_key_fn ? parse_key_fn : parse_hex,
+            .parse_value_fn = parse_value_fn ? parse_value_fn : parse_hex,
+            .owners = owners,
+            .heads = lists + 2 * i * owners,
+            .tails = lists + (2 * i + 1) * owners,
+        };
+        chunk_begin = chunk_end;
     }
 
-    printf("\n    ]\n");
-    printf("}\n");
+    //phase 1: parsing, hash et allocation des paires
+    for(size_t i = 1; i < nthreads; i++)
+        started[i] = pthread_create(&threads[i], NULL, load_parse_worker, &chunks[i]) == 0;
+
+    bool ok = true;
+    size_t parsed = 0;
+    for(size_t i = 0; i < nthreads; i++)
+    {
+        if(started[i]) pthread_join(threads[i], NULL);
+        else load_parse_worker(&chunks[i]);
+
+        ok = ok && chunks[i].ok;
+        parsed += chunks[i].parsed;
+    }
+
+    close(fd);
+    close(data_fd);
+
+    if(!ok)
+    {
+        for(size_t i = 0; i < nthreads * owners; i++)
+            node_list_destroy(chunks[i / owners].heads[i % owners], hm->fn_destroy_key, hm->fn_destroy_value);
+    }
+    else
+    {
+        //phase 2: un seul resize, puis chaque thread remplit ses propres buckets
+        hashmap_reserve(hm, hm->count + parsed);
+
+        //une table trop petite pour separer les proprietaires par groupes de buckets: un seul thread
+        //(un seul aussi avec une fonction de mutation: elle est appelee par le thread appelant)
+        size_t inserters = hm->capacity >= (owners << LOAD_OWNER_SHIFT) && hm->fn_mutation == NULL ? owners : 1;
+        for(size_t i = 0; i < inserters; i++)
+        {
+            inserts[i] = (load_insert_t){
+                .hm = hm,
+                .chunks = chunks,
+                .chunk_count = nthreads,
+                .owner_begin = owners * i / inserters,
+                .owner_end = owners * (i + 1) / inserters,
+            };
+            started[i] = i > 0 && pthread_create(&threads[i], NULL, load_insert_worker, &inserts[i]) == 0;
+        }
+
+        for(size_t i = 0; i < inserters; i++)
+        {
+            if(started[i]) pthread_join(threads[i], NULL);
+            else load_insert_worker(&inserts[i]);
+
+            hm->count += inserts[i].added;
+        }
+    }
+
+    free(chunks);
+    free(lists);
+    free(inserts);
+    free(threads);
+    free(started);
+    return ok;
 }
 
 size_t hashmap_count(hashmap_t *hm)
@@ -223,15 +923,88 @@ size_t hashmap_count(hashmap_t *hm)
 size_t hashmap_capacity(hashmap_t *hm)
 { return hm->capacity; }
 
+size_t hashmap_key_size(hashmap_t *hm)
+{ return hm->key_size; }
+
+size_t hashmap_value_size(hashmap_t *hm)
+{ return hm->value_size; }
+
 void hashmap_set_load_balance_threshold(hashmap_t *hm, float min, float max)
 {
     hm->load_balance_threshold_min = min;
     hm->load_balance_threshold_max = max;
 }
 
+void hashmap_set_alloc_mode(hashmap_t *hm, hashmap_alloc_mode_t mode)
+{
+    hm->alloc_mode = mode;
+    resize(hm, hm->capacity);//reallocate the current table with the new mode
+}
+
+void hashmap_set_numa_node(hashmap_t *hm, int node)
+{
+    hm->numa_node = node;
+    resize(hm, hm->capacity);//reallocate the current table on the node
+}
+
+void hashmap_set_free_batch(hashmap_t *hm, size_t batch_size)
+{
+    hm->free_batch = batch_size;
+    if(hm->removed_count >= batch_size) removed_flush(hm);
+}
+
 void hashmap_set_fn_compare(hashmap_t *hm, compare_fn_t compare_fn)
 { hm->fn_compare = compare_fn; }
 
+void hashmap_set_fn_mutation(hashmap_t *hm, mutation_fn_t mutation_fn, void *ctx)
+{
+    hm->fn_mutation = mutation_fn;
+    hm->mutation_ctx = ctx;
+}
+
+bool hashmap_set_latency_sampling(hashmap_t *hm, size_t period)
+{
+    if(period == 0)
+    {
+        if(hm->latency != NULL) hm->latency->enabled = false;
+        return true;
+    }
+
+    if(hm->latency == NULL)
+    {
+        hm->latency = calloc(1, sizeof(*hm->latency));
+        if(!hm->latency) return (perror("calloc"), false);
+    }
+
+    uint64_t rounded = 1;
+    while(rounded < period) rounded <<= 1;
+
+    hm->latency->mask = rounded - 1;
+    hm->latency->enabled = true;
+    return true;
+}
+
+uint64_t hashmap_latency_snapshot(hashmap_t *hm, hashmap_latency_op_t op, histogram_t *h)
+{
+    if(hm->latency == NULL) return 0;
+
+    uint64_t total = 0;
+    for(size_t i = 0; i < HASHMAP_LATENCY_SLOTS; i++)
+    {
+        latency_slot_t *slot = atomic_load_explicit(&hm->latency->slots[i], memory_order_acquire);
+        if(slot == NULL) continue;
+
+        for(size_t b = 0; b < LATENCY_BUCKETS; b++)
+        {
+            uint64_t count = atomic_load_explicit(&slot->buckets[op][b], memory_order_relaxed);
+            histogram_record_n(h, latency_bucket_highest(b), count);
+            total += count;
+        }
+    }
+
+    return total;
+}
+
 void hashmap_set_fn_alloc_copy_key(hashmap_t *hm, alloc_copy_fn_t key_alloc_fn)
 { hm->fn_alloc_copy_key = key_alloc_fn; }
 
@@ -267,32 +1040,412 @@ static void auto_shrink(hashmap_t *hm)
 
 static void resize(hashmap_t *hm, size_t new_capacity)
 {
-    if(new_capacity < HASHMAP_MINIMAL_CAPACITY) new_capacity = HASHMAP_MINIMAL_CAPACITY;
+    uint64_t begin = latency_begin_every(hm);
+    new_capacity = round_up_pow2(new_capacity);
+    PROBE4(hashmap, resize__start, hm, hm->capacity, new_capacity, hm->count);
 
     //allocation pour le nouveau tableau
-    node_t **new_table = calloc(new_capacity, sizeof(*new_table));
-    if(!new_table){ perror("calloc"); return; }
-
-    //vu que la capacité change, on doit rehasher les noeuds 
-    //(car l'index = hash mod capacité)
+    size_t new_table_mapped_size;
+    bucket_t *new_table = table_alloc(hm, new_capacity, &new_table_mapped_size);
+    if(!new_table)
+    {
+        PROBE2(hashmap, alloc__fail, hm, 1);
+        PROBE3(hashmap, resize__end, hm, hm->capacity, 0);
+        return;
+    }
+
+    //vu que la capacité change, on doit redistribuer les noeuds 
+    //(car l'index = hash & (capacité - 1), le hash est garde dans le noeud)
     for(size_t i = 0; i < hm->capacity; i++)
     {
-        node_t *current = hm->table[i];
+        node_t *current = bucket_detach(&hm->table[i]);
         while(current != NULL)
         {
-            size_t index = hm->fn_hash(current->key, hm->key_size) % new_capacity;
             node_t *next = current->next;
-
-            current->next = new_table[index];
-            new_table[index] = current;
-
+            bucket_insert(hm, &new_table[bucket_index(current->hash, new_capacity)], current);
             current = next;
         }
     }
 
-    free(hm->table);
+    table_free(hm->table, hm->table_mapped_size);
     hm->table = new_table;
+    hm->table_mapped_size = new_table_mapped_size;
     hm->capacity = new_capacity;
+    latency_end(hm, HASHMAP_LATENCY_RESIZE, begin);
+    PROBE3(hashmap, resize__end, hm, new_capacity, 1);
+}
+
+//--------------- BUCKETS ---------------//
+
+//order of the keys in a tree bucket: by hash first, then by fn_compare
+static inline int node_order(const hashmap_t *hm, size_t hash, const void *key, const node_t *node)
+{
+    if(hash != node->hash) return hash < node->hash ? -1 : 1;
+    return hm->fn_compare(key, node->key, hm->key_size);
+}
+
+static node_t* bucket_find(const hashmap_t *hm, const bucket_t *bucket, size_t hash, const void *key)
+{
+    node_t *current = bucket->head;
+    PROBE3(hashmap, lookup, hm, bucket->length, bucket->is_tree);
+
+    if(bucket->is_tree)
+    {
+        while(current != NULL)
+        {
+            int order = node_order(hm, hash, key, current);
+            if(order == 0) return current;
+
+            current = order < 0 ? current->left : current->right;
+        }
+
+        return NULL;
+    }
+
+    while(current != NULL)
+    {
+        if(current->hash == hash && hm->fn_compare(key, current->key, hm->key_size) == 0)
+            return current;
+
+        current = current->next;
+    }
+
+    return NULL;
+}
+
+static void bucket_insert(const hashmap_t *hm, bucket_t *bucket, node_t *node)
+{
+    bucket->length++;
+
+    if(bucket->is_tree)
+    {
+        bucket->head = tree_insert(hm, bucket->head, node);
+        return;
+    }
+
+    //on ajoute le noeud en tete de la liste chainée
+    //(on rest a O(1) pour l'ajout)
+    node->next = bucket->head;
+    bucket->head = node;
+
+    if(bucket->length > HASHMAP_TREEIFY_THRESHOLD) treeify(hm, bucket);
+}
+
+static node_t* bucket_unlink(const hashmap_t *hm, bucket_t *bucket, size_t hash, const void *key)
+{
+    node_t *removed = NULL;
+
+    if(bucket->is_tree)
+    {
+        bucket->head = tree_remove(hm, bucket->head, hash, key, &removed);
+        if(removed == NULL) return NULL;
+
+        bucket->length--;
+        if(bucket->length < HASHMAP_UNTREEIFY_THRESHOLD) untreeify(bucket);
+        return removed;
+    }
+
+    node_t *current = bucket->head;
+    node_t *prev = NULL;
+
+    while(current != NULL)
+    {
+        if(current->hash == hash && hm->fn_compare(key, current->key, hm->key_size) == 0)
+        {
+            if(prev != NULL) //si le noeud n'est pas le premier de la liste
+            {
+                prev->next = current->next;
+            }    
+            else //si le noeud est le premier de la liste
+            {
+                bucket->head = current->next;
+            }
+
+            bucket->length--;
+            return current;
+        }
+
+        prev = current;
+        current = current->next;
+    }
+
+    return NULL;
+}
+
+//empty the bucket and return all its nodes as a linked list
+static node_t* bucket_detach(bucket_t *bucket)
+{
+    node_t *list = bucket->is_tree ? tree_to_list(bucket->head, NULL) : bucket->head;
+
+    bucket->head = NULL;
+    bucket->length = 0;
+    bucket->is_tree = false;
+    return list;
+}
+
+static void bucket_visit(const bucket_t *bucket, node_visit_fn_t fn, void *ctx)
+{
+    if(bucket->is_tree)
+    {
+        tree_visit(bucket->head, fn, ctx);
+        return;
+    }
+
+    for(const node_t *current = bucket->head; current != NULL; current = current->next)
+        fn(current, ctx);
+}
+
+static void treeify(const hashmap_t *hm, bucket_t *bucket)
+{
+    node_t *current = bucket->head;
+    node_t *root = NULL;
+
+    while(current != NULL)
+    {
+        node_t *next = current->next;
+        root = tree_insert(hm, root, current);
+        current = next;
+    }
+
+    bucket->head = root;
+    bucket->is_tree = true;
+}
+
+static void untreeify(bucket_t *bucket)
+{
+    bucket->head = tree_to_list(bucket->head, NULL);
+    bucket->is_tree = false;
+}
+
+//--------------- TREE BUCKETS (AVL) ---------------//
+
+static inline int tree_height(const node_t *node)
+{ return node != NULL ? node->height : 0; }
+
+static inline void tree_update_height(node_t *node)
+{
+    int left = tree_height(node->left);
+    int right = tree_height(node->right);
+    node->height = (left > right ? left : right) + 1;
+}
+
+static node_t* tree_rotate_right(node_t *node)
+{
+    node_t *left = node->left;
+    node->left = left->right;
+    left->right = node;
+
+    tree_update_height(node);
+    tree_update_height(left);
+    return left;
+}
+
+static node_t* tree_rotate_left(node_t *node)
+{
+    node_t *right = node->right;
+    node->right = right->left;
+    right->left = node;
+
+    tree_update_height(node);
+    tree_update_height(right);
+    return right;
+}
+
+static node_t* tree_balance(node_t *node)
+{
+    tree_update_height(node);
+    int balance = tree_height(node->left) - tree_height(node->right);
+
+    if(balance > 1)
+    {
+        if(tree_height(node->left->left) < tree_height(node->left->right))
+            node->left = tree_rotate_left(node->left);
+        return tree_rotate_right(node);
+    }
+
+    if(balance < -1)
+    {
+        if(tree_height(node->right->right) < tree_height(node->right->left))
+            node->right = tree_rotate_right(node->right);
+        return tree_rotate_left(node);
+    }
+
+    return node;
+}
+
+//the key of the node must not be in the tree
+static node_t* tree_insert(const hashmap_t *hm, node_t *root, node_t *node)
+{
+    if(root == NULL)
+    {
+        node->left = NULL;
+        node->right = NULL;
+        node->height = 1;
+        return node;
+    }
+
+    if(node_order(hm, node->hash, node->key, root) < 0)
+        root->left = tree_insert(hm, root->left, node);
+    else
+        root->right = tree_insert(hm, root->right, node);
+
+    return tree_balance(root);
+}
+
+static node_t* tree_remove_min(node_t *root, node_t **min)
+{
+    if(root->left == NULL)
+    {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = tree_remove_min(root->left, min);
+    return tree_balance(root);
+}
+
+static node_t* tree_remove(const hashmap_t *hm, node_t *root, size_t hash, const void *key, node_t **removed)
+{
+    if(root == NULL) return NULL;
+
+    int order = node_order(hm, hash, key, root);
+    if(order < 0)
+    {
+        root->left = tree_remove(hm, root->left, hash, key, removed);
+        return tree_balance(root);
+    }
+
+    if(order > 0)
+    {
+        root->right = tree_remove(hm, root->right, hash, key, removed);
+        return tree_balance(root);
+    }
+
+    *removed = root;
+    if(root->left == NULL) return root->right;
+    if(root->right == NULL) return root->left;
+
+    //on remplace le noeud par le plus petit noeud du sous-arbre droit
+    node_t *successor;
+    node_t *right = tree_remove_min(root->right, &successor);
+    successor->left = root->left;
+    successor->right = right;
+    return tree_balance(successor);
+}
+
+//prepend all the nodes of the tree to the list (in order)
+static node_t* tree_to_list(node_t *root, node_t *list)
+{
+    if(root == NULL) return list;
+
+    node_t *left = root->left;
+    node_t *right = root->right;
+
+    list = tree_to_list(right, list);
+    root->next = list;
+    root->right = NULL;
+    root->height = 1;
+    return tree_to_list(left, root);
+}
+
+static void tree_visit(const node_t *root, node_visit_fn_t fn, void *ctx)
+{
+    if(root == NULL) return;
+
+    tree_visit(root->left, fn, ctx);
+    fn(root, ctx);
+    tree_visit(root->right, fn, ctx);
+}
+
+//--------------- TABLE ALLOCATION ---------------//
+
+static inline size_t round_up_hugepage(size_t size)
+{ return (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1); }
+
+//anonymous mapping aligned on a huge page, so that transparent huge pages can back all of it
+static void* mmap_hugepage_aligned(size_t size)
+{
+    size_t length = size + HUGEPAGE_SIZE;
+    char *raw = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED) return NULL;
+
+    //on rend ce qui depasse avant et apres la zone alignee
+    char *aligned = (char*)(((uintptr_t)raw + HUGEPAGE_SIZE - 1) & ~(uintptr_t)(HUGEPAGE_SIZE - 1));
+    if(aligned > raw) munmap(raw, aligned - raw);
+    if(raw + length > aligned + size) munmap(aligned + size, (raw + length) - (aligned + size));
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);//simple conseil, on ignore l'erreur (THP desactive...)
+#endif
+    return aligned;
+}
+
+//prefer the pages of the mapping to be allocated on the node (best effort: ignored if NUMA is not available)
+static void mbind_preferred(void *addr, size_t size, int node)
+{
+#ifdef SYS_mbind
+    unsigned long nodemask[16] = {0};
+    if(node < 0 || (size_t)node >= sizeof(nodemask) * 8) return;
+
+    nodemask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+    syscall(SYS_mbind, addr, size, MPOL_PREFERRED_MODE, nodemask, sizeof(nodemask) * 8, 0);
+#else
+    (void)addr; (void)size; (void)node;
+#endif
+}
+
+//allocate a zeroed table
+//with mmap (huge page modes or NUMA binding), the zeroing is lazy: the kernel maps its zero page until a bucket is written
+static bucket_t* table_alloc(const hashmap_t *hm, size_t capacity, size_t *mapped_size)
+{
+    size_t size = capacity * sizeof(bucket_t);
+    bool huge = hm->alloc_mode != HASHMAP_ALLOC_DEFAULT && size >= HASHMAP_HUGEPAGE_MIN_SIZE;
+    *mapped_size = 0;
+
+    //mbind a besoin de pages entieres, une table liee a un noeud vient donc toujours de mmap
+    if(!huge && hm->numa_node >= 0)
+    {
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size = (size + page_size - 1) / page_size * page_size;
+
+        void *table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(table == MAP_FAILED) return (perror("mmap"), NULL);
+
+        mbind_preferred(table, size, hm->numa_node);
+        *mapped_size = size;
+        return table;
+    }
+
+    if(!huge)
+    {
+        bucket_t *table = calloc(capacity, sizeof(bucket_t));
+        if(!table) perror("calloc");
+        return table;
+    }
+
+    size = round_up_hugepage(size);
+    void *table = NULL;
+
+#ifdef MAP_HUGETLB
+    if(hm->alloc_mode == HASHMAP_ALLOC_HUGETLB)
+    {
+        table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(table == MAP_FAILED) table = NULL;//pool hugetlbfs vide: on se rabat sur les THP
+    }
+#endif
+
+    if(table == NULL) table = mmap_hugepage_aligned(size);
+    if(table == NULL) return (perror("mmap"), NULL);
+
+    if(hm->numa_node >= 0) mbind_preferred(table, size, hm->numa_node);
+    *mapped_size = size;
+    return table;
+}
+
+static void table_free(bucket_t *table, size_t mapped_size)
+{
+    if(mapped_size > 0) munmap(table, mapped_size);
+    else free(table);
 }
 
 static void* default_fn_alloc_copy(const void *element, const size_t size)
@@ -304,7 +1457,7 @@ static void* default_fn_alloc_copy(const void *element, const size_t size)
     return copy;
 }
 
-static node_t* node_create(const hashmap_t *hm, const void *key, const void *value)
+static node_t* node_create(const hashmap_t *hm, const void *key, const void *value, size_t hash)
 {
     //allocation pour le noeud
     node_t *node = malloc(sizeof(*node));
@@ -318,7 +1471,10 @@ static node_t* node_create(const hashmap_t *hm, const void *key, const void *val
     node->value = hm->fn_alloc_copy_value(value, hm->value_size);
     if(!node->value) return (perror("hashmap_value_alloc_cpy"), hm->fn_destroy_key(node->key), free(node), NULL);
 
+    node->hash = hash;
     node->next = NULL;
+    node->right = NULL;
+    node->height = 1;
     return node;
 }
 
@@ -329,6 +1485,720 @@ static inline void node_destroy(const hashmap_t *hm, node_t *node)
     free(node);
 }
 
+static void node_list_destroy(node_t *list, destroy_fn_t fn_destroy_key, destroy_fn_t fn_destroy_value)
+{
+    while(list != NULL)
+    {
+        node_t *tmp = list;
+        list = list->next;
+
+        fn_destroy_key(tmp->key);
+        fn_destroy_value(tmp->value);
+        free(tmp);
+    }
+}
+
+//insertion d'une clef absente (hash deja calcule)
+static node_t* node_insert_new(hashmap_t *hm, const void *key, const void *value, size_t hash)
+{
+    //on resize avant d'ajouter l'element
+    //cela nous permet de ne pas avoir a rehasher l'element
+    hm->count++;
+    auto_grow(hm);
+
+    //on ajoute l'element
+    uint64_t begin = latency_begin(hm);
+    node_t *node = node_create(hm, key, value, hash);
+    latency_end(hm, HASHMAP_LATENCY_NODE_CREATE, begin);
+    if(node == NULL)
+    {
+        PROBE2(hashmap, alloc__fail, hm, 0);
+        return (hm->count--, NULL);//decrement count (mais pas besoin de shrink)
+    }
+
+    bucket_insert(hm, &hm->table[bucket_index(hash, hm->capacity)], node);
+    return node;
+}
+
+static void mutation_notify(const hashmap_t *hm, hashmap_mutation_t mutation, const node_t *node)
+{ if(hm->fn_mutation != NULL) hm->fn_mutation(mutation, node->key, node->value, hm->mutation_ctx); }
+
+//--------------- LATENCY SAMPLING ---------------//
+
+//start of a timed call, 0 if the call is not sampled
+static inline uint64_t latency_begin(const hashmap_t *hm)
+{
+    if(hm->latency == NULL || !hm->latency->enabled) return 0;
+    return (latency_random() & hm->latency->mask) == 0 ? latency_now() : 0;
+}
+
+//start of a call that is always timed while the sampling is enabled
+static inline uint64_t latency_begin_every(const hashmap_t *hm)
+{ return hm->latency != NULL && hm->latency->enabled ? latency_now() : 0; }
+
+static inline void latency_end(const hashmap_t *hm, hashmap_latency_op_t op, uint64_t begin)
+{ if(begin != 0) latency_record(hm->latency, op, latency_now() - begin); }
+
+static void latency_record(latency_t *latency, hashmap_latency_op_t op, uint64_t duration)
+{
+    if(latency_slot < 0) latency_slot = atomic_fetch_add(&latency_next_slot, 1) % HASHMAP_LATENCY_SLOTS;
+
+    latency_slot_t *slot = atomic_load_explicit(&latency->slots[latency_slot], memory_order_acquire);
+    if(slot == NULL)
+    {
+        //premier echantillon de ce slot: un autre thread peut l'allouer en meme temps
+        latency_slot_t *expected = NULL;
+        slot = calloc(1, sizeof(*slot));
+        if(!slot) return;//echantillon perdu
+
+        if(!atomic_compare_exchange_strong_explicit(&latency->slots[latency_slot], &expected, slot,
+                                                    memory_order_acq_rel, memory_order_acquire))
+        {
+            free(slot);
+            slot = expected;
+        }
+    }
+
+    //atomique: les threads au dela de HASHMAP_LATENCY_SLOTS partagent les slots
+    atomic_fetch_add_explicit(&slot->buckets[op][latency_bucket_of(duration)], 1, memory_order_relaxed);
+}
+
+static uint64_t latency_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//xorshift64, one generator per thread (seeded with the address of its state)
+static uint64_t latency_random(void)
+{
+    uint64_t x = latency_state;
+    if(x == 0) x = (uint64_t)(uintptr_t)&latency_state | 1;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    latency_state = x;
+    return x;
+}
+
+//same log-linear scheme as histogram.h, but with 2^HASHMAP_LATENCY_SUB_BUCKET_BITS sub-buckets per power of two
+//(32, against 128 for HISTOGRAM_SUB_BUCKET_BITS): coarser buckets
+static size_t latency_bucket_of(uint64_t value)
+{
+    if(value >= (1ULL << HASHMAP_LATENCY_MAX_BITS)) value = (1ULL << HASHMAP_LATENCY_MAX_BITS) - 1;
+
+    int msb = value ? 63 - __builtin_clzll(value) : 0;
+    int shift = msb > HASHMAP_LATENCY_SUB_BUCKET_BITS ? msb - HASHMAP_LATENCY_SUB_BUCKET_BITS : 0;
+
+    return ((size_t)shift << HASHMAP_LATENCY_SUB_BUCKET_BITS) + (size_t)(value >> shift);
+}
+
+static uint64_t latency_bucket_highest(size_t index)
+{
+    size_t high = index >> HASHMAP_LATENCY_SUB_BUCKET_BITS;
+    if(high <= 1) return index;//un bucket par valeur
+
+    int shift = (int)high - 1;
+    uint64_t sub = index - ((size_t)shift << HASHMAP_LATENCY_SUB_BUCKET_BITS);
+    return ((sub + 1) << shift) - 1;
+}
+
+static void latency_destroy(latency_t *latency)
+{
+    if(latency == NULL) return;
+
+    for(size_t i = 0; i < HASHMAP_LATENCY_SLOTS; i++)
+        free(atomic_load_explicit(&latency->slots[i], memory_order_relaxed));
+
+    free(latency);
+}
+
+//--------------- BACKGROUND RECLAIMER ---------------//
+
+static void reclaimer_start(void)
+{
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, reclaimer_main, NULL) != 0){ perror("pthread_create"); return; }
+
+    pthread_detach(thread);
+    reclaimer.started = true;
+}
+
+static void* reclaimer_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&reclaimer.lock);
+    for(;;)
+    {
+        while(reclaimer.head == NULL) pthread_cond_wait(&reclaimer.wakeup, &reclaimer.lock);
+
+        reclaim_job_t *job = reclaimer.head;
+        reclaimer.head = job->next;
+        if(reclaimer.head == NULL) reclaimer.tail = NULL;
+
+        //les free se font sans le verrou: les autres threads peuvent continuer a deposer des jobs
+        pthread_mutex_unlock(&reclaimer.lock);
+        reclaim_job_run(job);
+        pthread_mutex_lock(&reclaimer.lock);
+
+        if(--reclaimer.pending == 0) pthread_cond_broadcast(&reclaimer.idle);
+    }
+
+    return NULL;
+}
+
+//queue a job for the reclaimer thread (run on the calling thread if it could not be started)
+static void reclaimer_submit(reclaim_job_t *job)
+{
+    pthread_once(&reclaimer.once, reclaimer_start);
+    if(!reclaimer.started)
+    {
+        reclaim_job_run(job);
+        return;
+    }
+
+    job->next = NULL;
+
+    pthread_mutex_lock(&reclaimer.lock);
+    if(reclaimer.tail != NULL) reclaimer.tail->next = job;
+    else reclaimer.head = job;
+    reclaimer.tail = job;
+    reclaimer.pending++;
+    pthread_cond_signal(&reclaimer.wakeup);
+    pthread_mutex_unlock(&reclaimer.lock);
+}
+
+static void reclaim_job_run(reclaim_job_t *job)
+{
+    if(job->map != NULL) hashmap_destroy(job->map);
+    else node_list_destroy(job->nodes, job->fn_destroy_key, job->fn_destroy_value);
+
+    free(job);
+}
+
+//hand the removed nodes waiting to be freed to the reclaimer
+static void removed_flush(hashmap_t *hm)
+{
+    if(hm->removed == NULL) return;
+
+    reclaim_job_t *job = malloc(sizeof(*job));
+    if(!job)
+    {
+        perror("malloc");
+        node_list_destroy(hm->removed, hm->fn_destroy_key, hm->fn_destroy_value);
+    }
+    else
+    {
+        *job = (reclaim_job_t){
+            .nodes = hm->removed,
+            .fn_destroy_key = hm->fn_destroy_key,
+            .fn_destroy_value = hm->fn_destroy_value,
+        };
+        reclaimer_submit(job);
+    }
+
+    hm->removed = NULL;
+    hm->removed_count = 0;
+}
+
+//--------------- DUMP ---------------//
+
+typedef struct {
+    hashmap_t *hm;
+    dump_writer_t *writer;
+    hashmap_dump_format_t format;
+    format_fn_t format_key_fn;
+    format_fn_t format_value_fn;
+    bool first;
+} dump_ctx_t;
+
+static bool dump_range(hashmap_t *hm, hashmap_range_t range, dump_writer_t *writer, hashmap_dump_format_t format,
+                       format_fn_t format_key_fn, format_fn_t format_value_fn)
+{
+    //un fichier: les buffers pleins sont ecrits en arriere plan pendant que le suivant se remplit
+    writer->aio = NULL;
+    //(pas avec O_APPEND: pwrite y ignore l'offset, les ecritures en vol seraient dans le desordre)
+    writer->offset = writer->stream == NULL ? lseek(writer->fd, 0, SEEK_CUR) : -1;
+    if(writer->offset >= 0 && (fcntl(writer->fd, F_GETFL) & O_APPEND)) writer->offset = -1;
+    if(writer->offset >= 0) writer->aio = aio_file_create(writer->fd, HASHMAP_DUMP_BUFFER_SIZE, 0);
+
+    writer->buffer = writer->aio ? aio_write_buffer(writer->aio) : malloc(HASHMAP_DUMP_BUFFER_SIZE);
+    if(!writer->buffer) return (perror("malloc"), writer->aio && aio_file_destroy(writer->aio), false);
+    writer->used = 0;
+    writer->failed = false;
+
+    format_fn_t default_fn = format == HASHMAP_DUMP_BINARY ? format_raw
+                           : format == HASHMAP_DUMP_JSON ? format_json_hex : format_hex;
+
+    dump_ctx_t ctx = {
+        .hm = hm,
+        .writer = writer,
+        .format = format,
+        .format_key_fn = format_key_fn ? format_key_fn : default_fn,
+        .format_value_fn = format_value_fn ? format_value_fn : default_fn,
+        .first = true,
+    };
+
+    if(format == HASHMAP_DUMP_BINARY) writer_write(writer, HASHMAP_DUMP_MAGIC, sizeof(HASHMAP_DUMP_MAGIC));
+    if(format == HASHMAP_DUMP_JSON) writer_write(writer, "[", 1);
+
+    hashmap_range_foreach(hm, range, dump_pair, &ctx);
+
+    if(format == HASHMAP_DUMP_JSON) writer_write(writer, ctx.first ? "]\n" : "\n]\n", ctx.first ? 2 : 3);
+
+    writer_flush(writer);
+    if(writer->aio == NULL) free(writer->buffer);
+    else
+    {
+        //comme write(): la position du fichier est apres le dump
+        writer->failed = !aio_file_destroy(writer->aio) || writer->failed;
+        if(lseek(writer->fd, writer->offset, SEEK_SET) < 0){ perror("lseek"); writer->failed = true; }
+    }
+
+    return !writer->failed;
+}
+
+static void dump_pair(const void *key, void *value, void *ctx)
+{
+    dump_ctx_t *dump = ctx;
+    dump_writer_t *writer = dump->writer;
+    if(writer->failed) return;
+
+    switch(dump->format)
+    {
+        case HASHMAP_DUMP_TSV:
+            writer_format(writer, dump->format_key_fn, key, dump->hm->key_size, false);
+            writer_write(writer, "\t", 1);
+            writer_format(writer, dump->format_value_fn, value, dump->hm->value_size, false);
+            writer_write(writer, "\n", 1);
+            break;
+
+        case HASHMAP_DUMP_JSON:
+            if(dump->first) writer_write(writer, "\n\t{\"key\": ", 10);
+            else writer_write(writer, ",\n\t{\"key\": ", 11);
+            writer_format(writer, dump->format_key_fn, key, dump->hm->key_size, false);
+            writer_write(writer, ", \"value\": ", 11);
+            writer_format(writer, dump->format_value_fn, value, dump->hm->value_size, false);
+            writer_write(writer, "}", 1);
+            break;
+
+        case HASHMAP_DUMP_BINARY:
+            writer_format(writer, dump->format_key_fn, key, dump->hm->key_size, true);
+            writer_format(writer, dump->format_value_fn, value, dump->hm->value_size, true);
+            break;
+    }
+
+    dump->first = false;
+}
+
+static void* dump_file_worker(void *arg)
+{
+    dump_file_job_t *job = arg;
+
+    int fd = aio_open(job->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){ perror("open"); job->ok = false; return NULL; }
+
+    job->ok = hashmap_dump_range(job->hm, job->range, fd, job->format, job->format_key_fn, job->format_value_fn);
+    if(close(fd) != 0){ perror("close"); job->ok = false; }
+    return NULL;
+}
+
+//the buffer is only written once full (except at the end): the writes stay aligned for O_DIRECT
+static void writer_write(dump_writer_t *writer, const void *data, size_t size)
+{
+    const char *bytes = data;
+
+    while(size > 0 && !writer->failed)
+    {
+        size_t n = HASHMAP_DUMP_BUFFER_SIZE - writer->used;
+        if(n > size) n = size;
+
+        memcpy(writer->buffer + writer->used, bytes, n);
+        writer->used += n;
+        bytes += n;
+        size -= n;
+
+        if(writer->used == HASHMAP_DUMP_BUFFER_SIZE) writer_flush(writer);
+    }
+}
+
+//format the element directly into the buffer (preceded by its uint32 length for the binary format)
+static void writer_format(dump_writer_t *writer, format_fn_t fn, const void *element, size_t element_size, bool length_prefix)
+{
+    if(writer->failed) return;
+
+    size_t prefix = length_prefix ? sizeof(uint32_t) : 0;
+    size_t left = HASHMAP_DUMP_BUFFER_SIZE - writer->used;
+    size_t space = left > prefix ? left - prefix : 0;
+
+    size_t length = fn(element, element_size, writer->buffer + writer->used + (left > prefix ? prefix : 0), space);
+    uint32_t length_u32 = (uint32_t)length;
+
+    if(length < space)
+    {
+        if(prefix) memcpy(writer->buffer + writer->used, &length_u32, prefix);
+        writer->used += prefix + length;
+        return;
+    }
+
+    //pas assez de place dans ce qui reste du buffer: on formate dans un buffer de la bonne taille
+    char *tmp = malloc(length + 1);
+    if(!tmp){ perror("malloc"); writer->failed = true; return; }
+
+    fn(element, element_size, tmp, length + 1);
+    if(prefix) writer_write(writer, &length_u32, prefix);
+    writer_write(writer, tmp, length);
+    free(tmp);
+}
+
+static void writer_flush(dump_writer_t *writer)
+{
+    if(writer->failed || writer->used == 0){ writer->used = 0; return; }
+
+    if(writer->stream != NULL)
+    {
+        if(fwrite(writer->buffer, 1, writer->used, writer->stream) != writer->used){ perror("fwrite"); writer->failed = true; }
+        writer->used = 0;
+        return;
+    }
+
+    if(writer->aio != NULL)
+    {
+        //le buffer part en arriere plan, on continue dans le suivant
+        writer->failed = !aio_write_submit(writer->aio, writer->used, writer->offset);
+        writer->offset += (off_t)writer->used;
+        writer->used = 0;
+
+        char *next = writer->failed ? NULL : aio_write_buffer(writer->aio);
+        if(next != NULL) writer->buffer = next;
+        else writer->failed = true;
+        return;
+    }
+
+    size_t written = 0;
+    while(written < writer->used)
+    {
+        ssize_t n = write(writer->fd, writer->buffer + written, writer->used - written);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0){ perror("write"); writer->failed = true; break; }
+
+        written += (size_t)n;
+    }
+
+    writer->used = 0;
+}
+
+static size_t format_hex(const void *element, const size_t element_size, char *buffer, const size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    const unsigned char *bytes = element;
+
+    size_t length = element_size * 2;
+    if(length >= size) return length;
+
+    for(size_t i = 0; i < element_size; i++)
+    {
+        buffer[2 * i] = digits[bytes[i] >> 4];
+        buffer[2 * i + 1] = digits[bytes[i] & 0xf];
+    }
+
+    buffer[length] = '\0';
+    return length;
+}
+
+static size_t format_json_hex(const void *element, const size_t element_size, char *buffer, const size_t size)
+{
+    size_t length = element_size * 2 + 2;
+    if(length >= size) return length;
+
+    buffer[0] = '"';
+    format_hex(element, element_size, buffer + 1, size - 1);
+    buffer[length - 1] = '"';
+    buffer[length] = '\0';
+    return length;
+}
+
+static size_t format_raw(const void *element, const size_t element_size, char *buffer, const size_t size)
+{
+    if(element_size < size) memcpy(buffer, element, element_size);
+    return element_size;
+}
+
+
+//--------------- BULK LOAD ---------------//
+
+static void* load_parse_worker(void *arg)
+{
+    load_chunk_t *chunk = arg;
+    chunk->ok = load_stream(chunk);
+    return NULL;
+}
+
+static void* load_insert_worker(void *arg)
+{
+    load_insert_t *insert = arg;
+    hashmap_t *hm = insert->hm;
+
+    //les buckets d'un proprietaire ne sont touches que par ce thread: pas de verrou
+    for(size_t owner = insert->owner_begin; owner < insert->owner_end; owner++)
+    {
+        for(size_t i = 0; i < insert->chunk_count; i++)
+        {
+            node_t *node = insert->chunks[i].heads[owner];
+            while(node != NULL)
+            {
+                node_t *next = node->next;
+                node->next = NULL;
+
+                bucket_t *bucket = &hm->table[bucket_index(node->hash, hm->capacity)];
+                if(bucket_find(hm, bucket, node->hash, node->key) != NULL) node_destroy(hm, node);//doublon: la premiere ligne gagne
+                else
+                {
+                    bucket_insert(hm, bucket, node);
+                    mutation_notify(hm, HASHMAP_MUTATION_ADD, node);
+                    insert->added++;
+                }
+
+                node = next;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+//read the chunk by blocks (read ahead by aio), and parse the whole lines / records of each block
+//in place: only a line cut by the end of a block is copied
+static bool load_stream(load_chunk_t *chunk)
+{
+    bool tsv = chunk->format == HASHMAP_DUMP_TSV;
+    size_t record_size = 2 * sizeof(uint32_t) + chunk->hm->key_size + chunk->hm->value_size;
+
+    aio_file_t *aio = aio_file_create(chunk->fd, HASHMAP_DUMP_BUFFER_SIZE, 0);
+    if(!aio) return false;
+
+    char *carry = NULL;//debut de la ligne coupee par la fin du bloc precedent
+    size_t carry_length = 0, carry_capacity = 0;
+    bool ok = aio_read_start(aio, chunk->file_begin, chunk->file_end);
+
+    while(ok)
+    {
+        const char *data = NULL;
+        ssize_t length = aio_read_next(aio, &data);
+        if(length <= 0){ ok = length == 0; break; }
+
+        const char *current = data;
+        const char *end = data + length;
+
+        //on complete d'abord la ligne coupee
+        if(carry_length > 0)
+        {
+            const char *newline = tsv ? memchr(current, '\n', (size_t)(end - current)) : NULL;
+            size_t missing = !tsv ? record_size - carry_length : newline ? (size_t)(newline + 1 - current) : (size_t)(end - current);
+            if(missing > (size_t)(end - current)) missing = (size_t)(end - current);
+
+            ok = load_buffer_reserve(&carry, &carry_capacity, carry_length + missing);
+            if(!ok) break;
+
+            memcpy(carry + carry_length, current, missing);
+            carry_length += missing;
+            current += missing;
+
+            bool complete = tsv ? carry[carry_length - 1] == '\n' : carry_length == record_size;
+            if(!complete) continue;
+
+            ok = load_parse_range(chunk, carry, carry + carry_length);
+            carry_length = 0;
+        }
+
+        //les lignes entieres sont lues directement dans le bloc
+        const char *last = end;
+        if(tsv) while(last > current && last[-1] != '\n') last--;
+        else last = current + (size_t)(end - current) / record_size * record_size;
+
+        ok = ok && load_parse_range(chunk, current, last) && load_buffer_reserve(&carry, &carry_capacity, (size_t)(end - last));
+        if(!ok) break;
+
+        carry_length = (size_t)(end - last);
+        if(carry_length > 0) memcpy(carry, last, carry_length);
+    }
+
+    //derniere ligne sans \n
+    if(ok && carry_length > 0)
+    {
+        if(tsv) ok = load_parse_range(chunk, carry, carry + carry_length);
+        else ok = (fprintf(stderr, "hashmap_load: truncated record\n"), false);
+    }
+
+    ok = aio_file_destroy(aio) && ok;
+    free(carry);
+    return ok;
+}
+
+static bool load_parse_range(load_chunk_t *chunk, const char *begin, const char *end)
+{
+    chunk->begin = begin;
+    chunk->end = end;
+    return chunk->format == HASHMAP_DUMP_BINARY ? load_parse_binary(chunk) : load_parse_tsv(chunk);
+}
+
+//offset just after the next newline (or end)
+static off_t load_next_line(int fd, off_t offset, off_t end)
+{
+    char block[4096];
+
+    while(offset < end)
+    {
+        ssize_t n = pread(fd, block, sizeof(block), offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return end;
+
+        const char *newline = memchr(block, '\n', (size_t)n);
+        if(newline) return offset + (newline - block) + 1;
+
+        offset += n;
+    }
+
+    return end;
+}
+
+static bool load_parse_tsv(load_chunk_t *chunk)
+{
+    hashmap_t *hm = chunk->hm;
+    char *key = NULL, *value = NULL;
+    size_t key_capacity = 0, value_capacity = 0;
+    bool ok = true;
+
+    const char *line = chunk->begin;
+    while(ok && line < chunk->end)
+    {
+        const char *newline = memchr(line, '\n', (size_t)(chunk->end - line));
+        const char *line_end = newline ? newline : chunk->end;
+        const char *next = newline ? newline + 1 : chunk->end;
+        if(line_end > line && line_end[-1] == '\r') line_end--;
+        if(line_end == line){ line = next; continue; }//ligne vide
+
+        const char *tab = memchr(line, '\t', (size_t)(line_end - line));
+        if(!tab)
+        {
+            fprintf(stderr, "hashmap_load: line without tab: %.*s\n", (int)(line_end - line), line);
+            ok = false;
+            break;
+        }
+
+        //buffers d'au moins max(taille de l'element, longueur du texte + 1)
+        size_t key_length = (size_t)(tab - line);
+        size_t value_length = (size_t)(line_end - tab - 1);
+        ok = load_buffer_reserve(&key, &key_capacity, key_length + 1 > hm->key_size ? key_length + 1 : hm->key_size)
+          && load_buffer_reserve(&value, &value_capacity, value_length + 1 > hm->value_size ? value_length + 1 : hm->value_size);
+        if(!ok) break;
+
+        if(!chunk->parse_key_fn(line, key_length, key, hm->key_size) || !chunk->parse_value_fn(tab + 1, value_length, value, hm->value_size))
+        {
+            fprintf(stderr, "hashmap_load: invalid line: %.*s\n", (int)(line_end - line), line);
+            ok = false;
+            break;
+        }
+
+        ok = load_append(chunk, key, value);
+        line = next;
+    }
+
+    free(key);
+    free(value);
+    return ok;
+}
+
+static bool load_parse_binary(load_chunk_t *chunk)
+{
+    hashmap_t *hm = chunk->hm;
+    size_t record_size = 2 * sizeof(uint32_t) + hm->key_size + hm->value_size;
+
+    //les clefs et valeurs du fichier ne sont pas alignees: copiees avant d'etre hashees
+    char *key = malloc(hm->key_size);
+    char *value = malloc(hm->value_size);
+    bool ok = key && value;
+    if(!ok) perror("malloc");
+
+    //enregistrements: (longueur, clef) (longueur, valeur), les longueurs sont verifiees
+    for(const char *record = chunk->begin; ok && record < chunk->end; record += record_size)
+    {
+        uint32_t key_length, value_length;
+        memcpy(&key_length, record, sizeof(uint32_t));
+        memcpy(&value_length, record + sizeof(uint32_t) + hm->key_size, sizeof(uint32_t));
+        if(key_length != hm->key_size || value_length != hm->value_size)
+        {
+            fprintf(stderr, "hashmap_load: record with %u+%u bytes (expected %zu+%zu)\n", key_length, value_length, hm->key_size, hm->value_size);
+            ok = false;
+            break;
+        }
+
+        memcpy(key, record + sizeof(uint32_t), hm->key_size);
+        memcpy(value, record + 2 * sizeof(uint32_t) + hm->key_size, hm->value_size);
+        ok = load_append(chunk, key, value);
+    }
+
+    free(key);
+    free(value);
+    return ok;
+}
+
+//grow a parse buffer to at least size bytes
+static bool load_buffer_reserve(char **buffer, size_t *capacity, size_t size)
+{
+    if(size <= *capacity) return true;
+
+    char *grown = realloc(*buffer, size);
+    if(!grown) return (perror("realloc"), false);
+
+    *buffer = grown;
+    *capacity = size;
+    return true;
+}
+
+static bool load_append(load_chunk_t *chunk, const void *key, const void *value)
+{
+    hashmap_t *hm = chunk->hm;
+    size_t hash = hm->fn_hash(key, hm->key_size);
+
+    node_t *node = node_create(hm, key, value, hash);
+    if(!node) return false;
+
+    //proprietaire = bits du hash juste au dessus de ceux d'un groupe de buckets
+    size_t owner = (hash >> LOAD_OWNER_SHIFT) & (chunk->owners - 1);
+    if(chunk->tails[owner]) chunk->tails[owner]->next = node;
+    else chunk->heads[owner] = node;
+    chunk->tails[owner] = node;
+
+    chunk->parsed++;
+    return true;
+}
+
+//reverse of format_hex
+static bool parse_hex(const char *text, const size_t length, void *element, const size_t element_size)
+{
+    if(length != element_size * 2) return false;
+
+    unsigned char *bytes = element;
+    for(size_t i = 0; i < length; i++)
+    {
+        char c = text[i];
+        int digit = c >= '0' && c <= '9' ? c - '0'
+                  : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if(digit < 0) return false;
+
+        if(i % 2 == 0) bytes[i / 2] = (unsigned char)(digit << 4);
+        else bytes[i / 2] |= (unsigned char)digit;
+    }
+
+    return true;
+}
+
+
 //--------------- HASH FUNCTIONS ---------------//
 //source for djb2 and sdbm: http://www.cse.yorku.ca/~oz/hash.html
 
@@ -380,3 +2250,59 @@ void* hashmap_fn_alloc_copy_str(const void *element, const size_t size)
     (void)size;//unused - to avoid warning
     return strdup((char*)element);
 }
+
+size_t hashmap_fn_format_str(const void *element, const size_t element_size, char *buffer, const size_t size)
+{
+    (void)element_size;//unused - to avoid warning
+    return (size_t)snprintf(buffer, size, "%s", (const char*)element);
+}
+
+static inline void format_put(char *buffer, const size_t size, size_t *length, char c)
+{
+    if(*length < size) buffer[*length] = c;
+    (*length)++;
+}
+
+size_t hashmap_fn_format_json_str(const void *element, const size_t element_size, char *buffer, const size_t size)
+{
+    (void)element_size;//unused - to avoid warning
+    static const char digits[] = "0123456789abcdef";
+
+    //la longueur complete est calculee meme si le buffer est trop petit (comme snprintf)
+    size_t length = 0;
+    format_put(buffer, size, &length, '"');
+    for(const unsigned char *c = element; *c != '\0'; c++)
+    {
+        switch(*c)
+        {
+            case '"': format_put(buffer, size, &length, '\\'); format_put(buffer, size, &length, '"'); break;
+            case '\\': format_put(buffer, size, &length, '\\'); format_put(buffer, size, &length, '\\'); break;
+            case '\n': format_put(buffer, size, &length, '\\'); format_put(buffer, size, &length, 'n'); break;
+            case '\r': format_put(buffer, size, &length, '\\'); format_put(buffer, size, &length, 'r'); break;
+            case '\t': format_put(buffer, size, &length, '\\'); format_put(buffer, size, &length, 't'); break;
+            default:
+                if(*c >= 0x20){ format_put(buffer, size, &length, (char)*c); break; }
+
+                //autres caracteres de controle: \u00XX
+                format_put(buffer, size, &length, '\\');
+                format_put(buffer, size, &length, 'u');
+                format_put(buffer, size, &length, '0');
+                format_put(buffer, size, &length, '0');
+                format_put(buffer, size, &length, digits[*c >> 4]);
+                format_put(buffer, size, &length, digits[*c & 0xf]);
+                break;
+        }
+    }
+    format_put(buffer, size, &length, '"');
+
+    if(length < size) buffer[length] = '\0';
+    return length;
+}
+
+bool hashmap_fn_parse_str(const char *text, const size_t length, void *element, const size_t element_size)
+{
+    (void)element_size;//unused - to avoid warning
+    memcpy(element, text, length);
+    ((char*)element)[length] = '\0';
+    return true;
+}
@@ -4,7 +4,10 @@
  *  
  *  This is a simple generic dynanic hashmap implementation in C.
  *  It uses separate chaining to handle collisions.
- *  It resize automatically when the load balance is too high or too low (const in hashmap.c)
+ *  A chain that grows too long (bad hash function, adversarial keys...) is converted into a balanced tree,
+ *  ordered by (hash, compare function), and back into a chain when it shrinks (const in hashmap.h).
+ *  It resize automatically when the load balance is too high or too low (const in hashmap.c),
+ *  the capacity is always a power of two (the index of a key is the low bits of its hash).
  *
  *  ---------- Features ---------
  *  - Generic : can store any type of key-value pairs
@@ -32,6 +35,10 @@
 #define __HASHMAP_H__
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "histogram.h"
 
 typedef unsigned long size_t;
 typedef struct _hashmap_t hashmap_t;
@@ -40,10 +47,61 @@ typedef struct _hashmap_t hashmap_t;
 #define HASHMAP_DEFAULT_CAPACITY 16
 #define HASHMAP_MINIMAL_CAPACITY 2
 
+//collision chains settings
+#define HASHMAP_TREEIFY_THRESHOLD 8   //a chain longer than this is converted into a balanced tree
+#define HASHMAP_UNTREEIFY_THRESHOLD 6 //a tree smaller than this is converted back into a chain
+
 //default load balance thresholds
 #define HASHMAP_DEFAULT_LOAD_BALANCE_THRESHOLD_MAX 0.75f
 #define HASHMAP_DEFAULT_LOAD_BALANCE_THRESHOLD_MIN 0.25f
 
+//table allocation modes
+typedef enum {
+    HASHMAP_ALLOC_DEFAULT,  //calloc
+    HASHMAP_ALLOC_HUGEPAGE, //anonymous mmap + MADV_HUGEPAGE (transparent huge pages)
+    HASHMAP_ALLOC_HUGETLB,  //anonymous mmap from the hugetlbfs pool (falls back to HASHMAP_ALLOC_HUGEPAGE)
+} hashmap_alloc_mode_t;
+
+#define HASHMAP_HUGEPAGE_MIN_SIZE (2UL << 20) //smaller tables always use calloc, even with a huge page mode
+
+//batched lookups
+#define HASHMAP_BATCH_SIZE 16 //keys hashed and prefetched together by hashmap_get_batch
+
+//parallel iteration
+#define HASHMAP_PARALLEL_CHUNK 1024 //buckets claimed at once by a thread of hashmap_parallel_foreach
+
+//dump settings
+#define HASHMAP_DUMP_BUFFER_SIZE (1UL << 20) //the dump functions write by blocks of this size
+#define HASHMAP_DUMP_MAGIC "HMDUMP1" //first 8 bytes (with the '\0') of a binary dump
+
+//dump formats (see hashmap_dump)
+typedef enum {
+    HASHMAP_DUMP_TSV,    //one "key\tvalue\n" line per pair
+    HASHMAP_DUMP_JSON,   //[{"key": key, "value": value}, ...] (the formatters must write JSON values)
+    HASHMAP_DUMP_BINARY, //HASHMAP_DUMP_MAGIC, then (uint32 length, bytes) for the key and the value of each pair
+} hashmap_dump_format_t;
+
+//latency sampling settings (see hashmap_set_latency_sampling)
+#define HASHMAP_LATENCY_SLOTS 64 //per-thread histograms of a map (the threads after the 64th share them)
+#define HASHMAP_LATENCY_SUB_BUCKET_BITS 5 //32 sub-buckets per power of two: about 3% of error
+#define HASHMAP_LATENCY_MAX_BITS 36 //latencies counted up to 2^36 ns (about 69 s), the longer ones in the last bucket
+
+//operations timed by the latency sampling
+typedef enum {
+    HASHMAP_LATENCY_GET,        //hashmap_get
+    HASHMAP_LATENCY_ADD,        //hashmap_add, with the resize and the node creation it triggers
+    HASHMAP_LATENCY_REMOVE,     //hashmap_remove, with the resize it triggers
+    HASHMAP_LATENCY_RESIZE,     //every resize (not sampled: they are rare)
+    HASHMAP_LATENCY_NODE_CREATE,//allocation and copy of a new key-value pair (add, put, update)
+    HASHMAP_LATENCY_OPERATIONS, //number of timed operations
+} hashmap_latency_op_t;
+
+//range of buckets [begin, end), for the splittable iteration
+typedef struct {
+    size_t begin;
+    size_t end;
+} hashmap_range_t;
+
 //macros for hash functions
 #define HASH_FUNC_DJB2 hashmap_fn_hash_djb2
 #define HASH_FUNC_SDBM hashmap_fn_hash_sdbm
@@ -54,12 +112,28 @@ typedef struct _hashmap_t hashmap_t;
 #define HASHMAP_PRINT_STRING hashmap_fn_print_str
 #define HASHMAP_COMPARE_STRING hashmap_fn_compare_str
 #define HASHMAP_ALLOC_COPY_STRING hashmap_fn_alloc_copy_str
+#define HASHMAP_FORMAT_STRING hashmap_fn_format_str
+#define HASHMAP_FORMAT_JSON_STRING hashmap_fn_format_json_str
+#define HASHMAP_PARSE_STRING hashmap_fn_parse_str
 
 typedef size_t (*hash_fn_t)(const void* key, const size_t size);
 typedef void (*print_fn_t)(const void *element);
 typedef void (*destroy_fn_t)(void *element);
 typedef void* (*alloc_copy_fn_t)(const void *element, const size_t size);
 typedef int (*compare_fn_t)(const void *a, const void *b, const size_t size);
+typedef void (*update_fn_t)(void *value, void *ctx);
+typedef void (*foreach_fn_t)(const void *key, void *value, void *ctx);
+typedef size_t (*format_fn_t)(const void *element, const size_t element_size, char *buffer, const size_t size);
+typedef bool (*parse_fn_t)(const char *text, const size_t length, void *element, const size_t element_size);
+
+//kind of modification reported to the mutation function (see hashmap_set_fn_mutation)
+typedef enum {
+    HASHMAP_MUTATION_ADD,   //a new key
+    HASHMAP_MUTATION_UPDATE,//a new value for an existing key
+    HASHMAP_MUTATION_REMOVE,//a removed key (value: the value it had)
+} hashmap_mutation_t;
+
+typedef void (*mutation_fn_t)(hashmap_mutation_t mutation, const void *key, const void *value, void *ctx);
 
 /// @brief Create a new hashmap
 /// @param initial_capacity The initial capacity of the hashmap 
@@ -70,7 +144,7 @@ typedef int (*compare_fn_t)(const void *a, const void *b, const size_t size);
 ///
 /// @note The key_size and value_size must be greater than 0 (asserted)
 /// @note The hash_fn can be NULL, in this case, the hashmap will use the default hash function (djb2)
-/// @note if initial_capacity is less than minimal_capacity, it will be set to minimal_capacity
+/// @note initial_capacity is rounded up to a power of two (and at least HASHMAP_MINIMAL_CAPACITY)
 /// 
 /// @note If You want to provide custom functions, use the following functions:
 /// @see hashmap_set_fn_alloc_copy_key : to provide custom copy functions for keys [DEFAULT: malloc+mempcy]
@@ -101,13 +175,39 @@ hashmap_t* hashmap_create(size_t initial_capacity, hash_fn_t hash_fn,
 /// @see hashmap_set_value_destroy_fn
 void hashmap_destroy(hashmap_t *hm);
 
+/// @brief Destroy the hashmap on a background thread
+/// @param hm The hashmap to destroy (must not be used anymore after this call)
+/// @note The map is handed to a reclaimer thread (shared by every map, started on first use) which
+///       calls hashmap_destroy: the caller does not wait for the key-value pairs to be freed
+/// @note The destroy functions are called from the reclaimer thread
+/// @note If the reclaimer thread cannot be started, the map is destroyed right away
+/// @see hashmap_reclaimer_wait
+void hashmap_destroy_async(hashmap_t *hm);
+
+/// @brief Wait until the reclaimer thread has destroyed everything handed to it so far
+/// @note Call it before exiting if the destroy functions have side effects (the reclaimer thread
+///       does not outlive the process)
+void hashmap_reclaimer_wait(void);
+
 /// @brief Get the value associated with the key
 /// @param hm The hashmap
 /// @param key The key to search for
 /// @return A pointer to the value or NULL if the key was not found
-/// @complexity ~O(1) -> O(n) where n is the number of same hash keys
+/// @complexity ~O(1) -> O(log n) where n is the number of keys in the same bucket
 void* hashmap_get(hashmap_t *hm, const void* key);
 
+/// @brief Get the values associated with several keys
+/// @param hm The hashmap
+/// @param keys The keys to search for
+/// @param values Receives a pointer to the value of each key, or NULL if the key was not found
+/// @param count The number of keys
+/// @return The number of keys found
+/// @note The keys are handled by groups of HASHMAP_BATCH_SIZE: their buckets and their first nodes
+///       are prefetched before the lookups, so the cache misses of a group overlap instead of
+///       adding up (useful for big tables, with many independent lookups)
+/// @see hashmap_get
+size_t hashmap_get_batch(hashmap_t *hm, const void *const *keys, void **values, size_t count);
+
 /// @brief Add a new key-value pair to the hashmap
 /// @param hm The hashmap
 /// @param key The key to add
@@ -117,14 +217,134 @@ void* hashmap_get(hashmap_t *hm, const void* key);
 /// @complexity O(1)
 void* hashmap_add(hashmap_t *hm, const void* key, const void* value);
 
+/// @brief Add several key-value pairs, with at most one resize
+/// @param hm The hashmap
+/// @param keys The keys to add
+/// @param values The values to add (values[i] goes with keys[i])
+/// @param count The number of pairs
+/// @return true on success, false if an error occured (the pairs before the error are added)
+/// @note Same semantic as hashmap_add: a key that already exists keeps its old value
+/// @see hashmap_reserve
+bool hashmap_add_bulk(hashmap_t *hm, const void *const *keys, const void *const *values, size_t count);
+
+/// @brief Associate the key with the value, replacing the old value if the key exists
+/// @param hm The hashmap
+/// @param key The key
+/// @param value The value (copied with the alloc_copy function of the values)
+/// @return A pointer to the stored value or NULL if an error occured (the old value is kept then)
+/// @note The old value is destroyed: the pointers to it (hashmap_get...) become invalid
+/// @complexity ~O(1) -> O(log n) where n is the number of keys in the same bucket
+void* hashmap_put(hashmap_t *hm, const void *key, const void *value);
+
+/// @brief Grow the hashmap so that it holds count key-value pairs without resizing
+/// @param hm The hashmap
+/// @param count The number of key-value pairs (in total, not in addition to the current ones)
+/// @note Does nothing if the capacity is already big enough (it never shrinks the map)
+void hashmap_reserve(hashmap_t *hm, size_t count);
+
+/// @brief Load the key-value pairs of a file (the reverse of hashmap_dump), on several threads
+/// @param hm The hashmap
+/// @param path The file to load
+/// @param format HASHMAP_DUMP_TSV or HASHMAP_DUMP_BINARY (JSON is not supported)
+/// @param nthreads The number of threads, 0 for the number of online CPUs
+/// @param parse_key_fn The function that reads a key from its text (TSV only, NULL: hexadecimal)
+/// @param parse_value_fn The function that reads a value from its text (TSV only, NULL: hexadecimal)
+/// @return true on success, false if the file cannot be read or is invalid (nothing is added then)
+/// @note The file is split into one chunk per thread (at line / record boundaries), each thread
+///       parses its chunk, hashes the keys and allocates the pairs. The map is then resized once,
+///       and the pairs are inserted in parallel (each thread owns a disjoint set of buckets)
+/// @note Each thread reads its chunk by blocks of HASHMAP_DUMP_BUFFER_SIZE, several blocks ahead
+///       (io_uring, or a pool of pread threads, with O_DIRECT when possible - see aio.h): the next
+///       blocks are read from the disk while the current one is parsed and hashed
+/// @note Same semantic as hashmap_add: for a key present several times, the first line wins
+/// @note The binary format must have fixed size records: the ones written by hashmap_dump without
+///       formatters (key_size and value_size raw bytes)
+/// @note The hash, alloc_copy and destroy functions are called from several threads
+/// @note A parse function reads length bytes of text (not null-terminated) into element, which has
+///       max(element_size, length + 1) bytes, and returns false if the text is invalid
+/// @see HASHMAP_PARSE_STRING : copy the text as a null-terminated string
+bool hashmap_load(hashmap_t *hm, const char *path, hashmap_dump_format_t format, size_t nthreads,
+                  parse_fn_t parse_key_fn, parse_fn_t parse_value_fn);
+
+/// @brief Update the value associated with the key in place
+/// @param hm The hashmap
+/// @param key The key of the value to update
+/// @param update_fn The function that modifies the value (called with the value and ctx)
+/// @param ctx User data given to update_fn
+/// @return A pointer to the updated value or NULL if an error occured
+/// @note If the key does not exist, a default value (value_size zero bytes, copied with the alloc_copy
+///       function of the values) is inserted first, then updated
+/// @note Only one lookup is done, where get + modify + add would do two
+/// @complexity ~O(1) -> O(log n) where n is the number of keys in the same bucket
+void* hashmap_update(hashmap_t *hm, const void *key, update_fn_t update_fn, void *ctx);
+
+/// @brief Add delta to the int64_t value associated with the key (0 is inserted if the key does not exist)
+/// @param hm The hashmap
+/// @param key The key of the counter
+/// @param delta The value to add
+/// @return The value of the counter BEFORE the addition
+/// @note The value_size must be sizeof(int64_t) (asserted)
+/// @note If the allocation of a new counter fails, 0 is returned and nothing is inserted
+/// @see hashmap_update
+int64_t hashmap_fetch_add_i64(hashmap_t *hm, const void *key, int64_t delta);
+
 /// @brief Remove a key-value pair from the hashmap
 /// @param hm The hashmap
 /// @param key The key to remove
 /// @return true if the key was removed, false otherwise (not found)
 /// @note AFTER removing the key, the hashmap will automatically shrink if the load balance is too low
-/// @complexity ~O(1) -> O(n) where n is the number of same hash keys
+/// @complexity ~O(1) -> O(log n) where n is the number of keys in the same bucket
 bool hashmap_remove(hashmap_t *hm, const void *key);
 
+/// @brief Visit a bounded number of buckets, starting at cursor (incremental iteration)
+/// @param hm The hashmap
+/// @param cursor 0 to start a new scan, then the value returned by the previous call
+/// @param count The number of buckets to visit (0 for no limit: the end of the scan)
+/// @param fn The function called with every key-value pair of the visited buckets
+/// @param ctx User data given to fn
+/// @return The cursor for the next call, 0 when the scan is complete
+/// @note Every key-value pair present during the whole scan is visited, even if the map is
+///       resized between two calls (the cursor goes through the buckets in reverse-binary order).
+///       A pair can be visited more than once if the map shrinks during the scan
+/// @note fn must not add or remove keys, but the map can be modified freely between two calls
+/// @complexity O(count) buckets
+size_t hashmap_scan(hashmap_t *hm, size_t cursor, size_t count, foreach_fn_t fn, void *ctx);
+
+/// @brief Get the range of all the buckets of the hashmap (splittable iteration)
+/// @param hm The hashmap
+/// @return The range [0, capacity)
+/// @note A range stays valid as long as the map is not modified (a resize changes the buckets)
+/// @see hashmap_range_split
+/// @see hashmap_range_foreach
+hashmap_range_t hashmap_range(hashmap_t *hm);
+
+/// @brief Split a range in two halves (to hand one of them to an other thread)
+/// @param range The range to split, keeps the first half
+/// @param other Receives the second half
+/// @return true if the range was split, false if it has less than 2 buckets (other is untouched)
+bool hashmap_range_split(hashmap_range_t *range, hashmap_range_t *other);
+
+/// @brief Call fn with every key-value pair of the buckets of the range
+/// @param hm The hashmap
+/// @param range A range of the hashmap (see hashmap_range)
+/// @param fn The function called with every key-value pair of the range
+/// @param ctx User data given to fn
+/// @note The disjoint ranges of the same map can be visited from several threads at the same time
+///       (as long as nobody modifies the map): fn can modify the values of its range in place
+void hashmap_range_foreach(hashmap_t *hm, hashmap_range_t range, foreach_fn_t fn, void *ctx);
+
+/// @brief Call fn with every key-value pair of the hashmap, from several threads
+/// @param hm The hashmap
+/// @param nthreads The number of threads (calling thread included), 0 for the number of online CPUs
+/// @param fn The function called with every key-value pair (from any of the threads)
+/// @param ctx User data given to fn (shared by the threads: fn must synchronize its writes to ctx)
+/// @note The buckets are claimed by chunks of HASHMAP_PARALLEL_CHUNK, so a thread that ends on
+///       short chains takes more chunks: the threads finish together even if the chains are uneven
+/// @note Each pair is visited exactly once, fn can modify the value in place but must not add or
+///       remove keys (the map must not be modified until hashmap_parallel_foreach returns)
+/// @note If a thread cannot be started, the other threads (at least the caller) do its share
+void hashmap_parallel_foreach(hashmap_t *hm, size_t nthreads, foreach_fn_t fn, void *ctx);
+
 /// @brief Print the hashmap : some informations about the hashmap and all the key-value pairs
 /// @param hm The hashmap
 /// @param print_key_fn The function to print the key
@@ -132,6 +352,50 @@ bool hashmap_remove(hashmap_t *hm, const void *key);
 /// @note For better results, print on single line without newline character at the end
 void hashmap_print(hashmap_t *hm, print_fn_t print_key_fn, print_fn_t print_value_fn);
 
+/// @brief Write all the key-value pairs to a stream, through a buffer of HASHMAP_DUMP_BUFFER_SIZE
+/// @param hm The hashmap
+/// @param stream The stream to write to (flushed before and after the dump)
+/// @param format The format of the dump
+/// @param format_key_fn The function that writes a key into the buffer (NULL: hexadecimal for the
+///                      text formats, the key_size raw bytes for HASHMAP_DUMP_BINARY)
+/// @param format_value_fn The function that writes a value into the buffer (NULL: same as the keys)
+/// @return true on success, false if a write failed
+/// @note A formatter works like snprintf: it writes at most size bytes and returns the length of
+///       the complete text. If the length is not smaller than size, it is called again with a bigger buffer
+/// @note The pairs are formatted directly into the buffer, which is written with one call per
+///       block: much faster than hashmap_print on big maps
+/// @see HASHMAP_FORMAT_STRING : the string as is (TSV)
+/// @see HASHMAP_FORMAT_JSON_STRING : the string quoted and escaped (JSON)
+bool hashmap_dump(hashmap_t *hm, FILE *stream, hashmap_dump_format_t format,
+                  format_fn_t format_key_fn, format_fn_t format_value_fn);
+
+/// @brief Same as hashmap_dump, on a file descriptor
+/// @note If the file can seek, the full buffers are written in the background (io_uring, or a pool
+///       of pwrite threads - see aio.h) while the next ones are filled: the serialization of the
+///       pairs and the disk writes overlap. The file position ends up after the dump, like with write()
+/// @see hashmap_dump
+bool hashmap_dump_fd(hashmap_t *hm, int fd, hashmap_dump_format_t format,
+                     format_fn_t format_key_fn, format_fn_t format_value_fn);
+
+/// @brief Same as hashmap_dump_fd, for the pairs of a range of buckets only
+/// @note The output is a complete dump (JSON array, binary header...): the disjoint ranges of a map
+///       can be dumped from several threads at the same time, each to its own file
+/// @see hashmap_range_split
+bool hashmap_dump_range(hashmap_t *hm, hashmap_range_t range, int fd, hashmap_dump_format_t format,
+                        format_fn_t format_key_fn, format_fn_t format_value_fn);
+
+/// @brief Dump the hashmap into several files in parallel (one thread per file)
+/// @param hm The hashmap
+/// @param path The files are named "<path>.0", "<path>.1"... (created or truncated)
+/// @param chunks The number of files, each one holds a range of buckets (0 for the number of online CPUs)
+/// @return true on success, false if a file could not be written
+/// @note The map must not be modified until hashmap_dump_files returns
+/// @note The files are opened with O_DIRECT if the file system supports it: a big snapshot does
+///       not evict the hot data from the page cache
+/// @see hashmap_dump_range
+bool hashmap_dump_files(hashmap_t *hm, const char *path, size_t chunks, hashmap_dump_format_t format,
+                        format_fn_t format_key_fn, format_fn_t format_value_fn);
+
 /// @brief Get the number of key-value pairs in the hashmap
 /// @param hm The hashmap
 /// @return The number of key-value pairs
@@ -145,6 +409,12 @@ size_t hashmap_count(hashmap_t *hm);
 /// @complexity O(1)
 size_t hashmap_capacity(hashmap_t *hm);
 
+/// @brief Get the size of the keys (the key_size given to hashmap_create)
+size_t hashmap_key_size(hashmap_t *hm);
+
+/// @brief Get the size of the values (the value_size given to hashmap_create)
+size_t hashmap_value_size(hashmap_t *hm);
+
 /// @brief Set the load balance thresholds
 /// @param hm The hashmap
 /// @param min The minimum load balance threshold (if the load balance is less than this value, the hashmap will shrink)
@@ -155,6 +425,33 @@ size_t hashmap_capacity(hashmap_t *hm);
 /// @see HASHMAP_DEFAULT_LOAD_BALANCE_THRESHOLD_MAX
 void hashmap_set_load_balance_threshold(hashmap_t *hm, float min, float max);
 
+/// @brief Set how the table (the array of buckets) is allocated [DEFAULT: HASHMAP_ALLOC_DEFAULT]
+/// @param hm The hashmap
+/// @param mode The allocation mode
+/// @note The current table is reallocated right away, the next resizes will also use this mode
+/// @note With HASHMAP_ALLOC_HUGEPAGE and HASHMAP_ALLOC_HUGETLB, the table is backed by 2MB pages
+///       (less TLB misses on giant maps) and is not zeroed explicitly: the kernel provides zero pages
+///       lazily, so a resize only touches the buckets it fills
+/// @note Tables smaller than HASHMAP_HUGEPAGE_MIN_SIZE always use calloc
+/// @see hashmap_alloc_mode_t
+void hashmap_set_alloc_mode(hashmap_t *hm, hashmap_alloc_mode_t mode);
+
+/// @brief Allocate the table (the array of buckets) on a NUMA node [DEFAULT: -1, no binding]
+/// @param hm The hashmap
+/// @param node The NUMA node, or -1 to remove the binding
+/// @note The current table is reallocated right away (with mmap + mbind), the next resizes will also use this node
+/// @note Best effort: the binding is silently ignored if the kernel does not support NUMA policies
+/// @note Only the table is bound, the key-value pairs are allocated by the calling thread (see numa_map.h)
+void hashmap_set_numa_node(hashmap_t *hm, int node);
+
+/// @brief Free the removed key-value pairs by batches [DEFAULT: 0, freed by hashmap_remove]
+/// @param hm The hashmap
+/// @param batch_size The number of removed pairs kept before they are freed, 0 to free them right away
+/// @note Each full batch is handed to the reclaimer thread (see hashmap_destroy_async): hashmap_remove
+///       does not call the destroy functions anymore, so they must be safe to call from an other thread
+/// @note The pairs still waiting when the map is destroyed are freed by hashmap_destroy
+void hashmap_set_free_batch(hashmap_t *hm, size_t batch_size);
+
 /// @brief Set the function to allocate and copy keys [DEFAULT: malloc+memcpy]
 /// @param hm The hashmap
 /// @param key_alloc_fn The function to allocate and copy keys
@@ -190,10 +487,47 @@ void hashmap_set_fn_destroy_value(hashmap_t *hm, destroy_fn_t value_destroy_fn);
 ///       0 : equal
 ///      -1 : a < b
 ///       1 : a > b
+/// @note The order must be consistent (total order): it is used to sort the keys of long collision chains
 ///
 /// @see HASHMAP_COMPARE_STRING : compare two strings using strcmp 
 void hashmap_set_fn_compare(hashmap_t *hm, compare_fn_t compare_fn);
 
+/// @brief Set the function called after each modification of the map [DEFAULT: NULL, none]
+/// @param hm The hashmap
+/// @param mutation_fn The function, called with the kind of modification, the stored key and value, and ctx
+/// @param ctx User data given to mutation_fn
+/// @note Reported: hashmap_add / hashmap_add_bulk / hashmap_put (new keys), hashmap_put / hashmap_update /
+///       hashmap_fetch_add_i64 (new values), hashmap_remove (before the pair is destroyed), hashmap_load
+/// @note The values modified in place through a pointer (hashmap_get, foreach...) are NOT reported
+/// @note mutation_fn must not modify the map. hashmap_load calls it from the calling thread only
+///       (the pairs are then inserted by one thread)
+/// @see changefeed.h : replication of the mutations to other processes
+void hashmap_set_fn_mutation(hashmap_t *hm, mutation_fn_t mutation_fn, void *ctx);
+
+/// @brief Time a sampled fraction of the operations, in per-thread histograms [DEFAULT: 0, disabled]
+/// @param hm The hashmap
+/// @param period One call out of period (rounded up to a power of two) is timed, chosen at random;
+///        1 times every call, 0 stops the sampling (the latencies recorded so far are kept)
+/// @return false if the allocation failed
+/// @note Without sampling, an operation only checks a pointer. A sampled one reads the clock twice
+///       and increments a counter of the histogram of the calling thread (atomic, without lock)
+/// @note Must not be called while other threads use the map (like the other settings)
+/// @see hashmap_latency_op_t : the timed operations
+/// @see hashmap_latency_snapshot : to read the histograms
+bool hashmap_set_latency_sampling(hashmap_t *hm, size_t period);
+
+/// @brief Add the latencies (in nanoseconds) sampled for an operation to a histogram
+/// @param hm The hashmap
+/// @param op The operation
+/// @param h The histogram receiving the samples of every thread (see histogram.h)
+/// @return The number of samples added
+/// @note Can be called while other threads use the map (from a monitoring thread): the samples
+///       recorded meanwhile may or may not be counted
+/// @note Each sample is counted as the highest latency of its bucket (HASHMAP_LATENCY_SUB_BUCKET_BITS)
+/// @note The percentiles read from h carry the error of these coarser buckets, 2^-HASHMAP_LATENCY_SUB_BUCKET_BITS
+///       (about 3%), not the precision of histogram.h (2^-HISTOGRAM_SUB_BUCKET_BITS, less than 1%)
+uint64_t hashmap_latency_snapshot(hashmap_t *hm, hashmap_latency_op_t op, histogram_t *h);
+
 /*--------------------------------- HASH FUNCTIONS ---------------------------------*/
 /*
 *   The hashmap uses a hash function to distribute the keys in the table.
@@ -238,6 +572,8 @@ size_t hashmap_fn_hash_id(const void* key, const size_t size);
 *   - print_str : print a string
 *   - compare_str : compare two strings using strcmp
 *   - alloc_copy_str : allocate and copy a string using strdup
+*   - format_str / format_json_str : write a string for hashmap_dump (TSV / JSON)
+*   - parse_str : read a string for hashmap_load
 *
 *   You can use them with the following macros (function pointers to pass to hashmap_set_)
 *    - HASHMAP_PRINT_STRING
@@ -263,4 +599,26 @@ int hashmap_fn_compare_str(const void *a, const void *b, const size_t size);
 /// @note size is unused, so we use the (void)x trick to avoid warnings
 void* hashmap_fn_alloc_copy_str(const void *element, const size_t size);
 
+/// @brief Write a string as is (formatter for hashmap_dump)
+/// @param element The string
+/// @param element_size The size of the string (unused)
+/// @param buffer The buffer to write to
+/// @param size The size of the buffer
+/// @return The length of the string
+/// @see format_fn_t
+size_t hashmap_fn_format_str(const void *element, const size_t element_size, char *buffer, const size_t size);
+
+/// @brief Write a string between quotes, with the JSON escapes (formatter for hashmap_dump)
+/// @see hashmap_fn_format_str
+size_t hashmap_fn_format_json_str(const void *element, const size_t element_size, char *buffer, const size_t size);
+
+/// @brief Copy the text as a null-terminated string (parser for hashmap_load)
+/// @param text The text (not null-terminated)
+/// @param length The length of the text
+/// @param element The buffer that receives the string (at least length + 1 bytes)
+/// @param element_size The size of the elements (unused)
+/// @return true
+/// @see parse_fn_t
+bool hashmap_fn_parse_str(const char *text, const size_t length, void *element, const size_t element_size);
+
 #endif
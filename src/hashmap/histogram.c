@@ -0,0 +1,121 @@
+#include "histogram.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUB_BUCKETS (1ULL << HISTOGRAM_SUB_BUCKET_BITS)
+
+struct _histogram_t {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double sum;//double: a sum of uint64_t overflows
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static size_t bucket_of(uint64_t value);
+static uint64_t bucket_highest(size_t index);
+
+histogram_t* histogram_create(void)
+{
+    histogram_t *h = malloc(sizeof(*h));
+    if(!h) return (perror("malloc"), NULL);
+
+    histogram_reset(h);
+    return h;
+}
+
+void histogram_destroy(histogram_t *h)
+{ free(h); }
+
+void histogram_record(histogram_t *h, uint64_t value)
+{ histogram_record_n(h, value, 1); }
+
+void histogram_record_n(histogram_t *h, uint64_t value, uint64_t count)
+{
+    if(count == 0) return;
+
+    h->buckets[bucket_of(value)] += count;
+    h->sum += (double)value * (double)count;
+    if(h->count == 0 || value < h->min) h->min = value;
+    if(value > h->max) h->max = value;
+    h->count += count;
+}
+
+void histogram_merge(histogram_t *dst, const histogram_t *src)
+{
+    if(src->count == 0) return;
+
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+
+    if(dst->count == 0 || src->min < dst->min) dst->min = src->min;
+    if(src->max > dst->max) dst->max = src->max;
+    dst->sum += src->sum;
+    dst->count += src->count;
+}
+
+void histogram_reset(histogram_t *h)
+{ memset(h, 0, sizeof(*h)); }
+
+uint64_t histogram_count(const histogram_t *h)
+{ return h->count; }
+
+uint64_t histogram_min(const histogram_t *h)
+{ return h->min; }
+
+uint64_t histogram_max(const histogram_t *h)
+{ return h->max; }
+
+double histogram_mean(const histogram_t *h)
+{ return h->count ? h->sum / (double)h->count : 0.0; }
+
+uint64_t histogram_percentile(const histogram_t *h, double percentile)
+{
+    if(h->count == 0) return 0;
+    if(percentile <= 0) return h->min;
+    if(percentile >= 100) return h->max;
+
+    //rang de la valeur cherchee (arrondi au superieur, au moins 1)
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)h->count);
+    if((double)rank < percentile / 100.0 * (double)h->count || rank == 0) rank++;
+
+    uint64_t seen = 0;
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if(seen < rank) continue;
+
+        //la borne haute du bucket, mais jamais au dela des valeurs vues
+        uint64_t value = bucket_highest(i);
+        if(value > h->max) value = h->max;
+        if(value < h->min) value = h->min;
+        return value;
+    }
+
+    return h->max;
+}
+
+
+//--------------- BUCKETS ---------------//
+
+//the values below 2^(bits+1) have their own bucket, then each power of two has SUB_BUCKETS buckets:
+//index = shift * SUB_BUCKETS + (value >> shift), with value >> shift in [SUB_BUCKETS, 2 * SUB_BUCKETS)
+static size_t bucket_of(uint64_t value)
+{
+    int msb = value ? 63 - __builtin_clzll(value) : 0;
+    int shift = msb > HISTOGRAM_SUB_BUCKET_BITS ? msb - HISTOGRAM_SUB_BUCKET_BITS : 0;
+
+    return ((size_t)shift << HISTOGRAM_SUB_BUCKET_BITS) + (size_t)(value >> shift);
+}
+
+static uint64_t bucket_highest(size_t index)
+{
+    size_t high = index >> HISTOGRAM_SUB_BUCKET_BITS;
+    if(high <= 1) return index;//un bucket par valeur
+
+    int shift = (int)high - 1;
+    uint64_t sub = index - ((size_t)shift << HISTOGRAM_SUB_BUCKET_BITS);
+    return ((sub + 1) << shift) - 1;
+}
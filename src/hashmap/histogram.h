@@ -0,0 +1,67 @@
+/*
+ *  Latency histogram with a bounded relative error (HDR histogram layout).
+ *
+ *  The values (nanoseconds, cycles, bytes...) are counted in log-linear buckets: each power
+ *  of two is divided in 2^HISTOGRAM_SUB_BUCKET_BITS equal sub-buckets, so a value is known
+ *  with a relative error below 2^-HISTOGRAM_SUB_BUCKET_BITS, from 0 to 2^64 - 1, with a fixed
+ *  number of counters. Recording is a few instructions (no allocation, no search), and two
+ *  histograms are merged by adding their counters: each thread records in its own
+ *  histogram, which are merged at the end.
+ *
+ *  The percentiles report the highest value of the bucket they fall into (never lower than
+ *  the actual value), and the minimum and maximum are exact.
+ *
+ *  NOT THREAD-SAFE: one histogram per thread, merged with histogram_merge.
+*/
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct _histogram_t histogram_t;
+
+#define HISTOGRAM_SUB_BUCKET_BITS 7 //128 sub-buckets per power of two: less than 1% of error
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS)
+
+/// @brief Create an empty histogram
+/// @return A pointer to the histogram or NULL if an error occured
+histogram_t* histogram_create(void);
+
+/// @brief Destroy the histogram
+void histogram_destroy(histogram_t *h);
+
+/// @brief Count a value
+/// @complexity O(1)
+void histogram_record(histogram_t *h, uint64_t value);
+
+/// @brief Count a value several times
+void histogram_record_n(histogram_t *h, uint64_t value, uint64_t count);
+
+/// @brief Add the values of src to dst
+void histogram_merge(histogram_t *dst, const histogram_t *src);
+
+/// @brief Forget every value
+void histogram_reset(histogram_t *h);
+
+/// @brief Get the number of values
+uint64_t histogram_count(const histogram_t *h);
+
+/// @brief Get the smallest value (0 if the histogram is empty)
+uint64_t histogram_min(const histogram_t *h);
+
+/// @brief Get the biggest value (0 if the histogram is empty)
+uint64_t histogram_max(const histogram_t *h);
+
+/// @brief Get the mean of the values (0 if the histogram is empty)
+double histogram_mean(const histogram_t *h);
+
+/// @brief Get the value below which a percentage of the values fall
+/// @param h The histogram
+/// @param percentile Between 0 and 100 (99.9 for the 99.9th percentile)
+/// @return The value (0 if the histogram is empty)
+/// @complexity O(HISTOGRAM_BUCKETS)
+uint64_t histogram_percentile(const histogram_t *h, double percentile);
+
+#endif
@@ -0,0 +1,1311 @@
+#define _GNU_SOURCE //pthread_rwlockattr_setkind_np
+#include "hopscotch.h"
+#include "probes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#define CACHE_LINE_SIZE 64
+#define HOPSCOTCH_MINIMAL_CAPACITY HOPSCOTCH_NEIGHBORHOOD
+#define OPTIMISTIC_RETRIES 16 //failed optimistic lookups before falling back to the locked path
+#define THREAD_SLOTS (HOPSCOTCH_FC_SLOTS > HOPSCOTCH_READER_SLOTS ? HOPSCOTCH_FC_SLOTS : HOPSCOTCH_READER_SLOTS)
+#define NO_THREAD_SLOT THREAD_SLOTS //index of a thread without slot: regular locked paths
+
+//the optimistic lookups read the buckets while the writers modify them: every access to a bucket
+//that can race with a lookup is atomic (relaxed, the ordering comes from the sequence counters),
+//except the key pointers, published with release so the lookups can compare the keys they load
+#define LOAD_RELAXED(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define STORE_RELAXED(field, val) __atomic_store_n(&(field), (val), __ATOMIC_RELAXED)
+#define LOAD_ACQUIRE(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(field, val) __atomic_store_n(&(field), (val), __ATOMIC_RELEASE)
+
+_Static_assert(HOPSCOTCH_NEIGHBORHOOD <= 32, "the hop bitmap is an unsigned int");
+_Static_assert(HOPSCOTCH_SEGMENT_SIZE >= HOPSCOTCH_NEIGHBORHOOD, "a neighborhood must fit in two segments");
+
+typedef struct {
+    unsigned int hop_info;//bit i: the bucket (this + i) holds a key whose home is this bucket
+    size_t hash;
+    void *key;//NULL = empty bucket
+    void *value;
+} bucket_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_rwlock_t lock;//writers only
+    atomic_uint seq;//odd while a writer holds the stripe: the lookups only read it
+} stripe_t;
+
+//epoch announced by a thread during an optimistic lookup (0 = not reading)
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t epoch;
+} reader_slot_t;
+
+//memory unlinked by a writer, freed once no lookup can still read it
+typedef struct retired_t {
+    void *key;//removed key-value pair (NULL if none)
+    void *value;
+    void *buckets;//replaced table (NULL if none)
+    size_t epoch;//global epoch when it was unlinked
+    struct retired_t *next;
+} retired_t;
+
+//flat combining: operation published by a thread, applied by the combiner
+typedef enum { FC_EMPTY, FC_PENDING, FC_DONE } fc_state_t;
+typedef enum { FC_ADD, FC_REMOVE, FC_UPDATE } fc_op_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_int state;
+    fc_op_t op;
+    size_t hash;//computed by the publishing thread, outside of the combiner
+    const void *key;
+    const void *value;
+    update_fn_t update_fn;
+    void *ctx;
+    void *result;
+} fc_slot_t;
+
+struct _hopscotch_t {
+    stripe_t stripes[HOPSCOTCH_LOCK_STRIPES];
+    pthread_rwlock_t resize_lock;//shared by every write, exclusive for resizes
+    atomic_uint table_seq;//odd while the whole table is locked
+
+    size_t capacity;//home buckets, always a power of two
+    size_t key_size;
+    size_t value_size;
+
+    //settings
+    float load_balance_threshold_min;
+    float load_balance_threshold_max;
+
+    //functions
+    hash_fn_t fn_hash;
+    compare_fn_t fn_compare;
+    destroy_fn_t fn_destroy_key;
+    destroy_fn_t fn_destroy_value;
+    alloc_copy_fn_t fn_alloc_copy_key;
+    alloc_copy_fn_t fn_alloc_copy_value;
+
+    //capacity + HOPSCOTCH_NEIGHBORHOOD - 1 buckets: the neighborhoods never wrap around
+    bucket_t *buckets;
+
+    //flat combining (NULL if disabled)
+    fc_slot_t *fc_slots;
+    pthread_mutex_t combiner_lock;
+
+    //written by every insertion / removal: kept away from the fields read by the lookups
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t count;
+
+    //deferred reclamation of the memory unlinked by the writers
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t epoch;
+    pthread_mutex_t retire_lock;
+    retired_t *retired;
+    size_t retired_count;
+    reader_slot_t readers[HOPSCOTCH_READER_SLOTS];
+};
+
+//versions seen by an optimistic lookup: its result stays valid as long as they do not change
+typedef struct {
+    size_t stripe;
+    unsigned int seq;
+    unsigned int table_seq;
+} read_version_t;
+
+//thread-local cache: a copy of the key, and the result of the lookup at the given version
+typedef struct {
+    size_t hash;
+    void *key;//private copy (NULL = empty entry)
+    void *value;//pointer into the map (NULL = the key was not found)
+    read_version_t version;
+} cache_entry_t;
+
+struct _hopscotch_cache_t {
+    hopscotch_t *hs;
+    size_t mask;//slots - 1
+    cache_entry_t *entries;
+};
+
+//stripes locked by an operation and the buckets they cover
+typedef struct {
+    size_t stripes[2];
+    int stripe_count;
+    bool exclusive;
+    size_t end;
+} lock_set_t;
+
+static inline size_t bucket_total(size_t capacity)
+{ return capacity + HOPSCOTCH_NEIGHBORHOOD - 1; }
+
+static inline size_t home_bucket(size_t hash, size_t capacity)
+{ return hash & (capacity - 1); }
+
+static inline size_t round_up_pow2(size_t n)
+{
+    size_t p = HOPSCOTCH_MINIMAL_CAPACITY;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+//dense index of the calling thread, used for the per-thread slots (publication, epoch) of every map.
+//taken on first use among the indices of the threads alive, and given back when the thread exits
+static struct {
+    pthread_once_t once;
+    pthread_key_t key;//its destructor gives the index back
+    pthread_mutex_t lock;
+    int free[THREAD_SLOTS];//indices given back by the threads that exited
+    int free_count;
+    int next;//first index never given
+    atomic_int available;//free_count + THREAD_SLOTS - next
+} thread_slots = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .available = THREAD_SLOTS,
+};
+static _Thread_local int thread_index = -1;
+
+static int thread_slot_acquire(void);
+
+static inline int current_thread_index(void)
+{
+    //un thread sans index reessaie quand un autre thread en a rendu un
+    if(thread_index < 0 || (thread_index == NO_THREAD_SLOT &&
+                            atomic_load_explicit(&thread_slots.available, memory_order_relaxed) > 0))
+        thread_index = thread_slot_acquire();
+
+    return thread_index;
+}
+
+//locking
+static void lock_segments(hopscotch_t *hs, size_t home, bool exclusive, lock_set_t *set);
+static void unlock_segments(hopscotch_t *hs, const lock_set_t *set);
+static void lock_table(hopscotch_t *hs);
+static void unlock_table(hopscotch_t *hs);
+
+//lookups
+static bool optimistic_get(hopscotch_t *hs, int reader, size_t hash, const void *key, void **value, read_version_t *version, void *copy);
+static void* locked_get(hopscotch_t *hs, size_t hash, const void *key, void *copy);
+static void value_copy_relaxed(void *dst, const void *src, size_t size);
+
+//deferred reclamation
+static void retire(hopscotch_t *hs, void *key, void *value, void *buckets);
+static void reclaim(hopscotch_t *hs);
+static void retired_free(hopscotch_t *hs, retired_t *item);
+
+//resize
+static void auto_grow(hopscotch_t *hs, size_t count, size_t capacity);
+static void auto_shrink(hopscotch_t *hs, size_t count, size_t capacity);
+static bool grow(hopscotch_t *hs);
+static bool resize(hopscotch_t *hs, size_t capacity);
+
+//placement
+static bucket_t* neighborhood_find(const hopscotch_t *hs, size_t home, size_t hash, const void *key);
+static bucket_t* make_room(hopscotch_t *hs, size_t home, size_t end);
+static void* bucket_fill(hopscotch_t *hs, size_t home, bucket_t *bucket, size_t hash, const void *key, const void *value);
+static void bucket_clear(hopscotch_t *hs, size_t home, bucket_t *bucket);
+static void* add_segment(hopscotch_t *hs, size_t hash, const void *key, const void *value, bool *inserted, bool *full);
+static bool remove_segment(hopscotch_t *hs, size_t hash, const void *key);
+static void* update_segment(hopscotch_t *hs, size_t hash, const void *key, update_fn_t update_fn, void *ctx, bool *inserted, bool *full);
+static void* add_exclusive(hopscotch_t *hs, size_t hash, const void *key, const void *value);
+static void* add_locked(hopscotch_t *hs, size_t hash, const void *key, const void *value);
+static void* update_locked(hopscotch_t *hs, size_t hash, const void *key, update_fn_t update_fn, void *ctx);
+
+//flat combining
+static void* fc_execute(hopscotch_t *hs, fc_op_t op, const void *key, const void *value, update_fn_t update_fn, void *ctx);
+static void fc_combine(hopscotch_t *hs);
+
+//default functions
+static void* default_fn_alloc_copy(const void *element, const size_t size);
+static const compare_fn_t default_fn_compare = memcmp;
+static const destroy_fn_t default_fn_destroy = free;
+
+hopscotch_t* hopscotch_create(size_t initial_capacity, hash_fn_t hash_fn,
+                              const size_t key_size, const size_t value_size)
+{
+    assert(key_size > 0 && value_size > 0);
+
+    //setting default values
+    if(initial_capacity == 0) initial_capacity = HASHMAP_DEFAULT_CAPACITY;
+    if(hash_fn == NULL) hash_fn = HASH_FUNC_DEFAULT;
+
+    //les stripes sont alignees sur une ligne de cache
+    hopscotch_t *hs = aligned_alloc(CACHE_LINE_SIZE, sizeof(*hs));
+    if(!hs) return (perror("aligned_alloc"), NULL);
+
+    hs->capacity = round_up_pow2(initial_capacity);
+    hs->key_size = key_size;
+    hs->value_size = value_size;
+    atomic_init(&hs->count, 0);
+
+    hs->load_balance_threshold_min = HOPSCOTCH_DEFAULT_LOAD_BALANCE_THRESHOLD_MIN;
+    hs->load_balance_threshold_max = HOPSCOTCH_DEFAULT_LOAD_BALANCE_THRESHOLD_MAX;
+
+    hs->fn_hash = hash_fn;
+    hs->fn_compare = default_fn_compare;
+    hs->fn_destroy_key = default_fn_destroy;
+    hs->fn_destroy_value = default_fn_destroy;
+    hs->fn_alloc_copy_key = default_fn_alloc_copy;
+    hs->fn_alloc_copy_value = default_fn_alloc_copy;
+
+    hs->buckets = calloc(bucket_total(hs->capacity), sizeof(*hs->buckets));
+    if(!hs->buckets) return (perror("calloc"), free(hs), NULL);
+
+    //on prefere les writers pour que les resizes ne soient pas affames par les lectures
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&hs->resize_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    for(size_t i = 0; i < HOPSCOTCH_LOCK_STRIPES; i++)
+    {
+        pthread_rwlock_init(&hs->stripes[i].lock, NULL);
+        atomic_init(&hs->stripes[i].seq, 0);
+    }
+    atomic_init(&hs->table_seq, 0);
+
+    hs->fc_slots = NULL;
+    pthread_mutex_init(&hs->combiner_lock, NULL);
+
+    //epoch 0 means "not reading"
+    atomic_init(&hs->epoch, 1);
+    pthread_mutex_init(&hs->retire_lock, NULL);
+    hs->retired = NULL;
+    hs->retired_count = 0;
+    for(size_t i = 0; i < HOPSCOTCH_READER_SLOTS; i++)
+        atomic_init(&hs->readers[i].epoch, 0);
+
+    return hs;
+}
+
+void hopscotch_destroy(hopscotch_t *hs)
+{
+    size_t total = bucket_total(hs->capacity);
+    for(size_t i = 0; i < total; i++)
+    {
+        if(hs->buckets[i].key == NULL) continue;
+
+        hs->fn_destroy_key(hs->buckets[i].key);
+        hs->fn_destroy_value(hs->buckets[i].value);
+    }
+
+    //plus aucun lecteur: tout ce qui a ete retire peut etre libere
+    while(hs->retired != NULL)
+    {
+        retired_t *next = hs->retired->next;
+        retired_free(hs, hs->retired);
+        free(hs->retired);
+        hs->retired = next;
+    }
+
+    for(size_t i = 0; i < HOPSCOTCH_LOCK_STRIPES; i++)
+        pthread_rwlock_destroy(&hs->stripes[i].lock);
+    pthread_rwlock_destroy(&hs->resize_lock);
+    pthread_mutex_destroy(&hs->combiner_lock);
+    pthread_mutex_destroy(&hs->retire_lock);
+
+    free(hs->fc_slots);
+    free(hs->buckets);
+    free(hs);
+}
+
+void* hopscotch_get(hopscotch_t *hs, const void *key)
+{
+    size_t hash = hs->fn_hash(key, hs->key_size);
+
+    //sans slot de lecteur (ou si les writers nous font trop recommencer), on verrouille
+    int reader = current_thread_index();
+    void *value;
+    if(reader < HOPSCOTCH_READER_SLOTS && optimistic_get(hs, reader, hash, key, &value, NULL, NULL))
+        return value;
+
+    return locked_get(hs, hash, key, NULL);
+}
+
+bool hopscotch_get_copy(hopscotch_t *hs, const void *key, void *value)
+{
+    size_t hash = hs->fn_hash(key, hs->key_size);
+
+    //la copie est faite dans la section validee par le seqlock (ou sous le verrou du segment)
+    int reader = current_thread_index();
+    void *stored;
+    if(reader < HOPSCOTCH_READER_SLOTS && optimistic_get(hs, reader, hash, key, &stored, NULL, value))
+        return stored != NULL;
+
+    return locked_get(hs, hash, key, value) != NULL;
+}
+
+void* hopscotch_add(hopscotch_t *hs, const void *key, const void *value)
+{
+    if(hs->fc_slots != NULL && current_thread_index() < HOPSCOTCH_FC_SLOTS)
+        return fc_execute(hs, FC_ADD, key, value, NULL, NULL);
+
+    size_t hash = hs->fn_hash(key, hs->key_size);
+
+    pthread_rwlock_rdlock(&hs->resize_lock);
+
+    size_t capacity = hs->capacity;
+    bool inserted, full;
+    void *result = add_segment(hs, hash, key, value, &inserted, &full);
+
+    pthread_rwlock_unlock(&hs->resize_lock);
+
+    //pas de place dans les segments verrouilles: on verrouille toute la table
+    if(full) return add_exclusive(hs, hash, key, value);
+
+    if(inserted) auto_grow(hs, atomic_fetch_add(&hs->count, 1) + 1, capacity);
+    return result;
+}
+
+bool hopscotch_remove(hopscotch_t *hs, const void *key)
+{
+    if(hs->fc_slots != NULL && current_thread_index() < HOPSCOTCH_FC_SLOTS)
+        return fc_execute(hs, FC_REMOVE, key, NULL, NULL, NULL) != NULL;
+
+    size_t hash = hs->fn_hash(key, hs->key_size);
+
+    pthread_rwlock_rdlock(&hs->resize_lock);
+
+    size_t capacity = hs->capacity;
+    bool removed = remove_segment(hs, hash, key);
+
+    pthread_rwlock_unlock(&hs->resize_lock);
+
+    if(!removed) return false;
+
+    auto_shrink(hs, atomic_fetch_sub(&hs->count, 1) - 1, capacity);
+    return true;
+}
+
+void* hopscotch_update(hopscotch_t *hs, const void *key, update_fn_t update_fn, void *ctx)
+{
+    if(hs->fc_slots != NULL && current_thread_index() < HOPSCOTCH_FC_SLOTS)
+        return fc_execute(hs, FC_UPDATE, key, NULL, update_fn, ctx);
+
+    size_t hash = hs->fn_hash(key, hs->key_size);
+
+    pthread_rwlock_rdlock(&hs->resize_lock);
+
+    size_t capacity = hs->capacity;
+    bool inserted, full;
+    void *value = update_segment(hs, hash, key, update_fn, ctx, &inserted, &full);
+
+    pthread_rwlock_unlock(&hs->resize_lock);
+
+    //pas de place dans les segments verrouilles: on verrouille toute la table
+    if(full)
+    {
+        lock_table(hs);
+        value = update_locked(hs, hash, key, update_fn, ctx);
+        unlock_table(hs);
+    }
+
+    if(inserted) auto_grow(hs, atomic_fetch_add(&hs->count, 1) + 1, capacity);
+    return value;
+}
+
+typedef struct {
+    int64_t delta;
+    int64_t previous;
+} fetch_add_ctx_t;
+
+static void fetch_add_i64(void *value, void *ctx)
+{
+    fetch_add_ctx_t *fetch_add = ctx;
+    fetch_add->previous = *(int64_t*)value;
+    *(int64_t*)value += fetch_add->delta;
+}
+
+int64_t hopscotch_fetch_add_i64(hopscotch_t *hs, const void *key, int64_t delta)
+{
+    assert(hs->value_size == sizeof(int64_t));
+
+    size_t hash = hs->fn_hash(key, hs->key_size);
+
+    //la clef existe: addition atomique avec le segment verrouille en lecture seulement,
+    //les compteurs d'un meme segment peuvent donc etre incrementes en parallele
+    pthread_rwlock_rdlock(&hs->resize_lock);
+
+    size_t home = home_bucket(hash, hs->capacity);
+    lock_set_t set;
+    lock_segments(hs, home, false, &set);
+
+    int64_t previous = 0;
+    bucket_t *bucket = neighborhood_find(hs, home, hash, key);
+    if(bucket != NULL) previous = __atomic_fetch_add((int64_t*)bucket->value, delta, __ATOMIC_RELAXED);
+
+    unlock_segments(hs, &set);
+    pthread_rwlock_unlock(&hs->resize_lock);
+
+    if(bucket != NULL) return previous;
+
+    //sinon on passe par hopscotch_update (insertion du compteur a 0)
+    fetch_add_ctx_t ctx = { .delta = delta, .previous = 0 };
+    hopscotch_update(hs, key, fetch_add_i64, &ctx);
+    return ctx.previous;
+}
+
+void hopscotch_print(hopscotch_t *hs, print_fn_t print_key_fn, print_fn_t print_value_fn)
+{
+    pthread_rwlock_wrlock(&hs->resize_lock);
+
+    size_t count = atomic_load(&hs->count);
+    printf("(hopscotch):\n");
+    printf("{\n");
+    printf("    key_size: %zu bytes\n", hs->key_size);
+    printf("    value_size: %zu bytes\n", hs->value_size);
+    printf("    capacity: %zu\n", hs->capacity);
+    printf("    count: %zu\n", count);
+    printf("    load_balance: %.2f\n", (float)count / hs->capacity);
+    printf("    table:\n");
+    printf("    [\n");
+
+    bool first = true;
+    size_t total = bucket_total(hs->capacity);
+    for(size_t i = 0; i < total; i++)
+    {
+        if(hs->buckets[i].key == NULL) continue;
+
+        printf(first ? "\t" : ",\n\t");
+        printf("(%zu, home %zu) : ", i, home_bucket(hs->buckets[i].hash, hs->capacity));
+        print_key_fn(hs->buckets[i].key);
+        printf("  =>  ");
+        print_value_fn(hs->buckets[i].value);
+        first = false;
+    }
+
+    printf("\n    ]\n");
+    printf("}\n");
+
+    pthread_rwlock_unlock(&hs->resize_lock);
+}
+
+size_t hopscotch_count(hopscotch_t *hs)
+{ return atomic_load(&hs->count); }
+
+size_t hopscotch_capacity(hopscotch_t *hs)
+{
+    pthread_rwlock_rdlock(&hs->resize_lock);
+    size_t capacity = hs->capacity;
+    pthread_rwlock_unlock(&hs->resize_lock);
+    return capacity;
+}
+
+void hopscotch_set_load_balance_threshold(hopscotch_t *hs, float min, float max)
+{
+    hs->load_balance_threshold_min = min;
+    hs->load_balance_threshold_max = max;
+}
+
+void hopscotch_set_flat_combining(hopscotch_t *hs, bool enabled)
+{
+    if(!enabled)
+    {
+        free(hs->fc_slots);
+        hs->fc_slots = NULL;
+        return;
+    }
+
+    if(hs->fc_slots != NULL) return;
+
+    hs->fc_slots = aligned_alloc(CACHE_LINE_SIZE, HOPSCOTCH_FC_SLOTS * sizeof(*hs->fc_slots));
+    if(!hs->fc_slots){ perror("aligned_alloc"); return; }//on reste sur le chemin classique
+
+    for(size_t i = 0; i < HOPSCOTCH_FC_SLOTS; i++)
+        atomic_init(&hs->fc_slots[i].state, FC_EMPTY);
+}
+
+void hopscotch_set_fn_compare(hopscotch_t *hs, compare_fn_t compare_fn)
+{ hs->fn_compare = compare_fn; }
+
+void hopscotch_set_fn_alloc_copy_key(hopscotch_t *hs, alloc_copy_fn_t key_alloc_fn)
+{ hs->fn_alloc_copy_key = key_alloc_fn; }
+
+void hopscotch_set_fn_alloc_copy_value(hopscotch_t *hs, alloc_copy_fn_t value_alloc_fn)
+{ hs->fn_alloc_copy_value = value_alloc_fn; }
+
+void hopscotch_set_fn_destroy_key(hopscotch_t *hs, destroy_fn_t key_destroy_fn)
+{ hs->fn_destroy_key = key_destroy_fn; }
+
+void hopscotch_set_fn_destroy_value(hopscotch_t *hs, destroy_fn_t value_destroy_fn)
+{ hs->fn_destroy_value = value_destroy_fn; }
+
+
+//lock the segment of the home bucket (shared), or the segment and the next one (exclusive):
+//an insertion never looks for a free bucket nor displaces keys outside of them
+static void lock_segments(hopscotch_t *hs, size_t home, bool exclusive, lock_set_t *set)
+{
+    size_t total = bucket_total(hs->capacity);
+    size_t segment = home / HOPSCOTCH_SEGMENT_SIZE;
+    size_t last_segment = (total - 1) / HOPSCOTCH_SEGMENT_SIZE;
+    size_t end_segment = segment + 1;
+
+    set->stripes[0] = segment % HOPSCOTCH_LOCK_STRIPES;
+    set->stripe_count = 1;
+
+    if(exclusive && segment < last_segment)
+    {
+        end_segment++;
+
+        size_t next = (segment + 1) % HOPSCOTCH_LOCK_STRIPES;
+        if(next != set->stripes[0])
+        {
+            //toujours dans l'ordre des index pour eviter les deadlocks
+            if(next < set->stripes[0])
+            {
+                set->stripes[1] = set->stripes[0];
+                set->stripes[0] = next;
+            }
+            else set->stripes[1] = next;
+
+            set->stripe_count = 2;
+        }
+    }
+
+    set->end = end_segment * HOPSCOTCH_SEGMENT_SIZE;
+    if(set->end > total) set->end = total;
+    set->exclusive = exclusive;
+
+    for(int i = 0; i < set->stripe_count; i++)
+    {
+        stripe_t *stripe = &hs->stripes[set->stripes[i]];
+        if(!exclusive){ pthread_rwlock_rdlock(&stripe->lock); continue; }
+
+        //seq impair: les lectures optimistes en cours sur ces segments recommenceront
+        pthread_rwlock_wrlock(&stripe->lock);
+        atomic_fetch_add_explicit(&stripe->seq, 1, memory_order_relaxed);
+    }
+
+    if(exclusive) atomic_thread_fence(memory_order_release);
+}
+
+static void unlock_segments(hopscotch_t *hs, const lock_set_t *set)
+{
+    for(int i = set->stripe_count - 1; i >= 0; i--)
+    {
+        stripe_t *stripe = &hs->stripes[set->stripes[i]];
+        if(set->exclusive) atomic_fetch_add_explicit(&stripe->seq, 1, memory_order_release);
+        pthread_rwlock_unlock(&stripe->lock);
+    }
+}
+
+//lock the whole table (resize_lock held exclusively): the optimistic lookups retry until it is unlocked
+static void lock_table(hopscotch_t *hs)
+{
+    pthread_rwlock_wrlock(&hs->resize_lock);
+    atomic_fetch_add_explicit(&hs->table_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void unlock_table(hopscotch_t *hs)
+{
+    atomic_fetch_add_explicit(&hs->table_seq, 1, memory_order_release);
+    pthread_rwlock_unlock(&hs->resize_lock);
+}
+
+//--------------- THREAD SLOTS ---------------//
+
+static void thread_slot_release(void *value)
+{
+    pthread_mutex_lock(&thread_slots.lock);
+    thread_slots.free[thread_slots.free_count++] = (int)((intptr_t)value - 1);
+    atomic_fetch_add(&thread_slots.available, 1);
+    pthread_mutex_unlock(&thread_slots.lock);
+}
+
+static void thread_slots_init(void)
+{
+    if(pthread_key_create(&thread_slots.key, thread_slot_release) != 0) perror("pthread_key_create");
+}
+
+//the slots of the maps are free when the thread exits: no lookup or published operation in progress
+static int thread_slot_acquire(void)
+{
+    pthread_once(&thread_slots.once, thread_slots_init);
+    pthread_mutex_lock(&thread_slots.lock);
+
+    int index = NO_THREAD_SLOT;
+    if(thread_slots.free_count > 0) index = thread_slots.free[--thread_slots.free_count];
+    else if(thread_slots.next < THREAD_SLOTS) index = thread_slots.next++;
+
+    //index + 1: la valeur NULL n'appelle pas le destructeur
+    if(index != NO_THREAD_SLOT && pthread_setspecific(thread_slots.key, (void*)(intptr_t)(index + 1)) != 0)
+    {
+        thread_slots.free[thread_slots.free_count++] = index;
+        index = NO_THREAD_SLOT;
+    }
+
+    if(index != NO_THREAD_SLOT) atomic_fetch_sub(&thread_slots.available, 1);
+    pthread_mutex_unlock(&thread_slots.lock);
+    return index;
+}
+
+//--------------- LOOKUPS ---------------//
+
+//seqlock read: nothing shared is written (the epoch slot belongs to the calling thread). The
+//neighborhood is read without lock, and the read is only accepted if neither the stripe of the
+//home segment nor the table were locked by a writer in the meantime.
+//return false if it had to retry too many times. version (can be NULL) receives the versions
+//the result was read at. copy (can be NULL) receives the value, copied before the validation:
+//an update in place (segment or table locked) makes the read start again
+static bool optimistic_get(hopscotch_t *hs, int reader, size_t hash, const void *key, void **value, read_version_t *version, void *copy)
+{
+    //les clefs et les tables retirees pendant la lecture ne sont pas liberees (voir retire)
+    reader_slot_t *slot = &hs->readers[reader];
+    atomic_store_explicit(&slot->epoch, atomic_load(&hs->epoch), memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    bool done = false;
+    for(int attempt = 0; attempt < OPTIMISTIC_RETRIES && !done; attempt++)
+    {
+        unsigned int table_seq = atomic_load_explicit(&hs->table_seq, memory_order_acquire);
+        if(table_seq & 1) continue;
+
+        bucket_t *buckets = __atomic_load_n(&hs->buckets, __ATOMIC_ACQUIRE);
+        size_t capacity = __atomic_load_n(&hs->capacity, __ATOMIC_RELAXED);
+
+        //la table et sa capacite doivent venir du meme resize avant d'indexer
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&hs->table_seq, memory_order_relaxed) != table_seq) continue;
+
+        size_t home = home_bucket(hash, capacity);
+        size_t stripe_index = (home / HOPSCOTCH_SEGMENT_SIZE) % HOPSCOTCH_LOCK_STRIPES;
+        stripe_t *stripe = &hs->stripes[stripe_index];
+        unsigned int seq = atomic_load_explicit(&stripe->seq, memory_order_acquire);
+        if(seq & 1) continue;
+
+        void *found = NULL;
+        unsigned int hop_info = LOAD_RELAXED(buckets[home].hop_info);
+        while(hop_info)
+        {
+            bucket_t *bucket = &buckets[home + __builtin_ctz(hop_info)];
+            void *bucket_key = LOAD_ACQUIRE(bucket->key);
+            if(bucket_key != NULL && LOAD_RELAXED(bucket->hash) == hash &&
+               hs->fn_compare(key, bucket_key, hs->key_size) == 0)
+            {
+                found = LOAD_RELAXED(bucket->value);
+                break;
+            }
+
+            hop_info &= hop_info - 1;
+        }
+
+        if(found != NULL && copy != NULL) value_copy_relaxed(copy, found, hs->value_size);
+
+        atomic_thread_fence(memory_order_acquire);
+        done = atomic_load_explicit(&stripe->seq, memory_order_relaxed) == seq &&
+               atomic_load_explicit(&hs->table_seq, memory_order_relaxed) == table_seq;
+        if(!done) continue;
+
+        *value = found;
+        if(version != NULL) *version = (read_version_t){ .stripe = stripe_index, .seq = seq, .table_seq = table_seq };
+    }
+
+    atomic_store_explicit(&slot->epoch, 0, memory_order_release);
+    return done;
+}
+
+//copy (can be NULL) receives the value, copied while the segment is locked
+static void* locked_get(hopscotch_t *hs, size_t hash, const void *key, void *copy)
+{
+    pthread_rwlock_rdlock(&hs->resize_lock);
+
+    //every writer that can touch the keys of this home bucket holds its segment
+    size_t home = home_bucket(hash, hs->capacity);
+    lock_set_t set;
+    lock_segments(hs, home, false, &set);
+
+    bucket_t *bucket = neighborhood_find(hs, home, hash, key);
+    void *value = bucket ? bucket->value : NULL;
+    if(value != NULL && copy != NULL) value_copy_relaxed(copy, value, hs->value_size);
+
+    unlock_segments(hs, &set);
+    pthread_rwlock_unlock(&hs->resize_lock);
+    return value;
+}
+
+//copy of a value that a writer may be modifying (the caller validates it): atomic loads, by
+//words when the value is aligned (hopscotch_fetch_add_i64 changes it without the exclusive lock)
+static void value_copy_relaxed(void *dst, const void *src, size_t size)
+{
+    const unsigned char *from = src;
+    unsigned char *to = dst;
+    size_t i = 0;
+
+    if(((uintptr_t)from & (sizeof(uint64_t) - 1)) == 0)
+    {
+        for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t word = __atomic_load_n((const uint64_t*)(const void*)(from + i), __ATOMIC_RELAXED);
+            memcpy(to + i, &word, sizeof(word));
+        }
+    }
+
+    for(; i < size; i++)
+        to[i] = __atomic_load_n(from + i, __ATOMIC_RELAXED);
+}
+
+//--------------- THREAD-LOCAL CACHE ---------------//
+
+hopscotch_cache_t* hopscotch_cache_create(hopscotch_t *hs, size_t slots)
+{
+    if(slots == 0) slots = HOPSCOTCH_CACHE_DEFAULT_SLOTS;
+
+    size_t pow2 = 1;
+    while(pow2 < slots) pow2 <<= 1;
+
+    hopscotch_cache_t *cache = malloc(sizeof(*cache));
+    if(!cache) return (perror("malloc"), NULL);
+
+    cache->entries = calloc(pow2, sizeof(*cache->entries));
+    if(!cache->entries) return (perror("calloc"), free(cache), NULL);
+
+    cache->hs = hs;
+    cache->mask = pow2 - 1;
+    return cache;
+}
+
+void hopscotch_cache_destroy(hopscotch_cache_t *cache)
+{
+    for(size_t i = 0; i <= cache->mask; i++)
+    {
+        if(cache->entries[i].key != NULL) cache->hs->fn_destroy_key(cache->entries[i].key);
+    }
+
+    free(cache->entries);
+    free(cache);
+}
+
+void* hopscotch_cache_get(hopscotch_cache_t *cache, const void *key)
+{
+    hopscotch_t *hs = cache->hs;
+    size_t hash = hs->fn_hash(key, hs->key_size);
+    cache_entry_t *entry = &cache->entries[hash & cache->mask];
+
+    //hit: la clef est comparee avec la copie privee, seules les versions sont lues dans la map
+    if(entry->key != NULL && entry->hash == hash && hs->fn_compare(key, entry->key, hs->key_size) == 0)
+    {
+        unsigned int seq = atomic_load_explicit(&hs->stripes[entry->version.stripe].seq, memory_order_acquire);
+        unsigned int table_seq = atomic_load_explicit(&hs->table_seq, memory_order_acquire);
+        if(seq == entry->version.seq && table_seq == entry->version.table_seq) return entry->value;
+    }
+
+    //miss (ou entree invalidee par un writer): lecture optimiste, puis on garde le resultat
+    int reader = current_thread_index();
+    void *value;
+    read_version_t version;
+    if(reader >= HOPSCOTCH_READER_SLOTS || !optimistic_get(hs, reader, hash, key, &value, &version, NULL))
+        return locked_get(hs, hash, key, NULL);
+
+    if(entry->key == NULL || entry->hash != hash || hs->fn_compare(key, entry->key, hs->key_size) != 0)
+    {
+        void *key_copy = hs->fn_alloc_copy_key(key, hs->key_size);
+        if(!key_copy) return (perror("hopscotch_key_alloc_cpy"), value);//simplement pas mis en cache
+
+        if(entry->key != NULL) hs->fn_destroy_key(entry->key);
+        entry->key = key_copy;
+        entry->hash = hash;
+    }
+
+    entry->value = value;
+    entry->version = version;
+    return value;
+}
+
+//--------------- DEFERRED RECLAMATION ---------------//
+
+//an optimistic lookup may still be reading memory unlinked by a writer (key, value or old table):
+//it is only freed once every lookup running when it was unlinked has finished.
+//a lookup that announced an epoch <= item->epoch may have seen it
+static void retire(hopscotch_t *hs, void *key, void *value, void *buckets)
+{
+    retired_t *item = malloc(sizeof(*item));
+    size_t epoch = atomic_fetch_add(&hs->epoch, 1);
+
+    if(!item)
+    {
+        //pas de memoire pour differer: on attend la fin des lectures en cours
+        perror("malloc");
+        retired_t on_stack = { .key = key, .value = value, .buckets = buckets, .epoch = epoch, .next = NULL };
+        bool reading = true;
+        while(reading)
+        {
+            atomic_thread_fence(memory_order_seq_cst);
+            reading = false;
+            for(size_t i = 0; i < HOPSCOTCH_READER_SLOTS && !reading; i++)
+            {
+                size_t reader_epoch = atomic_load_explicit(&hs->readers[i].epoch, memory_order_acquire);
+                reading = reader_epoch != 0 && reader_epoch <= epoch;
+            }
+            if(reading) sched_yield();
+        }
+
+        retired_free(hs, &on_stack);
+        return;
+    }
+
+    item->key = key;
+    item->value = value;
+    item->buckets = buckets;
+    item->epoch = epoch;
+
+    pthread_mutex_lock(&hs->retire_lock);
+    item->next = hs->retired;
+    hs->retired = item;
+    if(++hs->retired_count >= HOPSCOTCH_RETIRE_BATCH) reclaim(hs);
+    pthread_mutex_unlock(&hs->retire_lock);
+}
+
+//free the retired items that no lookup can still read (retire_lock held)
+static void reclaim(hopscotch_t *hs)
+{
+    //pairs with the fence of optimistic_get: a lookup not seen here started after the unlinks
+    atomic_thread_fence(memory_order_seq_cst);
+
+    size_t oldest = SIZE_MAX;
+    for(size_t i = 0; i < HOPSCOTCH_READER_SLOTS; i++)
+    {
+        size_t reader_epoch = atomic_load_explicit(&hs->readers[i].epoch, memory_order_acquire);
+        if(reader_epoch != 0 && reader_epoch < oldest) oldest = reader_epoch;
+    }
+
+    retired_t **link = &hs->retired;
+    while(*link != NULL)
+    {
+        retired_t *item = *link;
+        if(item->epoch >= oldest){ link = &item->next; continue; }
+
+        *link = item->next;
+        hs->retired_count--;
+        retired_free(hs, item);
+        free(item);
+    }
+}
+
+//free the memory of a retired item (not the item itself)
+static void retired_free(hopscotch_t *hs, retired_t *item)
+{
+    if(item->key != NULL) hs->fn_destroy_key(item->key);
+    if(item->value != NULL) hs->fn_destroy_value(item->value);
+    free(item->buckets);
+}
+
+//--------------- RESIZE ---------------//
+
+//count and capacity are the values seen by the caller, the condition is checked again
+//with the table locked (an other thread may have resized in between)
+static void auto_grow(hopscotch_t *hs, size_t count, size_t capacity)
+{
+    if(((float)count / capacity) <= hs->load_balance_threshold_max) return;
+
+    lock_table(hs);
+
+    count = atomic_load(&hs->count);
+    if(((float)count / hs->capacity) > hs->load_balance_threshold_max) grow(hs);
+
+    unlock_table(hs);
+}
+
+static void auto_shrink(hopscotch_t *hs, size_t count, size_t capacity)
+{
+    if(((float)count / capacity) >= hs->load_balance_threshold_min) return;
+
+    lock_table(hs);
+
+    count = atomic_load(&hs->count);
+    if(hs->capacity > HOPSCOTCH_MINIMAL_CAPACITY &&
+       ((float)count / hs->capacity) < hs->load_balance_threshold_min)
+        resize(hs, hs->capacity >> 1);//si les clefs ne rentrent pas, on garde la table actuelle
+
+    unlock_table(hs);
+}
+
+//double the table until every key finds a place (resize_lock held exclusively)
+static bool grow(hopscotch_t *hs)
+{
+    size_t capacity = hs->capacity;
+    for(int tries = 0; tries < 4; tries++)
+    {
+        capacity <<= 1;
+        if(resize(hs, capacity)) return true;
+    }
+
+    return false;
+}
+
+static bool resize(hopscotch_t *hs, size_t new_capacity)
+{
+    if(new_capacity < HOPSCOTCH_MINIMAL_CAPACITY) new_capacity = HOPSCOTCH_MINIMAL_CAPACITY;
+
+    bucket_t *old_buckets = hs->buckets;
+    size_t old_capacity = hs->capacity;
+    size_t old_total = bucket_total(old_capacity);
+
+    PROBE4(hopscotch, resize__start, hs, old_capacity, new_capacity, atomic_load(&hs->count));
+
+    bucket_t *new_buckets = calloc(bucket_total(new_capacity), sizeof(*new_buckets));
+    if(!new_buckets)
+    {
+        PROBE3(hopscotch, resize__end, hs, old_capacity, 0);
+        return (perror("calloc"), false);
+    }
+
+    //publiee pendant le remplissage: les lectures optimistes recommencent tant que la table est verrouillee
+    __atomic_store_n(&hs->buckets, new_buckets, __ATOMIC_RELEASE);
+    __atomic_store_n(&hs->capacity, new_capacity, __ATOMIC_RELAXED);
+
+    //les buckets gardent leur hash, on n'a donc pas besoin de rehasher les clefs
+    for(size_t i = 0; i < old_total; i++)
+    {
+        if(old_buckets[i].key == NULL) continue;
+
+        size_t home = home_bucket(old_buckets[i].hash, new_capacity);
+        bucket_t *bucket = make_room(hs, home, bucket_total(new_capacity));
+        if(bucket == NULL)
+        {
+            __atomic_store_n(&hs->buckets, old_buckets, __ATOMIC_RELEASE);
+            __atomic_store_n(&hs->capacity, old_capacity, __ATOMIC_RELAXED);
+            retire(hs, NULL, NULL, new_buckets);
+            PROBE3(hopscotch, resize__end, hs, old_capacity, 0);
+            return false;
+        }
+
+        STORE_RELAXED(bucket->hash, old_buckets[i].hash);
+        STORE_RELEASE(bucket->key, old_buckets[i].key);
+        STORE_RELAXED(bucket->value, old_buckets[i].value);
+        STORE_RELAXED(hs->buckets[home].hop_info, hs->buckets[home].hop_info | 1u << (bucket - &hs->buckets[home]));
+    }
+
+    retire(hs, NULL, NULL, old_buckets);
+    PROBE3(hopscotch, resize__end, hs, new_capacity, 1);
+    return true;
+}
+
+static bucket_t* neighborhood_find(const hopscotch_t *hs, size_t home, size_t hash, const void *key)
+{
+    unsigned int hop_info = hs->buckets[home].hop_info;
+
+    while(hop_info)
+    {
+        bucket_t *bucket = &hs->buckets[home + __builtin_ctz(hop_info)];
+        if(bucket->hash == hash && hs->fn_compare(key, bucket->key, hs->key_size) == 0)
+            return bucket;
+
+        hop_info &= hop_info - 1;
+    }
+
+    return NULL;
+}
+
+//find a free bucket in [home, end) and bring it back into the neighborhood of home
+//by displacing other keys closer to their own home. return NULL if it is not possible
+static bucket_t* make_room(hopscotch_t *hs, size_t home, size_t end)
+{
+    size_t free_bucket = home;
+    while(free_bucket < end && hs->buckets[free_bucket].key != NULL) free_bucket++;
+    if(free_bucket >= end) return NULL;
+
+    while(free_bucket - home >= HOPSCOTCH_NEIGHBORHOOD)
+    {
+        //on cherche une clef (le plus loin possible) qui peut etre deplacee dans le bucket libre
+        //(free - H < candidate <= home, donc on reste dans les segments verrouilles)
+        bool moved = false;
+        for(size_t candidate = free_bucket - (HOPSCOTCH_NEIGHBORHOOD - 1); candidate < free_bucket && !moved; candidate++)
+        {
+            unsigned int hop_info = hs->buckets[candidate].hop_info;
+            if(hop_info == 0) continue;
+
+            size_t from = candidate + __builtin_ctz(hop_info);
+            if(from >= free_bucket) continue;
+
+            bucket_t *src = &hs->buckets[from];
+            bucket_t *dst = &hs->buckets[free_bucket];
+            STORE_RELAXED(dst->hash, src->hash);
+            STORE_RELEASE(dst->key, src->key);
+            STORE_RELAXED(dst->value, src->value);
+            STORE_RELAXED(src->key, NULL);
+            STORE_RELAXED(src->value, NULL);
+
+            hop_info = hs->buckets[candidate].hop_info;
+            hop_info |= 1u << (free_bucket - candidate);
+            hop_info &= ~(1u << (from - candidate));
+            STORE_RELAXED(hs->buckets[candidate].hop_info, hop_info);
+
+            free_bucket = from;
+            moved = true;
+        }
+
+        if(!moved) return NULL;
+    }
+
+    return &hs->buckets[free_bucket];
+}
+
+static void* bucket_fill(hopscotch_t *hs, size_t home, bucket_t *bucket, size_t hash, const void *key, const void *value)
+{
+    void *key_copy = hs->fn_alloc_copy_key(key, hs->key_size);
+    if(!key_copy) return (perror("hopscotch_key_alloc_cpy"), NULL);
+
+    void *value_copy = hs->fn_alloc_copy_value(value, hs->value_size);
+    if(!value_copy) return (perror("hopscotch_value_alloc_cpy"), hs->fn_destroy_key(key_copy), NULL);
+
+    STORE_RELAXED(bucket->hash, hash);
+    STORE_RELEASE(bucket->key, key_copy);
+    STORE_RELAXED(bucket->value, value_copy);
+    STORE_RELAXED(hs->buckets[home].hop_info, hs->buckets[home].hop_info | 1u << (bucket - &hs->buckets[home]));
+    return value_copy;
+}
+
+static void bucket_clear(hopscotch_t *hs, size_t home, bucket_t *bucket)
+{
+    void *key = bucket->key;
+    void *value = bucket->value;
+
+    STORE_RELAXED(hs->buckets[home].hop_info, hs->buckets[home].hop_info & ~(1u << (bucket - &hs->buckets[home])));
+    STORE_RELAXED(bucket->key, NULL);
+    STORE_RELAXED(bucket->value, NULL);
+
+    //une lecture optimiste peut encore comparer cette clef
+    retire(hs, key, value, NULL);
+}
+
+//add with only the segments of the home bucket locked (resize_lock held shared by the caller).
+//inserted: a new key-value pair was added (not counted yet). full: no free bucket could be brought
+//into the neighborhood from these segments, the caller must retry with the whole table locked
+static void* add_segment(hopscotch_t *hs, size_t hash, const void *key, const void *value, bool *inserted, bool *full)
+{
+    size_t home = home_bucket(hash, hs->capacity);
+    lock_set_t set;
+    lock_segments(hs, home, true, &set);
+
+    *inserted = *full = false;
+
+    //on verifie si la clef existe deja
+    void *result = NULL;
+    bucket_t *bucket = neighborhood_find(hs, home, hash, key);
+    if(bucket != NULL) result = bucket->value;
+    else if((bucket = make_room(hs, home, set.end)) != NULL)
+    {
+        result = bucket_fill(hs, home, bucket, hash, key, value);
+        *inserted = result != NULL;
+    }
+    else *full = true;
+
+    unlock_segments(hs, &set);
+    return result;
+}
+
+//remove with only the segments of the home bucket locked (resize_lock held shared by the caller),
+//the removal is not counted yet
+static bool remove_segment(hopscotch_t *hs, size_t hash, const void *key)
+{
+    size_t home = home_bucket(hash, hs->capacity);
+    lock_set_t set;
+    lock_segments(hs, home, true, &set);
+
+    bucket_t *bucket = neighborhood_find(hs, home, hash, key);
+    if(bucket != NULL) bucket_clear(hs, home, bucket);
+
+    unlock_segments(hs, &set);
+    return bucket != NULL;
+}
+
+//update with only the segments of the home bucket locked (resize_lock held shared by the caller),
+//same inserted / full as add_segment
+static void* update_segment(hopscotch_t *hs, size_t hash, const void *key, update_fn_t update_fn, void *ctx, bool *inserted, bool *full)
+{
+    size_t home = home_bucket(hash, hs->capacity);
+    lock_set_t set;
+    lock_segments(hs, home, true, &set);
+
+    *inserted = *full = false;
+
+    void *value = NULL;
+    bucket_t *bucket = neighborhood_find(hs, home, hash, key);
+    if(bucket != NULL) value = bucket->value;
+    else if((bucket = make_room(hs, home, set.end)) != NULL)
+    {
+        //valeur par defaut allouee seulement quand la clef n'existe pas (cas rare d'un compteur)
+        void *default_value = calloc(1, hs->value_size);
+        if(!default_value) perror("calloc");
+        else
+        {
+            value = bucket_fill(hs, home, bucket, hash, key, default_value);
+            *inserted = value != NULL;
+            free(default_value);
+        }
+    }
+    else *full = true;
+
+    if(value != NULL) update_fn(value, ctx);
+
+    unlock_segments(hs, &set);
+    return value;
+}
+
+//slow path of hopscotch_add: the whole table is locked, so the free bucket can be anywhere
+static void* add_exclusive(hopscotch_t *hs, size_t hash, const void *key, const void *value)
+{
+    lock_table(hs);
+    void *result = add_locked(hs, hash, key, value);
+    unlock_table(hs);
+
+    return result;
+}
+
+//add with the whole table locked (resize_lock held exclusively), without load balance check
+static void* add_locked(hopscotch_t *hs, size_t hash, const void *key, const void *value)
+{
+    //la clef a peut-etre ete ajoutee entre temps
+    size_t home = home_bucket(hash, hs->capacity);
+    bucket_t *bucket = neighborhood_find(hs, home, hash, key);
+    if(bucket != NULL) return bucket->value;
+
+    while((bucket = make_room(hs, home, bucket_total(hs->capacity))) == NULL)
+    {
+        if(!grow(hs)) return NULL;
+        home = home_bucket(hash, hs->capacity);
+    }
+
+    void *result = bucket_fill(hs, home, bucket, hash, key, value);
+    if(result != NULL) atomic_fetch_add(&hs->count, 1);
+
+    return result;
+}
+
+//update with the whole table locked (resize_lock held exclusively), without load balance check
+static void* update_locked(hopscotch_t *hs, size_t hash, const void *key, update_fn_t update_fn, void *ctx)
+{
+    size_t home = home_bucket(hash, hs->capacity);
+    bucket_t *bucket = neighborhood_find(hs, home, hash, key);
+    void *value = bucket != NULL ? bucket->value : NULL;
+
+    if(value == NULL)
+    {
+        void *default_value = calloc(1, hs->value_size);
+        if(!default_value) return (perror("calloc"), NULL);
+
+        value = add_locked(hs, hash, key, default_value);
+        free(default_value);
+        if(value == NULL) return NULL;
+    }
+
+    update_fn(value, ctx);
+    return value;
+}
+
+//--------------- FLAT COMBINING ---------------//
+
+//publish the operation in the slot of the calling thread, and wait until a combiner
+//(possibly this thread) has applied it
+static void* fc_execute(hopscotch_t *hs, fc_op_t op, const void *key, const void *value, update_fn_t update_fn, void *ctx)
+{
+    fc_slot_t *slot = &hs->fc_slots[current_thread_index()];
+
+    slot->op = op;
+    slot->hash = hs->fn_hash(key, hs->key_size);
+    slot->key = key;
+    slot->value = value;
+    slot->update_fn = update_fn;
+    slot->ctx = ctx;
+    atomic_store_explicit(&slot->state, FC_PENDING, memory_order_release);
+
+    while(atomic_load_explicit(&slot->state, memory_order_acquire) != FC_DONE)
+    {
+        if(pthread_mutex_trylock(&hs->combiner_lock) == 0)
+        {
+            fc_combine(hs);
+            pthread_mutex_unlock(&hs->combiner_lock);
+        }
+        else sched_yield();
+    }
+
+    void *result = slot->result;
+    atomic_store_explicit(&slot->state, FC_EMPTY, memory_order_relaxed);
+    return result;
+}
+
+//apply every pending operation in one batch (combiner_lock held). each operation only locks the
+//segments of its key, like the regular path, so the lookups of the other segments go on. the table
+//is locked at most once, at the end: for the insertions that found no room in their segments, and
+//for the load balance, checked once for the whole batch
+static void fc_combine(hopscotch_t *hs)
+{
+    bool full[HOPSCOTCH_FC_SLOTS];
+    size_t full_count = 0;
+
+    pthread_rwlock_rdlock(&hs->resize_lock);
+
+    for(size_t i = 0; i < HOPSCOTCH_FC_SLOTS; i++)
+    {
+        fc_slot_t *slot = &hs->fc_slots[i];
+        full[i] = false;
+        if(atomic_load_explicit(&slot->state, memory_order_acquire) != FC_PENDING) continue;
+
+        bool inserted = false;
+        switch(slot->op)
+        {
+            case FC_ADD:
+                slot->result = add_segment(hs, slot->hash, slot->key, slot->value, &inserted, &full[i]);
+                break;
+            case FC_REMOVE:
+                slot->result = remove_segment(hs, slot->hash, slot->key) ? (void*)slot : NULL;
+                if(slot->result != NULL) atomic_fetch_sub(&hs->count, 1);
+                break;
+            case FC_UPDATE:
+                slot->result = update_segment(hs, slot->hash, slot->key, slot->update_fn, slot->ctx, &inserted, &full[i]);
+                break;
+        }
+
+        if(inserted) atomic_fetch_add(&hs->count, 1);
+
+        //termine plus tard, avec la table verrouillee
+        if(full[i]){ full_count++; continue; }
+
+        atomic_store_explicit(&slot->state, FC_DONE, memory_order_release);
+    }
+
+    size_t capacity = hs->capacity;
+    pthread_rwlock_unlock(&hs->resize_lock);
+
+    size_t count = atomic_load(&hs->count);
+    bool unbalanced = ((float)count / capacity) > hs->load_balance_threshold_max ||
+                      (capacity > HOPSCOTCH_MINIMAL_CAPACITY && ((float)count / capacity) < hs->load_balance_threshold_min);
+    if(full_count == 0 && !unbalanced) return;
+
+    lock_table(hs);
+
+    for(size_t i = 0; i < HOPSCOTCH_FC_SLOTS && full_count > 0; i++)
+    {
+        if(!full[i]) continue;
+
+        fc_slot_t *slot = &hs->fc_slots[i];
+        if(slot->op == FC_ADD) slot->result = add_locked(hs, slot->hash, slot->key, slot->value);
+        else slot->result = update_locked(hs, slot->hash, slot->key, slot->update_fn, slot->ctx);
+
+        atomic_store_explicit(&slot->state, FC_DONE, memory_order_release);
+        full_count--;
+    }
+
+    //l'etat de la table a pu changer depuis la premiere verification
+    count = atomic_load(&hs->count);
+    if(((float)count / hs->capacity) > hs->load_balance_threshold_max)
+        grow(hs);
+    else if(hs->capacity > HOPSCOTCH_MINIMAL_CAPACITY && ((float)count / hs->capacity) < hs->load_balance_threshold_min)
+        resize(hs, hs->capacity >> 1);
+
+    unlock_table(hs);
+}
+
+static void* default_fn_alloc_copy(const void *element, const size_t size)
+{
+    void *copy = malloc(size);
+    if(!copy) return NULL;
+
+    memcpy(copy, element, size);
+    return copy;
+}
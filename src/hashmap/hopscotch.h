@@ -0,0 +1,217 @@
+/*
+ *  Concurrent hopscotch hashing backend.
+ *
+ *  Same usage as hashmap_t (see hashmap.h), but THREAD-SAFE: every function (except the
+ *  setters, which must be called before sharing the map) can be called from several
+ *  threads at the same time.
+ *
+ *  Every key lives within HOPSCOTCH_NEIGHBORHOOD slots of its home bucket, and each bucket
+ *  keeps a hop bitmap telling which slots of its neighborhood hold its keys. A lookup only
+ *  reads the slots flagged in the bitmap (usually one or two cache lines).
+ *
+ *  ---------- Concurrency ---------
+ *  The table is divided in segments of HOPSCOTCH_SEGMENT_SIZE buckets, protected by a
+ *  fixed number of lock stripes:
+ *  - an insertion or a removal locks (exclusive) the segment of the home bucket and the
+ *    next one: the neighborhood and the displacements never go further.
+ *  - a resize (or an insertion that needs to look further for a free slot) locks the
+ *    whole table.
+ *  - a lookup does not lock anything (seqlock): every stripe (and the table) carries a
+ *    sequence counter, odd while a writer holds it. The lookup reads the neighborhood, then
+ *    checks that the counter of its stripe did not change, and retries otherwise. It never
+ *    writes shared memory, so the readers do not bounce the cache lines of the locks.
+ *    The keys and the tables unlinked by the writers are freed later, once no lookup can
+ *    still read them (epoch based reclamation, by batches of HOPSCOTCH_RETIRE_BATCH).
+ *
+ *  For workloads where a few hot keys receive most of the reads, a thread can put a small
+ *  private cache in front of the map (hopscotch_cache_t): a hit only reads the sequence
+ *  counters, which the writers of the stripe bump, to check that the entry is still valid.
+ *
+ *  For workloads where a few hot keys receive most of the writes, the flat-combining mode
+ *  (hopscotch_set_flat_combining) applies the writes by batches from a single thread, instead
+ *  of having every writer queue on the locks of the hot segments.
+ *
+ *  -------- Limitations --------
+ *  - the pointer returned by hopscotch_get / hopscotch_add stays valid until the key is
+ *    removed, the caller must make sure no other thread removes it while it is used.
+ *  - hopscotch_update modifies the value in place, and hopscotch_get returns the same pointer
+ *    without any lock: reading a value that other threads update through that pointer can see
+ *    it half-written. Read such values with hopscotch_get_copy (copy validated like the
+ *    lookup), with hopscotch_fetch_add_i64 / atomics, or with an external synchronization.
+ *  - only HOPSCOTCH_READER_SLOTS threads alive at the same time get optimistic lookups (the
+ *    slots are shared by every map, and given back when a thread exits), the others lock the
+ *    segment (shared) like the writers until a slot is free.
+ *  - the table grows by doubling (power-of-two number of buckets).
+*/
+
+#ifndef __HOPSCOTCH_H__
+#define __HOPSCOTCH_H__
+
+#include "hashmap.h"
+
+typedef struct _hopscotch_t hopscotch_t;
+typedef struct _hopscotch_cache_t hopscotch_cache_t;
+
+//table settings
+#define HOPSCOTCH_NEIGHBORHOOD 32   //H: max distance between a key and its home bucket (bits of the hop bitmap)
+#define HOPSCOTCH_SEGMENT_SIZE 64   //buckets per segment (must be >= HOPSCOTCH_NEIGHBORHOOD)
+#define HOPSCOTCH_LOCK_STRIPES 64   //number of locks shared by the segments
+#define HOPSCOTCH_FC_SLOTS 64       //publication slots of the flat-combining mode (one per thread)
+#define HOPSCOTCH_READER_SLOTS 64   //threads with optimistic lookups (one epoch slot per thread)
+#define HOPSCOTCH_RETIRE_BATCH 64   //removed key-value pairs kept before trying to free them
+#define HOPSCOTCH_CACHE_DEFAULT_SLOTS 256 //entries of a thread-local cache
+
+//default load balance thresholds
+#define HOPSCOTCH_DEFAULT_LOAD_BALANCE_THRESHOLD_MAX 0.85f
+#define HOPSCOTCH_DEFAULT_LOAD_BALANCE_THRESHOLD_MIN 0.20f
+
+/// @brief Create a new concurrent hopscotch hashmap
+/// @param initial_capacity The initial capacity of the hashmap (rounded up to a power of two), 0 for the default capacity
+/// @param hash_fn The hash function to use (NULL for the default hash function)
+/// @param key_size The size of the key in bytes
+/// @param value_size The size of the value in bytes
+/// @return A pointer to the hopscotch hashmap or NULL if an error occured
+///
+/// @note The key_size and value_size must be greater than 0 (asserted)
+/// @note The same custom functions as hashmap_t can be provided (hopscotch_set_fn_...)
+/// @see hashmap_create
+hopscotch_t* hopscotch_create(size_t initial_capacity, hash_fn_t hash_fn,
+                              const size_t key_size, const size_t value_size);
+
+/// @brief Destroy the hopscotch hashmap and all the key-value pairs (using the destroy functions)
+/// @param hs The hopscotch hashmap to destroy
+/// @note NOT thread-safe: no other thread may use the map anymore
+void hopscotch_destroy(hopscotch_t *hs);
+
+/// @brief Get the value associated with the key
+/// @param hs The hopscotch hashmap
+/// @param key The key to search for
+/// @return A pointer to the value or NULL if the key was not found
+/// @note Lock-free read: retried if a writer modified the segment meanwhile (falls back to a
+///       shared lock after a few retries)
+/// @complexity O(1) worst case (HOPSCOTCH_NEIGHBORHOOD slots at most)
+void* hopscotch_get(hopscotch_t *hs, const void *key);
+
+/// @brief Copy the value associated with the key (value_size bytes)
+/// @param hs The hopscotch hashmap
+/// @param key The key to search for
+/// @param value Receives the value
+/// @return true if the key was found
+/// @note The value is copied inside the lock-free read, and the copy is retried if a writer
+///       (hopscotch_update...) modified the segment meanwhile: never a half-updated value
+/// @note The value must be flat (its value_size bytes, no custom alloc/copy functions pointing elsewhere)
+bool hopscotch_get_copy(hopscotch_t *hs, const void *key, void *value);
+
+/// @brief Add a new key-value pair to the hopscotch hashmap
+/// @param hs The hopscotch hashmap
+/// @param key The key to add
+/// @param value The value to add
+/// @return A pointer to the added value, a pointer to the existing value or NULL if an error occured
+/// @note If the key already exists, it will NOT REPLACE the old value ! (but return the old value)
+/// @complexity amortized O(1)
+void* hopscotch_add(hopscotch_t *hs, const void *key, const void *value);
+
+/// @brief Update the value associated with the key in place, with the segment of the key locked
+/// @param hs The hopscotch hashmap
+/// @param key The key of the value to update
+/// @param update_fn The function that modifies the value (called with the value and ctx, while the segment is locked)
+/// @param ctx User data given to update_fn
+/// @return A pointer to the updated value or NULL if an error occured
+/// @note If the key does not exist, a default value (value_size zero bytes) is inserted first, then updated
+/// @note update_fn must not call the functions of this map (deadlock)
+/// @see hashmap_update
+void* hopscotch_update(hopscotch_t *hs, const void *key, update_fn_t update_fn, void *ctx);
+
+/// @brief Atomically add delta to the int64_t value associated with the key (0 is inserted if the key does not exist)
+/// @param hs The hopscotch hashmap
+/// @param key The key of the counter
+/// @param delta The value to add
+/// @return The value of the counter BEFORE the addition
+/// @note The value_size must be sizeof(int64_t) (asserted)
+/// @note When the key exists, the addition is a lock-free atomic operation done with the segment locked
+///       in shared mode: counters of the same segment can be incremented in parallel
+/// @see hashmap_fetch_add_i64
+int64_t hopscotch_fetch_add_i64(hopscotch_t *hs, const void *key, int64_t delta);
+
+/// @brief Remove a key-value pair from the hopscotch hashmap
+/// @param hs The hopscotch hashmap
+/// @param key The key to remove
+/// @return true if the key was removed, false otherwise (not found)
+/// @note AFTER removing the key, the table will automatically shrink if the load balance is too low
+/// @complexity O(1) worst case
+bool hopscotch_remove(hopscotch_t *hs, const void *key);
+
+/// @brief Print the hopscotch hashmap : some informations about the table and all the key-value pairs
+/// @param hs The hopscotch hashmap
+/// @param print_key_fn The function to print the key
+/// @param print_value_fn The function to print the value
+/// @note The whole table is locked while printing
+void hopscotch_print(hopscotch_t *hs, print_fn_t print_key_fn, print_fn_t print_value_fn);
+
+/// @brief Get the number of key-value pairs
+/// @complexity O(1)
+size_t hopscotch_count(hopscotch_t *hs);
+
+/// @brief Get the capacity (number of home buckets)
+/// @complexity O(1)
+size_t hopscotch_capacity(hopscotch_t *hs);
+
+/// @brief Set the load balance thresholds
+/// @note by default, the load balance thresholds are set to 0.20 and 0.85
+/// @see hashmap_set_load_balance_threshold
+void hopscotch_set_load_balance_threshold(hopscotch_t *hs, float min, float max);
+
+/// @brief Enable (or disable) the flat-combining write path [DEFAULT: disabled]
+/// @param hs The hopscotch hashmap
+/// @param enabled true to enable flat combining
+/// @note With flat combining, hopscotch_add, hopscotch_remove and hopscotch_update publish the operation in a slot owned
+///       by the calling thread. The thread that takes the combiner lock applies all the pending
+///       operations in one batch (single load balance check at the end), the others wait for their
+///       result. Under heavy write skew, this avoids the lock convoys on the segments of the hot
+///       keys, and the batch stays in the cache of a single core.
+/// @note Each operation of a batch locks only the segments of its key, like the regular path: the
+///       lookups (and the thread caches) of the other segments are not disturbed. The whole table
+///       is locked only when an insertion finds no room in its segments, or to resize
+/// @note Only HOPSCOTCH_FC_SLOTS threads alive at the same time get a slot (given back when the
+///       thread exits), the others keep using the regular locked path until a slot is free
+/// @note NOT thread-safe: must be called before sharing the map
+void hopscotch_set_flat_combining(hopscotch_t *hs, bool enabled);
+
+/// @brief Create a read-through cache for the calling thread, in front of the map
+/// @param hs The hopscotch hashmap
+/// @param slots The number of entries (rounded up to a power of two), 0 for HOPSCOTCH_CACHE_DEFAULT_SLOTS
+/// @return A pointer to the cache or NULL if an error occured
+/// @note The cache is direct-mapped (one entry per hash & (slots - 1)) and keeps a copy of the
+///       cached keys (made with the alloc_copy function of the keys)
+/// @note NOT thread-safe: each thread must have its own cache, and destroy it before the map
+hopscotch_cache_t* hopscotch_cache_create(hopscotch_t *hs, size_t slots);
+
+/// @brief Destroy a thread-local cache (the map is not modified)
+void hopscotch_cache_destroy(hopscotch_cache_t *cache);
+
+/// @brief Get the value associated with the key, through the cache
+/// @param cache The cache of the calling thread
+/// @param key The key to search for
+/// @return A pointer to the value or NULL if the key was not found (same result as hopscotch_get)
+/// @note A hit does not read the buckets of the map, only the sequence counter of the key's
+///       stripe and of the table: any write to the stripe (or resize) invalidates the entry.
+///       Misses (found or not) are cached
+/// @complexity O(1)
+void* hopscotch_cache_get(hopscotch_cache_t *cache, const void *key);
+
+/// @see hashmap_set_fn_alloc_copy_key
+void hopscotch_set_fn_alloc_copy_key(hopscotch_t *hs, alloc_copy_fn_t key_alloc_fn);
+
+/// @see hashmap_set_fn_alloc_copy_value
+void hopscotch_set_fn_alloc_copy_value(hopscotch_t *hs, alloc_copy_fn_t value_alloc_fn);
+
+/// @see hashmap_set_fn_destroy_key
+void hopscotch_set_fn_destroy_key(hopscotch_t *hs, destroy_fn_t key_destroy_fn);
+
+/// @see hashmap_set_fn_destroy_value
+void hopscotch_set_fn_destroy_value(hopscotch_t *hs, destroy_fn_t value_destroy_fn);
+
+/// @see hashmap_set_fn_compare
+void hopscotch_set_fn_compare(hopscotch_t *hs, compare_fn_t compare_fn);
+
+#endif
@@ -0,0 +1,379 @@
+#include "mmap_map.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HEADER_SIZE 4096 //the header has the first page for itself
+#define LOAD_BALANCE_THRESHOLD_MAX HASHMAP_DEFAULT_LOAD_BALANCE_THRESHOLD_MAX
+#define NO_ENTRY 0 //offset 0 is the header: never an entry
+
+//beginning of the file (every field is an offset from the start of the file or a number)
+typedef struct {
+    char magic[8];
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t table;//bucket heads (capacity offsets)
+    uint64_t heap_end;//end of the allocated part of the file
+    uint64_t free_list;//first free entry (chained with next)
+    uint64_t clean;//1 if nothing was modified since the last checkpoint
+} file_header_t;
+
+//an entry is followed by its key and its value (each one aligned on 8 bytes)
+typedef struct {
+    uint64_t next;
+    uint64_t hash;
+} entry_t;
+
+struct _mmap_map_t {
+    int fd;
+    char *base;
+    size_t size;//size of the file and of the mapping
+    hash_fn_t fn_hash;
+
+    size_t key_size;
+    size_t value_size;
+    size_t value_offset;//from the start of an entry
+    size_t entry_size;
+    bool was_clean;
+    bool dirty;//clean = 0 is already on the disk (until the next checkpoint)
+};
+
+static bool header_valid(const mmap_map_t *mm);
+static bool map_file(mmap_map_t *mm, size_t size);
+static bool file_grow(mmap_map_t *mm, size_t needed);
+static uint64_t heap_alloc(mmap_map_t *mm, size_t size);
+static uint64_t entry_alloc(mmap_map_t *mm);
+static void entry_free(mmap_map_t *mm, uint64_t offset);
+static void table_grow(mmap_map_t *mm);
+static uint64_t* find_link(mmap_map_t *mm, size_t hash, const void *key);
+
+static inline size_t align8(size_t n)
+{ return (n + 7) & ~(size_t)7; }
+
+static inline file_header_t* header_of(const mmap_map_t *mm)
+{ return (file_header_t*)mm->base; }
+
+static inline entry_t* entry_at(const mmap_map_t *mm, uint64_t offset)
+{ return (entry_t*)(mm->base + offset); }
+
+static inline uint64_t* table_of(const mmap_map_t *mm)
+{ return (uint64_t*)(mm->base + header_of(mm)->table); }
+
+//before the first mutation after a checkpoint: the marker reaches the disk before the pages it guards
+static bool mark_dirty(mmap_map_t *mm)
+{
+    if(mm->dirty) return true;
+
+    header_of(mm)->clean = 0;
+    if(msync(mm->base, HEADER_SIZE, MS_SYNC) != 0) return (perror("msync"), false);
+
+    mm->dirty = true;
+    return true;
+}
+
+mmap_map_t* mmap_map_open(const char *path, size_t initial_capacity, hash_fn_t hash_fn,
+                          const size_t key_size, const size_t value_size)
+{
+    assert(key_size > 0 && value_size > 0);
+
+    if(hash_fn == NULL) hash_fn = HASH_FUNC_DEFAULT;
+    if(initial_capacity == 0) initial_capacity = HASHMAP_DEFAULT_CAPACITY;
+
+    mmap_map_t *mm = calloc(1, sizeof(*mm));
+    if(!mm) return (perror("calloc"), NULL);
+
+    mm->fn_hash = hash_fn;
+    mm->key_size = key_size;
+    mm->value_size = value_size;
+    mm->value_offset = sizeof(entry_t) + align8(key_size);
+    mm->entry_size = mm->value_offset + align8(value_size);
+
+    mm->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(mm->fd < 0) return (perror("open"), free(mm), NULL);
+
+    //un seul processus a la fois: les mutations se font directement dans le fichier
+    if(flock(mm->fd, LOCK_EX | LOCK_NB) != 0) return (perror("flock"), close(mm->fd), free(mm), NULL);
+
+    struct stat st;
+    if(fstat(mm->fd, &st) != 0) return (perror("fstat"), close(mm->fd), free(mm), NULL);
+
+    if(st.st_size == 0)
+    {
+        //nouveau fichier: entete, table, et de la place pour autant d'entrees que de buckets
+        size_t capacity = HASHMAP_MINIMAL_CAPACITY;
+        while(capacity < initial_capacity) capacity <<= 1;
+
+        size_t size = HEADER_SIZE + capacity * sizeof(uint64_t) + capacity * mm->entry_size;
+        if(ftruncate(mm->fd, (off_t)size) != 0) return (perror("ftruncate"), close(mm->fd), free(mm), NULL);
+        if(!map_file(mm, size)) return (close(mm->fd), free(mm), NULL);
+
+        file_header_t *header = header_of(mm);
+        memcpy(header->magic, MMAP_MAP_MAGIC, sizeof(header->magic));
+        header->key_size = key_size;
+        header->value_size = value_size;
+        header->capacity = capacity;
+        header->count = 0;
+        header->table = HEADER_SIZE;
+        header->heap_end = HEADER_SIZE + capacity * sizeof(uint64_t);
+        header->free_list = NO_ENTRY;
+        header->clean = 1;
+
+        mm->was_clean = true;
+        return mm;
+    }
+
+    if(!map_file(mm, (size_t)st.st_size)) return (close(mm->fd), free(mm), NULL);
+
+    file_header_t *header = mm->size >= HEADER_SIZE ? header_of(mm) : NULL;
+    if(header == NULL || memcmp(header->magic, MMAP_MAP_MAGIC, sizeof(header->magic)) != 0
+       || header->key_size != key_size || header->value_size != value_size)
+    {
+        fprintf(stderr, "mmap_map_open: %s is not a map with %zu+%zu bytes pairs\n", path, key_size, value_size);
+        munmap(mm->base, mm->size);
+        close(mm->fd);
+        free(mm);
+        return NULL;
+    }
+
+    //fichier tronque (taille perdue) ou entete abime: les offsets sortiraient du mapping
+    if(!header_valid(mm))
+    {
+        fprintf(stderr, "mmap_map_open: %s is corrupted (offsets beyond the end of the file)\n", path);
+        munmap(mm->base, mm->size);
+        close(mm->fd);
+        free(mm);
+        return NULL;
+    }
+
+    mm->was_clean = header->clean == 1;
+    mm->dirty = !mm->was_clean;//deja marque sur le disque
+    return mm;
+}
+
+void mmap_map_close(mmap_map_t *mm)
+{
+    mmap_map_sync(mm);
+    munmap(mm->base, mm->size);
+    close(mm->fd);//libere aussi le flock
+    free(mm);
+}
+
+bool mmap_map_sync(mmap_map_t *mm)
+{
+    //les donnees d'abord, puis le marqueur: un fichier marque propre est toujours complet
+    if(msync(mm->base, mm->size, MS_SYNC) != 0) return (perror("msync"), false);
+
+    header_of(mm)->clean = 1;
+    if(msync(mm->base, HEADER_SIZE, MS_SYNC) != 0) return (perror("msync"), false);
+
+    mm->dirty = false;
+    return true;
+}
+
+bool mmap_map_was_clean(mmap_map_t *mm)
+{ return mm->was_clean; }
+
+void* mmap_map_get(mmap_map_t *mm, const void *key)
+{
+    uint64_t *link = find_link(mm, mm->fn_hash(key, mm->key_size), key);
+    if(*link == NO_ENTRY) return NULL;
+
+    return (char*)entry_at(mm, *link) + mm->value_offset;
+}
+
+void* mmap_map_add(mmap_map_t *mm, const void *key, const void *value)
+{
+    size_t hash = mm->fn_hash(key, mm->key_size);
+    uint64_t *link = find_link(mm, hash, key);
+    if(*link != NO_ENTRY) return (char*)entry_at(mm, *link) + mm->value_offset;
+
+    if(!mark_dirty(mm)) return NULL;
+
+    //on agrandit la table avant d'ajouter (comme hashmap_add)
+    file_header_t *header = header_of(mm);
+    if((float)(header->count + 1) / header->capacity > LOAD_BALANCE_THRESHOLD_MAX) table_grow(mm);
+
+    //l'allocation peut deplacer le mapping: les pointeurs sont recalcules apres
+    uint64_t offset = entry_alloc(mm);
+    if(offset == NO_ENTRY) return NULL;
+
+    header = header_of(mm);
+    entry_t *entry = entry_at(mm, offset);
+    entry->hash = hash;
+    memcpy((char*)entry + sizeof(entry_t), key, mm->key_size);
+    memcpy((char*)entry + mm->value_offset, value, mm->value_size);
+
+    //l'entree est complete avant d'etre chainee
+    uint64_t *head = &table_of(mm)[hash & (header->capacity - 1)];
+    entry->next = *head;
+    *head = offset;
+    header->count++;
+
+    return (char*)entry + mm->value_offset;
+}
+
+bool mmap_map_remove(mmap_map_t *mm, const void *key)
+{
+    uint64_t *link = find_link(mm, mm->fn_hash(key, mm->key_size), key);
+    if(*link == NO_ENTRY) return false;
+
+    if(!mark_dirty(mm)) return false;
+
+    uint64_t offset = *link;
+    *link = entry_at(mm, offset)->next;
+    header_of(mm)->count--;
+
+    entry_free(mm, offset);
+    return true;
+}
+
+size_t mmap_map_count(mmap_map_t *mm)
+{ return header_of(mm)->count; }
+
+size_t mmap_map_capacity(mmap_map_t *mm)
+{ return header_of(mm)->capacity; }
+
+size_t mmap_map_file_size(mmap_map_t *mm)
+{ return mm->size; }
+
+
+//--------------- FILE ---------------//
+
+//the offsets of the header stay in the file (the entries themselves are not checked)
+static bool header_valid(const mmap_map_t *mm)
+{
+    const file_header_t *header = header_of(mm);
+    uint64_t size = mm->size;
+
+    if(header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0) return false;
+    if(header->table < HEADER_SIZE || header->table % 8 != 0 || header->table > size) return false;
+    if(header->capacity > (size - header->table) / sizeof(uint64_t)) return false;
+    if(header->heap_end < HEADER_SIZE || header->heap_end > size) return false;
+    if(header->count > (header->heap_end - HEADER_SIZE) / mm->entry_size) return false;
+
+    return header->free_list == NO_ENTRY ||
+           (header->free_list >= HEADER_SIZE && header->free_list <= header->heap_end - mm->entry_size);
+}
+
+static bool map_file(mmap_map_t *mm, size_t size)
+{
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mm->fd, 0);
+    if(base == MAP_FAILED) return (perror("mmap"), false);
+
+    mm->base = base;
+    mm->size = size;
+    return true;
+}
+
+//grow the file (and the mapping) so that at least needed more bytes fit after heap_end
+static bool file_grow(mmap_map_t *mm, size_t needed)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t growth = mm->size < MMAP_MAP_MAX_GROWTH ? mm->size : MMAP_MAP_MAX_GROWTH;
+    if(growth < needed) growth = needed;
+
+    size_t size = (mm->size + growth + page_size - 1) / page_size * page_size;
+    if(ftruncate(mm->fd, (off_t)size) != 0) return (perror("ftruncate"), false);
+
+    //les offsets restent valides, seule l'adresse du mapping change
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mm->fd, 0);
+    if(base == MAP_FAILED) return (perror("mmap"), false);
+
+    munmap(mm->base, mm->size);
+    mm->base = base;
+    mm->size = size;
+    return true;
+}
+
+//bump allocation at the end of the heap (NO_ENTRY if the file cannot grow)
+static uint64_t heap_alloc(mmap_map_t *mm, size_t size)
+{
+    if(header_of(mm)->heap_end + size > mm->size && !file_grow(mm, size)) return NO_ENTRY;
+
+    file_header_t *header = header_of(mm);
+    uint64_t offset = header->heap_end;
+    header->heap_end += size;
+    return offset;
+}
+
+static uint64_t entry_alloc(mmap_map_t *mm)
+{
+    file_header_t *header = header_of(mm);
+    if(header->free_list == NO_ENTRY) return heap_alloc(mm, mm->entry_size);
+
+    uint64_t offset = header->free_list;
+    header->free_list = entry_at(mm, offset)->next;
+    return offset;
+}
+
+static void entry_free(mmap_map_t *mm, uint64_t offset)
+{
+    file_header_t *header = header_of(mm);
+    entry_at(mm, offset)->next = header->free_list;
+    header->free_list = offset;
+}
+
+//double the table, the old table is cut into free entries
+static void table_grow(mmap_map_t *mm)
+{
+    size_t capacity = header_of(mm)->capacity;
+    size_t new_capacity = capacity << 1;
+
+    uint64_t new_table = heap_alloc(mm, new_capacity * sizeof(uint64_t));
+    if(new_table == NO_ENTRY) return;//on garde la table actuelle, les chaines seront plus longues
+
+    file_header_t *header = header_of(mm);
+    uint64_t *old_heads = table_of(mm);
+    uint64_t *new_heads = (uint64_t*)(mm->base + new_table);
+    memset(new_heads, 0, new_capacity * sizeof(uint64_t));
+
+    //le hash est garde dans l'entree: pas besoin de rehasher les clefs
+    for(size_t i = 0; i < capacity; i++)
+    {
+        uint64_t offset = old_heads[i];
+        while(offset != NO_ENTRY)
+        {
+            entry_t *entry = entry_at(mm, offset);
+            uint64_t next = entry->next;
+
+            uint64_t *head = &new_heads[entry->hash & (new_capacity - 1)];
+            entry->next = *head;
+            *head = offset;
+            offset = next;
+        }
+    }
+
+    uint64_t old_table = header->table;
+    header->table = new_table;
+    header->capacity = new_capacity;
+
+    //la place de l'ancienne table sert aux prochaines entrees
+    for(size_t used = 0; used + mm->entry_size <= capacity * sizeof(uint64_t); used += mm->entry_size)
+        entry_free(mm, old_table + used);
+}
+
+//link (bucket head or next of the previous entry) pointing to the entry of the key, or to NO_ENTRY
+static uint64_t* find_link(mmap_map_t *mm, size_t hash, const void *key)
+{
+    file_header_t *header = header_of(mm);
+    uint64_t *link = &table_of(mm)[hash & (header->capacity - 1)];
+
+    while(*link != NO_ENTRY)
+    {
+        entry_t *entry = entry_at(mm, *link);
+        if(entry->hash == hash && memcmp((char*)entry + sizeof(entry_t), key, mm->key_size) == 0) return link;
+
+        link = &entry->next;
+    }
+
+    return link;
+}
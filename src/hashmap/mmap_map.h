@@ -0,0 +1,93 @@
+/*
+ *  Persistent hashmap stored in a memory-mapped file.
+ *
+ *  The whole map (bucket table and key-value pairs) lives in a file mapped with MAP_SHARED:
+ *  the entries are linked with offsets from the start of the file instead of pointers, so the
+ *  file can be mapped at any address. The mutations are done in place, directly in the mapping.
+ *  Reopening the file gives back the map right away: there is no load phase, the pages are
+ *  faulted in by the kernel when they are used.
+ *
+ *  The file grows (ftruncate + new mapping) when the entries need more room. The table
+ *  doubles like the one of hashmap_t (power-of-two capacity, separate chaining); the space of
+ *  the old table and of the removed entries is reused for the next entries.
+ *
+ *  ---------- Durability ---------
+ *  - a crash of the process loses nothing: the mapping is shared, the modified pages are in
+ *    the page cache and reach the file anyway.
+ *  - mmap_map_sync is a checkpoint: it writes the modified pages to the disk (msync), then marks
+ *    the file clean. A crash of the machine between two checkpoints can leave the file with a
+ *    part of the later mutations: mmap_map_was_clean tells if the file was opened in that state.
+ *  - the first mutation after a checkpoint marks the file dirty on the disk (msync of the
+ *    header) before modifying anything else: the kernel can write the modified pages back at
+ *    any time, they never reach the disk under a clean marker. One msync per checkpoint
+ *    interval, not per mutation.
+ *  - a file whose header points beyond its end (truncated file, lost size update) is rejected
+ *    by mmap_map_open.
+ *
+ *  NOT THREAD-SAFE (like hashmap_t). A file can only be opened by one map at a time (flock).
+ *
+ *  -------- Limitations --------
+ *  - keys and values are flat: they are stored as their key_size / value_size bytes (no
+ *    pointers, no custom alloc/copy/destroy functions), and the keys are compared with memcmp.
+ *  - the hash function must be the same every time the file is opened.
+ *  - the pointers returned by mmap_map_get / mmap_map_add are valid until the next
+ *    mmap_map_add (the file may be mapped again at another address) or the removal of the key.
+ *  - the table never shrinks, and the file never gets smaller.
+*/
+
+#ifndef __MMAP_MAP_H__
+#define __MMAP_MAP_H__
+
+#include "hashmap.h"
+
+typedef struct _mmap_map_t mmap_map_t;
+
+#define MMAP_MAP_MAGIC "HMMMAP1" //first 8 bytes (with the '\0') of the file
+#define MMAP_MAP_MAX_GROWTH (1UL << 30) //the file grows by its size (x2), but at most by this many bytes at once
+
+/// @brief Open a persistent map, or create it if the file does not exist (or is empty)
+/// @param path The file of the map
+/// @param initial_capacity The initial capacity of a new map (0 for HASHMAP_DEFAULT_CAPACITY)
+/// @param hash_fn The hash function to use (NULL for the default hash function)
+/// @param key_size The size of the key in bytes
+/// @param value_size The size of the value in bytes
+/// @return A pointer to the map or NULL if an error occured (not a map file, other key/value
+///         sizes, file already opened, header pointing beyond the end of the file...)
+mmap_map_t* mmap_map_open(const char *path, size_t initial_capacity, hash_fn_t hash_fn,
+                          const size_t key_size, const size_t value_size);
+
+/// @brief Checkpoint the map (see mmap_map_sync) and close it
+void mmap_map_close(mmap_map_t *mm);
+
+/// @brief Write every modification to the disk (checkpoint), and mark the file clean
+/// @return true on success, false if msync failed
+bool mmap_map_sync(mmap_map_t *mm);
+
+/// @brief Tell if the file was clean when it was opened (closed or synced after its last modification)
+bool mmap_map_was_clean(mmap_map_t *mm);
+
+/// @brief Get the value associated with the key
+/// @return A pointer to the value in the mapping (it can be modified in place) or NULL if not found
+/// @note A value modified in place does not mark the file dirty: call mmap_map_sync to checkpoint it
+void* mmap_map_get(mmap_map_t *mm, const void *key);
+
+/// @brief Add a new key-value pair
+/// @return A pointer to the added value, a pointer to the existing value or NULL if an error occured
+///         (the file could not grow, or could not be marked dirty)
+/// @note If the key already exists, it will NOT REPLACE the old value ! (but return the old value)
+void* mmap_map_add(mmap_map_t *mm, const void *key, const void *value);
+
+/// @brief Remove a key-value pair
+/// @return true if the key was removed, false otherwise (not found, or the file could not be marked dirty)
+bool mmap_map_remove(mmap_map_t *mm, const void *key);
+
+/// @brief Get the number of key-value pairs
+size_t mmap_map_count(mmap_map_t *mm);
+
+/// @brief Get the capacity of the table
+size_t mmap_map_capacity(mmap_map_t *mm);
+
+/// @brief Get the size of the file, in bytes
+size_t mmap_map_file_size(mmap_map_t *mm);
+
+#endif
@@ -0,0 +1,505 @@
+#include "numa_map.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define CACHE_LINE_SIZE 64
+
+//memory policies (linux/mempolicy.h), without depending on libnuma
+#define MPOL_PREFERRED_MODE 1
+#define NODEMASK_BITS (sizeof(unsigned long) * 8)
+#define NODEMASK_LONGS ((NUMA_MAP_MAX_NODES + NODEMASK_BITS - 1) / NODEMASK_BITS)
+
+//a copy of a shard, placed on a node
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_rwlock_t lock;
+    hashmap_t *map;
+    int node;
+} replica_t;
+
+typedef struct {
+    replica_t *replicas;//replicas[0] is the primary copy, a replicated shard has one copy per node (replicas[node])
+    size_t replica_count;
+    int node;
+} shard_t;
+
+struct _numa_map_t {
+    shard_t *shards;
+    size_t shard_count;
+    int node_count;
+
+    //settings used to create the replicas
+    size_t initial_capacity;
+    size_t key_size;
+    size_t value_size;
+
+    //functions (NULL = default function of hashmap_t)
+    hash_fn_t fn_hash;
+    compare_fn_t fn_compare;
+    destroy_fn_t fn_destroy_key;
+    destroy_fn_t fn_destroy_value;
+    alloc_copy_fn_t fn_alloc_copy_key;
+    alloc_copy_fn_t fn_alloc_copy_value;
+};
+
+//saved memory policy of the calling thread
+typedef struct {
+    bool changed;
+    int mode;
+    unsigned long nodemask[NODEMASK_LONGS];
+} mempolicy_t;
+
+static int online_node_count(void);
+static bool replica_init(const numa_map_t *nm, replica_t *replica, int node);
+static void replica_destroy(replica_t *replica);
+static void replica_move(replica_t *dst, replica_t *src);
+static void prefer_node(const numa_map_t *nm, int node, mempolicy_t *saved);
+static void restore_policy(const mempolicy_t *saved);
+
+static inline replica_t* local_replica(const shard_t *shard, int node)
+{
+    if(shard->replica_count == 1) return &shard->replicas[0];
+    return &shard->replicas[(size_t)node % shard->replica_count];
+}
+
+numa_map_t* numa_map_create(size_t shard_count, size_t initial_capacity, hash_fn_t hash_fn,
+                            const size_t key_size, const size_t value_size)
+{
+    assert(key_size > 0 && value_size > 0);
+
+    if(hash_fn == NULL) hash_fn = HASH_FUNC_DEFAULT;
+
+    numa_map_t *nm = calloc(1, sizeof(*nm));
+    if(!nm) return (perror("calloc"), NULL);
+
+    nm->node_count = online_node_count();
+    nm->shard_count = shard_count > 0 ? shard_count : (size_t)nm->node_count;
+    nm->initial_capacity = initial_capacity;
+    nm->key_size = key_size;
+    nm->value_size = value_size;
+    nm->fn_hash = hash_fn;
+
+    nm->shards = calloc(nm->shard_count, sizeof(*nm->shards));
+    if(!nm->shards) return (perror("calloc"), free(nm), NULL);
+
+    for(size_t i = 0; i < nm->shard_count; i++)
+    {
+        shard_t *shard = &nm->shards[i];
+        shard->node = (int)(i % (size_t)nm->node_count);
+        shard->replica_count = 1;
+        shard->replicas = aligned_alloc(CACHE_LINE_SIZE, sizeof(*shard->replicas));
+
+        if(!shard->replicas || !replica_init(nm, &shard->replicas[0], shard->node))
+        {
+            if(!shard->replicas) perror("aligned_alloc");
+            free(shard->replicas);
+            shard->replicas = NULL;
+            shard->replica_count = 0;
+            numa_map_destroy(nm);
+            return NULL;
+        }
+    }
+
+    return nm;
+}
+
+void numa_map_destroy(numa_map_t *nm)
+{
+    for(size_t i = 0; i < nm->shard_count; i++)
+    {
+        for(size_t r = 0; r < nm->shards[i].replica_count; r++)
+            replica_destroy(&nm->shards[i].replicas[r]);
+
+        free(nm->shards[i].replicas);
+    }
+
+    free(nm->shards);
+    free(nm);
+}
+
+bool numa_map_set_replicated(numa_map_t *nm, size_t shard_index, bool replicated)
+{
+    assert(shard_index < nm->shard_count);
+    shard_t *shard = &nm->shards[shard_index];
+
+    if(!replicated)
+    {
+        if(shard->replica_count == 1) return true;
+
+        //on garde uniquement la copie principale (replicas[node]) et on la remet en premier
+        for(size_t r = 0; r < shard->replica_count; r++)
+        {
+            if(r != (size_t)shard->node) replica_destroy(&shard->replicas[r]);
+        }
+
+        if(shard->node != 0) replica_move(&shard->replicas[0], &shard->replicas[shard->node]);
+
+        shard->replica_count = 1;
+        return true;
+    }
+
+    if(shard->replica_count > 1 || nm->node_count == 1) return true;
+    if(hashmap_count(shard->replicas[0].map) > 0) return false;
+
+    replica_t *replicas = aligned_alloc(CACHE_LINE_SIZE, (size_t)nm->node_count * sizeof(*replicas));
+    if(!replicas) return (perror("aligned_alloc"), false);
+
+    //une copie par noeud, la copie du noeud du shard est la copie existante
+    for(int node = 0; node < nm->node_count; node++)
+    {
+        if(node == shard->node) continue;
+
+        if(!replica_init(nm, &replicas[node], node))
+        {
+            for(int i = 0; i < node; i++)
+            {
+                if(i != shard->node) replica_destroy(&replicas[i]);
+            }
+
+            free(replicas);
+            return false;
+        }
+    }
+
+    replica_move(&replicas[shard->node], &shard->replicas[0]);
+
+    free(shard->replicas);
+    shard->replicas = replicas;
+    shard->replica_count = (size_t)nm->node_count;
+    return true;
+}
+
+bool numa_map_set_shard_node(numa_map_t *nm, size_t shard_index, int node)
+{
+    assert(shard_index < nm->shard_count);
+    shard_t *shard = &nm->shards[shard_index];
+
+    if(node < 0 || node >= nm->node_count) return false;
+    if(node == shard->node) return true;
+
+    //deja une copie sur chaque noeud: seule la copie principale change
+    if(shard->replica_count > 1)
+    {
+        shard->node = node;
+        return true;
+    }
+
+    if(hashmap_count(shard->replicas[0].map) > 0) return false;
+
+    //la copie est vide: on la recree sur le nouveau noeud (table liee au noeud)
+    replica_t replica;
+    if(!replica_init(nm, &replica, node)) return false;
+
+    replica_destroy(&shard->replicas[0]);
+    replica_move(&shard->replicas[0], &replica);
+    shard->node = node;
+    return true;
+}
+
+size_t numa_map_shard_of(numa_map_t *nm, const void *key)
+{
+    //les bits de poids fort du hash, les shards utilisent les bits de poids faible (hash & (capacity - 1))
+    size_t hash = nm->fn_hash(key, nm->key_size);
+    return ((hash * 0x9e3779b97f4a7c15UL) >> 32) % nm->shard_count;
+}
+
+void* numa_map_get(numa_map_t *nm, const void *key)
+{ return numa_map_get_on_node(nm, key, numa_current_node()); }
+
+void* numa_map_get_on_node(numa_map_t *nm, const void *key, int node)
+{
+    shard_t *shard = &nm->shards[numa_map_shard_of(nm, key)];
+    replica_t *replica = local_replica(shard, node);
+
+    pthread_rwlock_rdlock(&replica->lock);
+    void *value = hashmap_get(replica->map, key);
+    pthread_rwlock_unlock(&replica->lock);
+
+    return value;
+}
+
+bool numa_map_get_copy(numa_map_t *nm, const void *key, void *value)
+{
+    shard_t *shard = &nm->shards[numa_map_shard_of(nm, key)];
+    replica_t *replica = local_replica(shard, numa_current_node());
+
+    //copie sous le verrou: une mise a jour concurrente ne peut pas etre lue a moitie
+    pthread_rwlock_rdlock(&replica->lock);
+    const void *stored = hashmap_get(replica->map, key);
+    if(stored != NULL) memcpy(value, stored, nm->value_size);
+    pthread_rwlock_unlock(&replica->lock);
+
+    return stored != NULL;
+}
+
+void* numa_map_add(numa_map_t *nm, const void *key, const void *value)
+{
+    shard_t *shard = &nm->shards[numa_map_shard_of(nm, key)];
+    replica_t *local = local_replica(shard, numa_current_node());
+    void *result = NULL;
+
+    //toutes les copies sont verrouillees (dans l'ordre) pour rester identiques
+    for(size_t r = 0; r < shard->replica_count; r++)
+        pthread_rwlock_wrlock(&shard->replicas[r].lock);
+
+    mempolicy_t saved = { .changed = false };
+    size_t done = 0;
+    for(; done < shard->replica_count; done++)
+    {
+        replica_t *replica = &shard->replicas[done];
+
+        //les noeuds, clefs et valeurs allouees par hashmap_add preferent le noeud de la copie
+        prefer_node(nm, replica->node, &saved);
+        void *added = hashmap_add(replica->map, key, value);
+        if(added == NULL) break;
+
+        if(replica == local) result = added;
+    }
+
+    restore_policy(&saved);
+
+    //si une copie a echoue, on annule l'ajout dans les autres
+    if(done < shard->replica_count)
+    {
+        for(size_t r = 0; r < done; r++)
+            hashmap_remove(shard->replicas[r].map, key);
+        result = NULL;
+    }
+
+    for(size_t r = shard->replica_count; r > 0; r--)
+        pthread_rwlock_unlock(&shard->replicas[r - 1].lock);
+
+    return result;
+}
+
+void* numa_map_update(numa_map_t *nm, const void *key, update_fn_t update_fn, void *ctx)
+{
+    shard_t *shard = &nm->shards[numa_map_shard_of(nm, key)];
+    replica_t *local = local_replica(shard, numa_current_node());
+    void *result = NULL;
+
+    //comme numa_map_add: toutes les copies verrouillees, et modifiees de la meme facon
+    for(size_t r = 0; r < shard->replica_count; r++)
+        pthread_rwlock_wrlock(&shard->replicas[r].lock);
+
+    bool existed = hashmap_get(shard->replicas[0].map, key) != NULL;
+
+    mempolicy_t saved = { .changed = false };
+    size_t done = 0;
+    for(; done < shard->replica_count; done++)
+    {
+        replica_t *replica = &shard->replicas[done];
+
+        prefer_node(nm, replica->node, &saved);
+        void *updated = hashmap_update(replica->map, key, update_fn, ctx);
+        if(updated == NULL) break;
+
+        if(replica == local) result = updated;
+    }
+
+    restore_policy(&saved);
+
+    //seule l'insertion d'une nouvelle clef peut echouer: on l'annule dans les autres copies
+    if(done < shard->replica_count)
+    {
+        for(size_t r = 0; r < done && !existed; r++)
+            hashmap_remove(shard->replicas[r].map, key);
+        result = NULL;
+    }
+
+    for(size_t r = shard->replica_count; r > 0; r--)
+        pthread_rwlock_unlock(&shard->replicas[r - 1].lock);
+
+    return result;
+}
+
+bool numa_map_remove(numa_map_t *nm, const void *key)
+{
+    shard_t *shard = &nm->shards[numa_map_shard_of(nm, key)];
+    bool removed = false;
+
+    for(size_t r = 0; r < shard->replica_count; r++)
+        pthread_rwlock_wrlock(&shard->replicas[r].lock);
+
+    for(size_t r = 0; r < shard->replica_count; r++)
+        removed = hashmap_remove(shard->replicas[r].map, key) || removed;
+
+    for(size_t r = shard->replica_count; r > 0; r--)
+        pthread_rwlock_unlock(&shard->replicas[r - 1].lock);
+
+    return removed;
+}
+
+size_t numa_map_count(numa_map_t *nm)
+{
+    size_t count = 0;
+    for(size_t i = 0; i < nm->shard_count; i++)
+    {
+        replica_t *replica = &nm->shards[i].replicas[0];
+
+        pthread_rwlock_rdlock(&replica->lock);
+        count += hashmap_count(replica->map);
+        pthread_rwlock_unlock(&replica->lock);
+    }
+
+    return count;
+}
+
+size_t numa_map_shard_count(numa_map_t *nm)
+{ return nm->shard_count; }
+
+int numa_map_shard_node(numa_map_t *nm, size_t shard)
+{ return nm->shards[shard].node; }
+
+int numa_map_node_count(numa_map_t *nm)
+{ return nm->node_count; }
+
+int numa_current_node(void)
+{
+#ifdef SYS_getcpu
+    unsigned int cpu, node;
+    if(syscall(SYS_getcpu, &cpu, &node, NULL) == 0) return (int)node;
+#endif
+    return 0;
+}
+
+//the setters apply the function to every copy of every shard, and remember it for the next replicas
+void numa_map_set_fn_compare(numa_map_t *nm, compare_fn_t compare_fn)
+{
+    nm->fn_compare = compare_fn;
+    for(size_t i = 0; i < nm->shard_count; i++)
+    {
+        for(size_t r = 0; r < nm->shards[i].replica_count; r++)
+            hashmap_set_fn_compare(nm->shards[i].replicas[r].map, compare_fn);
+    }
+}
+
+void numa_map_set_fn_alloc_copy_key(numa_map_t *nm, alloc_copy_fn_t key_alloc_fn)
+{
+    nm->fn_alloc_copy_key = key_alloc_fn;
+    for(size_t i = 0; i < nm->shard_count; i++)
+    {
+        for(size_t r = 0; r < nm->shards[i].replica_count; r++)
+            hashmap_set_fn_alloc_copy_key(nm->shards[i].replicas[r].map, key_alloc_fn);
+    }
+}
+
+void numa_map_set_fn_alloc_copy_value(numa_map_t *nm, alloc_copy_fn_t value_alloc_fn)
+{
+    nm->fn_alloc_copy_value = value_alloc_fn;
+    for(size_t i = 0; i < nm->shard_count; i++)
+    {
+        for(size_t r = 0; r < nm->shards[i].replica_count; r++)
+            hashmap_set_fn_alloc_copy_value(nm->shards[i].replicas[r].map, value_alloc_fn);
+    }
+}
+
+void numa_map_set_fn_destroy_key(numa_map_t *nm, destroy_fn_t key_destroy_fn)
+{
+    nm->fn_destroy_key = key_destroy_fn;
+    for(size_t i = 0; i < nm->shard_count; i++)
+    {
+        for(size_t r = 0; r < nm->shards[i].replica_count; r++)
+            hashmap_set_fn_destroy_key(nm->shards[i].replicas[r].map, key_destroy_fn);
+    }
+}
+
+void numa_map_set_fn_destroy_value(numa_map_t *nm, destroy_fn_t value_destroy_fn)
+{
+    nm->fn_destroy_value = value_destroy_fn;
+    for(size_t i = 0; i < nm->shard_count; i++)
+    {
+        for(size_t r = 0; r < nm->shards[i].replica_count; r++)
+            hashmap_set_fn_destroy_value(nm->shards[i].replicas[r].map, value_destroy_fn);
+    }
+}
+
+
+//number of online nodes, read from sysfs (ex: "0-3" or "0,2-3"), 1 if unknown
+static int online_node_count(void)
+{
+    FILE *file = fopen("/sys/devices/system/node/online", "r");
+    if(!file) return 1;
+
+    int max_node = 0, node;
+    char separator;
+    while(fscanf(file, "%d", &node) == 1)
+    {
+        if(node > max_node) max_node = node;
+        if(fscanf(file, "%c", &separator) != 1) break;
+    }
+
+    fclose(file);
+
+    if(max_node >= NUMA_MAP_MAX_NODES) max_node = NUMA_MAP_MAX_NODES - 1;
+    return max_node + 1;
+}
+
+static bool replica_init(const numa_map_t *nm, replica_t *replica, int node)
+{
+    replica->node = node;
+    replica->map = hashmap_create(nm->initial_capacity, nm->fn_hash, nm->key_size, nm->value_size);
+    if(!replica->map) return false;
+
+    //sur une machine a un seul noeud, inutile de passer par mmap + mbind
+    if(nm->node_count > 1) hashmap_set_numa_node(replica->map, node);
+
+    if(nm->fn_compare) hashmap_set_fn_compare(replica->map, nm->fn_compare);
+    if(nm->fn_alloc_copy_key) hashmap_set_fn_alloc_copy_key(replica->map, nm->fn_alloc_copy_key);
+    if(nm->fn_alloc_copy_value) hashmap_set_fn_alloc_copy_value(replica->map, nm->fn_alloc_copy_value);
+    if(nm->fn_destroy_key) hashmap_set_fn_destroy_key(replica->map, nm->fn_destroy_key);
+    if(nm->fn_destroy_value) hashmap_set_fn_destroy_value(replica->map, nm->fn_destroy_value);
+
+    pthread_rwlock_init(&replica->lock, NULL);
+    return true;
+}
+
+static void replica_destroy(replica_t *replica)
+{
+    pthread_rwlock_destroy(&replica->lock);
+    hashmap_destroy(replica->map);
+}
+
+//a lock cannot be copied: the map is moved and the lock initialized again
+static void replica_move(replica_t *dst, replica_t *src)
+{
+    dst->map = src->map;
+    dst->node = src->node;
+
+    pthread_rwlock_destroy(&src->lock);
+    pthread_rwlock_init(&dst->lock, NULL);
+}
+
+//make the new pages of the calling thread prefer the node (saving the previous policy once)
+static void prefer_node(const numa_map_t *nm, int node, mempolicy_t *saved)
+{
+#if defined(SYS_set_mempolicy) && defined(SYS_get_mempolicy)
+    if(nm->node_count == 1) return;
+
+    if(!saved->changed)
+    {
+        if(syscall(SYS_get_mempolicy, &saved->mode, saved->nodemask, NUMA_MAP_MAX_NODES, NULL, 0) != 0) return;
+        saved->changed = true;
+    }
+
+    unsigned long nodemask[NODEMASK_LONGS] = {0};
+    nodemask[node / NODEMASK_BITS] = 1UL << (node % NODEMASK_BITS);
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, nodemask, NUMA_MAP_MAX_NODES);
+#else
+    (void)nm; (void)node; (void)saved;
+#endif
+}
+
+static void restore_policy(const mempolicy_t *saved)
+{
+#ifdef SYS_set_mempolicy
+    if(saved->changed) syscall(SYS_set_mempolicy, saved->mode, saved->nodemask, NUMA_MAP_MAX_NODES);
+#else
+    (void)saved;
+#endif
+}
@@ -0,0 +1,137 @@
+/*
+ *  NUMA-aware sharded hashmap.
+ *
+ *  The keys are distributed (by hash) over several hashmap_t shards. Each shard is placed on
+ *  a NUMA node (round robin over the online nodes, or the node chosen with
+ *  numa_map_set_shard_node): its table is bound to the node (hashmap_set_numa_node), and the
+ *  key-value pairs it allocates prefer the node too.
+ *
+ *  A read-mostly shard can be replicated: it then has one copy per node, the writes are
+ *  applied to every copy and the reads are routed to the copy of the caller's node, so the
+ *  lookups never cross the interconnect.
+ *
+ *  THREAD-SAFE: every function (except the setters: placement, replication and custom functions,
+ *  which must be called before sharing the map) can be called from several threads at the same
+ *  time. Every copy of a shard has its own reader-writer lock.
+ *
+ *  Without NUMA support (single node machine, kernel without NUMA policies...), the map still
+ *  works as a simple sharded map.
+ *
+ *  -------- Limitations --------
+ *  - the pointer returned by numa_map_get / numa_map_add stays valid until the key is removed,
+ *    the caller must make sure no other thread removes it while it is used. Reading the value
+ *    through it races with numa_map_update: use numa_map_get_copy for values that are updated.
+ *  - the placement of the key-value pairs is best effort: the allocator may reuse memory that
+ *    was already faulted on an other node.
+*/
+
+#ifndef __NUMA_MAP_H__
+#define __NUMA_MAP_H__
+
+#include "hashmap.h"
+
+typedef struct _numa_map_t numa_map_t;
+
+#define NUMA_MAP_MAX_NODES 64
+
+/// @brief Create a new NUMA-aware sharded hashmap
+/// @param shard_count The number of shards (0 for one shard per NUMA node)
+/// @param initial_capacity The initial capacity of each shard
+/// @param hash_fn The hash function to use (NULL for the default hash function)
+/// @param key_size The size of the key in bytes
+/// @param value_size The size of the value in bytes
+/// @return A pointer to the map or NULL if an error occured
+/// @note Shard i is placed on the node (i % numa_map_node_count()), see numa_map_set_shard_node to choose it
+/// @see hashmap_create
+numa_map_t* numa_map_create(size_t shard_count, size_t initial_capacity, hash_fn_t hash_fn,
+                            const size_t key_size, const size_t value_size);
+
+/// @brief Destroy the map, all its shards and their replicas
+/// @note NOT thread-safe: no other thread may use the map anymore
+void numa_map_destroy(numa_map_t *nm);
+
+/// @brief Replicate a read-mostly shard on every NUMA node (or stop replicating it)
+/// @param nm The map
+/// @param shard The index of the shard (see numa_map_shard_of)
+/// @param replicated true to have one copy of the shard per node
+/// @return true on success, false if the shard is not empty or if an allocation failed
+/// @note The replication must be chosen while the shard is still empty
+/// @note NOT thread-safe: the copies are created and destroyed without lock, must be called before sharing the map
+bool numa_map_set_replicated(numa_map_t *nm, size_t shard, bool replicated);
+
+/// @brief Place a shard on a chosen NUMA node (instead of the round robin of numa_map_create)
+/// @param nm The map
+/// @param shard The index of the shard (see numa_map_shard_of)
+/// @param node The NUMA node (0 <= node < numa_map_node_count())
+/// @return true on success, false if the node is invalid, the shard is not empty or an allocation failed
+/// @note A replicated shard keeps its copies, only its primary copy becomes the one of the node
+/// @note NOT thread-safe: the copy is created again without lock, must be called before sharing the map
+bool numa_map_set_shard_node(numa_map_t *nm, size_t shard, int node);
+
+/// @brief Get the value associated with the key, from the copy of the shard local to the calling thread
+/// @return A pointer to the value or NULL if the key was not found
+void* numa_map_get(numa_map_t *nm, const void *key);
+
+/// @brief Get the value associated with the key, from the copy of the shard on the given node
+/// @param node The NUMA node to read from (if the shard is not replicated, its only copy is used)
+/// @return A pointer to the value or NULL if the key was not found
+void* numa_map_get_on_node(numa_map_t *nm, const void *key, int node);
+
+/// @brief Copy the value associated with the key (value_size bytes), from the copy of the shard local to the calling thread
+/// @param value Receives the value
+/// @return true if the key was found
+/// @note The value is copied while the copy of the shard is locked: never a half-updated value
+bool numa_map_get_copy(numa_map_t *nm, const void *key, void *value);
+
+/// @brief Add a new key-value pair (to every copy of its shard)
+/// @return A pointer to the added value (in the local copy), a pointer to the existing value or NULL if an error occured
+/// @note If the key already exists, it will NOT REPLACE the old value ! (but return the old value)
+void* numa_map_add(numa_map_t *nm, const void *key, const void *value);
+
+/// @brief Update the value associated with the key in place, in every copy of its shard (locked)
+/// @param update_fn The function that modifies the value (called with the value and ctx, once per copy)
+/// @param ctx User data given to update_fn
+/// @return A pointer to the updated value (in the local copy) or NULL if an error occured
+/// @note If the key does not exist, a default value (value_size zero bytes) is inserted first, then updated
+/// @note update_fn must give the same result for every copy, and must not call the functions of this map (deadlock)
+/// @see hashmap_update
+void* numa_map_update(numa_map_t *nm, const void *key, update_fn_t update_fn, void *ctx);
+
+/// @brief Remove a key-value pair (from every copy of its shard)
+/// @return true if the key was removed, false otherwise (not found)
+bool numa_map_remove(numa_map_t *nm, const void *key);
+
+/// @brief Get the number of key-value pairs (replicated pairs are counted once)
+size_t numa_map_count(numa_map_t *nm);
+
+/// @brief Get the number of shards
+size_t numa_map_shard_count(numa_map_t *nm);
+
+/// @brief Get the index of the shard holding the key
+size_t numa_map_shard_of(numa_map_t *nm, const void *key);
+
+/// @brief Get the NUMA node of a shard (the node of its primary copy)
+int numa_map_shard_node(numa_map_t *nm, size_t shard);
+
+/// @brief Get the number of NUMA nodes used by the map
+int numa_map_node_count(numa_map_t *nm);
+
+/// @brief Get the NUMA node of the CPU running the calling thread (0 if unknown)
+int numa_current_node(void);
+
+/// @see hashmap_set_fn_alloc_copy_key
+void numa_map_set_fn_alloc_copy_key(numa_map_t *nm, alloc_copy_fn_t key_alloc_fn);
+
+/// @see hashmap_set_fn_alloc_copy_value
+void numa_map_set_fn_alloc_copy_value(numa_map_t *nm, alloc_copy_fn_t value_alloc_fn);
+
+/// @see hashmap_set_fn_destroy_key
+void numa_map_set_fn_destroy_key(numa_map_t *nm, destroy_fn_t key_destroy_fn);
+
+/// @see hashmap_set_fn_destroy_value
+void numa_map_set_fn_destroy_value(numa_map_t *nm, destroy_fn_t value_destroy_fn);
+
+/// @see hashmap_set_fn_compare
+void numa_map_set_fn_compare(numa_map_t *nm, compare_fn_t compare_fn);
+
+#endif
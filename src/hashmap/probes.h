@@ -0,0 +1,57 @@
+/*
+ *  USDT static tracepoints (sys/sdt.h), to trace the maps of a running process with bpftrace,
+ *  perf or systemtap, without rebuilding it.
+ *
+ *  Compiled in with -DHASHMAP_ENABLE_USDT (make USDT=1, needs the sys/sdt.h header of systemtap,
+ *  package systemtap-sdt-dev or systemtap-sdt-devel; nothing at run time). A probe is then a
+ *  single nop in the code, turned into a breakpoint only while a tracer is attached, and its
+ *  arguments are described in the .note.stapsdt section of the binary.
+ *  Without HASHMAP_ENABLE_USDT, the probes are empty and their arguments are not evaluated.
+ *
+ *  ---------- Probes ---------
+ *  hashmap:resize__start (map, capacity, new_capacity, count)
+ *  hashmap:resize__end   (map, capacity, ok)           ok = 0: the new table could not be allocated
+ *  hashmap:lookup        (map, chain_length, is_tree)  length of the bucket searched by a lookup
+ *  hashmap:alloc__fail   (map, what)                   what = 0: key-value pair, 1: table
+ *  cuckoo:resize__start  (map, buckets, new_buckets, count)
+ *  cuckoo:resize__end    (map, buckets, ok)
+ *  cuckoo:displace       (map, moves)                  entries moved to make room for an insertion
+ *  cuckoo:alloc__fail    (map)                         key-value pair
+ *  hopscotch:resize__start (map, capacity, new_capacity, count)
+ *  hopscotch:resize__end   (map, capacity, ok)
+ *  spill_map:evict       (map, partition, count)       a partition written to disk (over the budget)
+ *  spill_map:fault__in   (map, partition, count)       a spilled partition read back in memory
+ *
+ *  Example: distribution of the chain lengths of the lookups
+ *  bpftrace -e 'usdt:./bin/server:hashmap:lookup { @[arg1] = count(); }' -p $(pidof server)
+*/
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#ifdef HASHMAP_ENABLE_USDT
+
+#if defined(__has_include) && !__has_include(<sys/sdt.h>)
+#error "HASHMAP_ENABLE_USDT needs sys/sdt.h (systemtap-sdt-dev)"
+#endif
+
+#include <sys/sdt.h>
+
+#define PROBE0(provider, name) DTRACE_PROBE(provider, name)
+#define PROBE1(provider, name, a) DTRACE_PROBE1(provider, name, a)
+#define PROBE2(provider, name, a, b) DTRACE_PROBE2(provider, name, a, b)
+#define PROBE3(provider, name, a, b, c) DTRACE_PROBE3(provider, name, a, b, c)
+#define PROBE4(provider, name, a, b, c, d) DTRACE_PROBE4(provider, name, a, b, c, d)
+
+#else
+
+//sizeof: les arguments comptent comme utilises, sans etre evalues
+#define PROBE0(provider, name) do {} while(0)
+#define PROBE1(provider, name, a) do { (void)sizeof(a); } while(0)
+#define PROBE2(provider, name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while(0)
+#define PROBE3(provider, name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while(0)
+#define PROBE4(provider, name, a, b, c, d) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while(0)
+
+#endif
+
+#endif
@@ -0,0 +1,685 @@
+#include "spill_map.h"
+#include "probes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BUCKET_OVERHEAD (2 * sizeof(void*)) //estimated memory of a bucket of a resident partition
+#define SPILL_LOAD_FACTOR 0.75 //records / capacity of the bucket pages, when a partition is spilled
+#define NO_PAGE UINT64_MAX
+
+typedef struct {
+    uint32_t count;//records in the page
+    uint32_t unused;
+    uint64_t next;//overflow page + 1, 0 if none
+} page_header_t;
+
+typedef struct {
+    hashmap_t *map;//resident partition, NULL if spilled
+
+    //spilled partition: bucket pages [first_page, first_page + page_count) of the spill file
+    uint64_t first_page;
+    size_t page_count;//power of two
+    size_t overflow_pages;
+    size_t disk_accesses;//since the partition was spilled
+
+    size_t count;
+    size_t memory;//estimated memory of the resident partition
+    uint64_t last_access;//clock of the last access (the least recently used partitions are spilled first)
+} partition_t;
+
+//free pages of the spill file (pages of the partitions faulted back in)
+typedef struct {
+    uint64_t first;
+    uint64_t count;
+} page_run_t;
+
+struct _spill_map_t {
+    partition_t *partitions;
+    size_t partition_count;
+    unsigned int partition_bits;
+
+    size_t key_size;
+    size_t value_size;
+    size_t record_size;
+    size_t records_per_page;
+    hash_fn_t fn_hash;
+
+    size_t memory_budget;
+    size_t memory;//estimated memory of the resident partitions
+    uint64_t clock;
+
+    //spill file
+    int fd;
+    char *path;//removed by spill_map_destroy (NULL: anonymous file, already unlinked)
+    uint64_t file_pages;
+    page_run_t *free_runs;
+    size_t free_run_count;
+    size_t free_run_capacity;
+
+    //buffers (a page, and aligned copies of a key and a value read from a page)
+    unsigned char *page;
+    void *key;
+    void *value;
+};
+
+typedef enum {
+    LOOKUP_ERROR,
+    LOOKUP_MISSING,
+    LOOKUP_FOUND,
+} lookup_t;
+
+//position of a key in the chain of its bucket page (see disk_find)
+typedef struct {
+    uint64_t page;//page holding the key (LOOKUP_FOUND)
+    size_t slot;
+    uint64_t space;//first page of the chain with a free slot, NO_PAGE if full
+    uint64_t last;//last page of the chain
+} disk_pos_t;
+
+//partitions
+static partition_t* partition_touch(spill_map_t *sm, size_t hash);
+static void partition_account(spill_map_t *sm, partition_t *p);
+static bool partition_spill(spill_map_t *sm, partition_t *p);
+static bool partition_fault_in(spill_map_t *sm, partition_t *p);
+static void enforce_budget(spill_map_t *sm);
+static void disk_accessed(spill_map_t *sm, partition_t *p);
+
+//spilled partitions
+static lookup_t disk_find(spill_map_t *sm, const partition_t *p, size_t hash, const void *key, disk_pos_t *pos);
+static bool disk_insert(spill_map_t *sm, partition_t *p, const disk_pos_t *pos, const void *key, const void *value);
+
+//spill file
+static bool page_read(spill_map_t *sm, uint64_t index);
+static bool page_write(spill_map_t *sm, uint64_t index);
+static bool file_write(int fd, const void *data, size_t size, uint64_t offset);
+static uint64_t pages_alloc(spill_map_t *sm, uint64_t count);
+static void pages_free(spill_map_t *sm, uint64_t first, uint64_t count);
+
+//the hash is mixed (fibonacci hashing): its high bits select the partition, the next ones the bucket page.
+//the resident partitions use the low bits (hash & (capacity - 1))
+static inline uint64_t mix(size_t hash)
+{ return (uint64_t)hash * 0x9e3779b97f4a7c15UL; }
+
+static inline size_t top_bits(uint64_t v, unsigned int bits)
+{ return bits ? (size_t)(v >> (64 - bits)) : 0; }
+
+static inline size_t page_of(const spill_map_t *sm, const partition_t *p, size_t hash)
+{
+    unsigned int page_bits = (unsigned int)__builtin_ctzl(p->page_count);
+    return top_bits(mix(hash) << sm->partition_bits, page_bits);
+}
+
+static inline unsigned char* record_at(const spill_map_t *sm, unsigned char *page, size_t slot)
+{ return page + sizeof(page_header_t) + slot * sm->record_size; }
+
+static inline page_header_t header_of(const unsigned char *page)
+{
+    page_header_t header;
+    memcpy(&header, page, sizeof(header));
+    return header;
+}
+
+spill_map_t* spill_map_create(const char *path, size_t memory_budget, size_t partition_count,
+                              hash_fn_t hash_fn, const size_t key_size, const size_t value_size)
+{
+    assert(key_size > 0 && value_size > 0);
+    assert(sizeof(page_header_t) + key_size + value_size <= SPILL_MAP_PAGE_SIZE);
+
+    if(hash_fn == NULL) hash_fn = HASH_FUNC_DEFAULT;
+    if(partition_count == 0) partition_count = SPILL_MAP_DEFAULT_PARTITIONS;
+
+    spill_map_t *sm = calloc(1, sizeof(*sm));
+    if(!sm) return (perror("calloc"), NULL);
+
+    sm->fd = -1;
+    sm->partition_count = 1;
+    while(sm->partition_count < partition_count)
+    {
+        sm->partition_count <<= 1;
+        sm->partition_bits++;
+    }
+
+    sm->key_size = key_size;
+    sm->value_size = value_size;
+    sm->record_size = key_size + value_size;
+    sm->records_per_page = (SPILL_MAP_PAGE_SIZE - sizeof(page_header_t)) / sm->record_size;
+    sm->fn_hash = hash_fn;
+    sm->memory_budget = memory_budget;
+
+    sm->page = malloc(SPILL_MAP_PAGE_SIZE);
+    sm->key = malloc(key_size);
+    sm->value = malloc(value_size);
+    sm->partitions = calloc(sm->partition_count, sizeof(*sm->partitions));
+    if(!sm->page || !sm->key || !sm->value || !sm->partitions) return (perror("malloc"), spill_map_destroy(sm), NULL);
+
+    //fichier de debordement: celui demande, ou un fichier temporaire supprime tout de suite
+    if(path != NULL)
+    {
+        sm->path = strdup(path);
+        if(!sm->path) return (perror("strdup"), spill_map_destroy(sm), NULL);
+        sm->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    }
+    else
+    {
+        char template[] = "/tmp/spill_map.XXXXXX";
+        sm->fd = mkstemp(template);
+        if(sm->fd >= 0) unlink(template);
+    }
+    if(sm->fd < 0) return (perror("open"), spill_map_destroy(sm), NULL);
+
+    for(size_t i = 0; i < sm->partition_count; i++)
+    {
+        sm->partitions[i].map = hashmap_create(0, hash_fn, key_size, value_size);
+        if(!sm->partitions[i].map) return (spill_map_destroy(sm), NULL);
+
+        partition_account(sm, &sm->partitions[i]);
+    }
+
+    enforce_budget(sm);
+    return sm;
+}
+
+void spill_map_destroy(spill_map_t *sm)
+{
+    for(size_t i = 0; sm->partitions && i < sm->partition_count; i++)
+    {
+        if(sm->partitions[i].map) hashmap_destroy(sm->partitions[i].map);
+    }
+
+    if(sm->fd >= 0) close(sm->fd);
+    if(sm->path) unlink(sm->path);
+
+    free(sm->path);
+    free(sm->free_runs);
+    free(sm->page);
+    free(sm->key);
+    free(sm->value);
+    free(sm->partitions);
+    free(sm);
+}
+
+bool spill_map_get(spill_map_t *sm, const void *key, void *value)
+{
+    size_t hash = sm->fn_hash(key, sm->key_size);
+    partition_t *p = partition_touch(sm, hash);
+
+    if(p->map)
+    {
+        void *found = hashmap_get(p->map, key);
+        if(found) memcpy(value, found, sm->value_size);
+        return found != NULL;
+    }
+
+    disk_pos_t pos;
+    lookup_t lookup = disk_find(sm, p, hash, key, &pos);
+    if(lookup == LOOKUP_FOUND) memcpy(value, record_at(sm, sm->page, pos.slot) + sm->key_size, sm->value_size);
+
+    disk_accessed(sm, p);
+    return lookup == LOOKUP_FOUND;
+}
+
+bool spill_map_put(spill_map_t *sm, const void *key, const void *value)
+{
+    size_t hash = sm->fn_hash(key, sm->key_size);
+    partition_t *p = partition_touch(sm, hash);
+
+    if(p->map)
+    {
+        void *existing = hashmap_get(p->map, key);
+        if(existing) memcpy(existing, value, sm->value_size);
+        else if(!hashmap_add(p->map, key, value)) return false;
+
+        partition_account(sm, p);
+        enforce_budget(sm);
+        return true;
+    }
+
+    disk_pos_t pos;
+    lookup_t lookup = disk_find(sm, p, hash, key, &pos);
+    bool ok = lookup != LOOKUP_ERROR;
+
+    if(lookup == LOOKUP_FOUND)
+    {
+        memcpy(record_at(sm, sm->page, pos.slot) + sm->key_size, value, sm->value_size);
+        ok = page_write(sm, pos.page);
+    }
+    else if(lookup == LOOKUP_MISSING) ok = disk_insert(sm, p, &pos, key, value);
+
+    disk_accessed(sm, p);
+    return ok;
+}
+
+bool spill_map_update(spill_map_t *sm, const void *key, update_fn_t update_fn, void *ctx)
+{
+    size_t hash = sm->fn_hash(key, sm->key_size);
+    partition_t *p = partition_touch(sm, hash);
+
+    if(p->map)
+    {
+        if(!hashmap_update(p->map, key, update_fn, ctx)) return false;
+
+        partition_account(sm, p);
+        enforce_budget(sm);
+        return true;
+    }
+
+    disk_pos_t pos;
+    lookup_t lookup = disk_find(sm, p, hash, key, &pos);
+    bool ok = lookup != LOOKUP_ERROR;
+
+    //la valeur de la page n'est pas forcement alignee: update_fn travaille sur une copie
+    if(lookup == LOOKUP_FOUND)
+    {
+        unsigned char *stored = record_at(sm, sm->page, pos.slot) + sm->key_size;
+        memcpy(sm->value, stored, sm->value_size);
+        update_fn(sm->value, ctx);
+        memcpy(stored, sm->value, sm->value_size);
+        ok = page_write(sm, pos.page);
+    }
+    else if(lookup == LOOKUP_MISSING)
+    {
+        memset(sm->value, 0, sm->value_size);
+        update_fn(sm->value, ctx);
+        ok = disk_insert(sm, p, &pos, key, sm->value);
+    }
+
+    disk_accessed(sm, p);
+    return ok;
+}
+
+bool spill_map_remove(spill_map_t *sm, const void *key)
+{
+    size_t hash = sm->fn_hash(key, sm->key_size);
+    partition_t *p = partition_touch(sm, hash);
+
+    if(p->map)
+    {
+        if(!hashmap_remove(p->map, key)) return false;
+
+        partition_account(sm, p);
+        return true;
+    }
+
+    disk_pos_t pos;
+    lookup_t lookup = disk_find(sm, p, hash, key, &pos);
+    bool removed = false;
+
+    //le dernier enregistrement de la page prend la place de celui supprime
+    if(lookup == LOOKUP_FOUND)
+    {
+        page_header_t header = header_of(sm->page);
+        header.count--;
+        if(pos.slot != header.count) memcpy(record_at(sm, sm->page, pos.slot), record_at(sm, sm->page, header.count), sm->record_size);
+        memcpy(sm->page, &header, sizeof(header));
+
+        removed = page_write(sm, pos.page);
+        if(removed) p->count--;
+    }
+
+    disk_accessed(sm, p);
+    return removed;
+}
+
+size_t spill_map_count(spill_map_t *sm)
+{
+    size_t count = 0;
+    for(size_t i = 0; i < sm->partition_count; i++)
+        count += sm->partitions[i].count;
+
+    return count;
+}
+
+size_t spill_map_memory_usage(spill_map_t *sm)
+{ return sm->memory; }
+
+size_t spill_map_spilled_count(spill_map_t *sm)
+{
+    size_t spilled = 0;
+    for(size_t i = 0; i < sm->partition_count; i++)
+        spilled += sm->partitions[i].map == NULL;
+
+    return spilled;
+}
+
+void spill_map_set_memory_budget(spill_map_t *sm, size_t memory_budget)
+{
+    sm->memory_budget = memory_budget;
+    enforce_budget(sm);
+}
+
+
+//--------------- PARTITIONS ---------------//
+
+static partition_t* partition_touch(spill_map_t *sm, size_t hash)
+{
+    partition_t *p = &sm->partitions[top_bits(mix(hash), sm->partition_bits)];
+    p->last_access = ++sm->clock;
+    return p;
+}
+
+//update the count and the estimated memory of a resident partition
+static void partition_account(spill_map_t *sm, partition_t *p)
+{
+    size_t memory = hashmap_count(p->map) * (sm->record_size + SPILL_MAP_PAIR_OVERHEAD)
+                  + hashmap_capacity(p->map) * BUCKET_OVERHEAD;
+
+    sm->memory = sm->memory - p->memory + memory;
+    p->memory = memory;
+    p->count = hashmap_count(p->map);
+}
+
+//spill the least recently used partitions until the resident ones fit in the budget
+static void enforce_budget(spill_map_t *sm)
+{
+    while(sm->memory > sm->memory_budget)
+    {
+        partition_t *victim = NULL;
+        for(size_t i = 0; i < sm->partition_count; i++)
+        {
+            partition_t *p = &sm->partitions[i];
+            if(p->map && (!victim || p->last_access < victim->last_access)) victim = p;
+        }
+
+        if(!victim || !partition_spill(sm, victim)) break;
+        PROBE3(spill_map, evict, sm, victim - sm->partitions, victim->count);
+    }
+}
+
+//an access to a spilled partition: a partition used often (or with long chains) is faulted back in
+static void disk_accessed(spill_map_t *sm, partition_t *p)
+{
+    if(p->map) return;
+
+    p->disk_accesses++;
+    if(p->disk_accesses >= SPILL_MAP_FAULT_THRESHOLD || p->overflow_pages > p->page_count)
+    {
+        if(partition_fault_in(sm, p))
+        {
+            PROBE3(spill_map, fault__in, sm, p - sm->partitions, p->count);
+            enforce_budget(sm);
+        }
+    }
+}
+
+typedef struct {
+    spill_map_t *sm;
+    partition_t *p;
+    unsigned char *pages;//the bucket pages, built in memory
+    const void **overflow;//pairs (key, value) that did not fit in their bucket page
+    size_t overflow_count;
+    size_t overflow_capacity;
+    bool failed;
+} spill_ctx_t;
+
+static void spill_pair(const void *key, void *value, void *arg)
+{
+    spill_ctx_t *ctx = arg;
+    spill_map_t *sm = ctx->sm;
+
+    unsigned char *page = ctx->pages + page_of(sm, ctx->p, sm->fn_hash(key, sm->key_size)) * SPILL_MAP_PAGE_SIZE;
+    page_header_t header = header_of(page);
+
+    if(header.count < sm->records_per_page)
+    {
+        memcpy(record_at(sm, page, header.count), key, sm->key_size);
+        memcpy(record_at(sm, page, header.count) + sm->key_size, value, sm->value_size);
+        header.count++;
+        memcpy(page, &header, sizeof(header));
+        return;
+    }
+
+    //page pleine: la paire ira dans une page de debordement une fois les pages ecrites
+    if(ctx->overflow_count == ctx->overflow_capacity)
+    {
+        size_t capacity = ctx->overflow_capacity ? ctx->overflow_capacity * 2 : 64;
+        const void **overflow = realloc(ctx->overflow, 2 * capacity * sizeof(*overflow));
+        if(!overflow){ perror("realloc"); ctx->failed = true; return; }
+
+        ctx->overflow = overflow;
+        ctx->overflow_capacity = capacity;
+    }
+
+    ctx->overflow[2 * ctx->overflow_count] = key;
+    ctx->overflow[2 * ctx->overflow_count + 1] = value;
+    ctx->overflow_count++;
+}
+
+//write a resident partition to a new set of bucket pages, and free its memory
+static bool partition_spill(spill_map_t *sm, partition_t *p)
+{
+    size_t count = hashmap_count(p->map);
+    size_t page_count = 1;
+    while((double)page_count * (double)sm->records_per_page * SPILL_LOAD_FACTOR < (double)count) page_count <<= 1;
+
+    spill_ctx_t ctx = { .sm = sm, .p = p };
+    ctx.pages = calloc(page_count, SPILL_MAP_PAGE_SIZE);
+    if(!ctx.pages) return (perror("calloc"), false);
+
+    p->first_page = pages_alloc(sm, page_count);
+    p->page_count = page_count;
+    p->overflow_pages = 0;
+
+    hashmap_range_foreach(p->map, hashmap_range(p->map), spill_pair, &ctx);
+
+    bool ok = !ctx.failed && file_write(sm->fd, ctx.pages, page_count * SPILL_MAP_PAGE_SIZE, p->first_page * SPILL_MAP_PAGE_SIZE);
+    for(size_t i = 0; ok && i < ctx.overflow_count; i++)
+    {
+        const void *key = ctx.overflow[2 * i];
+        disk_pos_t pos;
+        ok = disk_find(sm, p, sm->fn_hash(key, sm->key_size), key, &pos) == LOOKUP_MISSING
+          && disk_insert(sm, p, &pos, key, ctx.overflow[2 * i + 1]);
+    }
+
+    free(ctx.pages);
+    free(ctx.overflow);
+
+    //echec: la partition reste en memoire (les pages de debordement deja allouees sont perdues)
+    if(!ok)
+    {
+        pages_free(sm, p->first_page, p->page_count);
+        p->page_count = 0;
+        p->overflow_pages = 0;
+        p->count = count;
+        return false;
+    }
+
+    hashmap_destroy(p->map);
+    p->map = NULL;
+    p->count = count;
+    p->disk_accesses = 0;
+    sm->memory -= p->memory;
+    p->memory = 0;
+    return true;
+}
+
+//read a spilled partition back in memory, and free its pages
+static bool partition_fault_in(spill_map_t *sm, partition_t *p)
+{
+    hashmap_t *map = hashmap_create(0, sm->fn_hash, sm->key_size, sm->value_size);
+    if(!map) return false;
+    hashmap_reserve(map, p->count);
+
+    //les pages ne sont liberees qu'une fois toute la partition relue
+    uint64_t *overflow = malloc((p->overflow_pages + 1) * sizeof(*overflow));
+    size_t overflow_count = 0;
+    bool ok = overflow != NULL;
+    if(!ok) perror("malloc");
+
+    for(size_t b = 0; ok && b < p->page_count; b++)
+    {
+        uint64_t index = p->first_page + b;
+        while(ok)
+        {
+            ok = page_read(sm, index);
+            if(!ok) break;
+
+            page_header_t header = header_of(sm->page);
+            for(size_t slot = 0; ok && slot < header.count; slot++)
+            {
+                //copies alignees pour la fonction de hash et les fonctions de copie
+                memcpy(sm->key, record_at(sm, sm->page, slot), sm->key_size);
+                memcpy(sm->value, record_at(sm, sm->page, slot) + sm->key_size, sm->value_size);
+                ok = hashmap_add(map, sm->key, sm->value) != NULL;
+            }
+
+            if(header.next == 0) break;
+            index = header.next - 1;
+            if(overflow_count < p->overflow_pages) overflow[overflow_count++] = index;
+        }
+    }
+
+    if(!ok)
+    {
+        free(overflow);
+        hashmap_destroy(map);
+        return false;
+    }
+
+    pages_free(sm, p->first_page, p->page_count);
+    for(size_t i = 0; i < overflow_count; i++)
+        pages_free(sm, overflow[i], 1);
+    free(overflow);
+
+    p->map = map;
+    p->page_count = 0;
+    p->overflow_pages = 0;
+    p->disk_accesses = 0;
+    partition_account(sm, p);
+    return true;
+}
+
+
+//--------------- SPILLED PARTITIONS ---------------//
+
+//walk the chain of the bucket page of the key (the page holding the key, or the last one, stays in sm->page)
+static lookup_t disk_find(spill_map_t *sm, const partition_t *p, size_t hash, const void *key, disk_pos_t *pos)
+{
+    uint64_t index = p->first_page + page_of(sm, p, hash);
+    pos->space = NO_PAGE;
+
+    for(;;)
+    {
+        if(!page_read(sm, index)) return LOOKUP_ERROR;
+
+        page_header_t header = header_of(sm->page);
+        for(size_t slot = 0; slot < header.count; slot++)
+        {
+            if(memcmp(record_at(sm, sm->page, slot), key, sm->key_size) == 0)
+            {
+                pos->page = index;
+                pos->slot = slot;
+                return LOOKUP_FOUND;
+            }
+        }
+
+        if(pos->space == NO_PAGE && header.count < sm->records_per_page) pos->space = index;
+        pos->last = index;
+
+        if(header.next == 0) return LOOKUP_MISSING;
+        index = header.next - 1;
+    }
+}
+
+//add a missing key (pos and sm->page come from disk_find)
+static bool disk_insert(spill_map_t *sm, partition_t *p, const disk_pos_t *pos, const void *key, const void *value)
+{
+    uint64_t index = pos->space;
+
+    if(index == NO_PAGE)
+    {
+        //chaine pleine: nouvelle page de debordement, chainee apres la derniere (qui est dans sm->page)
+        index = pages_alloc(sm, 1);
+
+        page_header_t last = header_of(sm->page);
+        last.next = index + 1;
+        memcpy(sm->page, &last, sizeof(last));
+        if(!page_write(sm, pos->last)) return false;
+
+        memset(sm->page, 0, SPILL_MAP_PAGE_SIZE);
+        p->overflow_pages++;
+    }
+    else if(index != pos->last && !page_read(sm, index)) return false;
+
+    page_header_t header = header_of(sm->page);
+    memcpy(record_at(sm, sm->page, header.count), key, sm->key_size);
+    memcpy(record_at(sm, sm->page, header.count) + sm->key_size, value, sm->value_size);
+    header.count++;
+    memcpy(sm->page, &header, sizeof(header));
+
+    if(!page_write(sm, index)) return false;
+
+    p->count++;
+    return true;
+}
+
+
+//--------------- SPILL FILE ---------------//
+
+static bool page_read(spill_map_t *sm, uint64_t index)
+{
+    ssize_t n = pread(sm->fd, sm->page, SPILL_MAP_PAGE_SIZE, (off_t)(index * SPILL_MAP_PAGE_SIZE));
+    if(n < 0) return (perror("pread"), false);
+
+    //page jamais ecrite (fin du fichier): vide
+    if((size_t)n < SPILL_MAP_PAGE_SIZE) memset(sm->page + n, 0, SPILL_MAP_PAGE_SIZE - (size_t)n);
+    return true;
+}
+
+static bool page_write(spill_map_t *sm, uint64_t index)
+{ return file_write(sm->fd, sm->page, SPILL_MAP_PAGE_SIZE, index * SPILL_MAP_PAGE_SIZE); }
+
+static bool file_write(int fd, const void *data, size_t size, uint64_t offset)
+{
+    size_t written = 0;
+    while(written < size)
+    {
+        ssize_t n = pwrite(fd, (const char*)data + written, size - written, (off_t)(offset + written));
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) return (perror("pwrite"), false);
+
+        written += (size_t)n;
+    }
+
+    return true;
+}
+
+//first fit in the free runs, or at the end of the file
+static uint64_t pages_alloc(spill_map_t *sm, uint64_t count)
+{
+    for(size_t i = 0; i < sm->free_run_count; i++)
+    {
+        page_run_t *run = &sm->free_runs[i];
+        if(run->count < count) continue;
+
+        uint64_t first = run->first;
+        run->first += count;
+        run->count -= count;
+        if(run->count == 0) *run = sm->free_runs[--sm->free_run_count];
+        return first;
+    }
+
+    uint64_t first = sm->file_pages;
+    sm->file_pages += count;
+    return first;
+}
+
+static void pages_free(spill_map_t *sm, uint64_t first, uint64_t count)
+{
+    if(sm->free_run_count == sm->free_run_capacity)
+    {
+        size_t capacity = sm->free_run_capacity ? sm->free_run_capacity * 2 : 16;
+        page_run_t *runs = realloc(sm->free_runs, capacity * sizeof(*runs));
+        if(!runs){ perror("realloc"); return; }//pages perdues, le fichier grandira un peu plus
+
+        sm->free_runs = runs;
+        sm->free_run_capacity = capacity;
+    }
+
+    sm->free_runs[sm->free_run_count++] = (page_run_t){ .first = first, .count = count };
+}
@@ -0,0 +1,100 @@
+/*
+ *  Disk-backed hashmap with a memory budget (spill-to-disk).
+ *
+ *  The keys are distributed (by hash) over partitions. A partition is either resident (a
+ *  hashmap_t in memory) or spilled (a hash file in the pages of the spill file). When the
+ *  memory used by the resident partitions goes over the budget, the least recently used
+ *  partitions are spilled, until the map fits again.
+ *
+ *  A spilled partition is NOT brought back in memory for every access: it is a static hash
+ *  table on disk (power-of-two bucket pages + chained overflow pages), so a lookup, a put or
+ *  a remove reads (and writes) one page, or a few if its chain overflowed. A spilled partition
+ *  that keeps being used (SPILL_MAP_FAULT_THRESHOLD accesses), or whose chains got too long,
+ *  is faulted back in memory, and colder partitions are spilled in its place.
+ *
+ *  The map degrades gracefully: when the data does not fit in RAM anymore, the cold keys are
+ *  served at disk speed instead of the process running out of memory.
+ *
+ *  ---------- Page format ---------
+ *  Every page is SPILL_MAP_PAGE_SIZE bytes: a header (record count, next overflow page), then
+ *  fixed size records (key_size bytes of key, value_size bytes of value).
+ *
+ *  NOT THREAD-SAFE (like hashmap_t).
+ *
+ *  -------- Limitations --------
+ *  - keys and values are flat: they are written to disk as their key_size / value_size bytes,
+ *    so they cannot hold pointers (no custom alloc/copy/destroy functions), and the keys are
+ *    compared with memcmp.
+ *  - the values are returned by copy: a pointer into the map would not survive a spill.
+ *  - the budget is approximate (the pairs are estimated at key_size + value_size +
+ *    SPILL_MAP_PAIR_OVERHEAD bytes), and it can be exceeded by one partition while a
+ *    partition is faulted in.
+ *  - the pages freed by the partitions faulted in are reused, but the spill file never shrinks.
+*/
+
+#ifndef __SPILL_MAP_H__
+#define __SPILL_MAP_H__
+
+#include "hashmap.h"
+
+typedef struct _spill_map_t spill_map_t;
+
+#define SPILL_MAP_PAGE_SIZE 4096
+#define SPILL_MAP_DEFAULT_PARTITIONS 256
+#define SPILL_MAP_FAULT_THRESHOLD 64 //accesses to a spilled partition before it is faulted back in memory
+#define SPILL_MAP_PAIR_OVERHEAD 64   //estimated memory of a resident pair, in addition to its key and value
+
+/// @brief Create a new disk-backed map
+/// @param path The spill file (created or truncated), NULL for an anonymous temporary file
+/// @param memory_budget The memory the resident partitions may use, in bytes
+/// @param partition_count The number of partitions, rounded up to a power of two (0 for SPILL_MAP_DEFAULT_PARTITIONS)
+/// @param hash_fn The hash function to use (NULL for the default hash function)
+/// @param key_size The size of the key in bytes
+/// @param value_size The size of the value in bytes
+/// @return A pointer to the map or NULL if an error occured
+/// @note A record (key_size + value_size) must fit in a page (asserted)
+/// @note The spill file is removed by spill_map_destroy
+spill_map_t* spill_map_create(const char *path, size_t memory_budget, size_t partition_count,
+                              hash_fn_t hash_fn, const size_t key_size, const size_t value_size);
+
+/// @brief Destroy the map and remove its spill file
+void spill_map_destroy(spill_map_t *sm);
+
+/// @brief Copy the value associated with the key
+/// @param sm The map
+/// @param key The key to search for
+/// @param value Receives the value (value_size bytes)
+/// @return true if the key was found, false otherwise (or if the spill file could not be read)
+bool spill_map_get(spill_map_t *sm, const void *key, void *value);
+
+/// @brief Associate the key with the value (replaces the old value if the key exists)
+/// @return true on success, false if an error occured
+bool spill_map_put(spill_map_t *sm, const void *key, const void *value);
+
+/// @brief Update the value associated with the key in place
+/// @param sm The map
+/// @param key The key of the value to update
+/// @param update_fn The function that modifies the value (called with a copy if the partition is spilled)
+/// @param ctx User data given to update_fn
+/// @return true on success, false if an error occured
+/// @note If the key does not exist, a default value (value_size zero bytes) is inserted first, then updated
+/// @see hashmap_update
+bool spill_map_update(spill_map_t *sm, const void *key, update_fn_t update_fn, void *ctx);
+
+/// @brief Remove a key-value pair
+/// @return true if the key was removed, false otherwise (not found or error)
+bool spill_map_remove(spill_map_t *sm, const void *key);
+
+/// @brief Get the number of key-value pairs (resident and spilled)
+size_t spill_map_count(spill_map_t *sm);
+
+/// @brief Get the estimated memory used by the resident partitions, in bytes
+size_t spill_map_memory_usage(spill_map_t *sm);
+
+/// @brief Get the number of spilled partitions
+size_t spill_map_spilled_count(spill_map_t *sm);
+
+/// @brief Change the memory budget (partitions are spilled right away if needed)
+void spill_map_set_memory_budget(spill_map_t *sm, size_t memory_budget);
+
+#endif
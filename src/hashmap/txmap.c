@@ -0,0 +1,284 @@
+#include "txmap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define TXN_INITIAL_WRITES 8
+
+struct _txmap_t {
+    hamt_t *current;//last committed version
+    pthread_rwlock_t current_lock;//shared to retain current, exclusive to swap it
+    pthread_mutex_t commit_lock;//serializes the commits
+
+    size_t key_size;
+
+    //functions (also given to the versions), used for the write sets
+    hash_fn_t fn_hash;
+    compare_fn_t fn_compare;
+    destroy_fn_t fn_destroy_key;
+    alloc_copy_fn_t fn_alloc_copy_key;
+};
+
+struct _txmap_txn_t {
+    txmap_t *tm;
+    hamt_t *snapshot;//version the transaction started from
+    hamt_t *working;//snapshot + the writes of the transaction
+    bool failed;//an allocation failed: the commit will fail
+
+    //written keys (each key once): the index gives the unicity, the array the order
+    hashmap_t *write_index;
+    void **writes;
+    size_t write_count;
+    size_t write_capacity;
+};
+
+//transactions
+static bool txn_record_write(txmap_txn_t *txn, const void *key);
+static bool txn_has_conflict(const txmap_txn_t *txn, const hamt_t *current);
+static hamt_t* txn_rebase(const txmap_txn_t *txn, hamt_t *current);
+static void txn_free(txmap_txn_t *txn);
+
+//default functions
+static void* default_fn_alloc_copy(const void *element, const size_t size);
+static const compare_fn_t default_fn_compare = memcmp;
+static const destroy_fn_t default_fn_destroy = free;
+
+txmap_t* txmap_create(hash_fn_t hash_fn, const size_t key_size, const size_t value_size)
+{
+    assert(key_size > 0 && value_size > 0);
+
+    if(hash_fn == NULL) hash_fn = HASH_FUNC_DEFAULT;
+
+    txmap_t *tm = malloc(sizeof(*tm));
+    if(!tm) return (perror("malloc"), NULL);
+
+    tm->current = hamt_create(hash_fn, key_size, value_size);
+    if(!tm->current) return (free(tm), NULL);
+
+    tm->key_size = key_size;
+    tm->fn_hash = hash_fn;
+    tm->fn_compare = default_fn_compare;
+    tm->fn_destroy_key = default_fn_destroy;
+    tm->fn_alloc_copy_key = default_fn_alloc_copy;
+
+    pthread_rwlock_init(&tm->current_lock, NULL);
+    pthread_mutex_init(&tm->commit_lock, NULL);
+    return tm;
+}
+
+void txmap_destroy(txmap_t *tm)
+{
+    hamt_destroy(tm->current);
+    pthread_rwlock_destroy(&tm->current_lock);
+    pthread_mutex_destroy(&tm->commit_lock);
+    free(tm);
+}
+
+hamt_t* txmap_snapshot(txmap_t *tm)
+{
+    //le verrou ne couvre que la prise de reference: le writer ne peut pas liberer la version entre temps
+    pthread_rwlock_rdlock(&tm->current_lock);
+    hamt_t *snapshot = hamt_retain(tm->current);
+    pthread_rwlock_unlock(&tm->current_lock);
+
+    return snapshot;
+}
+
+size_t txmap_count(txmap_t *tm)
+{
+    pthread_rwlock_rdlock(&tm->current_lock);
+    size_t count = hamt_count(tm->current);
+    pthread_rwlock_unlock(&tm->current_lock);
+
+    return count;
+}
+
+txmap_txn_t* txmap_txn_begin(txmap_t *tm)
+{
+    txmap_txn_t *txn = malloc(sizeof(*txn));
+    if(!txn) return (perror("malloc"), NULL);
+
+    //la valeur de l'index n'est pas utilisee (un octet)
+    txn->write_index = hashmap_create(0, tm->fn_hash, tm->key_size, 1);
+    if(!txn->write_index) return (free(txn), NULL);
+
+    hashmap_set_fn_compare(txn->write_index, tm->fn_compare);
+    hashmap_set_fn_alloc_copy_key(txn->write_index, tm->fn_alloc_copy_key);
+    hashmap_set_fn_destroy_key(txn->write_index, tm->fn_destroy_key);
+
+    txn->tm = tm;
+    txn->snapshot = txmap_snapshot(tm);
+    txn->working = hamt_retain(txn->snapshot);
+    txn->failed = false;
+    txn->writes = NULL;
+    txn->write_count = 0;
+    txn->write_capacity = 0;
+    return txn;
+}
+
+const void* txmap_txn_get(txmap_txn_t *txn, const void *key)
+{ return hamt_get(txn->working, key); }
+
+bool txmap_txn_put(txmap_txn_t *txn, const void *key, const void *value)
+{
+    if(!txn_record_write(txn, key)) return (txn->failed = true, false);
+
+    hamt_t *working = hamt_assoc(txn->working, key, value);
+    if(!working) return (txn->failed = true, false);
+
+    hamt_destroy(txn->working);
+    txn->working = working;
+    return true;
+}
+
+bool txmap_txn_remove(txmap_txn_t *txn, const void *key)
+{
+    if(hamt_get(txn->working, key) == NULL) return false;
+    if(!txn_record_write(txn, key)) return (txn->failed = true, false);
+
+    hamt_t *working = hamt_dissoc(txn->working, key);
+    if(!working) return (txn->failed = true, false);
+
+    hamt_destroy(txn->working);
+    txn->working = working;
+    return true;
+}
+
+bool txmap_txn_commit(txmap_txn_t *txn)
+{
+    txmap_t *tm = txn->tm;
+    if(txn->failed) return (txn_free(txn), false);
+
+    pthread_mutex_lock(&tm->commit_lock);
+
+    //seuls les commits modifient current, on peut donc le lire sans current_lock
+    hamt_t *current = tm->current;
+    hamt_t *committed = NULL;
+
+    if(current == txn->snapshot) committed = hamt_retain(txn->working);//personne n'a commit entre temps
+    else if(!txn_has_conflict(txn, current)) committed = txn_rebase(txn, current);
+
+    if(committed != NULL)
+    {
+        //les lecteurs ne sont bloques que le temps d'echanger le pointeur
+        pthread_rwlock_wrlock(&tm->current_lock);
+        tm->current = committed;
+        pthread_rwlock_unlock(&tm->current_lock);
+
+        hamt_destroy(current);
+    }
+
+    pthread_mutex_unlock(&tm->commit_lock);
+
+    txn_free(txn);
+    return committed != NULL;
+}
+
+void txmap_txn_abort(txmap_txn_t *txn)
+{ txn_free(txn); }
+
+void txmap_set_fn_compare(txmap_t *tm, compare_fn_t compare_fn)
+{
+    tm->fn_compare = compare_fn;
+    hamt_set_fn_compare(tm->current, compare_fn);
+}
+
+void txmap_set_fn_alloc_copy_key(txmap_t *tm, alloc_copy_fn_t key_alloc_fn)
+{
+    tm->fn_alloc_copy_key = key_alloc_fn;
+    hamt_set_fn_alloc_copy_key(tm->current, key_alloc_fn);
+}
+
+void txmap_set_fn_alloc_copy_value(txmap_t *tm, alloc_copy_fn_t value_alloc_fn)
+{ hamt_set_fn_alloc_copy_value(tm->current, value_alloc_fn); }
+
+void txmap_set_fn_destroy_key(txmap_t *tm, destroy_fn_t key_destroy_fn)
+{
+    tm->fn_destroy_key = key_destroy_fn;
+    hamt_set_fn_destroy_key(tm->current, key_destroy_fn);
+}
+
+void txmap_set_fn_destroy_value(txmap_t *tm, destroy_fn_t value_destroy_fn)
+{ hamt_set_fn_destroy_value(tm->current, value_destroy_fn); }
+
+
+//--------------- TRANSACTIONS ---------------//
+
+//remember that the transaction writes the key (once per key)
+static bool txn_record_write(txmap_txn_t *txn, const void *key)
+{
+    char unused = 0;
+    size_t count = hashmap_count(txn->write_index);
+    if(!hashmap_add(txn->write_index, key, &unused)) return false;
+    if(hashmap_count(txn->write_index) == count) return true;//deja ecrite
+
+    if(txn->write_count == txn->write_capacity)
+    {
+        size_t capacity = txn->write_capacity ? txn->write_capacity * 2 : TXN_INITIAL_WRITES;
+        void **writes = realloc(txn->writes, capacity * sizeof(*writes));
+        if(!writes) return (perror("realloc"), hashmap_remove(txn->write_index, key), false);
+
+        txn->writes = writes;
+        txn->write_capacity = capacity;
+    }
+
+    void *key_copy = txn->tm->fn_alloc_copy_key(key, txn->tm->key_size);
+    if(!key_copy) return (perror("txmap_key_alloc_cpy"), hashmap_remove(txn->write_index, key), false);
+
+    txn->writes[txn->write_count++] = key_copy;
+    return true;
+}
+
+//a written key was also written by a commit made after the snapshot (commit_lock held).
+//the versions share their entries: an unchanged key has the same value pointer in both
+static bool txn_has_conflict(const txmap_txn_t *txn, const hamt_t *current)
+{
+    for(size_t i = 0; i < txn->write_count; i++)
+    {
+        if(hamt_get(current, txn->writes[i]) != hamt_get(txn->snapshot, txn->writes[i])) return true;
+    }
+
+    return false;
+}
+
+//apply the final state of every written key on top of current (new reference, NULL on error)
+static hamt_t* txn_rebase(const txmap_txn_t *txn, hamt_t *current)
+{
+    hamt_t *version = hamt_retain(current);
+
+    for(size_t i = 0; i < txn->write_count && version != NULL; i++)
+    {
+        const void *key = txn->writes[i];
+        const void *value = hamt_get(txn->working, key);
+
+        hamt_t *next = value ? hamt_assoc(version, key, value) : hamt_dissoc(version, key);
+        hamt_destroy(version);
+        version = next;
+    }
+
+    return version;
+}
+
+static void txn_free(txmap_txn_t *txn)
+{
+    for(size_t i = 0; i < txn->write_count; i++)
+        txn->tm->fn_destroy_key(txn->writes[i]);
+
+    free(txn->writes);
+    hashmap_destroy(txn->write_index);
+    hamt_destroy(txn->working);
+    hamt_destroy(txn->snapshot);
+    free(txn);
+}
+
+static void* default_fn_alloc_copy(const void *element, const size_t size)
+{
+    void *copy = malloc(size);
+    if(!copy) return NULL;
+
+    memcpy(copy, element, size);
+    return copy;
+}
@@ -0,0 +1,92 @@
+/*
+ *  Transactional map (multi-key atomic updates, snapshot isolation).
+ *
+ *  The content of the map is a persistent version (hamt_t, see hamt.h). A transaction starts
+ *  from the current version (its snapshot), and builds a private new version with its puts
+ *  and removes. The commit publishes the new version with a single pointer swap: readers see
+ *  all the mutations of a transaction, or none of them.
+ *
+ *  ---------- Isolation ---------
+ *  - readers take a snapshot (txmap_snapshot), which never changes and never blocks: the
+ *    writers build their versions aside, and only lock the map to swap the pointer.
+ *  - a transaction reads its snapshot (plus its own writes).
+ *  - commits are serialized: if other transactions committed since the snapshot, the commit
+ *    checks that none of them wrote a key written by this transaction (first committer wins),
+ *    then applies the writes on top of the current version. Otherwise it fails, and the
+ *    transaction has to be retried.
+ *
+ *  THREAD-SAFE: every function (except the setters, which must be called before sharing the
+ *  map) can be called from several threads. A transaction must be used by one thread.
+*/
+
+#ifndef __TXMAP_H__
+#define __TXMAP_H__
+
+#include "hashmap.h"
+#include "hamt.h"
+
+typedef struct _txmap_t txmap_t;
+typedef struct _txmap_txn_t txmap_txn_t;
+
+/// @brief Create a new transactional map
+/// @param hash_fn The hash function to use (NULL for the default hash function)
+/// @param key_size The size of the key in bytes
+/// @param value_size The size of the value in bytes
+/// @return A pointer to the map or NULL if an error occured
+/// @see hashmap_create
+txmap_t* txmap_create(hash_fn_t hash_fn, const size_t key_size, const size_t value_size);
+
+/// @brief Destroy the map (the snapshots still held stay valid until they are released)
+/// @note NOT thread-safe: no transaction may be running anymore
+void txmap_destroy(txmap_t *tm);
+
+/// @brief Get the current version of the map, for reading
+/// @return A version that never changes (release it with hamt_destroy), NULL if an error occured
+/// @note Reads with hamt_get / hamt_count on the returned version
+hamt_t* txmap_snapshot(txmap_t *tm);
+
+/// @brief Get the number of key-value pairs of the current version
+size_t txmap_count(txmap_t *tm);
+
+/// @brief Start a transaction from the current version
+/// @return The transaction or NULL if an error occured
+/// @note The transaction must be ended with txmap_txn_commit or txmap_txn_abort
+txmap_txn_t* txmap_txn_begin(txmap_t *tm);
+
+/// @brief Get the value associated with the key, as seen by the transaction (snapshot + own writes)
+/// @return A pointer to the value (read-only, valid until the end of the transaction) or NULL if not found
+const void* txmap_txn_get(txmap_txn_t *txn, const void *key);
+
+/// @brief Associate the key with the value in the transaction (replaces the old value)
+/// @return true on success, false if an allocation failed (the commit will then fail)
+bool txmap_txn_put(txmap_txn_t *txn, const void *key, const void *value);
+
+/// @brief Remove the key in the transaction
+/// @return true if the key existed (as seen by the transaction), false otherwise
+bool txmap_txn_remove(txmap_txn_t *txn, const void *key);
+
+/// @brief Publish all the writes of the transaction atomically, and free the transaction
+/// @return true if committed, false if an other transaction committed a write to one of the
+///         same keys since the snapshot (or if an allocation failed): nothing is published
+/// @complexity O(w * log32 n) where w is the number of written keys
+bool txmap_txn_commit(txmap_txn_t *txn);
+
+/// @brief Drop the writes of the transaction, and free the transaction
+void txmap_txn_abort(txmap_txn_t *txn);
+
+/// @see hashmap_set_fn_alloc_copy_key
+void txmap_set_fn_alloc_copy_key(txmap_t *tm, alloc_copy_fn_t key_alloc_fn);
+
+/// @see hashmap_set_fn_alloc_copy_value
+void txmap_set_fn_alloc_copy_value(txmap_t *tm, alloc_copy_fn_t value_alloc_fn);
+
+/// @see hashmap_set_fn_destroy_key
+void txmap_set_fn_destroy_key(txmap_t *tm, destroy_fn_t key_destroy_fn);
+
+/// @see hashmap_set_fn_destroy_value
+void txmap_set_fn_destroy_value(txmap_t *tm, destroy_fn_t value_destroy_fn);
+
+/// @see hashmap_set_fn_compare
+void txmap_set_fn_compare(txmap_t *tm, compare_fn_t compare_fn);
+
+#endif
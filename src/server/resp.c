@@ -0,0 +1,204 @@
+#include "resp.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+static long parse_array(const char *buffer, size_t length, resp_command_t *command);
+static long parse_inline(const char *buffer, size_t length, resp_command_t *command);
+static int parse_header(const char *buffer, size_t length, size_t *position, char prefix, long max, long *value);
+static bool command_push(resp_command_t *command, const char *data, size_t length);
+static void reply_line(resp_buffer_t *buffer, char prefix, int64_t value);
+
+long resp_parse(const char *buffer, size_t length, resp_command_t *command)
+{
+    command->argc = 0;
+    if(length == 0) return 0;
+
+    return buffer[0] == '*' ? parse_array(buffer, length, command) : parse_inline(buffer, length, command);
+}
+
+void resp_command_destroy(resp_command_t *command)
+{
+    free(command->argv);
+    command->argv = NULL;
+    command->argc = 0;
+    command->capacity = 0;
+}
+
+bool resp_slice_is(const resp_slice_t *slice, const char *word)
+{
+    size_t length = strlen(word);
+    return slice->length == length && strncasecmp(slice->data, word, length) == 0;
+}
+
+char* resp_buffer_reserve(resp_buffer_t *buffer, size_t size)
+{
+    if(buffer->failed) return NULL;
+
+    if(buffer->length + size > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while(capacity < buffer->length + size) capacity <<= 1;
+
+        char *data = realloc(buffer->data, capacity);
+        if(!data) return (perror("realloc"), buffer->failed = true, NULL);
+
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    return buffer->data + buffer->length;
+}
+
+void resp_buffer_append(resp_buffer_t *buffer, const void *data, size_t size)
+{
+    char *room = resp_buffer_reserve(buffer, size);
+    if(room == NULL) return;
+
+    memcpy(room, data, size);
+    buffer->length += size;
+}
+
+void resp_buffer_destroy(resp_buffer_t *buffer)
+{
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->failed = false;
+}
+
+void resp_reply_simple(resp_buffer_t *buffer, const char *status)
+{
+    resp_buffer_append(buffer, "+", 1);
+    resp_buffer_append(buffer, status, strlen(status));
+    resp_buffer_append(buffer, "\r\n", 2);
+}
+
+void resp_reply_error(resp_buffer_t *buffer, const char *message)
+{
+    resp_buffer_append(buffer, "-", 1);
+    resp_buffer_append(buffer, message, strlen(message));
+    resp_buffer_append(buffer, "\r\n", 2);
+}
+
+void resp_reply_integer(resp_buffer_t *buffer, int64_t value)
+{ reply_line(buffer, ':', value); }
+
+void resp_reply_bulk(resp_buffer_t *buffer, const void *data, size_t length)
+{
+    reply_line(buffer, '$', (int64_t)length);
+    resp_buffer_append(buffer, data, length);
+    resp_buffer_append(buffer, "\r\n", 2);
+}
+
+void resp_reply_nil(resp_buffer_t *buffer)
+{ resp_buffer_append(buffer, "$-1\r\n", 5); }
+
+void resp_reply_array(resp_buffer_t *buffer, size_t count)
+{ reply_line(buffer, '*', (int64_t)count); }
+
+
+//--------------- PARSING ---------------//
+
+//*<argc>\r\n then argc times $<length>\r\n<bytes>\r\n
+static long parse_array(const char *buffer, size_t length, resp_command_t *command)
+{
+    size_t position = 0;
+    long argc = 0;
+
+    int status = parse_header(buffer, length, &position, '*', RESP_MAX_ARGS, &argc);
+    if(status <= 0) return status;
+
+    for(long i = 0; i < argc; i++)
+    {
+        long size = 0;
+        status = parse_header(buffer, length, &position, '$', RESP_MAX_BULK, &size);
+        if(status <= 0) return status;
+
+        //l'argument et son \r\n doivent etre arrives
+        if(length - position < (size_t)size + 2) return 0;
+        if(buffer[position + size] != '\r' || buffer[position + size + 1] != '\n') return -1;
+
+        if(!command_push(command, buffer + position, (size_t)size)) return -1;
+        position += (size_t)size + 2;
+    }
+
+    return (long)position;
+}
+
+//words separated by spaces, until \n (optionally preceded by \r)
+static long parse_inline(const char *buffer, size_t length, resp_command_t *command)
+{
+    const char *newline = memchr(buffer, '\n', length);
+    if(newline == NULL) return length > RESP_MAX_INLINE ? -1 : 0;
+
+    const char *end = newline > buffer && newline[-1] == '\r' ? newline - 1 : newline;
+    const char *current = buffer;
+
+    while(current < end)
+    {
+        while(current < end && (*current == ' ' || *current == '\t')) current++;
+
+        const char *word = current;
+        while(current < end && *current != ' ' && *current != '\t') current++;
+
+        if(current > word && !command_push(command, word, (size_t)(current - word))) return -1;
+    }
+
+    return (long)(newline - buffer) + 1;
+}
+
+//reads <prefix><integer>\r\n at *position: 1 if read, 0 if not complete, -1 if invalid (or not in [0, max])
+static int parse_header(const char *buffer, size_t length, size_t *position, char prefix, long max, long *value)
+{
+    const char *begin = buffer + *position;
+    size_t available = length - *position;
+
+    const char *newline = memchr(begin, '\n', available);
+    if(newline == NULL) return available > RESP_MAX_INLINE ? -1 : 0;
+
+    const char *end = newline - 1;//\r
+    if(newline - begin < 3 || begin[0] != prefix || *end != '\r') return -1;
+
+    long result = 0;
+    for(const char *digit = begin + 1; digit < end; digit++)
+    {
+        if(*digit < '0' || *digit > '9') return -1;
+
+        result = result * 10 + (*digit - '0');
+        if(result > max) return -1;
+    }
+
+    *value = result;
+    *position += (size_t)(newline - begin) + 1;
+    return 1;
+}
+
+static bool command_push(resp_command_t *command, const char *data, size_t length)
+{
+    if(command->argc == command->capacity)
+    {
+        size_t capacity = command->capacity ? command->capacity * 2 : 8;
+        resp_slice_t *argv = realloc(command->argv, capacity * sizeof(*argv));
+        if(!argv) return (perror("realloc"), false);
+
+        command->argv = argv;
+        command->capacity = capacity;
+    }
+
+    command->argv[command->argc++] = (resp_slice_t){ .length = length, .data = data };
+    return true;
+}
+
+
+//--------------- REPLIES ---------------//
+
+static void reply_line(resp_buffer_t *buffer, char prefix, int64_t value)
+{
+    char line[32];
+    int length = snprintf(line, sizeof(line), "%c%lld\r\n", prefix, (long long)value);
+    resp_buffer_append(buffer, line, (size_t)length);
+}
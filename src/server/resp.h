@@ -0,0 +1,72 @@
+/*
+ *  RESP (REdis Serialization Protocol) requests and replies.
+ *
+ *  A request is an array of bulk strings ("*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n"), or an inline
+ *  command (words separated by spaces, ended by "\r\n"), like the ones typed in telnet.
+ *  The arguments of a parsed request point into the read buffer: they are valid until the
+ *  buffer is modified.
+ *
+ *  The replies are appended to a growable buffer.
+*/
+
+#ifndef __RESP_H__
+#define __RESP_H__
+
+#include "../hashmap/hashmap.h"
+
+#define RESP_MAX_ARGS (1L << 20) //arguments of a request
+#define RESP_MAX_BULK (1L << 29) //bytes of an argument (512 MB, like redis)
+#define RESP_MAX_INLINE (1L << 16) //bytes of an inline request, or of the header line of an argument
+
+//bytes that are not owned (arguments of a request, keys given to the store...)
+typedef struct {
+    size_t length;
+    const char *data;
+} resp_slice_t;
+
+typedef struct {
+    size_t argc;
+    resp_slice_t *argv;
+    size_t capacity;//of argv
+} resp_command_t;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;//an allocation failed: the content is incomplete
+} resp_buffer_t;
+
+/// @brief Parse a request at the beginning of a buffer
+/// @param buffer The received bytes
+/// @param length The number of received bytes
+/// @param command Receives the arguments of the request (argc is 0 for an empty request)
+/// @return The number of bytes of the request, 0 if it is not complete yet, or -1 if it is invalid
+///         (protocol error, too many arguments, argument too big, allocation failed)
+long resp_parse(const char *buffer, size_t length, resp_command_t *command);
+
+/// @brief Free the arguments array of a command
+void resp_command_destroy(resp_command_t *command);
+
+/// @brief Check if an argument is a given word (case insensitive, like the redis commands)
+bool resp_slice_is(const resp_slice_t *slice, const char *word);
+
+/// @brief Make room for size more bytes in the buffer
+/// @return A pointer to the room, or NULL if the allocation failed (the buffer is marked failed)
+char* resp_buffer_reserve(resp_buffer_t *buffer, size_t size);
+
+/// @brief Append bytes to the buffer
+void resp_buffer_append(resp_buffer_t *buffer, const void *data, size_t size);
+
+/// @brief Free the content of the buffer
+void resp_buffer_destroy(resp_buffer_t *buffer);
+
+//replies
+void resp_reply_simple(resp_buffer_t *buffer, const char *status);//+OK
+void resp_reply_error(resp_buffer_t *buffer, const char *message);//-ERR ...
+void resp_reply_integer(resp_buffer_t *buffer, int64_t value);//:42
+void resp_reply_bulk(resp_buffer_t *buffer, const void *data, size_t length);//$3 foo
+void resp_reply_nil(resp_buffer_t *buffer);//$-1
+void resp_reply_array(resp_buffer_t *buffer, size_t count);//*2, followed by count replies
+
+#endif
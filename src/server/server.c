@@ -0,0 +1,513 @@
+/*
+ *  Key-value server: the sharded store (store.h) behind a subset of the redis protocol (resp.h),
+ *  so that the standard clients (redis-cli, redis-benchmark...) can use it.
+ *
+ *  Commands: GET, SET, DEL, MGET, INCR, PING, ECHO, DBSIZE, QUIT.
+ *  CONFIG and COMMAND are answered with an empty array (some clients send them when they start).
+ *
+ *  Usage: bin/server [-p port | -s unix_socket] [-t threads] [-S shards]
+ *  The TCP socket only listens on localhost (127.0.0.1).
+ *
+ *  ---------- Threads ---------
+ *  Every thread runs its own epoll event loop. The listening socket is shared by every loop
+ *  (EPOLLEXCLUSIVE wakes up one of them per new connection), and a connection stays on the
+ *  thread that accepted it.
+ *
+ *  ---------- Pipelining ---------
+ *  Every request already received on a connection is executed before the replies are sent
+ *  (one send for the whole pipeline). The GET and MGET of consecutive requests are not looked
+ *  up one by one: their keys are gathered (up to STORE_BATCH_MAX), then looked up together with
+ *  store_get_batch (one lock per shard, hashmap_get_batch). A write flushes the pending reads
+ *  first, so the requests of a connection are always executed in order.
+*/
+
+#include "store.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define SERVER_DEFAULT_PORT 6379
+#define SERVER_READ_SIZE (16 * 1024) //bytes received at once
+#define SERVER_KEEP_BUFFER (1UL << 20) //an empty buffer bigger than this is freed
+#define SERVER_EVENTS 256 //events handled by one epoll_wait
+#define SERVER_WAIT_MS 100 //the loops check if the server is stopping this often
+
+typedef struct _connection_t {
+    int fd;
+    resp_buffer_t input;
+    resp_buffer_t output;
+    size_t sent;//bytes of output already sent
+    bool writing;//the socket is full: the connection waits for EPOLLOUT, and is not read meanwhile
+    bool closing;//closed once the output is sent (QUIT, protocol error)
+    struct _connection_t *prev;
+    struct _connection_t *next;
+} connection_t;
+
+typedef struct {
+    store_t *store;
+    int listen_fd;
+    int epoll_fd;
+    pthread_t thread;
+    connection_t *connections;//opened by this thread
+
+    resp_command_t command;
+
+    //GET and MGET waiting for the next store_get_batch
+    resp_slice_t keys[STORE_BATCH_MAX];//point into the input of the connection
+    size_t array_heads[STORE_BATCH_MAX];//0 for a GET, n for the first key of an MGET of n keys
+    size_t pending;
+    store_value_t values[STORE_BATCH_MAX];
+    resp_buffer_t found;//values copied by store_get_batch
+} worker_t;
+
+static atomic_bool stopping = false;//set by the signal handler, read by every loop
+
+static void on_signal(int signal);
+static int listen_tcp(int port);
+static int listen_unix(const char *path);
+
+//event loop
+static void* worker_main(void *arg);
+static void accept_all(worker_t *w);
+static void connection_read(worker_t *w, connection_t *c);
+static bool connection_flush(worker_t *w, connection_t *c);
+static void connection_close(worker_t *w, connection_t *c);
+
+//commands
+static void process(worker_t *w, connection_t *c);
+static void execute(worker_t *w, connection_t *c);
+static void batch_push(worker_t *w, connection_t *c, const resp_slice_t *key, size_t array_head);
+static void batch_flush(worker_t *w, connection_t *c);
+static void reply_arity(resp_buffer_t *out, const resp_slice_t *name);
+
+int main(int argc, char **argv)
+{
+    int port = SERVER_DEFAULT_PORT;
+    const char *unix_path = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t shards = STORE_DEFAULT_SHARDS;
+
+    int option;
+    while((option = getopt(argc, argv, "p:s:t:S:h")) != -1)
+    {
+        switch(option)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 's': unix_path = optarg; break;
+            case 't': threads = atol(optarg); break;
+            case 'S': shards = (size_t)atol(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-p port | -s unix_socket] [-t threads] [-S shards]\n", argv[0]);
+                return option == 'h' ? 0 : 1;
+        }
+    }
+    if(threads < 1) threads = 1;
+
+    struct sigaction action = { .sa_handler = on_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    store_t *store = store_create(shards);
+    if(!store) return 1;
+
+    int listen_fd = unix_path ? listen_unix(unix_path) : listen_tcp(port);
+    if(listen_fd < 0) return (store_destroy(store), 1);
+
+    worker_t *workers = calloc((size_t)threads, sizeof(*workers));
+    if(!workers) return (perror("calloc"), close(listen_fd), store_destroy(store), 1);
+
+    long started = 0;
+    for(; started < threads; started++)
+    {
+        worker_t *w = &workers[started];
+        w->store = store;
+        w->listen_fd = listen_fd;
+
+        w->epoll_fd = epoll_create1(0);
+        if(w->epoll_fd < 0) { perror("epoll_create1"); break; }
+
+        //une seule boucle est reveillee par nouvelle connexion
+        struct epoll_event event = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+        if(epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) { perror("epoll_ctl"); close(w->epoll_fd); break; }
+
+        if(pthread_create(&w->thread, NULL, worker_main, w) != 0) { perror("pthread_create"); close(w->epoll_fd); break; }
+    }
+
+    if(started == threads)
+    {
+        if(unix_path) printf("listening on %s (%ld threads, %zu shards)\n", unix_path, threads, shards);
+        else printf("listening on 127.0.0.1:%d (%ld threads, %zu shards)\n", port, threads, shards);
+        fflush(stdout);
+    }
+    else atomic_store(&stopping, true);
+
+    for(long i = 0; i < started; i++)
+    {
+        worker_t *w = &workers[i];
+        pthread_join(w->thread, NULL);
+
+        while(w->connections != NULL) connection_close(w, w->connections);
+        close(w->epoll_fd);
+        resp_command_destroy(&w->command);
+        resp_buffer_destroy(&w->found);
+    }
+
+    close(listen_fd);
+    if(unix_path) unlink(unix_path);
+
+    free(workers);
+    store_destroy(store);
+    return started == threads ? 0 : 1;
+}
+
+static void on_signal(int signal)
+{
+    (void)signal;//unused - to avoid warning
+    atomic_store(&stopping, true);
+}
+
+static int listen_tcp(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) return (perror("socket"), -1);
+
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    if(bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0) return (perror("bind"), close(fd), -1);
+    if(listen(fd, SOMAXCONN) != 0) return (perror("listen"), close(fd), -1);
+
+    return fd;
+}
+
+static int listen_unix(const char *path)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if(strlen(path) >= sizeof(address.sun_path)) return (fprintf(stderr, "listen_unix: path too long\n"), -1);
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) return (perror("socket"), -1);
+
+    unlink(path);//socket laissee par une execution precedente
+    if(bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0) return (perror("bind"), close(fd), -1);
+    if(listen(fd, SOMAXCONN) != 0) return (perror("listen"), close(fd), -1);
+
+    return fd;
+}
+
+
+//--------------- EVENT LOOP ---------------//
+
+static void* worker_main(void *arg)
+{
+    worker_t *w = arg;
+    struct epoll_event events[SERVER_EVENTS];
+
+    while(!atomic_load(&stopping))
+    {
+        int count = epoll_wait(w->epoll_fd, events, SERVER_EVENTS, SERVER_WAIT_MS);
+        if(count < 0 && errno != EINTR) return (perror("epoll_wait"), NULL);
+
+        for(int i = 0; i < count; i++)
+        {
+            connection_t *c = events[i].data.ptr;
+            if(c == NULL)
+            {
+                accept_all(w);
+                continue;
+            }
+
+            if(events[i].events & EPOLLOUT && !connection_flush(w, c)) continue;
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) && !c->writing) connection_read(w, c);
+        }
+    }
+
+    return NULL;
+}
+
+static void accept_all(worker_t *w)
+{
+    while(true)
+    {
+        int fd = accept(w->listen_fd, NULL, NULL);
+        if(fd < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) perror("accept");
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+
+        //les reponses d'un pipeline partent en un seul send: pas besoin de Nagle (echoue sur un socket unix)
+        int yes = 1;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        connection_t *c = calloc(1, sizeof(*c));
+        if(!c)
+        {
+            perror("calloc");
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = c };
+        if(epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            perror("epoll_ctl");
+            close(fd);
+            free(c);
+            continue;
+        }
+
+        c->next = w->connections;
+        if(w->connections) w->connections->prev = c;
+        w->connections = c;
+    }
+}
+
+//receive and execute everything available (until the socket is empty or full)
+static void connection_read(worker_t *w, connection_t *c)
+{
+    while(!c->writing)
+    {
+        char *room = resp_buffer_reserve(&c->input, SERVER_READ_SIZE);
+        ssize_t received = room != NULL ? recv(c->fd, room, SERVER_READ_SIZE, 0) : 0;
+        if(received < 0 && errno == EINTR) continue;
+        if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if(received <= 0) break;//fermee par le client, erreur, ou allocation ratee
+
+        c->input.length += (size_t)received;
+        process(w, c);
+
+        //une reponse incomplete (allocation ratee) casserait le protocole
+        if(c->output.failed) break;
+        if(!connection_flush(w, c)) return;
+        if(c->closing && !c->writing) break;
+    }
+
+    if(!c->writing) connection_close(w, c);
+}
+
+//send the pending output: false if the connection was closed
+static bool connection_flush(worker_t *w, connection_t *c)
+{
+    while(c->sent < c->output.length)
+    {
+        ssize_t sent = send(c->fd, c->output.data + c->sent, c->output.length - c->sent, MSG_NOSIGNAL);
+        if(sent < 0)
+        {
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) return (connection_close(w, c), false);
+
+            //socket plein: on attend EPOLLOUT, sans lire de nouvelles requetes
+            if(!c->writing)
+            {
+                struct epoll_event event = { .events = EPOLLOUT, .data.ptr = c };
+                epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &event);
+                c->writing = true;
+            }
+            return true;
+        }
+
+        c->sent += (size_t)sent;
+    }
+
+    c->output.length = 0;
+    c->sent = 0;
+    if(c->output.capacity > SERVER_KEEP_BUFFER) resp_buffer_destroy(&c->output);
+
+    if(c->writing)
+    {
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = c };
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &event);
+        c->writing = false;
+
+        if(c->closing) return (connection_close(w, c), false);
+    }
+
+    return true;
+}
+
+static void connection_close(worker_t *w, connection_t *c)
+{
+    close(c->fd);//le retire aussi de l'epoll
+
+    if(c->prev) c->prev->next = c->next;
+    else w->connections = c->next;
+    if(c->next) c->next->prev = c->prev;
+
+    resp_buffer_destroy(&c->input);
+    resp_buffer_destroy(&c->output);
+    free(c);
+}
+
+
+//--------------- COMMANDS ---------------//
+
+//execute every complete request of the input
+static void process(worker_t *w, connection_t *c)
+{
+    size_t position = 0;
+
+    while(!c->closing)
+    {
+        long used = resp_parse(c->input.data + position, c->input.length - position, &w->command);
+        if(used == 0) break;
+        if(used < 0)
+        {
+            batch_flush(w, c);
+            resp_reply_error(&c->output, "ERR Protocol error");
+            c->closing = true;
+            break;
+        }
+
+        position += (size_t)used;
+        if(w->command.argc > 0) execute(w, c);
+    }
+
+    //les clefs en attente pointent dans l'input: on les traite avant de le decaler
+    batch_flush(w, c);
+
+    c->input.length -= position;
+    memmove(c->input.data, c->input.data + position, c->input.length);
+    if(c->input.length == 0 && c->input.capacity > SERVER_KEEP_BUFFER) resp_buffer_destroy(&c->input);
+}
+
+static void execute(worker_t *w, connection_t *c)
+{
+    const resp_slice_t *argv = w->command.argv;
+    size_t argc = w->command.argc;
+    const resp_slice_t *name = &argv[0];
+    resp_buffer_t *out = &c->output;
+
+    //lectures: regroupees avec celles des requetes suivantes
+    if(resp_slice_is(name, "GET") && argc == 2)
+    {
+        batch_push(w, c, &argv[1], 0);
+        return;
+    }
+    if(resp_slice_is(name, "MGET") && argc >= 2)
+    {
+        for(size_t i = 1; i < argc; i++) batch_push(w, c, &argv[i], i == 1 ? argc - 1 : 0);
+        return;
+    }
+
+    //les autres commandes repondent apres les lectures en attente
+    batch_flush(w, c);
+
+    if(resp_slice_is(name, "GET") || resp_slice_is(name, "MGET"))
+        reply_arity(out, name);
+    else if(resp_slice_is(name, "SET"))
+    {
+        if(argc < 3) reply_arity(out, name);
+        else if(argc > 3) resp_reply_error(out, "ERR syntax error");//pas d'options (EX, NX...)
+        else if(store_set(w->store, &argv[1], &argv[2]) != STORE_OK) resp_reply_error(out, "ERR out of memory");
+        else resp_reply_simple(out, "OK");
+    }
+    else if(resp_slice_is(name, "DEL"))
+    {
+        int64_t removed = 0;
+        for(size_t i = 1; i < argc; i++) removed += store_del(w->store, &argv[i]);
+
+        if(argc < 2) reply_arity(out, name);
+        else resp_reply_integer(out, removed);
+    }
+    else if(resp_slice_is(name, "INCR"))
+    {
+        int64_t value = 0;
+        store_status_t status = argc == 2 ? store_incr(w->store, &argv[1], 1, &value) : STORE_OK;
+
+        if(argc != 2) reply_arity(out, name);
+        else if(status == STORE_NOT_INTEGER) resp_reply_error(out, "ERR value is not an integer or out of range");
+        else if(status != STORE_OK) resp_reply_error(out, "ERR out of memory");
+        else resp_reply_integer(out, value);
+    }
+    else if(resp_slice_is(name, "PING"))
+    {
+        if(argc > 2) reply_arity(out, name);
+        else if(argc == 2) resp_reply_bulk(out, argv[1].data, argv[1].length);
+        else resp_reply_simple(out, "PONG");
+    }
+    else if(resp_slice_is(name, "ECHO"))
+    {
+        if(argc != 2) reply_arity(out, name);
+        else resp_reply_bulk(out, argv[1].data, argv[1].length);
+    }
+    else if(resp_slice_is(name, "DBSIZE"))
+        resp_reply_integer(out, (int64_t)store_count(w->store));
+    else if(resp_slice_is(name, "QUIT"))
+    {
+        resp_reply_simple(out, "OK");
+        c->closing = true;
+    }
+    else if(resp_slice_is(name, "CONFIG") || resp_slice_is(name, "COMMAND"))
+        resp_reply_array(out, 0);
+    else
+    {
+        char message[128];
+        snprintf(message, sizeof(message), "ERR unknown command '%.*s'", name->length > 64 ? 64 : (int)name->length, name->data);
+        resp_reply_error(out, message);
+    }
+}
+
+static void batch_push(worker_t *w, connection_t *c, const resp_slice_t *key, size_t array_head)
+{
+    w->keys[w->pending] = *key;
+    w->array_heads[w->pending] = array_head;
+    w->pending++;
+
+    if(w->pending == STORE_BATCH_MAX) batch_flush(w, c);
+}
+
+//look up the pending keys, and write their replies (in the order of the requests)
+static void batch_flush(worker_t *w, connection_t *c)
+{
+    if(w->pending == 0) return;
+
+    w->found.length = 0;
+    store_get_batch(w->store, w->keys, w->pending, w->values, &w->found);
+
+    for(size_t i = 0; i < w->pending; i++)
+    {
+        if(w->array_heads[i] > 0) resp_reply_array(&c->output, w->array_heads[i]);
+
+        const store_value_t *value = &w->values[i];
+        if(w->found.failed) resp_reply_error(&c->output, "ERR out of memory");
+        else if(!value->found) resp_reply_nil(&c->output);
+        else resp_reply_bulk(&c->output, w->found.data + value->offset, value->length);
+    }
+
+    if(w->found.failed || w->found.capacity > SERVER_KEEP_BUFFER) resp_buffer_destroy(&w->found);
+    w->pending = 0;
+}
+
+static void reply_arity(resp_buffer_t *out, const resp_slice_t *name)
+{
+    char message[128];
+    snprintf(message, sizeof(message), "ERR wrong number of arguments for '%.*s' command",
+             name->length > 64 ? 64 : (int)name->length, name->data);
+    resp_reply_error(out, message);
+}
@@ -0,0 +1,287 @@
+#include "store.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_rwlock_t lock;
+    hashmap_t *map;//keys: resp_slice_t (one allocation with the bytes), values: resp_slice_t owning its bytes
+} shard_t;
+
+struct _store_t {
+    shard_t *shards;
+    size_t shard_count;
+};
+
+static size_t shard_index(const store_t *st, size_t hash);
+static store_status_t incr_locked(hashmap_t *map, const resp_slice_t *key, int64_t delta, int64_t *result);
+static bool parse_int64(const resp_slice_t *slice, int64_t *value);
+
+//functions of the shards
+static size_t slice_hash(const void *key, const size_t size);
+static int slice_compare(const void *a, const void *b, const size_t size);
+static void* slice_alloc_copy(const void *element, const size_t size);
+static void value_destroy(void *element);
+
+store_t* store_create(size_t shard_count)
+{
+    if(shard_count == 0) shard_count = STORE_DEFAULT_SHARDS;
+    if(shard_count > STORE_MAX_SHARDS) shard_count = STORE_MAX_SHARDS;
+
+    size_t count = 1;
+    while(count < shard_count) count <<= 1;
+
+    store_t *st = malloc(sizeof(*st));
+    if(!st) return (perror("malloc"), NULL);
+
+    st->shards = aligned_alloc(CACHE_LINE_SIZE, count * sizeof(*st->shards));
+    if(!st->shards) return (perror("aligned_alloc"), free(st), NULL);
+
+    for(st->shard_count = 0; st->shard_count < count; st->shard_count++)
+    {
+        shard_t *shard = &st->shards[st->shard_count];
+
+        shard->map = hashmap_create(HASHMAP_DEFAULT_CAPACITY, slice_hash, sizeof(resp_slice_t), sizeof(resp_slice_t));
+        if(!shard->map) return (store_destroy(st), NULL);
+
+        hashmap_set_fn_compare(shard->map, slice_compare);
+        hashmap_set_fn_alloc_copy_key(shard->map, slice_alloc_copy);
+        hashmap_set_fn_destroy_value(shard->map, value_destroy);
+        pthread_rwlock_init(&shard->lock, NULL);
+    }
+
+    return st;
+}
+
+void store_destroy(store_t *st)
+{
+    //shard_count = nombre de shards crees (store_create peut echouer au milieu)
+    for(size_t i = 0; i < st->shard_count; i++)
+    {
+        hashmap_destroy(st->shards[i].map);
+        pthread_rwlock_destroy(&st->shards[i].lock);
+    }
+
+    free(st->shards);
+    free(st);
+}
+
+size_t store_get_batch(store_t *st, const resp_slice_t *keys, size_t count, store_value_t *values, resp_buffer_t *out)
+{
+    size_t shard_of[STORE_BATCH_MAX];
+    size_t order[STORE_BATCH_MAX];
+    size_t end[STORE_MAX_SHARDS];
+    const void *lookup[STORE_BATCH_MAX];
+    void *found_values[STORE_BATCH_MAX];
+    size_t found = 0;
+
+    if(count > STORE_BATCH_MAX) count = STORE_BATCH_MAX;
+
+    //tri par shard (tri par comptage): chaque shard n'est verrouille qu'une fois
+    memset(end, 0, st->shard_count * sizeof(*end));
+    for(size_t i = 0; i < count; i++)
+    {
+        shard_of[i] = shard_index(st, slice_hash(&keys[i], sizeof(resp_slice_t)));
+        end[shard_of[i]]++;
+    }
+
+    for(size_t s = 1; s < st->shard_count; s++)
+        end[s] += end[s - 1];
+
+    for(size_t i = count; i-- > 0; )
+        order[--end[shard_of[i]]] = i;
+
+    for(size_t begin = 0; begin < count; )
+    {
+        size_t s = shard_of[order[begin]];
+        size_t n = 0;
+        while(begin + n < count && shard_of[order[begin + n]] == s)
+        {
+            lookup[n] = &keys[order[begin + n]];
+            n++;
+        }
+
+        shard_t *shard = &st->shards[s];
+        pthread_rwlock_rdlock(&shard->lock);
+
+        found += hashmap_get_batch(shard->map, lookup, found_values, n);
+
+        //les valeurs sont copiees avant de rendre le verrou
+        for(size_t i = 0; i < n; i++)
+        {
+            store_value_t *value = &values[order[begin + i]];
+            const resp_slice_t *stored = found_values[i];
+
+            value->found = stored != NULL;
+            value->offset = out->length;
+            value->length = stored != NULL ? stored->length : 0;
+            if(stored != NULL) resp_buffer_append(out, stored->data, stored->length);
+        }
+
+        pthread_rwlock_unlock(&shard->lock);
+        begin += n;
+    }
+
+    return found;
+}
+
+store_status_t store_set(store_t *st, const resp_slice_t *key, const resp_slice_t *value)
+{
+    //la copie est faite avant de prendre le verrou
+    char *data = malloc(value->length ? value->length : 1);
+    if(!data) return (perror("malloc"), STORE_NO_MEMORY);
+    memcpy(data, value->data, value->length);
+
+    resp_slice_t stored = { .length = value->length, .data = data };
+    shard_t *shard = &st->shards[shard_index(st, slice_hash(key, sizeof(resp_slice_t)))];
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    resp_slice_t *slot = hashmap_add(shard->map, key, &stored);
+    if(slot != NULL && slot->data != data)
+    {
+        //la clef existait: on remplace la valeur
+        free((char*)slot->data);
+        *slot = stored;
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    if(slot == NULL) return (free(data), STORE_NO_MEMORY);
+    return STORE_OK;
+}
+
+bool store_del(store_t *st, const resp_slice_t *key)
+{
+    shard_t *shard = &st->shards[shard_index(st, slice_hash(key, sizeof(resp_slice_t)))];
+
+    pthread_rwlock_wrlock(&shard->lock);
+    bool removed = hashmap_remove(shard->map, key);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return removed;
+}
+
+store_status_t store_incr(store_t *st, const resp_slice_t *key, int64_t delta, int64_t *result)
+{
+    shard_t *shard = &st->shards[shard_index(st, slice_hash(key, sizeof(resp_slice_t)))];
+
+    pthread_rwlock_wrlock(&shard->lock);
+    store_status_t status = incr_locked(shard->map, key, delta, result);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return status;
+}
+
+size_t store_count(store_t *st)
+{
+    size_t count = 0;
+
+    for(size_t i = 0; i < st->shard_count; i++)
+    {
+        pthread_rwlock_rdlock(&st->shards[i].lock);
+        count += hashmap_count(st->shards[i].map);
+        pthread_rwlock_unlock(&st->shards[i].lock);
+    }
+
+    return count;
+}
+
+//the bits that pick the bucket in a shard (low bits) must not pick the shard too
+static size_t shard_index(const store_t *st, size_t hash)
+{ return (size_t)((hash * 0x9E3779B97F4A7C15ULL) >> 32) & (st->shard_count - 1); }
+
+//INCR, the shard being locked
+static store_status_t incr_locked(hashmap_t *map, const resp_slice_t *key, int64_t delta, int64_t *result)
+{
+    int64_t current = 0;
+    resp_slice_t *slot = hashmap_get(map, key);
+    if(slot != NULL && !parse_int64(slot, &current)) return STORE_NOT_INTEGER;
+    if(__builtin_add_overflow(current, delta, &current)) return STORE_NOT_INTEGER;
+
+    char text[24];
+    size_t length = (size_t)snprintf(text, sizeof(text), "%lld", (long long)current);
+
+    //realloc garde l'ancienne valeur si elle echoue
+    char *data = realloc(slot != NULL ? (char*)slot->data : NULL, length);
+    if(!data) return (perror("realloc"), STORE_NO_MEMORY);
+    memcpy(data, text, length);
+
+    resp_slice_t stored = { .length = length, .data = data };
+    if(slot != NULL) *slot = stored;
+    else if(hashmap_add(map, key, &stored) == NULL) return (free(data), STORE_NO_MEMORY);
+
+    *result = current;
+    return STORE_OK;
+}
+
+//strict parsing, like redis: optional '-', digits only, no spaces
+static bool parse_int64(const resp_slice_t *slice, int64_t *value)
+{
+    char text[24];
+    if(slice->length == 0 || slice->length >= sizeof(text)) return false;
+    if(slice->data[0] != '-' && (slice->data[0] < '0' || slice->data[0] > '9')) return false;
+
+    memcpy(text, slice->data, slice->length);
+    text[slice->length] = '\0';
+
+    char *end = NULL;
+    errno = 0;
+    long long parsed = strtoll(text, &end, 10);
+    if(errno != 0 || *end != '\0' || end == text) return false;
+
+    *value = parsed;
+    return true;
+}
+
+
+//--------------- SHARD FUNCTIONS ---------------//
+
+//FNV-1a over the bytes of the slice
+static size_t slice_hash(const void *key, const size_t size)
+{
+    (void)size;//unused - to avoid warning
+    const resp_slice_t *slice = key;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for(size_t i = 0; i < slice->length; i++)
+        hash = (hash ^ (unsigned char)slice->data[i]) * 0x100000001B3ULL;
+
+    return (size_t)hash;
+}
+
+static int slice_compare(const void *a, const void *b, const size_t size)
+{
+    (void)size;//unused - to avoid warning
+    const resp_slice_t *x = a;
+    const resp_slice_t *y = b;
+
+    if(x->length != y->length) return x->length < y->length ? -1 : 1;
+    return memcmp(x->data, y->data, x->length);
+}
+
+//the slice and its bytes in one allocation (freed by the default destroy function)
+static void* slice_alloc_copy(const void *element, const size_t size)
+{
+    (void)size;//unused - to avoid warning
+    const resp_slice_t *slice = element;
+
+    resp_slice_t *copy = malloc(sizeof(*copy) + slice->length);
+    if(!copy) return (perror("malloc"), NULL);
+
+    memcpy(copy + 1, slice->data, slice->length);
+    copy->length = slice->length;
+    copy->data = (const char*)(copy + 1);
+    return copy;
+}
+
+static void value_destroy(void *element)
+{
+    free((char*)((resp_slice_t*)element)->data);
+    free(element);
+}
@@ -0,0 +1,72 @@
+/*
+ *  Sharded key-value store of the server.
+ *
+ *  The keys are distributed (by hash) over several hashmap_t shards, each one protected by
+ *  its own reader-writer lock. Keys and values are byte strings of any length.
+ *
+ *  The reads go through store_get_batch: the keys of a batch are grouped by shard, and each
+ *  shard is locked once for all its keys, which are looked up with hashmap_get_batch.
+ *  The values are copied while the shard is locked, so a concurrent SET or DEL can not free
+ *  them while they are used.
+ *
+ *  THREAD-SAFE.
+*/
+
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include "resp.h"
+
+typedef struct _store_t store_t;
+
+#define STORE_DEFAULT_SHARDS 64
+#define STORE_MAX_SHARDS 1024
+#define STORE_BATCH_MAX 256 //keys of a store_get_batch
+
+typedef enum {
+    STORE_OK,
+    STORE_NOT_INTEGER,//INCR: the value is not an integer, or the result would overflow
+    STORE_NO_MEMORY,
+} store_status_t;
+
+//value copied by store_get_batch
+typedef struct {
+    bool found;
+    size_t offset;//in the output buffer
+    size_t length;
+} store_value_t;
+
+/// @brief Create an empty store
+/// @param shard_count The number of shards, rounded up to a power of two (0 for STORE_DEFAULT_SHARDS, at most STORE_MAX_SHARDS)
+/// @return A pointer to the store or NULL if an error occured
+store_t* store_create(size_t shard_count);
+
+/// @brief Destroy the store and every key-value pair
+void store_destroy(store_t *st);
+
+/// @brief Copy the values of several keys
+/// @param st The store
+/// @param keys The keys (at most STORE_BATCH_MAX)
+/// @param count The number of keys
+/// @param values Receives where the value of each key was copied in out
+/// @param out The buffer the values are appended to
+/// @return The number of keys found
+size_t store_get_batch(store_t *st, const resp_slice_t *keys, size_t count, store_value_t *values, resp_buffer_t *out);
+
+/// @brief Associate the key with the value (replaces the old value if the key exists)
+/// @return STORE_OK or STORE_NO_MEMORY
+store_status_t store_set(store_t *st, const resp_slice_t *key, const resp_slice_t *value);
+
+/// @brief Remove a key
+/// @return true if the key was removed, false if it did not exist
+bool store_del(store_t *st, const resp_slice_t *key);
+
+/// @brief Add delta to the integer stored at the key (a missing key counts as 0)
+/// @param result Receives the new value
+/// @return STORE_OK, STORE_NOT_INTEGER or STORE_NO_MEMORY
+store_status_t store_incr(store_t *st, const resp_slice_t *key, int64_t delta, int64_t *result);
+
+/// @brief Get the number of keys
+size_t store_count(store_t *st);
+
+#endif